@@ -0,0 +1,68 @@
+/**
+ * @file esp_partition.h
+ * @brief Host shim for the ESP-IDF partition API, backed by simulated NOR flash
+ *
+ * Provides the "spiffs" data partition from partitions.csv in memory. Writes
+ * can only clear bits and erases set whole sectors to 0xFF, as on the real
+ * flash, and all accesses are counted so flash wear can be measured.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef enum {
+    ESP_PARTITION_SUBTYPE_DATA_NVS = 0x02,
+    ESP_PARTITION_SUBTYPE_DATA_SPIFFS = 0x82,
+    ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+typedef struct {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    uint32_t erase_size;
+    char label[17];
+    bool encrypted;
+    bool readonly;
+} esp_partition_t;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label);
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size);
+
+// Host shim only: flash access counters
+
+typedef struct {
+    uint64_t read_ops;
+    uint64_t read_bytes;
+    uint64_t write_ops;
+    uint64_t write_bytes;
+    uint64_t erase_ops;
+    uint64_t erase_bytes;
+    uint64_t bit_conflicts; // Bytes written that would need a 0 bit set back to 1
+} shim_partition_stats_t;
+
+void shim_partition_get_stats(shim_partition_stats_t *stats);
+void shim_partition_reset_stats(void);
+
+// Simulate a power loss during the next write: only its first bytes_written bytes reach the flash
+void shim_partition_tear_next_write(size_t bytes_written);
+
+#ifdef __cplusplus
+}
+#endif
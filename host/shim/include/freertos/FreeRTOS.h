@@ -0,0 +1,36 @@
+/**
+ * @file FreeRTOS.h
+ * @brief Host shim for the FreeRTOS kernel types used by the sensor pipeline
+ *
+ * Ticks advance with CLOCK_MONOTONIC at the same rate as the firmware
+ * (CONFIG_FREERTOS_HZ=100 in sdkconfig.polverine).
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define configTICK_RATE_HZ   100
+#define configMAX_PRIORITIES 25
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdFAIL  pdFALSE
+#define pdPASS  pdTRUE
+
+#define portMAX_DELAY      ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)  ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000U))
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,48 @@
+/**
+ * @file task.h
+ * @brief Host shim for FreeRTOS tasks, backed by POSIX threads
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*TaskFunction_t)(void *);
+typedef struct shim_task *TaskHandle_t;
+
+TickType_t xTaskGetTickCount(void);
+void vTaskDelay(TickType_t ticks);
+
+/**
+ * @brief Start a detached thread running the task function
+ *
+ * Stack depth and priority are accepted for source compatibility and ignored.
+ */
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters, UBaseType_t priority,
+    TaskHandle_t *created_task);
+
+/**
+ * @brief Handle of the calling thread, created on first use for threads not started by xTaskCreate
+ */
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+/**
+ * @brief Increment the notification count of a task and wake it
+ */
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+/**
+ * @brief Wait for the calling task's notification count to become non-zero
+ * @param clear_on_exit pdTRUE resets the count to zero, pdFALSE decrements it
+ * @param ticks_to_wait Maximum wait, portMAX_DELAY waits forever
+ * @return Notification count before it was cleared or decremented, 0 on timeout
+ */
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+
+#ifdef __cplusplus
+}
+#endif
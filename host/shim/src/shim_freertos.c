@@ -0,0 +1,285 @@
+/**
+ * @file shim_freertos.c
+ * @brief Host shim for FreeRTOS ticks, tasks, queues and mutexes
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+struct shim_task {
+    TaskFunction_t function;
+    void *parameters;
+    pthread_t thread;
+
+    // Direct-to-task notification
+    pthread_mutex_t notify_lock;
+    pthread_cond_t notify_cond;
+    uint32_t notify_count;
+};
+
+static _Thread_local struct shim_task *current_task = NULL;
+
+struct shim_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t *storage;
+};
+
+struct shim_semaphore {
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+    bool taken;
+};
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(esp_timer_get_time() / (1000000 / configTICK_RATE_HZ));
+}
+
+void vTaskDelay(TickType_t ticks) {
+    uint64_t us = (uint64_t)ticks * (1000000 / configTICK_RATE_HZ);
+    struct timespec ts = {.tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000};
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+static struct shim_task *task_alloc(void) {
+    struct shim_task *task = calloc(1, sizeof(*task));
+    if (task != NULL) {
+        pthread_mutex_init(&task->notify_lock, NULL);
+        pthread_cond_init(&task->notify_cond, NULL);
+    }
+    return task;
+}
+
+static void *task_trampoline(void *arg) {
+    struct shim_task *task = arg;
+    current_task = task;
+    task->function(task->parameters);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters, UBaseType_t priority,
+    TaskHandle_t *created_task) {
+    (void)name;
+    (void)stack_depth;
+    (void)priority;
+
+    struct shim_task *handle = task_alloc();
+    if (handle == NULL) {
+        return pdFAIL;
+    }
+    handle->function = task;
+    handle->parameters = parameters;
+
+    if (pthread_create(&handle->thread, NULL, task_trampoline, handle) != 0) {
+        free(handle);
+        return pdFAIL;
+    }
+    pthread_detach(handle->thread);
+
+    if (created_task != NULL) {
+        *created_task = handle;
+    }
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    if (current_task == NULL) {
+        // Threads not started through xTaskCreate (e.g. main) get a handle on first use; it is never freed
+        current_task = task_alloc();
+        if (current_task != NULL) {
+            current_task->thread = pthread_self();
+        }
+    }
+    return current_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    if (task == NULL) {
+        return pdFAIL;
+    }
+
+    pthread_mutex_lock(&task->notify_lock);
+    task->notify_count++;
+    pthread_cond_signal(&task->notify_cond);
+    pthread_mutex_unlock(&task->notify_lock);
+    return pdPASS;
+}
+
+// Absolute deadline for a timed condition wait, NULL means wait forever
+static const struct timespec *deadline_from_ticks(TickType_t ticks, struct timespec *deadline) {
+    if (ticks == portMAX_DELAY) {
+        return NULL;
+    }
+
+    uint64_t us = (uint64_t)ticks * (1000000 / configTICK_RATE_HZ);
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += us / 1000000;
+    deadline->tv_nsec += (us % 1000000) * 1000;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+static bool wait_for(pthread_cond_t *cond, pthread_mutex_t *lock, const struct timespec *deadline) {
+    if (deadline == NULL) {
+        return pthread_cond_wait(cond, lock) == 0;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    struct shim_queue *queue = calloc(1, sizeof(*queue));
+    if (queue == NULL) {
+        return NULL;
+    }
+
+    queue->storage = calloc(length, item_size);
+    if (queue->storage == NULL) {
+        free(queue);
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = item_size;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    if (queue == NULL) {
+        return;
+    }
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->storage);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait) {
+    struct timespec ts;
+    const struct timespec *deadline = deadline_from_ticks(ticks_to_wait, &ts);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length) {
+        if (ticks_to_wait == 0 || !wait_for(&queue->not_full, &queue->lock, deadline)) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFAIL;
+        }
+    }
+
+    UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    memcpy(queue->storage + (size_t)tail * queue->item_size, item, queue->item_size);
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait) {
+    struct timespec ts;
+    const struct timespec *deadline = deadline_from_ticks(ticks_to_wait, &ts);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0) {
+        if (ticks_to_wait == 0 || !wait_for(&queue->not_empty, &queue->lock, deadline)) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFAIL;
+        }
+    }
+
+    memcpy(buffer, queue->storage + (size_t)queue->head * queue->item_size, queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    struct shim_semaphore *semaphore = calloc(1, sizeof(*semaphore));
+    if (semaphore == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&semaphore->lock, NULL);
+    pthread_cond_init(&semaphore->released, NULL);
+    return semaphore;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    if (semaphore == NULL) {
+        return;
+    }
+    pthread_cond_destroy(&semaphore->released);
+    pthread_mutex_destroy(&semaphore->lock);
+    free(semaphore);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait) {
+    struct timespec ts;
+    const struct timespec *deadline = deadline_from_ticks(ticks_to_wait, &ts);
+
+    pthread_mutex_lock(&semaphore->lock);
+    while (semaphore->taken) {
+        if (ticks_to_wait == 0 || !wait_for(&semaphore->released, &semaphore->lock, deadline)) {
+            pthread_mutex_unlock(&semaphore->lock);
+            return pdFAIL;
+        }
+    }
+    semaphore->taken = true;
+    pthread_mutex_unlock(&semaphore->lock);
+    return pdPASS;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    pthread_mutex_lock(&semaphore->lock);
+    semaphore->taken = false;
+    pthread_cond_signal(&semaphore->released);
+    pthread_mutex_unlock(&semaphore->lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+    struct shim_task *task = xTaskGetCurrentTaskHandle();
+    struct timespec ts;
+    const struct timespec *deadline = deadline_from_ticks(ticks_to_wait, &ts);
+
+    pthread_mutex_lock(&task->notify_lock);
+    while (task->notify_count == 0) {
+        if (ticks_to_wait == 0 || !wait_for(&task->notify_cond, &task->notify_lock, deadline)) {
+            pthread_mutex_unlock(&task->notify_lock);
+            return 0;
+        }
+    }
+
+    uint32_t count = task->notify_count;
+    task->notify_count = clear_on_exit ? 0 : count - 1;
+    pthread_mutex_unlock(&task->notify_lock);
+    return count;
+}
@@ -0,0 +1,256 @@
+/**
+ * @file shim_nvs.c
+ * @brief Host shim for NVS, backed by an in-memory key/value store
+ *
+ * Values are kept per namespace in a linked list and are lost when the
+ * process exits. Commit is a no-op since every set is applied immediately.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#define NVS_KEY_NAME_MAX_SIZE 16
+#define NVS_MAX_NAMESPACES    16
+
+typedef enum {
+    ENTRY_U8,
+    ENTRY_U16,
+    ENTRY_U32,
+    ENTRY_STR,
+    ENTRY_BLOB
+} entry_type_t;
+
+typedef struct nvs_entry {
+    struct nvs_entry *next;
+    uint8_t ns;
+    entry_type_t type;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    size_t length;
+    uint8_t data[];
+} nvs_entry_t;
+
+static pthread_mutex_t nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static char namespaces[NVS_MAX_NAMESPACES][NVS_KEY_NAME_MAX_SIZE];
+static uint8_t namespace_count = 0;
+static nvs_entry_t *entries = NULL;
+
+// Handles are namespace index + 1 so that 0 stays "not opened", as config.c expects
+static bool handle_to_ns(nvs_handle_t handle, uint8_t *ns) {
+    if (handle == 0 || handle > namespace_count) {
+        return false;
+    }
+    *ns = (uint8_t)(handle - 1);
+    return true;
+}
+
+static nvs_entry_t *find_entry(uint8_t ns, const char *key, nvs_entry_t ***link) {
+    nvs_entry_t **cur = &entries;
+    while (*cur != NULL) {
+        if ((*cur)->ns == ns && strcmp((*cur)->key, key) == 0) {
+            if (link != NULL) {
+                *link = cur;
+            }
+            return *cur;
+        }
+        cur = &(*cur)->next;
+    }
+    return NULL;
+}
+
+static esp_err_t set_value(nvs_handle_t handle, const char *key, entry_type_t type, const void *value, size_t length) {
+    uint8_t ns;
+    if (!handle_to_ns(handle, &ns)) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (key == NULL || strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+
+    nvs_entry_t *entry = malloc(sizeof(nvs_entry_t) + length);
+    if (entry == NULL) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    entry->ns = ns;
+    entry->type = type;
+    strcpy(entry->key, key);
+    entry->length = length;
+    memcpy(entry->data, value, length);
+
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t **link;
+    nvs_entry_t *old = find_entry(ns, key, &link);
+    if (old != NULL) {
+        entry->next = old->next;
+        *link = entry;
+        free(old);
+    } else {
+        entry->next = entries;
+        entries = entry;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+
+    return ESP_OK;
+}
+
+static esp_err_t get_value(nvs_handle_t handle, const char *key, entry_type_t type, void *out, size_t *length, bool exact) {
+    uint8_t ns;
+    if (!handle_to_ns(handle, &ns)) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t *entry = find_entry(ns, key, NULL);
+    esp_err_t err = ESP_OK;
+    if (entry == NULL || entry->type != type) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (out == NULL) {
+        // Size query, as supported by nvs_get_str/nvs_get_blob
+        *length = entry->length;
+    } else if ((exact && *length != entry->length) || *length < entry->length) {
+        *length = entry->length;
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+        memcpy(out, entry->data, entry->length);
+        *length = entry->length;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+
+    return err;
+}
+
+esp_err_t nvs_flash_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    pthread_mutex_lock(&nvs_lock);
+    while (entries != NULL) {
+        nvs_entry_t *next = entries->next;
+        free(entries);
+        entries = next;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle) {
+    (void)open_mode;
+    if (namespace_name == NULL || strlen(namespace_name) >= NVS_KEY_NAME_MAX_SIZE || out_handle == NULL) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+
+    pthread_mutex_lock(&nvs_lock);
+    uint8_t ns;
+    for (ns = 0; ns < namespace_count; ns++) {
+        if (strcmp(namespaces[ns], namespace_name) == 0) {
+            break;
+        }
+    }
+    if (ns == namespace_count) {
+        if (namespace_count >= NVS_MAX_NAMESPACES) {
+            pthread_mutex_unlock(&nvs_lock);
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+        strcpy(namespaces[namespace_count++], namespace_name);
+    }
+    pthread_mutex_unlock(&nvs_lock);
+
+    *out_handle = ns + 1;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) {
+    (void)handle;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    uint8_t ns;
+    return handle_to_ns(handle, &ns) ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key) {
+    uint8_t ns;
+    if (!handle_to_ns(handle, &ns)) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t **link;
+    nvs_entry_t *entry = find_entry(ns, key, &link);
+    if (entry != NULL) {
+        *link = entry->next;
+        free(entry);
+    }
+    pthread_mutex_unlock(&nvs_lock);
+
+    return entry != NULL ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle) {
+    uint8_t ns;
+    if (!handle_to_ns(handle, &ns)) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t **cur = &entries;
+    while (*cur != NULL) {
+        if ((*cur)->ns == ns) {
+            nvs_entry_t *entry = *cur;
+            *cur = entry->next;
+            free(entry);
+        } else {
+            cur = &(*cur)->next;
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value) {
+    return set_value(handle, key, ENTRY_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length) {
+    return get_value(handle, key, ENTRY_STR, out_value, length, false);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length) {
+    return set_value(handle, key, ENTRY_BLOB, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length) {
+    return get_value(handle, key, ENTRY_BLOB, out_value, length, false);
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value) {
+    return set_value(handle, key, ENTRY_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value) {
+    size_t length = sizeof(*out_value);
+    return get_value(handle, key, ENTRY_U8, out_value, &length, true);
+}
+
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char *key, uint16_t value) {
+    return set_value(handle, key, ENTRY_U16, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char *key, uint16_t *out_value) {
+    size_t length = sizeof(*out_value);
+    return get_value(handle, key, ENTRY_U16, out_value, &length, true);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value) {
+    return set_value(handle, key, ENTRY_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value) {
+    size_t length = sizeof(*out_value);
+    return get_value(handle, key, ENTRY_U32, out_value, &length, true);
+}
@@ -0,0 +1,139 @@
+/**
+ * @file shim_partition.c
+ * @brief Host shim for the ESP-IDF partition API, backed by simulated NOR flash
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_partition.h"
+
+#define SHIM_FLASH_SECTOR_SIZE 4096
+
+// The data partition from partitions.csv, right after the 4 MB factory app
+static const esp_partition_t spiffs_partition = {
+    .type = ESP_PARTITION_TYPE_DATA,
+    .subtype = ESP_PARTITION_SUBTYPE_DATA_SPIFFS,
+    .address = 0x410000,
+    .size = 0x2F0000,
+    .erase_size = SHIM_FLASH_SECTOR_SIZE,
+    .label = "spiffs",
+};
+
+static pthread_mutex_t flash_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *flash = NULL;
+static shim_partition_stats_t stats;
+static size_t tear_after = SIZE_MAX;
+
+// Contents are allocated on first use and start out erased
+static uint8_t *flash_contents(void) {
+    if (flash == NULL) {
+        flash = malloc(spiffs_partition.size);
+        if (flash != NULL) {
+            memset(flash, 0xFF, spiffs_partition.size);
+        }
+    }
+    return flash;
+}
+
+static bool in_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    return partition == &spiffs_partition && offset <= partition->size && size <= partition->size - offset;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label) {
+    if (type != spiffs_partition.type) {
+        return NULL;
+    }
+    if (subtype != ESP_PARTITION_SUBTYPE_ANY && subtype != spiffs_partition.subtype) {
+        return NULL;
+    }
+    if (label != NULL && strcmp(label, spiffs_partition.label) != 0) {
+        return NULL;
+    }
+    return &spiffs_partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+    if (!in_range(partition, src_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    pthread_mutex_lock(&flash_lock);
+    uint8_t *contents = flash_contents();
+    if (contents != NULL) {
+        memcpy(dst, contents + src_offset, size);
+        stats.read_ops++;
+        stats.read_bytes += size;
+    }
+    pthread_mutex_unlock(&flash_lock);
+    return contents != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size) {
+    if (!in_range(partition, dst_offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    pthread_mutex_lock(&flash_lock);
+    uint8_t *contents = flash_contents();
+    bool torn = tear_after < size;
+    if (torn) {
+        size = tear_after;
+    }
+    tear_after = SIZE_MAX;
+    if (contents != NULL) {
+        const uint8_t *bytes = src;
+        for (size_t i = 0; i < size; i++) {
+            uint8_t *cell = &contents[dst_offset + i];
+            if ((bytes[i] & ~*cell) != 0) {
+                stats.bit_conflicts++;
+            }
+            *cell &= bytes[i];
+        }
+        stats.write_ops++;
+        stats.write_bytes += size;
+    }
+    pthread_mutex_unlock(&flash_lock);
+    if (torn) {
+        return ESP_FAIL;
+    }
+    return contents != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    if (!in_range(partition, offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (offset % partition->erase_size != 0 || size % partition->erase_size != 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    pthread_mutex_lock(&flash_lock);
+    uint8_t *contents = flash_contents();
+    if (contents != NULL) {
+        memset(contents + offset, 0xFF, size);
+        stats.erase_ops += size / partition->erase_size;
+        stats.erase_bytes += size;
+    }
+    pthread_mutex_unlock(&flash_lock);
+    return contents != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void shim_partition_get_stats(shim_partition_stats_t *out) {
+    pthread_mutex_lock(&flash_lock);
+    *out = stats;
+    pthread_mutex_unlock(&flash_lock);
+}
+
+void shim_partition_tear_next_write(size_t bytes_written) {
+    pthread_mutex_lock(&flash_lock);
+    tear_after = bytes_written;
+    pthread_mutex_unlock(&flash_lock);
+}
+
+void shim_partition_reset_stats(void) {
+    pthread_mutex_lock(&flash_lock);
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_unlock(&flash_lock);
+}
@@ -0,0 +1,1019 @@
+/**
+ * @file broker_bench.c
+ * @brief Measures MQTT publish throughput, latency and outbox growth against a local broker
+ *
+ * Synthetic BME690 and BMV080 samples go through the publish path of
+ * mqtt_main.c: the payload builders of mqtt_payload.c and mqtt_cbor.c,
+ * optional batching with mqtt_batch.c and the QoS selection of mqtt_qos.c
+ * from the outbox depth. The PUBLISH packets are written to a real TCP
+ * connection with the send buffer of the device. Like esp-mqtt, the client
+ * keeps every QoS 1 message in its outbox until the PUBACK arrives.
+ *
+ * The broker is a minimal MQTT 3.1.1 broker stand-in running in the same
+ * process on 127.0.0.1. It acknowledges the messages and checks each one
+ * against what the client sent. It can delay its PUBACKs to model a round
+ * trip and limit how fast it reads, which lets TCP back pressure reach the
+ * client. Alternatively the client connects to a real broker such as
+ * mosquitto. QoS 0 messages then count as delivered once they are written.
+ *
+ * Samples are offered at increasing rates, one step per rate. The latency of
+ * a message runs from the time the sample that caused its publish was due to
+ * its PUBACK (QoS 1) or to the broker receiving it (QoS 0), so publish calls
+ * that block are included. Reported per step are the samples and messages per second
+ * delivered, p50/p99/max latency, the outbox peak and its growth. The run
+ * stops at the first step the path cannot sustain. That step delivers less
+ * than 95% of its messages within the step (less the share the PUBACK delay
+ * holds back), leaves the outbox above the adaptive QoS high water mark, or
+ * falls behind its schedule. --min-rate turns
+ * the highest sustained rate into a pass/fail regression gate.
+ *
+ * Usage:
+ *   broker_bench [--rates R,R,...] [--step-ms MS] [--qos 0|1|auto] [--format json|cbor|json+cbor]
+ *                [--batch N] [--ack-delay MS] [--bw B] [--broker HOST:PORT] [--min-rate R]
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "esp_timer.h"
+
+#include "config.h"
+#include "mqtt_batch.h"
+#include "mqtt_cbor.h"
+#include "mqtt_payload.h"
+#include "mqtt_qos.h"
+
+#define BENCH_DEVICE_ID   "bench"
+#define BENCH_SNDBUF      5744  // lwIP TCP send buffer of the device
+#define BENCH_RCVBUF      8192  // Broker receive buffer while --bw limits its reads
+#define BENCH_KEEPALIVE_S 120   // esp-mqtt default
+#define BENCH_DRAIN_US    10000000
+#define BENCH_CONN_BUF    16384 // Packets up to a full JSON batch
+#define BENCH_HIGH_WATER  6144  // Adaptive water marks as in mqtt_main.c
+#define BENCH_LOW_WATER   2048
+#define BENCH_MAX_STEPS   32
+
+#define MQTT_CONNECT    0x10
+#define MQTT_CONNACK    0x20
+#define MQTT_PUBLISH    0x30
+#define MQTT_PUBACK     0x40
+#define MQTT_PINGREQ    0xC0
+#define MQTT_PINGRESP   0xD0
+#define MQTT_DISCONNECT 0xE0
+
+// A message written to the connection, in the order it was written
+typedef struct {
+    int64_t sample_us; // Time the sample that caused the publish was due
+    uint32_t bytes;    // PUBLISH packet bytes
+    uint16_t step;     // Step the message was published in
+    uint8_t qos;
+    bool delivered;
+} message_t;
+
+typedef struct {
+    uint32_t rate; // Offered samples per second
+    int64_t start_us;
+    int64_t end_us;
+    bool behind; // Stopped before offering all samples, the publisher fell behind
+
+    uint32_t samples;  // Samples published
+    uint32_t messages; // Messages written
+    uint32_t refused;  // Messages without a free packet id
+    uint32_t delivered;
+    uint64_t delivered_bytes;
+    uint32_t outbox_start;
+    uint32_t outbox_peak;
+    uint32_t outbox_end;
+
+    uint32_t *latency_us; // Latencies of the messages published in this step
+    size_t latency_count;
+    size_t latency_capacity;
+} step_t;
+
+// Buffered reader of MQTT packets from a socket
+typedef struct {
+    int fd;
+    uint8_t buf[BENCH_CONN_BUF];
+    size_t len;
+} conn_t;
+
+// A state stream as in mqtt_main.c, with its batch
+typedef struct {
+    char state_topic[64];
+    char batch_topic[64];
+    mqtt_batch_t batch;
+    bool enabled;
+} stream_t;
+
+typedef struct {
+    int64_t due_us;
+    uint16_t packet_id;
+} pending_ack_t;
+
+static bool failed = false;
+
+static pthread_mutex_t bench_mutex = PTHREAD_MUTEX_INITIALIZER;
+static message_t *messages;
+static size_t message_count;
+static size_t message_capacity;
+static size_t pending_index[65536]; // Message index + 1 per packet id in the outbox, 0 if free
+static uint32_t pending_count;
+static uint32_t outbox_bytes;
+static uint16_t next_packet_id = 1;
+static step_t steps[BENCH_MAX_STEPS + 1]; // The last slot collects deliveries while draining
+static size_t current_step;
+static size_t delivered_count;
+
+static mqtt_qos_t qos_policy;
+static int client_fd = -1;
+static bool embedded = true;
+static int64_t sample_due_us; // Due time of the sample being published
+
+// Broker stand-in settings
+static uint32_t ack_delay_ms = 0;
+static uint32_t broker_bw = 0; // Bytes per second the broker reads, 0 for no limit
+static uint32_t broker_errors = 0;
+static size_t broker_received;
+
+static void sleep_until_us(int64_t when_us) {
+    // esp_timer_get_time() runs on CLOCK_MONOTONIC as well
+    struct timespec ts = {.tv_sec = when_us / 1000000, .tv_nsec = (when_us % 1000000) * 1000};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static size_t put_remaining_length(uint8_t *out, size_t value) {
+    size_t n = 0;
+    do {
+        uint8_t byte = value % 128;
+        value /= 128;
+        out[n++] = byte | (value > 0 ? 0x80 : 0);
+    } while (value > 0);
+    return n;
+}
+
+static size_t put_string(uint8_t *out, const char *str, size_t len) {
+    out[0] = (uint8_t)(len >> 8);
+    out[1] = (uint8_t)len;
+    memcpy(out + 2, str, len);
+    return 2 + len;
+}
+
+/**
+ * Take the next complete packet from the connection buffer
+ * @return 1 with the packet in header, body and body_len, 0 if incomplete, -1 if malformed
+ */
+static int conn_packet(conn_t *conn, uint8_t *header, const uint8_t **body, size_t *body_len, size_t *total) {
+    size_t value = 0;
+    size_t pos = 1;
+    for (unsigned shift = 0;; shift += 7) {
+        if (pos >= conn->len) {
+            return 0;
+        }
+        if (shift > 21) {
+            return -1;
+        }
+        uint8_t byte = conn->buf[pos++];
+        value |= (size_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            break;
+        }
+    }
+    if (pos + value > sizeof(conn->buf)) {
+        return -1;
+    }
+    if (pos + value > conn->len) {
+        return 0;
+    }
+
+    *header = conn->buf[0];
+    *body = conn->buf + pos;
+    *body_len = value;
+    *total = pos + value;
+    return 1;
+}
+
+static void conn_consume(conn_t *conn, size_t total) {
+    memmove(conn->buf, conn->buf + total, conn->len - total);
+    conn->len -= total;
+}
+
+// Read up to limit bytes, false once the peer closed the connection
+static bool conn_fill(conn_t *conn, size_t limit) {
+    size_t room = sizeof(conn->buf) - conn->len;
+    if (limit > room) {
+        limit = room;
+    }
+    ssize_t n = recv(conn->fd, conn->buf + conn->len, limit, 0);
+    if (n < 0 && errno == EINTR) {
+        return true;
+    }
+    if (n <= 0) {
+        return false;
+    }
+    conn->len += (size_t)n;
+    return true;
+}
+
+static void latency_add(step_t *step, uint32_t latency_us) {
+    if (step->latency_count == step->latency_capacity) {
+        size_t capacity = step->latency_capacity ? step->latency_capacity * 2 : 1024;
+        uint32_t *grown = realloc(step->latency_us, capacity * sizeof(*grown));
+        if (grown == NULL) {
+            return;
+        }
+        step->latency_us = grown;
+        step->latency_capacity = capacity;
+    }
+    step->latency_us[step->latency_count++] = latency_us;
+}
+
+// Count a message as delivered, called with bench_mutex held
+static void deliver(size_t index) {
+    message_t *message = &messages[index];
+    if (message->delivered) {
+        return;
+    }
+
+    message->delivered = true;
+    delivered_count++;
+    steps[current_step].delivered++;
+    steps[current_step].delivered_bytes += message->bytes;
+    int64_t latency = esp_timer_get_time() - message->sample_us;
+    latency_add(&steps[message->step], latency > 0 ? (uint32_t)latency : 0);
+}
+
+// Publish like mqtt_publish() in mqtt_main.c: QoS from the policy and the outbox, then write the packet
+static int bench_publish(const char *topic, const void *payload, size_t len, mqtt_qos_class_t cls) {
+    static uint8_t packet[BENCH_CONN_BUF];
+
+    pthread_mutex_lock(&bench_mutex);
+    step_t *step = &steps[current_step];
+    int qos = mqtt_qos_select(&qos_policy, cls, outbox_bytes);
+    size_t topic_len = strlen(topic);
+    size_t remaining = 2 + topic_len + (qos > 0 ? 2 : 0) + len;
+    if (remaining + 5 > sizeof(packet) || (qos > 0 && pending_index[next_packet_id] != 0)) {
+        // esp-mqtt refuses a message it cannot hold
+        step->refused++;
+        mqtt_qos_record(&qos_policy, cls, qos, false);
+        pthread_mutex_unlock(&bench_mutex);
+        return -1;
+    }
+
+    size_t pos = 0;
+    packet[pos++] = MQTT_PUBLISH | (uint8_t)(qos << 1);
+    pos += put_remaining_length(packet + pos, remaining);
+    pos += put_string(packet + pos, topic, topic_len);
+    uint16_t packet_id = 0;
+    if (qos > 0) {
+        packet_id = next_packet_id;
+        next_packet_id = next_packet_id == UINT16_MAX ? 1 : next_packet_id + 1;
+        packet[pos++] = (uint8_t)(packet_id >> 8);
+        packet[pos++] = (uint8_t)packet_id;
+    }
+    memcpy(packet + pos, payload, len);
+    pos += len;
+
+    // Logged before writing, the broker may receive the message before the write returns
+    if (message_count == message_capacity) {
+        size_t capacity = message_capacity ? message_capacity * 2 : 4096;
+        message_t *grown = realloc(messages, capacity * sizeof(*grown));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&bench_mutex);
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        messages = grown;
+        message_capacity = capacity;
+    }
+    size_t index = message_count++;
+    messages[index] = (message_t){
+        .sample_us = sample_due_us,
+        .bytes = (uint32_t)pos,
+        .step = (uint16_t)current_step,
+        .qos = (uint8_t)qos,
+    };
+    if (qos > 0) {
+        pending_index[packet_id] = index + 1;
+        pending_count++;
+        outbox_bytes += (uint32_t)pos;
+        if (outbox_bytes > step->outbox_peak) {
+            step->outbox_peak = outbox_bytes;
+        }
+    }
+    step->messages++;
+    mqtt_qos_record(&qos_policy, cls, qos, true);
+    pthread_mutex_unlock(&bench_mutex);
+
+    if (!write_all(client_fd, packet, pos)) {
+        fprintf(stderr, "write to broker failed: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    if (qos == 0 && !embedded) {
+        pthread_mutex_lock(&bench_mutex);
+        deliver(index);
+        pthread_mutex_unlock(&bench_mutex);
+    }
+    return packet_id;
+}
+
+// Publish a complete batch and the newest sample in it, as batch_flush_publish() does
+static void batch_flush_publish(const uint8_t *payload, size_t len, uint16_t count, void *ctx) {
+    stream_t *stream = ctx;
+    const mqtt_batch_t *batch = &stream->batch;
+
+    bench_publish(stream->batch_topic, payload, len, MQTT_QOS_CLASS_BATCH);
+    bench_publish(stream->state_topic, batch->buf + batch->last_offset, batch->last_len, MQTT_QOS_CLASS_BATCH);
+}
+
+static void publish_state(stream_t *stream, const void *payload, size_t len) {
+    if (!stream->enabled) {
+        bench_publish(stream->state_topic, payload, len, MQTT_QOS_CLASS_STATE);
+        return;
+    }
+    mqtt_batch_add(&stream->batch, payload, len, (uint32_t)(sample_due_us / 1000), batch_flush_publish, stream);
+}
+
+enum { STREAM_BME690_JSON, STREAM_BMV080_JSON, STREAM_BME690_CBOR, STREAM_BMV080_CBOR, STREAM_COUNT };
+
+static stream_t streams[STREAM_COUNT];
+
+// Small deterministic PRNG so runs are reproducible across hosts
+static uint32_t rng_state = 1;
+
+static float rng_range(float min, float max) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return min + (max - min) * ((rng_state >> 8) / 16777216.0f);
+}
+
+// Publish one sample, alternating between the sensors, like the data handlers of mqtt_main.c
+static void publish_sample(uint32_t n, polverine_payload_format_t format) {
+    if ((n & 1) == 0) {
+        const bme690_data_t data = {
+            .temperature = rng_range(18.0f, 26.0f),
+            .pressure = rng_range(95000.0f, 105000.0f),
+            .humidity = rng_range(30.0f, 60.0f),
+            .iaq = rng_range(0.0f, 200.0f),
+            .iaq_accuracy = 3,
+            .co2_equivalent = rng_range(400.0f, 2000.0f),
+            .breath_voc_equivalent = rng_range(0.0f, 5.0f),
+            .static_iaq = rng_range(0.0f, 200.0f),
+            .gas_percentage = rng_range(0.0f, 100.0f),
+            .stabilization_status = true,
+            .run_in_status = true,
+            .timestamp = n * 3000u,
+        };
+        if (format != PAYLOAD_FORMAT_CBOR) {
+            char payload[320];
+            int written = mqtt_payload_bme690(payload, sizeof(payload), &data, false);
+            publish_state(&streams[STREAM_BME690_JSON], payload, (size_t)written);
+        }
+        if (format != PAYLOAD_FORMAT_JSON) {
+            uint8_t payload[MQTT_CBOR_BME690_MAX];
+            int written = mqtt_cbor_bme690(payload, sizeof(payload), &data, false);
+            publish_state(&streams[STREAM_BME690_CBOR], payload, (size_t)written);
+        }
+    } else {
+        const bmv080_data_t data = {
+            .pm10 = rng_range(0.0f, 50.0f),
+            .pm25 = rng_range(0.0f, 30.0f),
+            .pm1 = rng_range(0.0f, 20.0f),
+            .runtime = n * 3.0f,
+            .timestamp = n * 3000u,
+        };
+        if (format != PAYLOAD_FORMAT_CBOR) {
+            char payload[192];
+            int written = mqtt_payload_bmv080(payload, sizeof(payload), &data);
+            publish_state(&streams[STREAM_BMV080_JSON], payload, (size_t)written);
+        }
+        if (format != PAYLOAD_FORMAT_JSON) {
+            uint8_t payload[MQTT_CBOR_BMV080_MAX];
+            int written = mqtt_cbor_bmv080(payload, sizeof(payload), &data);
+            publish_state(&streams[STREAM_BMV080_CBOR], payload, (size_t)written);
+        }
+    }
+
+    uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    for (size_t i = 0; i < STREAM_COUNT; i++) {
+        if (streams[i].enabled) {
+            mqtt_batch_poll(&streams[i].batch, now_ms, batch_flush_publish, &streams[i]);
+        }
+    }
+}
+
+// Check a PUBLISH the broker received against the message written in the same position
+static void broker_publish(uint8_t header, const uint8_t *body, size_t body_len, size_t total, pending_ack_t *acks, size_t *ack_tail) {
+    int qos = (header >> 1) & 3;
+    size_t topic_len = body_len >= 2 ? ((size_t)body[0] << 8 | body[1]) : SIZE_MAX;
+    size_t prefix_len = strlen("polverine/" BENCH_DEVICE_ID "/");
+    if (topic_len > body_len - 2 || topic_len < prefix_len || memcmp(body + 2, "polverine/" BENCH_DEVICE_ID "/", prefix_len) != 0 ||
+        qos > 1 || (qos == 1 && body_len < topic_len + 4)) {
+        broker_errors++;
+        return;
+    }
+
+    pthread_mutex_lock(&bench_mutex);
+    size_t index = broker_received++;
+    if (index >= message_count || messages[index].bytes != total || messages[index].qos != qos) {
+        broker_errors++;
+    } else if (qos == 0) {
+        deliver(index);
+    }
+    pthread_mutex_unlock(&bench_mutex);
+
+    if (qos == 1) {
+        uint16_t packet_id = (uint16_t)(body[2 + topic_len] << 8 | body[3 + topic_len]);
+        acks[*ack_tail % 65536] = (pending_ack_t){esp_timer_get_time() + (int64_t)ack_delay_ms * 1000, packet_id};
+        (*ack_tail)++;
+    }
+}
+
+// Minimal MQTT 3.1.1 broker for one client: CONNACK, PUBACK after ack_delay_ms, PINGRESP
+static void *broker_main(void *arg) {
+    int listen_fd = *(int *)arg;
+    static conn_t conn;
+    static pending_ack_t acks[65536];
+    size_t ack_head = 0, ack_tail = 0;
+
+    conn.fd = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+    if (conn.fd < 0) {
+        broker_errors++;
+        return NULL;
+    }
+    int one = 1;
+    setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    double budget = 0; // Bytes the broker may read under --bw
+    int64_t budget_us = esp_timer_get_time();
+    bool open = true;
+    while (open || ack_head != ack_tail) {
+        int64_t now = esp_timer_get_time();
+
+        // Send the acknowledgements that are due
+        while (ack_head != ack_tail && acks[ack_head % 65536].due_us <= now) {
+            uint16_t packet_id = acks[ack_head % 65536].packet_id;
+            const uint8_t puback[] = {MQTT_PUBACK, 2, (uint8_t)(packet_id >> 8), (uint8_t)packet_id};
+            if (!write_all(conn.fd, puback, sizeof(puback))) {
+                broker_errors++;
+            }
+            ack_head++;
+        }
+        if (!open) {
+            if (ack_head != ack_tail) {
+                sleep_until_us(acks[ack_head % 65536].due_us);
+            }
+            continue;
+        }
+
+        size_t limit = sizeof(conn.buf);
+        int timeout_ms = 100;
+        if (broker_bw > 0) {
+            budget += (double)(now - budget_us) * broker_bw / 1e6;
+            budget_us = now;
+            double burst = broker_bw / 10.0 > 1460 ? broker_bw / 10.0 : 1460;
+            if (budget > burst) {
+                budget = burst;
+            }
+            limit = budget < 1 ? 0 : (size_t)budget;
+        }
+        if (ack_head != ack_tail) {
+            int64_t wait_ms = (acks[ack_head % 65536].due_us - now + 999) / 1000;
+            if (wait_ms < timeout_ms) {
+                timeout_ms = (int)wait_ms;
+            }
+        }
+
+        if (limit == 0) {
+            // Out of read budget, let the socket fill up
+            int64_t refill_us = (int64_t)(512 * 1e6 / broker_bw);
+            if (refill_us > timeout_ms * 1000) {
+                refill_us = timeout_ms * 1000;
+            }
+            sleep_until_us(now + refill_us);
+            continue;
+        }
+
+        struct pollfd pfd = {.fd = conn.fd, .events = POLLIN};
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            continue;
+        }
+        size_t before = conn.len;
+        if (!conn_fill(&conn, limit)) {
+            open = false;
+            continue;
+        }
+        budget -= (double)(conn.len - before);
+
+        uint8_t header;
+        const uint8_t *body;
+        size_t body_len, total;
+        int got;
+        while ((got = conn_packet(&conn, &header, &body, &body_len, &total)) == 1) {
+            switch (header & 0xF0) {
+            case MQTT_CONNECT: {
+                bool mqtt311 = body_len >= 7 && memcmp(body, "\0\4MQTT\4", 7) == 0;
+                const uint8_t connack[] = {MQTT_CONNACK, 2, 0, mqtt311 ? 0 : 1};
+                write_all(conn.fd, connack, sizeof(connack));
+                if (!mqtt311) {
+                    broker_errors++;
+                }
+                break;
+            }
+            case MQTT_PUBLISH:
+                broker_publish(header, body, body_len, total, acks, &ack_tail);
+                break;
+            case MQTT_PINGREQ: {
+                const uint8_t pingresp[] = {MQTT_PINGRESP, 0};
+                write_all(conn.fd, pingresp, sizeof(pingresp));
+                break;
+            }
+            case MQTT_DISCONNECT:
+                open = false;
+                break;
+            default:
+                broker_errors++;
+                break;
+            }
+            conn_consume(&conn, total);
+        }
+        if (got < 0) {
+            broker_errors++;
+            open = false;
+        }
+    }
+
+    close(conn.fd);
+    return NULL;
+}
+
+// Client side reader: matches PUBACKs to the outbox
+static void *reader_main(void *arg) {
+    static conn_t conn;
+    conn.fd = client_fd;
+    (void)arg;
+
+    while (conn_fill(&conn, sizeof(conn.buf))) {
+        uint8_t header;
+        const uint8_t *body;
+        size_t body_len, total;
+        int got;
+        while ((got = conn_packet(&conn, &header, &body, &body_len, &total)) == 1) {
+            if (header == MQTT_PUBACK && body_len == 2) {
+                uint16_t packet_id = (uint16_t)(body[0] << 8 | body[1]);
+                pthread_mutex_lock(&bench_mutex);
+                size_t index = pending_index[packet_id];
+                if (index == 0) {
+                    fprintf(stderr, "PUBACK for unknown packet id %u\n", packet_id);
+                    failed = true;
+                } else {
+                    pending_index[packet_id] = 0;
+                    pending_count--;
+                    outbox_bytes -= messages[index - 1].bytes;
+                    deliver(index - 1);
+                }
+                pthread_mutex_unlock(&bench_mutex);
+            }
+            conn_consume(&conn, total);
+        }
+        if (got < 0) {
+            fprintf(stderr, "malformed packet from broker\n");
+            failed = true;
+            break;
+        }
+    }
+    return NULL;
+}
+
+static int connect_to(const char *host, const char *port) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *result;
+    int err = getaddrinfo(host, port, &hints, &result);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", host, gai_strerror(err));
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = result; ai != NULL && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        // The device's send buffer, so back pressure reaches the publisher as it would on the device
+        int sndbuf = BENCH_SNDBUF;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    if (fd < 0) {
+        fprintf(stderr, "cannot connect to %s:%s: %s\n", host, port, strerror(errno));
+    }
+    return fd;
+}
+
+// Send CONNECT and wait for the CONNACK
+static bool mqtt_connect(void) {
+    static const char client_id[] = "polverine-" BENCH_DEVICE_ID;
+    uint8_t packet[64];
+    size_t remaining = 10 + 2 + strlen(client_id);
+    size_t pos = 0;
+    packet[pos++] = MQTT_CONNECT;
+    pos += put_remaining_length(packet + pos, remaining);
+    pos += put_string(packet + pos, "MQTT", 4);
+    packet[pos++] = 4;    // MQTT 3.1.1
+    packet[pos++] = 0x02; // Clean session
+    packet[pos++] = BENCH_KEEPALIVE_S >> 8;
+    packet[pos++] = BENCH_KEEPALIVE_S & 0xFF;
+    pos += put_string(packet + pos, client_id, strlen(client_id));
+    if (!write_all(client_fd, packet, pos)) {
+        return false;
+    }
+
+    conn_t *conn = calloc(1, sizeof(*conn));
+    conn->fd = client_fd;
+    bool accepted = false;
+    while (conn_fill(conn, 4 - conn->len)) {
+        uint8_t header;
+        const uint8_t *body;
+        size_t body_len, total;
+        if (conn_packet(conn, &header, &body, &body_len, &total) == 1) {
+            accepted = header == MQTT_CONNACK && body_len == 2 && body[1] == 0;
+            break;
+        }
+    }
+    free(conn);
+    return accepted;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_ms(const step_t *step, double p) {
+    if (step->latency_count == 0) {
+        return 0;
+    }
+    size_t rank = (size_t)(p * (step->latency_count - 1) + 0.5);
+    return step->latency_us[rank] / 1000.0;
+}
+
+// Offer samples at one rate for step_ms, true if the path sustained it
+static bool run_step(size_t index, uint32_t rate, uint32_t step_ms, polverine_payload_format_t format, uint32_t *sample_n) {
+    step_t *step = &steps[index];
+    int64_t interval_us = 1000000 / rate;
+    uint32_t offered = (uint32_t)((uint64_t)rate * step_ms / 1000);
+    if (offered == 0) {
+        offered = 1;
+    }
+
+    pthread_mutex_lock(&bench_mutex);
+    current_step = index;
+    step->rate = rate;
+    step->start_us = esp_timer_get_time();
+    step->outbox_start = outbox_bytes;
+    step->outbox_peak = outbox_bytes;
+    pthread_mutex_unlock(&bench_mutex);
+
+    int64_t deadline_us = step->start_us + 2 * (int64_t)step_ms * 1000;
+    for (uint32_t i = 0; i < offered; i++) {
+        sample_due_us = step->start_us + (int64_t)i * interval_us;
+        sleep_until_us(sample_due_us);
+        if (esp_timer_get_time() > deadline_us) {
+            step->behind = true;
+            break;
+        }
+        publish_sample((*sample_n)++, format);
+        step->samples++;
+    }
+    sleep_until_us(step->start_us + (int64_t)step_ms * 1000);
+
+    pthread_mutex_lock(&bench_mutex);
+    step->end_us = esp_timer_get_time();
+    step->outbox_end = outbox_bytes;
+    pthread_mutex_unlock(&bench_mutex);
+
+    // Late publishes show up as a longer step, the PUBACK delay holds back the messages of its last stretch
+    bool kept_pace = !step->behind && step->end_us - step->start_us <= (int64_t)step_ms * 1100;
+    double required = 0.95 - (double)ack_delay_ms / step_ms;
+    return kept_pace && step->delivered >= required * step->messages && step->outbox_end < BENCH_HIGH_WATER;
+}
+
+static void print_step(const step_t *step, bool sustained) {
+    double seconds = (step->end_us - step->start_us) / 1e6;
+    pthread_mutex_lock(&bench_mutex);
+    qsort(step->latency_us, step->latency_count, sizeof(uint32_t), compare_u32);
+    printf("%7lu %9.1f %8.1f %8.1f %8.2f %8.2f %8.2f %9lu B %+8ld B %s\n", (unsigned long)step->rate, step->samples / seconds,
+        step->delivered / seconds, step->delivered_bytes / seconds / 1000, percentile_ms(step, 0.5), percentile_ms(step, 0.99),
+        percentile_ms(step, 1.0), (unsigned long)step->outbox_peak, (long)step->outbox_end - (long)step->outbox_start,
+        sustained ? "ok" : (step->behind ? "behind" : "saturated"));
+    pthread_mutex_unlock(&bench_mutex);
+    if (step->refused > 0) {
+        printf("        %lu messages refused, no free packet id\n", (unsigned long)step->refused);
+    }
+}
+
+static bool parse_rates(const char *arg, uint32_t *rates, size_t *count) {
+    *count = 0;
+    while (*arg != '\0') {
+        char *end;
+        unsigned long rate = strtoul(arg, &end, 10);
+        if (end == arg || rate == 0 || rate > 1000000 || *count == BENCH_MAX_STEPS || (*end != ',' && *end != '\0')) {
+            return false;
+        }
+        rates[(*count)++] = (uint32_t)rate;
+        arg = *end == ',' ? end + 1 : end;
+    }
+    return *count > 0;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [--rates R,R,...] [--step-ms MS] [--qos 0|1|auto] [--format json|cbor|json+cbor]\n"
+        "          [--batch N] [--ack-delay MS] [--bw B] [--broker HOST:PORT] [--min-rate R]\n"
+        "  --rates R,...       offered samples per second, one step each (default 10,20,50,...,20000)\n"
+        "  --step-ms MS        duration of a step (default 1000)\n"
+        "  --qos P             QoS policy of state and batch messages (default: state 0, batch 1 as on the device)\n"
+        "  --format F          payload format, json, cbor or json+cbor (default json)\n"
+        "  --batch N           samples per batch message, 0 for none (default 0)\n"
+        "  --ack-delay MS      broker stand-in delays each PUBACK (default 0)\n"
+        "  --bw B              broker stand-in reads at most B bytes per second, 0 for no limit (default 0)\n"
+        "  --broker HOST:PORT  publish to a running MQTT 3.1.1 broker instead of the stand-in\n"
+        "  --min-rate R        fail unless at least R samples per second are sustained\n",
+        argv0);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"rates", required_argument, NULL, 'r'},
+        {"step-ms", required_argument, NULL, 's'},
+        {"qos", required_argument, NULL, 'q'},
+        {"format", required_argument, NULL, 'f'},
+        {"batch", required_argument, NULL, 'b'},
+        {"ack-delay", required_argument, NULL, 'a'},
+        {"bw", required_argument, NULL, 'w'},
+        {"broker", required_argument, NULL, 'h'},
+        {"min-rate", required_argument, NULL, 'm'},
+        {NULL, 0, NULL, 0},
+    };
+
+    uint32_t rates[BENCH_MAX_STEPS];
+    size_t rate_count = 0;
+    parse_rates("10,20,50,100,200,500,1000,2000,5000,10000,20000", rates, &rate_count);
+    uint32_t step_ms = 1000;
+    int qos_override = -1;
+    polverine_payload_format_t format = PAYLOAD_FORMAT_JSON;
+    uint16_t batch_samples = 0;
+    char *broker = NULL;
+    uint32_t min_rate = 0;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        uint8_t policy;
+        switch (opt) {
+        case 'r':
+            if (!parse_rates(optarg, rates, &rate_count)) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 's':
+            step_ms = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'q':
+            if (!mqtt_qos_policy_parse(optarg, &policy)) {
+                usage(argv[0]);
+                return 2;
+            }
+            qos_override = policy;
+            break;
+        case 'f':
+            if (!config_payload_format_parse(optarg, &format)) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'b':
+            batch_samples = (uint16_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'a':
+            ack_delay_ms = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'w':
+            broker_bw = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'h':
+            broker = optarg;
+            break;
+        case 'm':
+            min_rate = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (step_ms == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    mqtt_qos_init(&qos_policy, BENCH_HIGH_WATER, BENCH_LOW_WATER);
+    mqtt_qos_set_policy(&qos_policy, MQTT_QOS_CLASS_STATE, qos_override >= 0 ? (uint8_t)qos_override : 0);
+    mqtt_qos_set_policy(&qos_policy, MQTT_QOS_CLASS_BATCH, qos_override >= 0 ? (uint8_t)qos_override : 1);
+
+    static const char *const stream_names[STREAM_COUNT][2] = {
+        [STREAM_BME690_JSON] = {"bme690/state", "bme690/state/batch"},
+        [STREAM_BMV080_JSON] = {"bmv080/state", "bmv080/state/batch"},
+        [STREAM_BME690_CBOR] = {"bme690/state/cbor", "bme690/state/cbor/batch"},
+        [STREAM_BMV080_CBOR] = {"bmv080/state/cbor", "bmv080/state/cbor/batch"},
+    };
+    for (size_t i = 0; i < STREAM_COUNT; i++) {
+        snprintf(streams[i].state_topic, sizeof(streams[i].state_topic), "polverine/%s/%s", BENCH_DEVICE_ID, stream_names[i][0]);
+        snprintf(streams[i].batch_topic, sizeof(streams[i].batch_topic), "polverine/%s/%s", BENCH_DEVICE_ID, stream_names[i][1]);
+        if (batch_samples > 1) {
+            // Batch buffer sizes of mqtt_main.c
+            bool cbor = i >= STREAM_BME690_CBOR;
+            const mqtt_batch_limits_t limits = {.max_samples = batch_samples, .max_age_ms = 1000};
+            streams[i].enabled = mqtt_batch_init(&streams[i].batch, cbor ? &mqtt_batch_cbor : &mqtt_batch_json, &limits,
+                cbor ? 1024 : MQTT_BATCH_DEFAULT_CAPACITY);
+        }
+    }
+
+    pthread_t broker_thread;
+    int listen_fd = -1;
+    const char *host = "127.0.0.1";
+    char port[8];
+    if (broker == NULL) {
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+        if (broker_bw > 0) {
+            // Inherited by the accepted connection, keeps the kernel from reading ahead of the budget
+            int rcvbuf = BENCH_RCVBUF;
+            setsockopt(listen_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        }
+        socklen_t addr_len = sizeof(addr);
+        if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 1) != 0 ||
+            getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+            fprintf(stderr, "cannot listen on 127.0.0.1: %s\n", strerror(errno));
+            return 1;
+        }
+        pthread_create(&broker_thread, NULL, broker_main, &listen_fd);
+
+        snprintf(port, sizeof(port), "%u", ntohs(addr.sin_port));
+        printf("Broker stand-in on 127.0.0.1:%s, PUBACK delay %lu ms, ", port, (unsigned long)ack_delay_ms);
+        if (broker_bw > 0) {
+            printf("reading %lu B/s\n", (unsigned long)broker_bw);
+        } else {
+            printf("reading without limit\n");
+        }
+    } else {
+        char *colon = strrchr(broker, ':');
+        if (colon == NULL || strlen(colon + 1) >= sizeof(port)) {
+            usage(argv[0]);
+            return 2;
+        }
+        *colon = '\0';
+        host = broker;
+        strcpy(port, colon + 1);
+        embedded = false;
+        printf("Broker %s:%s, QoS 0 messages count as delivered once written\n", host, port);
+    }
+    fflush(stdout);
+    client_fd = connect_to(host, port);
+    if (client_fd < 0 || !mqtt_connect()) {
+        fprintf(stderr, "MQTT connect failed\n");
+        return 1;
+    }
+
+    pthread_t reader_thread;
+    pthread_create(&reader_thread, NULL, reader_main, NULL);
+
+    printf("%s payloads, QoS state %s batch %s, ", config_payload_format_name(format),
+        mqtt_qos_policy_name(qos_policy.policy[MQTT_QOS_CLASS_STATE]), mqtt_qos_policy_name(qos_policy.policy[MQTT_QOS_CLASS_BATCH]));
+    if (batch_samples > 1) {
+        printf("batches of %u, ", batch_samples);
+    }
+    printf("%lu ms per step\n", (unsigned long)step_ms);
+    printf("  rate  samples/s   msgs/s     kB/s   p50 ms   p99 ms   max ms  outbox peak    growth\n");
+
+    uint32_t sustained_rate = 0;
+    uint32_t sample_n = 0;
+    size_t step_count = 0;
+    for (size_t i = 0; i < rate_count; i++) {
+        bool sustained = run_step(i, rates[i], step_ms, format, &sample_n);
+        step_count = i + 1;
+        print_step(&steps[i], sustained);
+        if (!sustained) {
+            break;
+        }
+        if (rates[i] > sustained_rate) {
+            sustained_rate = rates[i];
+        }
+    }
+
+    // Flush open batches and wait for every message to be delivered
+    for (size_t i = 0; i < STREAM_COUNT; i++) {
+        if (streams[i].enabled) {
+            mqtt_batch_flush(&streams[i].batch, batch_flush_publish, &streams[i]);
+        }
+    }
+    pthread_mutex_lock(&bench_mutex);
+    current_step = BENCH_MAX_STEPS;
+    pthread_mutex_unlock(&bench_mutex);
+    int64_t drain_deadline = esp_timer_get_time() + BENCH_DRAIN_US + (int64_t)ack_delay_ms * 1000;
+    size_t delivered = 0, written = 0;
+    uint32_t pending = 0;
+    while (esp_timer_get_time() < drain_deadline) {
+        pthread_mutex_lock(&bench_mutex);
+        delivered = delivered_count;
+        written = message_count;
+        pending = pending_count;
+        pthread_mutex_unlock(&bench_mutex);
+        if (delivered == written) {
+            break;
+        }
+        sleep_until_us(esp_timer_get_time() + 10000);
+    }
+
+    const uint8_t disconnect[] = {MQTT_DISCONNECT, 0};
+    write_all(client_fd, disconnect, sizeof(disconnect));
+    shutdown(client_fd, SHUT_WR);
+    if (broker == NULL) {
+        pthread_join(broker_thread, NULL);
+    }
+    pthread_join(reader_thread, NULL);
+    close(client_fd);
+
+    printf("%zu messages, %lu refused, outbox peak %lu B, %lu congestions\n", written,
+        (unsigned long)(qos_policy.failed[MQTT_QOS_CLASS_STATE] + qos_policy.failed[MQTT_QOS_CLASS_BATCH]),
+        (unsigned long)qos_policy.outbox_peak, (unsigned long)qos_policy.congestions);
+    if (delivered != written) {
+        printf("FAIL: %zu of %zu messages undelivered, %lu without PUBACK\n", written - delivered, written, (unsigned long)pending);
+        failed = true;
+    }
+    if (broker_errors > 0) {
+        printf("FAIL: broker stand-in saw %lu malformed or mismatched packets\n", (unsigned long)broker_errors);
+        failed = true;
+    }
+    if (embedded && broker_received != written) {
+        printf("FAIL: broker received %zu of %zu messages\n", broker_received, written);
+        failed = true;
+    }
+    printf("Sustained: %lu samples/s\n", (unsigned long)sustained_rate);
+    if (sustained_rate < min_rate) {
+        printf("FAIL: below the required %lu samples/s\n", (unsigned long)min_rate);
+        failed = true;
+    }
+
+    for (size_t i = 0; i < step_count; i++) {
+        free(steps[i].latency_us);
+    }
+    free(steps[BENCH_MAX_STEPS].latency_us);
+    for (size_t i = 0; i < STREAM_COUNT; i++) {
+        if (streams[i].enabled) {
+            mqtt_batch_deinit(&streams[i].batch);
+        }
+    }
+    free(messages);
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
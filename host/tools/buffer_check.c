@@ -0,0 +1,178 @@
+/**
+ * @file buffer_check.c
+ * @brief Checks the running sums of the BME690 averaging buffer against a full re-summation
+ *
+ * Adds synthetic samples to a bme690_sensor_buffer_t and compares its running
+ * sums with the fields of the samples in the window summed from scratch in
+ * long double: while the window fills, once samples are evicted, and on both
+ * sides of every periodic recompute. The samples mix large offsets with
+ * small changes, sign changes and jumps by orders of magnitude, which is
+ * where an add and a later subtract of the same value lose bits. Also checks
+ * that bme690_buffer_get_averaged() returns the means of the window.
+ *
+ * Built twice, with the firmware's MAX_SENSOR_SAMPLES and with the largest
+ * window the uint16_t indices allow. With large windows the re-summation runs
+ * every few samples instead of after each one, boundaries always included.
+ *
+ * Usage:
+ *   buffer_check [--samples N] [--seed N]
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sensor_buffer.h"
+
+#define CHECK(cond, ...)                                                                                                                   \
+    do {                                                                                                                                   \
+        if (!(cond)) {                                                                                                                     \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);                                                                                    \
+            printf(__VA_ARGS__);                                                                                                           \
+            printf("\n");                                                                                                                  \
+            failed = true;                                                                                                                 \
+        }                                                                                                                                  \
+    } while (0)
+
+// Relative to the sum of the absolute values in the window
+#define SUM_TOLERANCE 1e-12
+
+static bool failed = false;
+static bme690_sensor_buffer_t buffer;
+
+// Small deterministic PRNG so runs are reproducible across hosts
+static uint32_t rng_state = 1;
+
+static float rng_range(float min, float max) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return min + (max - min) * ((rng_state >> 8) / 16777216.0f);
+}
+
+static bme690_data_t make_sample(uint32_t n) {
+    // Every 1000 samples the CO2 and VOC levels jump by orders of magnitude for a while
+    bool burst = (n / 1000) % 4 == 3;
+    return (bme690_data_t){
+        .temperature = rng_range(-30.0f, 40.0f),
+        .pressure = 101325.0f + rng_range(-0.05f, 0.05f),
+        .humidity = rng_range(0.0f, 100.0f),
+        .iaq = burst ? rng_range(300.0f, 500.0f) : rng_range(0.0f, 1.0f),
+        .iaq_accuracy = (uint8_t)(rng_state % 4),
+        .co2_equivalent = burst ? rng_range(1e5f, 1e6f) : rng_range(400.0f, 401.0f),
+        .breath_voc_equivalent = burst ? rng_range(1e3f, 1e4f) : rng_range(1e-4f, 1e-3f),
+        .timestamp = n * 3000u,
+    };
+}
+
+static void field_values(const bme690_data_t *sample, long double values[BME690_AVG_FIELD_COUNT]) {
+    values[BME690_AVG_TEMPERATURE] = sample->temperature;
+    values[BME690_AVG_PRESSURE] = sample->pressure;
+    values[BME690_AVG_HUMIDITY] = sample->humidity;
+    values[BME690_AVG_IAQ] = sample->iaq;
+    values[BME690_AVG_IAQ_ACCURACY] = sample->iaq_accuracy;
+    values[BME690_AVG_CO2] = sample->co2_equivalent;
+    values[BME690_AVG_VOC] = sample->breath_voc_equivalent;
+}
+
+// Compare the running sums with the window summed from scratch, returns the largest relative error
+static double check_sums(uint32_t added) {
+    long double exact[BME690_AVG_FIELD_COUNT] = {0};
+    long double magnitude[BME690_AVG_FIELD_COUNT] = {0};
+    long double values[BME690_AVG_FIELD_COUNT];
+
+    for (uint16_t i = 0; i < buffer.sample_count; i++) {
+        field_values(&buffer.samples[i], values);
+        for (int f = 0; f < BME690_AVG_FIELD_COUNT; f++) {
+            exact[f] += values[f];
+            magnitude[f] += fabsl(values[f]);
+        }
+    }
+
+    double worst = 0.0;
+    for (int f = 0; f < BME690_AVG_FIELD_COUNT; f++) {
+        long double running = (long double)buffer.sums[f] + buffer.compensation[f];
+        double error = (double)(fabsl(running - exact[f]) / (magnitude[f] + 1.0L));
+        CHECK(error <= SUM_TOLERANCE, "field %d after %lu samples: running sum %.17Lg, re-summed %.17Lg", f, (unsigned long)added,
+            running, exact[f]);
+        worst = error > worst ? error : worst;
+    }
+
+    bme690_data_t averaged = bme690_buffer_get_averaged(&buffer);
+    float mean = (float)(exact[BME690_AVG_CO2] / buffer.sample_count);
+    CHECK(fabsf(averaged.co2_equivalent - mean) <= fabsf(mean) * 1e-6f, "CO2 average %.7g after %lu samples, re-summed %.7g",
+        averaged.co2_equivalent, (unsigned long)added, mean);
+    return worst;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [--samples N] [--seed N]\n"
+        "  --samples N     samples added (default 2.5 recompute intervals plus a window)\n"
+        "  --seed N        random seed (default 1)\n",
+        argv0);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"samples", required_argument, NULL, 'n'},
+        {"seed", required_argument, NULL, 's'},
+        {NULL, 0, NULL, 0},
+    };
+
+    uint32_t samples = SENSOR_BUFFER_RECOMPUTE_INTERVAL * 5 / 2 + MAX_SENSOR_SAMPLES;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'n':
+            samples = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            rng_state = (uint32_t)strtoul(optarg, NULL, 10);
+            if (rng_state == 0) {
+                rng_state = 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (samples == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // Re-summing the whole window after every sample is quadratic, large windows are sampled
+    const uint32_t every = MAX_SENSOR_SAMPLES > 1024 ? MAX_SENSOR_SAMPLES / 16 : 1;
+
+    bme690_buffer_init(&buffer);
+    unsigned checks = 0;
+    unsigned recomputes = 0;
+    double worst = 0.0;
+    for (uint32_t n = 1; n <= samples; n++) {
+        bme690_data_t sample = make_sample(n);
+        bme690_buffer_add(&buffer, &sample);
+
+        uint32_t since = buffer.adds_since_recompute;
+        bool boundary = since <= 1 || since + 1 >= SENSOR_BUFFER_RECOMPUTE_INTERVAL || n <= 2 ||
+                        (n >= MAX_SENSOR_SAMPLES - 1 && n <= MAX_SENSOR_SAMPLES + 2) || n == samples;
+        recomputes += since == 0;
+        if (boundary || n % every == 0) {
+            double error = check_sums(n);
+            worst = error > worst ? error : worst;
+            checks++;
+        }
+    }
+
+    printf("window %d, recompute every %d: %lu samples, %u recomputes, %u checks, worst relative error %.2e\n", MAX_SENSOR_SAMPLES,
+        SENSOR_BUFFER_RECOMPUTE_INTERVAL, (unsigned long)samples, recomputes, checks, worst);
+    CHECK(samples < SENSOR_BUFFER_RECOMPUTE_INTERVAL || recomputes > 0, "no recompute after %lu samples", (unsigned long)samples);
+
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,423 @@
+/**
+ * @file history_bench.c
+ * @brief Checks /history query results against the raw samples and reports their cost
+ *
+ * Feeds a day and more of synthetic BME690 samples, with a sensor outage,
+ * into a sensor history with the default tiers and keeps the raw samples.
+ * Queries over the last hour to the whole run, with several steps, are then
+ * compared step by step with min/mean/max computed from the raw samples of
+ * the buckets the queried tier still holds: sample counts exactly, values
+ * within half the field's resolution. Also checks that a query running while
+ * samples are added returns its steps in order without duplicates, that
+ * values outside a field's range saturate, and that buckets keep closing and
+ * queries keep working when the millisecond timestamps wrap after 49.7 days.
+ *
+ * Reports the ring storage of both sensors, the cost of adding a sample and
+ * per query the number of steps, the time and the size of the JSON response.
+ *
+ * Usage:
+ *   history_bench [--hours N] [--interval MS] [--seed N]
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_timer.h"
+
+#include "json_writer.h"
+#include "sensor_history.h"
+#include "sensor_json.h"
+
+#define CHECK(cond, ...)                                                                                                                   \
+    do {                                                                                                                                   \
+        if (!(cond)) {                                                                                                                     \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);                                                                                    \
+            printf(__VA_ARGS__);                                                                                                           \
+            printf("\n");                                                                                                                  \
+            failed = true;                                                                                                                 \
+        }                                                                                                                                  \
+    } while (0)
+
+#define OUTAGE_START_H 20 // A 20 min sensor outage starting this many hours into the run
+#define OUTAGE_MIN     20
+
+static bool failed = false;
+
+static bme690_data_t *samples;
+static size_t sample_count;
+static sensor_history_t history;
+
+// Small deterministic PRNG so runs are reproducible across hosts
+static uint32_t rng_state = 1;
+
+static float rng_range(float min, float max) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return min + (max - min) * ((rng_state >> 8) / 16777216.0f);
+}
+
+static float walk(float value, float step, float min, float max) {
+    value += rng_range(-step, step);
+    return value < min ? min : value > max ? max : value;
+}
+
+// Random walks sampled every interval_ms with a little jitter, without samples during the outage
+static void generate(double hours, uint32_t interval_ms) {
+    size_t capacity = (size_t)(hours * 3600000.0 / interval_ms) + 1;
+    samples = calloc(capacity, sizeof(bme690_data_t));
+    if (samples == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    bme690_data_t sample = {
+        .temperature = 21.0f,
+        .pressure = 101000.0f,
+        .humidity = 45.0f,
+        .iaq = 50.0f,
+        .co2_equivalent = 600.0f,
+        .breath_voc_equivalent = 0.8f,
+    };
+    uint32_t outage_start_ms = OUTAGE_START_H * 3600000u;
+    uint32_t outage_end_ms = outage_start_ms + OUTAGE_MIN * 60000u;
+
+    uint32_t timestamp_ms = 1500; // First sample after boot
+    for (sample_count = 0; sample_count < capacity; timestamp_ms += interval_ms + (uint32_t)rng_range(0.0f, 40.0f)) {
+        if (timestamp_ms >= hours * 3600000.0) {
+            break;
+        }
+        if (timestamp_ms >= outage_start_ms && timestamp_ms < outage_end_ms) {
+            continue;
+        }
+        sample.temperature = walk(sample.temperature, 0.05f, 15.0f, 30.0f);
+        sample.pressure = walk(sample.pressure, 8.0f, 98000.0f, 104000.0f);
+        sample.humidity = walk(sample.humidity, 0.2f, 20.0f, 80.0f);
+        sample.iaq = walk(sample.iaq, 2.0f, 0.0f, 500.0f);
+        sample.co2_equivalent = walk(sample.co2_equivalent, 10.0f, 400.0f, 5000.0f);
+        sample.breath_voc_equivalent = walk(sample.breath_voc_equivalent, 0.05f, 0.0f, 50.0f);
+        sample.timestamp = timestamp_ms;
+        samples[sample_count++] = sample;
+    }
+}
+
+static float field_value(const bme690_data_t *sample, uint8_t field) {
+    float value;
+    memcpy(&value, (const uint8_t *)sample + history.fields[field].offset, sizeof(value));
+    return value;
+}
+
+// Oldest bucket start the tier holds, its open bucket included
+static uint32_t tier_oldest_ms(const sensor_history_tier_t *tier) {
+    if (tier->count == 0) {
+        return tier->open_start_ms;
+    }
+    return tier->start_ms[(tier->head + tier->capacity - tier->count) % tier->capacity];
+}
+
+// Start of a range reaching back from now, clamped to boot as /history does
+static uint32_t ago_ms(uint32_t now_ms, uint32_t range_ms) {
+    return range_ms >= now_ms ? 0 : now_ms - range_ms;
+}
+
+static bool json_discard(const char *buf, size_t len, void *ctx) {
+    *(size_t *)ctx += len;
+    return true;
+}
+
+// Run a query over [from_ms, to_ms) and compare every step with the raw samples
+static void verify_query(const char *label, uint32_t from_ms, uint32_t to_ms, uint32_t step_ms) {
+    sensor_history_query_t query;
+    sensor_history_query_begin(&history, &query, from_ms, to_ms, step_ms);
+    const sensor_history_tier_t *tier = &history.tiers[query.tier];
+    uint32_t oldest_ms = tier_oldest_ms(tier);
+    uint32_t step = query.step_ms;
+
+    // Expected steps, from the samples in buckets the tier still holds
+    size_t first = 0;
+    while (first < sample_count && samples[first].timestamp - samples[first].timestamp % tier->bucket_ms < oldest_ms) {
+        first++;
+    }
+
+    size_t index = first;
+    while (index < sample_count && samples[index].timestamp < query.next_ms) {
+        index++;
+    }
+
+    sensor_history_point_t point;
+    unsigned points = 0;
+    unsigned mismatches = 0;
+    while (sensor_history_query_next(&history, &query, &point)) {
+        points++;
+        uint32_t end_ms = point.start_ms + step;
+
+        // Raw samples between the previous point and this one must not exist
+        size_t skipped = 0;
+        while (index < sample_count && samples[index].timestamp < point.start_ms) {
+            index++;
+            skipped++;
+        }
+        if (skipped > 0 && mismatches++ < 3) {
+            printf("FAIL: %s: %zu samples before the step at %u ms are missing\n", label, skipped, (unsigned)point.start_ms);
+        }
+
+        uint32_t count = 0;
+        float min[SENSOR_HISTORY_MAX_FIELDS], max[SENSOR_HISTORY_MAX_FIELDS];
+        double sum[SENSOR_HISTORY_MAX_FIELDS] = {0};
+        for (uint8_t f = 0; f < history.field_count; f++) {
+            min[f] = INFINITY;
+            max[f] = -INFINITY;
+        }
+        for (; index < sample_count && samples[index].timestamp < end_ms; index++, count++) {
+            for (uint8_t f = 0; f < history.field_count; f++) {
+                float value = field_value(&samples[index], f);
+                min[f] = fminf(min[f], value);
+                max[f] = fmaxf(max[f], value);
+                sum[f] += value;
+            }
+        }
+
+        bool same = point.count == count && point.start_ms % step == 0;
+        for (uint8_t f = 0; same && f < history.field_count; f++) {
+            double mean = sum[f] / count;
+            double tolerance = history.fields[f].resolution * 0.5 + fabs(mean) * 1e-6;
+            same = fabs(point.min[f] - min[f]) <= tolerance && fabs(point.max[f] - max[f]) <= tolerance &&
+                   fabs(point.mean[f] - mean) <= tolerance;
+        }
+        if (!same && mismatches++ < 3) {
+            printf("FAIL: %s: step at %u ms: %u samples, temperature %.3f/%.3f/%.3f, expected %u, %.3f/%.3f/%.3f\n", label,
+                (unsigned)point.start_ms, (unsigned)point.count, point.min[0], point.mean[0], point.max[0], (unsigned)count, min[0],
+                sum[0] / (count ? count : 1), max[0]);
+        }
+    }
+    while (index < sample_count && samples[index].timestamp < to_ms) {
+        index++;
+        if (mismatches++ < 3) {
+            printf("FAIL: %s: sample at %u ms missing from the result\n", label, (unsigned)samples[index - 1].timestamp);
+        }
+    }
+    if (mismatches > 0) {
+        failed = true;
+    }
+
+    // Cost of the query and of its JSON response
+    const int repeat = 20;
+    size_t json_bytes = 0;
+    int64_t start = esp_timer_get_time();
+    for (int r = 0; r < repeat; r++) {
+        char chunk[1024];
+        json_writer_t writer;
+        json_bytes = 0;
+        json_writer_init(&writer, chunk, sizeof(chunk), json_discard, &json_bytes);
+        json_writer_array_begin(&writer, NULL);
+        sensor_history_query_begin(&history, &query, from_ms, to_ms, step_ms);
+        while (sensor_history_query_next(&history, &query, &point)) {
+            sensor_json_write_history_point(&writer, &history, &point);
+        }
+        json_writer_array_end(&writer);
+        CHECK(json_writer_finish(&writer), "%s: JSON response incomplete", label);
+    }
+    double query_us = (double)(esp_timer_get_time() - start) / repeat;
+
+    printf("%-22s tier %u, %6u s steps: %4u points %8.1f us %7zu B JSON\n", label, (unsigned)query.tier, (unsigned)(step / 1000), points,
+        query_us, json_bytes);
+}
+
+// A query spanning additions returns its steps once each and in order
+static void verify_interleaved(uint32_t interval_ms) {
+    static sensor_history_t live;
+    if (!sensor_history_init(&live, "bme690", sensor_history_bme690_fields, sensor_history_bme690_field_count, NULL)) {
+        failed = true;
+        return;
+    }
+
+    size_t next = 0;
+    while (next < sample_count && samples[next].timestamp < 2 * 3600000u) {
+        sensor_history_add(&live, &samples[next], samples[next].timestamp);
+        next++;
+    }
+
+    sensor_history_query_t query;
+    sensor_history_point_t point;
+    sensor_history_query_begin(&live, &query, samples[next - 1].timestamp - 3600000u, samples[sample_count - 1].timestamp + 1, 0);
+    uint32_t previous_ms = 0;
+    uint64_t counted = 0;
+    bool ordered = true;
+    while (sensor_history_query_next(&live, &query, &point)) {
+        ordered = ordered && (previous_ms == 0 || point.start_ms > previous_ms);
+        previous_ms = point.start_ms;
+        counted += point.count;
+
+        // A few samples between every step, the ring wraps while the query runs
+        for (int i = 0; i < 20 && next < sample_count; i++, next++) {
+            sensor_history_add(&live, &samples[next], samples[next].timestamp);
+        }
+    }
+    CHECK(ordered, "interleaved query returned steps out of order");
+    CHECK(counted > 0 && previous_ms + query.step_ms > samples[next - 1].timestamp - interval_ms,
+        "interleaved query did not reach the samples added while it ran");
+    sensor_history_deinit(&live);
+}
+
+static void verify_saturation(void) {
+    static const sensor_history_field_t fields[] = {{"value", 0, 1.0f}};
+    static const sensor_history_tier_config_t tiers[SENSOR_HISTORY_TIER_COUNT] = {{1000, 4}, {2000, 4}};
+    sensor_history_t small;
+    if (!sensor_history_init(&small, "test", fields, 1, tiers)) {
+        failed = true;
+        return;
+    }
+
+    const float values[] = {1e6f, -1e6f, NAN};
+    for (uint32_t i = 0; i < 3; i++) {
+        sensor_history_add(&small, &values[i], i * 1000);
+    }
+    sensor_history_add(&small, &values[0], 9000); // Closes the last bucket
+
+    sensor_history_query_t query;
+    sensor_history_point_t point;
+    sensor_history_query_begin(&small, &query, 0, 3000, 1000);
+    CHECK(sensor_history_query_next(&small, &query, &point) && point.max[0] == INT16_MAX, "large value not saturated");
+    CHECK(sensor_history_query_next(&small, &query, &point) && point.min[0] == -INT16_MAX, "small value not saturated");
+    CHECK(sensor_history_query_next(&small, &query, &point) && point.mean[0] == 0.0f, "NaN not stored as zero");
+    CHECK(!sensor_history_query_next(&small, &query, &point), "query continued past the range");
+    sensor_history_deinit(&small);
+}
+
+// Samples every second from 10 min before to 20 min after the timestamps wrap
+static void verify_wrap(void) {
+    enum { BEFORE_S = 600, AFTER_S = 1200 };
+    static sensor_history_t wrapped;
+    if (!sensor_history_init(&wrapped, "bme690", sensor_history_bme690_fields, sensor_history_bme690_field_count, NULL)) {
+        failed = true;
+        return;
+    }
+
+    const uint32_t first_ms = 0u - BEFORE_S * 1000u;
+    bme690_data_t sample = {.temperature = 21.0f};
+    for (uint32_t s = 0; s < BEFORE_S + AFTER_S; s++) {
+        sample.timestamp = first_ms + s * 1000u;
+        sensor_history_add(&wrapped, &sample, sample.timestamp);
+    }
+    const uint32_t last_ms = sample.timestamp;
+    const sensor_history_tier_t *tier = &wrapped.tiers[0];
+    CHECK(tier->count >= (BEFORE_S + AFTER_S) * 1000u / tier->bucket_ms - 2, "only %u buckets closed across the wrap",
+        (unsigned)tier->count);
+    CHECK(last_ms - tier->open_start_ms < tier->bucket_ms, "open bucket at %u ms does not hold the last sample at %u ms",
+        (unsigned)tier->open_start_ms, (unsigned)last_ms);
+
+    // The last 5 min, within a bucket at both ends, and the whole span across the wrap exactly
+    const uint32_t ranges_s[] = {300, BEFORE_S + AFTER_S + 60};
+    for (size_t r = 0; r < sizeof(ranges_s) / sizeof(ranges_s[0]); r++) {
+        sensor_history_query_t query;
+        sensor_history_point_t point;
+        sensor_history_query_begin(&wrapped, &query, last_ms + 1 - ranges_s[r] * 1000u, last_ms + 1, 0);
+
+        uint64_t counted = 0;
+        unsigned points = 0;
+        uint32_t previous_ms = 0;
+        bool ordered = true;
+        while (sensor_history_query_next(&wrapped, &query, &point)) {
+            ordered = ordered && (points == 0 || (int32_t)(point.start_ms - previous_ms) > 0);
+            previous_ms = point.start_ms;
+            counted += point.count;
+            points++;
+        }
+
+        uint32_t expected = ranges_s[r] < BEFORE_S + AFTER_S ? ranges_s[r] : BEFORE_S + AFTER_S;
+        uint32_t tolerance = ranges_s[r] < BEFORE_S + AFTER_S ? 2 * tier->bucket_ms / 1000u : 0;
+        CHECK(ordered, "steps out of order in the last %u s across the wrap", (unsigned)ranges_s[r]);
+        CHECK(points >= expected * 1000u / query.step_ms - 2, "%u steps in the last %u s across the wrap", points, (unsigned)ranges_s[r]);
+        CHECK(counted + tolerance >= expected && counted <= expected + tolerance,
+            "%llu samples in the last %u s across the wrap, expected %u", (unsigned long long)counted, (unsigned)ranges_s[r],
+            (unsigned)expected);
+    }
+    sensor_history_deinit(&wrapped);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [--hours N] [--interval MS] [--seed N]\n"
+        "  --hours N       length of the run (default 26)\n"
+        "  --interval MS   BME690 sample interval (default 3000, BSEC low power mode)\n"
+        "  --seed N        random seed (default 1)\n",
+        argv0);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"hours", required_argument, NULL, 'h'},
+        {"interval", required_argument, NULL, 'i'},
+        {"seed", required_argument, NULL, 's'},
+        {NULL, 0, NULL, 0},
+    };
+
+    double hours = 26.0;
+    uint32_t interval_ms = 3000;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            hours = atof(optarg);
+            break;
+        case 'i':
+            interval_ms = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            rng_state = (uint32_t)strtoul(optarg, NULL, 10);
+            if (rng_state == 0) {
+                rng_state = 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (hours < 2.0 || interval_ms == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    generate(hours, interval_ms);
+    if (!sensor_history_init(&history, "bme690", sensor_history_bme690_fields, sensor_history_bme690_field_count, NULL)) {
+        return 1;
+    }
+
+    int64_t start = esp_timer_get_time();
+    for (size_t i = 0; i < sample_count; i++) {
+        sensor_history_add(&history, &samples[i], samples[i].timestamp);
+    }
+    double add_ns = (double)(esp_timer_get_time() - start) * 1000.0 / sample_count;
+
+    printf("%zu samples over %.1f h, %.0f ns per sample added\n", sample_count, hours, add_ns);
+    printf("ring storage: bme690 %zu B, bmv080 %zu B\n", sensor_history_storage_size(sensor_history_bme690_field_count, NULL),
+        sensor_history_storage_size(sensor_history_bmv080_field_count, NULL));
+
+    uint32_t now_ms = samples[sample_count - 1].timestamp + interval_ms / 2;
+    uint32_t to_ms = now_ms + 1;
+    verify_query("last hour", ago_ms(now_ms, 3600000u), to_ms, 0);
+    verify_query("last hour, 1 min", ago_ms(now_ms, 3600000u), to_ms, 60000);
+    verify_query("last 6 h, 5 min", ago_ms(now_ms, 6 * 3600000u), to_ms, 300000);
+    verify_query("last 24 h, 15 min", ago_ms(now_ms, 24 * 3600000u), to_ms, 900000);
+    verify_query("last 24 h, 1 h", ago_ms(now_ms, 24 * 3600000u), to_ms, 3600000);
+    verify_query("whole run, 30 s", 0, to_ms, 30000);
+    if (hours > OUTAGE_START_H + 1) {
+        verify_query("outage, 1 min", OUTAGE_START_H * 3600000u - 600000u, OUTAGE_START_H * 3600000u + 1800000u, 60000);
+    }
+
+    verify_interleaved(interval_ms);
+    verify_saturation();
+    verify_wrap();
+
+    sensor_history_deinit(&history);
+    free(samples);
+
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,447 @@
+/**
+ * @file json_bench.c
+ * @brief Checks the streaming JSON writer and compares the /data serializer with cJSON
+ *
+ * Writes the /data document of pseudo-random samples with
+ * sensor_json_write_data() through output buffers of every size from 1 to 64
+ * bytes and checks that the output is identical to one written in a single
+ * buffer. Known documents are checked against their expected text, including
+ * string escapes, cJSON's number format, documents kept in the buffer as the
+ * /data snapshot is, and the writer's error handling.
+ * When libcjson is available, every document is also compared with
+ * cJSON_PrintUnformatted() of the cJSON tree the /data handler used to build.
+ *
+ * Reported per document are the time, the output size and the heap
+ * allocations. Allocations by the firmware code are counted by wrapping
+ * malloc, calloc and realloc at link time, those inside libcjson through its
+ * allocation hooks. The former handler built a cJSON tree and pretty printed
+ * it with cJSON_Print(), which is what the comparison runs.
+ *
+ * Usage:
+ *   json_bench [--iterations N] [--seed N]
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_timer.h"
+
+#include "json_writer.h"
+#include "sensor_json.h"
+
+#ifdef POLVERINE_HOST_CJSON
+#include "cJSON.h"
+#endif
+
+#define BENCH_SAMPLES 256
+#define BENCH_CHUNK   1024 // WEBSERVER_JSON_CHUNK
+#define DOC_MAX       4096
+
+static bool failed = false;
+
+// Heap allocations by code linked into this program, see the --wrap options in CMakeLists.txt
+static unsigned long allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+// Output collected from the flush callback, standing in for httpd_resp_send_chunk()
+typedef struct {
+    char doc[DOC_MAX];
+    size_t len;
+    unsigned chunks;
+    unsigned fail_after; // Refuse the flush after this many chunks, 0 never
+} sink_t;
+
+static bool sink_flush(const char *buf, size_t len, void *ctx) {
+    sink_t *sink = ctx;
+    if (sink->fail_after != 0 && sink->chunks >= sink->fail_after) {
+        return false;
+    }
+    if (len == 0 || sink->len + len >= sizeof(sink->doc)) {
+        return false;
+    }
+    memcpy(sink->doc + sink->len, buf, len);
+    sink->len += len;
+    sink->doc[sink->len] = '\0';
+    sink->chunks++;
+    return true;
+}
+
+static bool write_data(sink_t *sink, size_t chunk_size, const bme690_data_t *bme690, const bmv080_data_t *bmv080) {
+    char chunk[DOC_MAX];
+    json_writer_t writer;
+
+    sink->len = 0;
+    sink->chunks = 0;
+    sink->doc[0] = '\0';
+    json_writer_init(&writer, chunk, chunk_size, sink_flush, sink);
+    sensor_json_write_data(&writer, "a1b2c3", 123456789, bme690, bmv080);
+    return json_writer_finish(&writer);
+}
+
+static void expect(const char *what, const char *actual, const char *expected) {
+    if (strcmp(actual, expected) != 0) {
+        printf("FAIL: %s\n  expected: %s\n  actual:   %s\n", what, expected, actual);
+        failed = true;
+    }
+}
+
+#ifdef POLVERINE_HOST_CJSON
+static unsigned long cjson_allocations = 0;
+
+// libcjson's own calls to malloc are not wrapped, so count them here and only here
+static void *cjson_malloc(size_t size) {
+    cjson_allocations++;
+    return __real_malloc(size);
+}
+
+// The cJSON tree the /data handler built before the streaming writer
+static cJSON *reference_tree(const char *device_id, int64_t timestamp_ms, const bme690_data_t *bme690, const bmv080_data_t *bmv080) {
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddItemToObject(json, "timestamp", cJSON_CreateNumber(timestamp_ms));
+    cJSON_AddStringToObject(json, "device_id", device_id);
+
+    if (bme690 != NULL) {
+        cJSON *obj = cJSON_CreateObject();
+        cJSON_AddNumberToObject(obj, "temperature", bme690->temperature);
+        cJSON_AddNumberToObject(obj, "humidity", bme690->humidity);
+        cJSON_AddNumberToObject(obj, "pressure", bme690->pressure);
+        cJSON_AddNumberToObject(obj, "iaq", bme690->iaq);
+        cJSON_AddNumberToObject(obj, "iaq_accuracy", bme690->iaq_accuracy);
+        cJSON_AddNumberToObject(obj, "co2_equivalent", bme690->co2_equivalent);
+        cJSON_AddNumberToObject(obj, "breath_voc_equivalent", bme690->breath_voc_equivalent);
+        cJSON_AddNumberToObject(obj, "static_iaq", bme690->static_iaq);
+        cJSON_AddNumberToObject(obj, "gas_percentage", bme690->gas_percentage);
+        cJSON_AddBoolToObject(obj, "stabilization_status", bme690->stabilization_status);
+        cJSON_AddBoolToObject(obj, "run_in_status", bme690->run_in_status);
+        cJSON_AddNumberToObject(obj, "data_timestamp", bme690->timestamp);
+        cJSON_AddItemToObject(json, "bme690", obj);
+    } else {
+        cJSON_AddNullToObject(json, "bme690");
+    }
+
+    if (bmv080 != NULL) {
+        cJSON *obj = cJSON_CreateObject();
+        cJSON_AddNumberToObject(obj, "pm1", bmv080->pm1);
+        cJSON_AddNumberToObject(obj, "pm25", bmv080->pm25);
+        cJSON_AddNumberToObject(obj, "pm10", bmv080->pm10);
+        cJSON_AddBoolToObject(obj, "is_obstructed", bmv080->is_obstructed);
+        cJSON_AddBoolToObject(obj, "is_outside_range", bmv080->is_outside_range);
+        cJSON_AddNumberToObject(obj, "runtime", bmv080->runtime);
+        cJSON_AddNumberToObject(obj, "data_timestamp", bmv080->timestamp);
+        cJSON_AddItemToObject(json, "bmv080", obj);
+    } else {
+        cJSON_AddNullToObject(json, "bmv080");
+    }
+
+    cJSON *status = cJSON_CreateObject();
+    cJSON_AddBoolToObject(status, "bme690_available", bme690 != NULL);
+    cJSON_AddBoolToObject(status, "bmv080_available", bmv080 != NULL);
+    cJSON_AddItemToObject(json, "status", status);
+    return json;
+}
+#endif
+
+// Small deterministic PRNG so runs are reproducible across hosts
+static uint32_t rng_state = 1;
+
+static float rng_range(float min, float max) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return min + (max - min) * ((rng_state >> 8) / 16777216.0f);
+}
+
+static void generate(bme690_data_t *bme690, bmv080_data_t *bmv080, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        bme690[i] = (bme690_data_t){
+            .temperature = rng_range(-40.0f, 85.0f),
+            .pressure = rng_range(30000.0f, 110000.0f),
+            .humidity = rng_range(0.0f, 100.0f),
+            .iaq = rng_range(0.0f, 500.0f),
+            .iaq_accuracy = (uint8_t)(i % 4),
+            .co2_equivalent = rng_range(400.0f, 10000.0f),
+            .breath_voc_equivalent = rng_range(0.0f, 1000.0f),
+            .static_iaq = rng_range(0.0f, 500.0f),
+            .gas_percentage = rng_range(0.0f, 100.0f),
+            .stabilization_status = i & 1,
+            .run_in_status = i & 2,
+            .timestamp = (uint32_t)(i * 3000u + rng_state),
+        };
+        bmv080[i] = (bmv080_data_t){
+            .pm10 = rng_range(0.0f, 1000.0f),
+            .pm25 = rng_range(0.0f, 1000.0f),
+            .pm1 = rng_range(0.0f, 1000.0f),
+            .is_obstructed = i & 1,
+            .is_outside_range = i & 2,
+            .runtime = rng_range(0.0f, 1e6f),
+            .timestamp = (uint32_t)(i * 30000u),
+        };
+    }
+}
+
+// Documents with known text and the writer's error handling
+static void verify_known(void) {
+    static sink_t sink;
+    char chunk[64];
+    json_writer_t writer;
+
+    const bme690_data_t bme690 = {
+        .temperature = 21.5f,
+        .pressure = 101325.0f,
+        .humidity = 45.25f,
+        .iaq = 50.0f,
+        .iaq_accuracy = 3,
+        .co2_equivalent = 600.5f,
+        .breath_voc_equivalent = 0.5f,
+        .static_iaq = 48.75f,
+        .gas_percentage = 12.5f,
+        .stabilization_status = true,
+        .timestamp = 120000,
+    };
+    const bmv080_data_t bmv080 = {
+        .pm1 = 1.5f,
+        .pm25 = 2.25f,
+        .pm10 = 3.0f,
+        .is_outside_range = true,
+        .runtime = 3600.5f,
+        .timestamp = 117000,
+    };
+
+    write_data(&sink, 16, &bme690, &bmv080);
+    expect("/data document", sink.doc,
+        "{\"timestamp\":123456789,\"device_id\":\"a1b2c3\","
+        "\"bme690\":{\"temperature\":21.5,\"humidity\":45.25,\"pressure\":101325,\"iaq\":50,\"iaq_accuracy\":3,"
+        "\"co2_equivalent\":600.5,\"breath_voc_equivalent\":0.5,\"static_iaq\":48.75,\"gas_percentage\":12.5,"
+        "\"stabilization_status\":true,\"run_in_status\":false,\"data_timestamp\":120000},"
+        "\"bmv080\":{\"pm1\":1.5,\"pm25\":2.25,\"pm10\":3,\"is_obstructed\":false,\"is_outside_range\":true,\"runtime\":3600.5,"
+        "\"data_timestamp\":117000},"
+        "\"status\":{\"bme690_available\":true,\"bmv080_available\":true}}");
+
+    write_data(&sink, 16, NULL, NULL);
+    expect("/data document without samples", sink.doc,
+        "{\"timestamp\":123456789,\"device_id\":\"a1b2c3\",\"bme690\":null,\"bmv080\":null,"
+        "\"status\":{\"bme690_available\":false,\"bmv080_available\":false}}");
+
+    // Escapes and numbers in cJSON's format
+    sink.len = 0;
+    json_writer_init(&writer, chunk, 7, sink_flush, &sink);
+    json_writer_array_begin(&writer, NULL);
+    json_writer_string(&writer, NULL, "a\"b\\c\n\t\x01/\xc3\xa9");
+    json_writer_string(&writer, NULL, NULL);
+    json_writer_number(&writer, NULL, 0.1);
+    json_writer_number(&writer, NULL, 1.0 / 3);
+    json_writer_number(&writer, NULL, -0.0);
+    json_writer_number(&writer, NULL, 1e300);
+    json_writer_number(&writer, NULL, 3e9);
+    json_writer_number(&writer, NULL, -2147483648.0);
+    json_writer_number(&writer, NULL, NAN);
+    json_writer_fixed(&writer, NULL, 21.456, 2);
+    json_writer_fixed(&writer, NULL, -0.25, 1);
+    json_writer_fixed(&writer, NULL, 101325.0, 0);
+    json_writer_fixed(&writer, NULL, INFINITY, 2);
+    json_writer_object_begin(&writer, NULL);
+    json_writer_array_begin(&writer, "empty");
+    json_writer_array_end(&writer);
+    json_writer_object_end(&writer);
+    json_writer_array_end(&writer);
+    if (!json_writer_finish(&writer)) {
+        printf("FAIL: writer reported an error for a valid document\n");
+        failed = true;
+    }
+    expect("escapes and numbers", sink.doc,
+        "[\"a\\\"b\\\\c\\n\\t\\u0001/\xc3\xa9\",null,0.1,0.33333333333333331,0,1e+300,3000000000,-2147483648,null,21.46,-0.2,101325,null,{\"empty\":[]}]");
+
+    // Errors stick and stop the output
+    sink.len = 0;
+    json_writer_init(&writer, chunk, sizeof(chunk), sink_flush, &sink);
+    for (int i = 0; i < JSON_WRITER_MAX_DEPTH; i++) {
+        json_writer_array_begin(&writer, NULL);
+    }
+    if (json_writer_finish(&writer)) {
+        printf("FAIL: nesting beyond JSON_WRITER_MAX_DEPTH accepted\n");
+        failed = true;
+    }
+
+    json_writer_init(&writer, chunk, sizeof(chunk), sink_flush, &sink);
+    json_writer_object_begin(&writer, NULL);
+    if (json_writer_finish(&writer)) {
+        printf("FAIL: unclosed object accepted\n");
+        failed = true;
+    }
+
+    sink.len = 0;
+    sink.chunks = 0;
+    sink.fail_after = 2;
+    bool complete = write_data(&sink, 8, &bme690, &bmv080);
+    if (complete || sink.chunks != 2) {
+        printf("FAIL: failed flush not reported or output continued (%u chunks)\n", sink.chunks);
+        failed = true;
+    }
+    sink.fail_after = 0;
+
+    // Without flush callback, as the /data snapshot is kept: exactly the streamed document, or an error if it does not fit
+    write_data(&sink, 16, &bme690, &bmv080);
+    static char snapshot[DOC_MAX];
+    for (size_t size = sink.len - 1; size <= sink.len; size++) {
+        memset(snapshot, 0, sizeof(snapshot));
+        json_writer_init(&writer, snapshot, size, NULL, NULL);
+        sensor_json_write_data(&writer, "a1b2c3", 123456789, &bme690, &bmv080);
+        bool complete = json_writer_finish(&writer);
+        if (size < sink.len && complete) {
+            printf("FAIL: document of %zu bytes accepted in a %zu byte buffer\n", sink.len, size);
+            failed = true;
+        } else if (size == sink.len && (!complete || writer.len != sink.len || memcmp(snapshot, sink.doc, sink.len) != 0)) {
+            printf("FAIL: document kept in the buffer differs from the streamed one\n");
+            failed = true;
+        }
+    }
+}
+
+// Output must not depend on the buffer size
+static void verify_chunking(const bme690_data_t *bme690, const bmv080_data_t *bmv080, size_t count) {
+    static sink_t whole, chunked;
+    unsigned mismatches = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        write_data(&whole, DOC_MAX, &bme690[i], &bmv080[i]);
+        for (size_t size = 1; size <= 64; size++) {
+            bool complete = write_data(&chunked, size, &bme690[i], i % 3 ? &bmv080[i] : NULL);
+            if (i % 3 == 0) {
+                continue;
+            }
+            if (!complete || strcmp(whole.doc, chunked.doc) != 0) {
+                if (mismatches++ < 5) {
+                    printf("FAIL: document %zu differs with %zu byte chunks\n", i, size);
+                }
+            }
+        }
+
+#ifdef POLVERINE_HOST_CJSON
+        cJSON *tree = reference_tree("a1b2c3", 123456789, &bme690[i], &bmv080[i]);
+        char *reference = cJSON_PrintUnformatted(tree);
+        if (reference == NULL || strcmp(reference, whole.doc) != 0) {
+            if (mismatches++ < 5) {
+                printf("FAIL: document %zu differs from cJSON\n  cJSON:  %s\n  writer: %s\n", i, reference ? reference : "(null)",
+                    whole.doc);
+            }
+        }
+        free(reference);
+        cJSON_Delete(tree);
+#endif
+    }
+
+    if (mismatches > 0) {
+        failed = true;
+    }
+}
+
+static void bench(const bme690_data_t *bme690, const bmv080_data_t *bmv080, size_t count, unsigned iterations) {
+    static sink_t sink;
+    size_t bytes = 0;
+    unsigned chunks = 0;
+
+    unsigned long before = allocations;
+    int64_t start = esp_timer_get_time();
+    for (unsigned it = 0; it < iterations; it++) {
+        for (size_t i = 0; i < count; i++) {
+            write_data(&sink, BENCH_CHUNK, &bme690[i], &bmv080[i]);
+            bytes += sink.len;
+            chunks += sink.chunks;
+        }
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    unsigned long writer_allocations = allocations - before;
+    double docs = (double)iterations * count;
+
+    printf("%-28s %8.2f us/doc %6.0f B/doc %4.1f chunks/doc %6.2f allocations/doc\n", "streaming writer", elapsed / docs, bytes / docs,
+        chunks / docs, writer_allocations / docs);
+    if (writer_allocations != 0) {
+        printf("FAIL: the streaming writer allocated %lu times\n", writer_allocations);
+        failed = true;
+    }
+
+#ifdef POLVERINE_HOST_CJSON
+    cJSON_Hooks hooks = {.malloc_fn = cjson_malloc, .free_fn = free};
+    cJSON_InitHooks(&hooks);
+    bytes = 0;
+    before = allocations;
+    cjson_allocations = 0;
+    start = esp_timer_get_time();
+    for (unsigned it = 0; it < iterations; it++) {
+        for (size_t i = 0; i < count; i++) {
+            cJSON *tree = reference_tree("a1b2c3", 123456789, &bme690[i], &bmv080[i]);
+            char *doc = cJSON_Print(tree);
+            bytes += strlen(doc);
+            free(doc);
+            cJSON_Delete(tree);
+        }
+    }
+    elapsed = esp_timer_get_time() - start;
+    cJSON_InitHooks(NULL);
+    printf("%-28s %8.2f us/doc %6.0f B/doc %4.1f chunks/doc %6.2f allocations/doc\n", "cJSON tree + cJSON_Print", elapsed / docs,
+        bytes / docs, 1.0, (cjson_allocations + allocations - before) / docs);
+#else
+    printf("libcjson not found, cJSON comparison skipped\n");
+#endif
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"iterations", required_argument, NULL, 'i'},
+        {"seed", required_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0},
+    };
+
+    unsigned iterations = 100;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'i':
+            iterations = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            rng_state = (uint32_t)strtoul(optarg, NULL, 10);
+            if (rng_state == 0) {
+                rng_state = 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [--iterations N] [--seed N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    static bme690_data_t bme690[BENCH_SAMPLES];
+    static bmv080_data_t bmv080[BENCH_SAMPLES];
+    generate(bme690, bmv080, BENCH_SAMPLES);
+
+    verify_known();
+    verify_chunking(bme690, bmv080, BENCH_SAMPLES);
+    bench(bme690, bmv080, BENCH_SAMPLES, iterations);
+
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
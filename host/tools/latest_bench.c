@@ -0,0 +1,321 @@
+/**
+ * @file latest_bench.c
+ * @brief Checks the latest value cell for torn reads and compares its cost with a mutex
+ *
+ * A writer thread stores values as fast as it can while reader threads load
+ * them. Every word of the n-th value holds n, so a reader sees a torn copy as
+ * words that differ or that do not match the returned version; versions
+ * must also never go backwards for one reader. Copies only race on a host
+ * with more cores than threads, on a single core readers are rarely
+ * preempted in the middle of one. Also checks loads from an empty cell,
+ * values whose size is not a multiple of a word, and that a load returns the
+ * previous value at once while a write is stuck half way, as with a writer
+ * preempted by the reading task.
+ *
+ * The same run is repeated with a pthread mutex around the copy, counting
+ * the stores that had to wait for a reader holding it, which the cell's
+ * writer never does. The cost of a store and a load of both is timed on a
+ * single thread, as with readers racing for the same cores the time is
+ * mostly scheduling.
+ *
+ * Usage:
+ *   latest_bench [--readers N] [--writes N] [--size BYTES]
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sensor_latest.h"
+
+#define CHECK(cond, ...)                                                                                                                   \
+    do {                                                                                                                                   \
+        if (!(cond)) {                                                                                                                     \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);                                                                                    \
+            printf(__VA_ARGS__);                                                                                                           \
+            printf("\n");                                                                                                                  \
+            failed = true;                                                                                                                 \
+        }                                                                                                                                  \
+    } while (0)
+
+#define MAX_READERS 8
+
+static bool failed = false;
+static volatile uint32_t sink; // Keeps the timed loads from being optimized out
+
+typedef enum {
+    MODE_SEQLOCK,
+    MODE_MUTEX,
+} bench_mode_t;
+
+typedef struct {
+    bench_mode_t mode;
+    size_t size;
+    unsigned writes;
+    sensor_latest_t cell;
+    pthread_mutex_t mutex;
+    uint32_t locked_value[SENSOR_LATEST_WORDS];
+    uint32_t locked_version;
+    atomic_bool done;
+    unsigned blocked; // Stores that found the mutex held by a reader
+} bench_t;
+
+typedef struct {
+    bench_t *bench;
+    uint64_t loads;
+    uint64_t torn;
+    uint64_t backwards;
+} reader_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void fill(uint32_t *words, size_t size, uint32_t n) {
+    for (size_t w = 0; w < (size + 3) / 4; w++) {
+        words[w] = n;
+    }
+}
+
+static void *writer_main(void *arg) {
+    bench_t *bench = arg;
+    uint32_t value[SENSOR_LATEST_WORDS];
+
+    for (uint32_t n = 1; n <= bench->writes; n++) {
+        fill(value, bench->size, n);
+        if (bench->mode == MODE_SEQLOCK) {
+            sensor_latest_store(&bench->cell, value, bench->size);
+        } else {
+            if (pthread_mutex_trylock(&bench->mutex) != 0) {
+                bench->blocked++;
+                pthread_mutex_lock(&bench->mutex);
+            }
+            memcpy(bench->locked_value, value, bench->size);
+            bench->locked_version = n;
+            pthread_mutex_unlock(&bench->mutex);
+        }
+    }
+
+    atomic_store(&bench->done, true);
+    return NULL;
+}
+
+static void *reader_main(void *arg) {
+    reader_t *reader = arg;
+    bench_t *bench = reader->bench;
+    uint32_t value[SENSOR_LATEST_WORDS];
+    uint32_t last = 0;
+
+    while (!atomic_load(&bench->done)) {
+        uint32_t version;
+        if (bench->mode == MODE_SEQLOCK) {
+            version = sensor_latest_load(&bench->cell, value, bench->size);
+        } else {
+            pthread_mutex_lock(&bench->mutex);
+            memcpy(value, bench->locked_value, bench->size);
+            version = bench->locked_version;
+            pthread_mutex_unlock(&bench->mutex);
+        }
+        reader->loads++;
+
+        if (version < last) {
+            reader->backwards++;
+        }
+        last = version;
+        for (size_t w = 0; version > 0 && w < bench->size / 4; w++) {
+            if (value[w] != version) {
+                reader->torn++;
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void run(bench_mode_t mode, int readers, unsigned writes, size_t size) {
+    static bench_t bench;
+    memset(&bench, 0, sizeof(bench));
+    bench.mode = mode;
+    bench.size = size;
+    bench.writes = writes;
+    pthread_mutex_init(&bench.mutex, NULL);
+
+    reader_t reader[MAX_READERS] = {0};
+    pthread_t threads[MAX_READERS];
+    for (int i = 0; i < readers; i++) {
+        reader[i].bench = &bench;
+        pthread_create(&threads[i], NULL, reader_main, &reader[i]);
+    }
+    pthread_t writer;
+    pthread_create(&writer, NULL, writer_main, &bench);
+
+    pthread_join(writer, NULL);
+    uint64_t loads = 0;
+    uint64_t torn = 0;
+    uint64_t backwards = 0;
+    for (int i = 0; i < readers; i++) {
+        pthread_join(threads[i], NULL);
+        loads += reader[i].loads;
+        torn += reader[i].torn;
+        backwards += reader[i].backwards;
+    }
+    pthread_mutex_destroy(&bench.mutex);
+
+    const char *name = mode == MODE_SEQLOCK ? "seqlock" : "mutex";
+    printf("%-8s %llu loads", name, (unsigned long long)loads);
+    if (mode == MODE_SEQLOCK) {
+        unsigned retries = atomic_load(&bench.cell.retries);
+        printf(", %u loads retried (%.3f%%)", retries, loads ? 100.0 * retries / loads : 0.0);
+    } else {
+        printf(", %u stores waited for a reader", bench.blocked);
+    }
+    printf("\n");
+
+    CHECK(torn == 0, "%s: %llu torn reads", name, (unsigned long long)torn);
+    CHECK(backwards == 0, "%s: %llu reads went back to an older version", name, (unsigned long long)backwards);
+    if (mode == MODE_SEQLOCK) {
+        CHECK(sensor_latest_version(&bench.cell) == writes, "%s: version %u after %u writes", name,
+            (unsigned)sensor_latest_version(&bench.cell), writes);
+    }
+}
+
+// Uncontended cost of a store and a load
+static void measure_cost(bench_mode_t mode, size_t size) {
+    enum { ROUNDS = 1000000 };
+    static bench_t bench;
+    memset(&bench, 0, sizeof(bench));
+    pthread_mutex_init(&bench.mutex, NULL);
+    uint32_t value[SENSOR_LATEST_WORDS];
+    fill(value, size, 1);
+
+    uint64_t start = now_ns();
+    for (uint32_t n = 1; n <= ROUNDS; n++) {
+        value[0] = n;
+        if (mode == MODE_SEQLOCK) {
+            sensor_latest_store(&bench.cell, value, size);
+        } else {
+            pthread_mutex_lock(&bench.mutex);
+            memcpy(bench.locked_value, value, size);
+            bench.locked_version = n;
+            pthread_mutex_unlock(&bench.mutex);
+        }
+    }
+    uint64_t store_ns = now_ns() - start;
+
+    uint32_t sum = 0;
+    start = now_ns();
+    for (uint32_t n = 1; n <= ROUNDS; n++) {
+        if (mode == MODE_SEQLOCK) {
+            sum += sensor_latest_load(&bench.cell, value, size);
+        } else {
+            pthread_mutex_lock(&bench.mutex);
+            memcpy(value, bench.locked_value, size);
+            sum += bench.locked_version;
+            pthread_mutex_unlock(&bench.mutex);
+        }
+        sum += value[0];
+    }
+    uint64_t load_ns = now_ns() - start;
+    pthread_mutex_destroy(&bench.mutex);
+
+    sink = sum;
+
+    printf("%-8s %6.1f ns/store, %6.1f ns/load\n", mode == MODE_SEQLOCK ? "seqlock" : "mutex", (double)store_ns / ROUNDS,
+        (double)load_ns / ROUNDS);
+}
+
+static void verify_basics(void) {
+    static sensor_latest_t cell;
+    uint8_t value[SENSOR_LATEST_MAX_SIZE];
+
+    CHECK(sensor_latest_version(&cell) == 0, "zero initialized cell not empty");
+    CHECK(sensor_latest_load(&cell, value, sizeof(value)) == 0, "load from an empty cell");
+
+    // Sizes that are not a multiple of a word leave the rest of the destination alone
+    uint8_t stored[45];
+    for (size_t i = 0; i < sizeof(stored); i++) {
+        stored[i] = (uint8_t)(i + 1);
+    }
+    sensor_latest_store(&cell, stored, sizeof(stored));
+    memset(value, 0xEE, sizeof(value));
+    CHECK(sensor_latest_load(&cell, value, sizeof(stored)) == 1, "first version not 1");
+    CHECK(memcmp(value, stored, sizeof(stored)) == 0, "odd sized value changed");
+    CHECK(value[sizeof(stored)] == 0xEE, "load wrote past the value");
+
+    stored[0] = 0xAA;
+    sensor_latest_store(&cell, stored, sizeof(stored));
+    CHECK(sensor_latest_load(&cell, value, sizeof(stored)) == 2 && value[0] == 0xAA, "second value not loaded");
+
+    // A writer stuck half way through the third value, the second stays readable
+    atomic_store(&cell.sequence, 2 * 2 + 1);
+    atomic_store(&cell.buffers[3 & 1][0], 0xDEADBEEF);
+    CHECK(sensor_latest_load(&cell, value, sizeof(stored)) == 2 && value[0] == 0xAA, "load waited for or read the write in progress");
+    CHECK(sensor_latest_version(&cell) == 2, "write in progress counted as a version");
+    CHECK(atomic_load(&cell.retries) == 0, "retries without a conflicting write");
+
+    sensor_latest_init(&cell);
+    CHECK(sensor_latest_load(&cell, value, sizeof(stored)) == 0, "cell not empty after init");
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [--readers N] [--writes N] [--size BYTES]\n"
+        "  --readers N     reader threads, at most %d (default 3)\n"
+        "  --writes N      values stored per run (default 1000000)\n"
+        "  --size BYTES    value size, at most %d (default 48, a BME690 reading)\n",
+        argv0, MAX_READERS, SENSOR_LATEST_MAX_SIZE);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"readers", required_argument, NULL, 'r'},
+        {"writes", required_argument, NULL, 'w'},
+        {"size", required_argument, NULL, 's'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int readers = 3;
+    unsigned writes = 1000000;
+    size_t size = 48;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'r':
+            readers = atoi(optarg);
+            break;
+        case 'w':
+            writes = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            size = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (readers < 1 || readers > MAX_READERS || writes == 0 || size < 4 || size > SENSOR_LATEST_MAX_SIZE) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    verify_basics();
+
+    printf("%d readers, %u writes of %zu bytes\n", readers, writes, size);
+    run(MODE_SEQLOCK, readers, writes, size);
+    run(MODE_MUTEX, readers, writes, size);
+    measure_cost(MODE_SEQLOCK, size);
+    measure_cost(MODE_MUTEX, size);
+
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
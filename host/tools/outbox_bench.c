@@ -0,0 +1,311 @@
+/**
+ * @file outbox_bench.c
+ * @brief Checks the MQTT outbox on simulated flash and measures its flash wear
+ *
+ * Runs the outbox against the simulated "spiffs" partition of the host shim:
+ * an outage followed by a batched replay, a reboot in the middle of a replay,
+ * a write torn by a power loss, many short outages and an outage longer than
+ * the log holds. Every replayed record is compared with the sample that was
+ * appended. For the outage scenarios the bytes programmed and erased are
+ * reported relative to the raw sample bytes (write amplification) and to the
+ * JSON payloads the samples would have been published as.
+ *
+ * Usage:
+ *   outbox_bench [--hours N]
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_partition.h"
+
+#include "mqtt_outbox.h"
+#include "mqtt_payload.h"
+#include "polverine_cfg.h"
+
+#define REPLAY_BATCH 20
+
+static bool failed = false;
+
+#define CHECK(cond, ...)                                                                                                                   \
+    do {                                                                                                                                   \
+        if (!(cond)) {                                                                                                                     \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);                                                                                    \
+            printf(__VA_ARGS__);                                                                                                           \
+            printf("\n");                                                                                                                  \
+            failed = true;                                                                                                                 \
+        }                                                                                                                                  \
+    } while (0)
+
+static mqtt_outbox_record_t *samples = NULL;
+static size_t sample_count = 0;
+
+// Samples as the MQTT handlers see them: BME690 at 1 Hz plus one BMV080 sample per duty cycle
+static void generate_samples(size_t count) {
+    samples = calloc(count, sizeof(*samples));
+    sample_count = count;
+    uint32_t bmv080_period_s = PLVN_CFG_BMV080_DUTY_CYCLE_PERIOD_S;
+
+    for (size_t i = 0, t = 0; i < count; t++) {
+        float phase = (float)(2.0 * M_PI * t / 86400.0);
+        bme690_data_t bme690 = {
+            .temperature = 22.0f + 2.0f * sinf(phase) + (t % 7) * 0.01f,
+            .pressure = 96500.0f + 150.0f * sinf(phase / 3.0f),
+            .humidity = 45.0f - 5.0f * sinf(phase),
+            .iaq = 60.0f + 30.0f * fabsf(sinf(phase * 4.0f)),
+            .iaq_accuracy = 3,
+            .co2_equivalent = 550.0f + 200.0f * fabsf(sinf(phase * 4.0f)),
+            .breath_voc_equivalent = 0.6f + 0.4f * fabsf(sinf(phase * 4.0f)),
+            .static_iaq = 55.0f + 25.0f * fabsf(sinf(phase * 4.0f)),
+            .gas_percentage = 40.0f + 20.0f * sinf(phase * 2.0f),
+            .stabilization_status = true,
+            .run_in_status = true,
+            .timestamp = (uint32_t)(t * 1000),
+        };
+        samples[i] = (mqtt_outbox_record_t){.type = SENSOR_TYPE_BME690, .len = sizeof(bme690)};
+        memcpy(samples[i].data, &bme690, sizeof(bme690));
+        i++;
+
+        if (i < count && t % bmv080_period_s == bmv080_period_s - 1) {
+            float pm = 8.0f + 6.0f * fabsf(sinf(phase * 3.0f));
+            bmv080_data_t bmv080 = {
+                .pm10 = pm * 1.6f,
+                .pm25 = pm,
+                .pm1 = pm * 0.7f,
+                .runtime = (float)t,
+                .timestamp = (uint32_t)(t * 1000),
+            };
+            samples[i] = (mqtt_outbox_record_t){.type = SENSOR_TYPE_BMV080, .len = sizeof(bmv080)};
+            memcpy(samples[i].data, &bmv080, sizeof(bmv080));
+            i++;
+        }
+    }
+}
+
+static bool same_record(const mqtt_outbox_record_t *a, const mqtt_outbox_record_t *b) {
+    return a->type == b->type && a->flags == b->flags && a->len == b->len && memcmp(a->data, b->data, a->len) == 0;
+}
+
+static size_t json_size(const mqtt_outbox_record_t *record) {
+    char payload[320];
+    if (record->type == SENSOR_TYPE_BME690) {
+        return mqtt_payload_bme690(payload, sizeof(payload), (const bme690_data_t *)record->data, false);
+    }
+    return mqtt_payload_bmv080(payload, sizeof(payload), (const bmv080_data_t *)record->data);
+}
+
+static void append_range(size_t first, size_t count) {
+    for (size_t i = first; i < first + count; i++) {
+        CHECK(mqtt_outbox_append(samples[i].type, samples[i].flags, samples[i].data, samples[i].len), "append %zu", i);
+    }
+}
+
+/**
+ * Replay up to limit records in batches, committing after each batch like
+ * the firmware does after handing a batch to the MQTT client. Records must
+ * continue the sample sequence at *next.
+ */
+static size_t replay(size_t *next, size_t limit) {
+    size_t replayed = 0;
+    mqtt_outbox_record_t record;
+
+    while (replayed < limit) {
+        mqtt_outbox_cursor_t cursor = mqtt_outbox_begin();
+        size_t batch = 0;
+        while (batch < REPLAY_BATCH && replayed + batch < limit && mqtt_outbox_read(&cursor, &record)) {
+            CHECK(*next < sample_count && same_record(&record, &samples[*next]), "replayed record %zu differs", *next);
+            (*next)++;
+            batch++;
+        }
+        if (batch == 0) {
+            break;
+        }
+        mqtt_outbox_commit(&cursor);
+        replayed += batch;
+    }
+    return replayed;
+}
+
+// Find the sample a remounted log resumes at
+static size_t resume_index(void) {
+    mqtt_outbox_cursor_t cursor = mqtt_outbox_begin();
+    mqtt_outbox_record_t record;
+    if (!mqtt_outbox_read(&cursor, &record)) {
+        return sample_count;
+    }
+    for (size_t i = 0; i < sample_count; i++) {
+        if (same_record(&record, &samples[i])) {
+            return i;
+        }
+    }
+    return sample_count;
+}
+
+static void report_wear(const char *name, size_t first, size_t count, const shim_partition_stats_t *flash) {
+    uint64_t sample_bytes = 0;
+    uint64_t json_bytes = 0;
+    for (size_t i = first; i < first + count; i++) {
+        sample_bytes += samples[i].len;
+        json_bytes += json_size(&samples[i]);
+    }
+
+    printf("%-16s %7zu samples %9" PRIu64 " B raw %9" PRIu64 " B json | programmed %9" PRIu64 " B (%.2fx raw, %.2fx json) "
+           "erased %9" PRIu64 " B (%.2fx raw) in %" PRIu64 " erases, %" PRIu64 " writes\n",
+        name, count, sample_bytes, json_bytes, flash->write_bytes, (double)flash->write_bytes / sample_bytes,
+        (double)flash->write_bytes / json_bytes, flash->erase_bytes, (double)flash->erase_bytes / sample_bytes, flash->erase_ops,
+        flash->write_ops);
+}
+
+static void scenario_outage(size_t count) {
+    shim_partition_stats_t flash;
+    CHECK(mqtt_outbox_init(), "init");
+    shim_partition_reset_stats();
+
+    append_range(0, count);
+    shim_partition_get_stats(&flash);
+    report_wear("outage", 0, count, &flash);
+    CHECK(mqtt_outbox_pending() == count, "pending %lu, expected %zu", (unsigned long)mqtt_outbox_pending(), count);
+
+    shim_partition_reset_stats();
+    size_t next = 0;
+    CHECK(replay(&next, SIZE_MAX) == count, "replayed %zu of %zu", next, count);
+    CHECK(mqtt_outbox_pending() == 0, "pending after replay %lu", (unsigned long)mqtt_outbox_pending());
+    shim_partition_get_stats(&flash);
+    printf("%-16s %7zu samples replayed in batches of %d, %" PRIu64 " B programmed for consumed markers, %" PRIu64 " B read\n", "replay",
+        count, REPLAY_BATCH, flash.write_bytes, flash.read_bytes);
+    CHECK(flash.bit_conflicts == 0, "%" PRIu64 " writes needed an erase", flash.bit_conflicts);
+
+    // A replayed log stays replayed across a reboot
+    CHECK(mqtt_outbox_init(), "remount");
+    CHECK(mqtt_outbox_pending() == 0, "pending after remount %lu", (unsigned long)mqtt_outbox_pending());
+}
+
+static void scenario_reboot(void) {
+    const size_t count = 1000;
+    const size_t before_reboot = 300;
+
+    CHECK(mqtt_outbox_init(), "init");
+    append_range(0, count);
+    size_t next = 0;
+    replay(&next, before_reboot);
+
+    // The committed position within a sector is not persisted, so a reboot may replay part of a sector again
+    CHECK(mqtt_outbox_init(), "remount");
+    size_t resume = resume_index();
+    CHECK(resume <= before_reboot, "resumed at %zu after committing %zu", resume, before_reboot);
+    CHECK(mqtt_outbox_pending() == count - resume, "pending %lu, expected %zu", (unsigned long)mqtt_outbox_pending(), count - resume);
+
+    next = resume;
+    replay(&next, SIZE_MAX);
+    CHECK(next == count, "replay ended at %zu", next);
+    printf("%-16s resumed at record %zu after %zu were committed, %zu replayed twice\n", "reboot", resume, before_reboot,
+        before_reboot - resume);
+
+    CHECK(mqtt_outbox_init(), "remount");
+    CHECK(mqtt_outbox_pending() == 0, "pending after replay %lu", (unsigned long)mqtt_outbox_pending());
+}
+
+static void scenario_torn_write(void) {
+    CHECK(mqtt_outbox_init(), "init");
+    append_range(0, 100);
+
+    shim_partition_tear_next_write(6);
+    CHECK(!mqtt_outbox_append(samples[100].type, samples[100].flags, samples[100].data, samples[100].len), "torn append succeeded");
+
+    // Power comes back: the torn record is ignored and new records go to the next sector
+    CHECK(mqtt_outbox_init(), "remount");
+    CHECK(mqtt_outbox_pending() == 100, "pending %lu, expected 100", (unsigned long)mqtt_outbox_pending());
+    append_range(100, 50);
+
+    size_t next = 0;
+    replay(&next, SIZE_MAX);
+    CHECK(next == 150, "replay ended at %zu", next);
+
+    mqtt_outbox_stats_t stats;
+    mqtt_outbox_get_stats(&stats);
+    CHECK(stats.pending == 0, "pending after replay %lu", (unsigned long)stats.pending);
+    printf("%-16s %zu records intact after a torn write, %lu corrupt skipped\n", "torn write", next, (unsigned long)stats.corrupt);
+}
+
+static void scenario_short_outages(void) {
+    const size_t outages = 50;
+    const size_t per_outage = 10;
+    shim_partition_stats_t flash;
+
+    CHECK(mqtt_outbox_init(), "init");
+    shim_partition_reset_stats();
+    for (size_t i = 0; i < outages; i++) {
+        append_range(i * per_outage, per_outage);
+        size_t next = i * per_outage;
+        replay(&next, SIZE_MAX);
+        CHECK(next == (i + 1) * per_outage, "outage %zu replay ended at %zu", i, next);
+    }
+    shim_partition_get_stats(&flash);
+    report_wear("short outages", 0, outages * per_outage, &flash);
+}
+
+static void scenario_overflow(void) {
+    CHECK(mqtt_outbox_init(), "init");
+    append_range(0, sample_count);
+
+    mqtt_outbox_stats_t stats;
+    mqtt_outbox_get_stats(&stats);
+    CHECK(stats.dropped > 0, "log did not overflow");
+    CHECK(stats.pending + stats.dropped == sample_count, "pending %lu + dropped %lu != %zu", (unsigned long)stats.pending,
+        (unsigned long)stats.dropped, sample_count);
+
+    // The newest records survive, in order
+    size_t next = stats.dropped;
+    replay(&next, SIZE_MAX);
+    CHECK(next == sample_count, "replay ended at %zu", next);
+    printf("%-16s %lu of %zu records kept (%lu sectors of %lu B), oldest %lu dropped\n", "overflow", (unsigned long)stats.pending,
+        sample_count, (unsigned long)stats.sectors, (unsigned long)stats.sector_size, (unsigned long)stats.dropped);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [--hours N]\n"
+        "  --hours N   length of the simulated outage (default 1)\n",
+        argv0);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"hours", required_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    double hours = 1.0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            hours = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    // Enough samples to overflow the log, the outage uses the first ones
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, MQTT_OUTBOX_PARTITION);
+    size_t capacity = partition->size / (8 + sizeof(bmv080_data_t));
+    size_t outage = (size_t)(hours * 3600.0 * (1.0 + 1.0 / PLVN_CFG_BMV080_DUTY_CYCLE_PERIOD_S));
+    generate_samples(outage > capacity ? outage : capacity);
+
+    scenario_outage(outage < sample_count ? outage : sample_count);
+    scenario_reboot();
+    scenario_torn_write();
+    scenario_short_outages();
+    scenario_overflow();
+
+    free(samples);
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
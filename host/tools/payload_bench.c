@@ -0,0 +1,711 @@
+/**
+ * @file payload_bench.c
+ * @brief Compares the MQTT state payload encodings
+ *
+ * Formats the same pseudo-random samples once with the snprintf calls the
+ * firmware used before the template builders and once with
+ * mqtt_payload_bme690() / mqtt_payload_bmv080(), checks that both produce
+ * identical payloads and reports the cost per payload of each. The CBOR
+ * encoding is checked to decode back to the exact input, including on
+ * hand-made payloads with foreign keys and alternative number encodings, and
+ * its size and cost are reported next to JSON. Samples cover the sensors'
+ * full ranges including negative temperatures and exact rounding ties.
+ * The Home Assistant discovery payloads rendered from the descriptor table
+ * are checked against the former hand-written format and their hash for
+ * stability. The MQTT 5 topic alias table is checked to only send alias only
+ * messages once the alias is announced, and the PUBLISH packet size of a
+ * state message is compared between MQTT 3.1.1 and MQTT 5. Settings commands
+ * are checked to be applied completely or not at all, and their result payload
+ * against the expected JSON. The binary /ws telemetry frames are checked to
+ * decode back to the exact samples and against a hand-made frame pinning
+ * the byte layout. Windowed statistics are checked to report every sample of
+ * the window when fields are NaN in some or all of them.
+ *
+ * Usage:
+ *   payload_bench [--iterations N] [--seed N]
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_timer.h"
+
+#include "mqtt_alias.h"
+#include "mqtt_cbor.h"
+#include "mqtt_command.h"
+#include "mqtt_discovery.h"
+#include "mqtt_payload.h"
+#include "sensor_aggregate.h"
+#include "telemetry_frame.h"
+
+#define BENCH_SAMPLES 1024
+
+static int reference_bme690(char *buf, size_t size, const bme690_data_t *data, bool is_averaged) {
+    return snprintf(buf, size,
+        "{\"temperature\":%.2f,\"humidity\":%.2f,\"pressure\":%.2f,"
+        "\"iaq\":%.2f,\"co2\":%.2f,\"voc\":%.2f,"
+        "\"iaq_accuracy\":%u,\"static_iaq\":%.2f,\"gas_percentage\":%.2f,"
+        "\"stabilization_status\":\"%s\",\"run_in_status\":\"%s\","
+        "\"data_type\":\"%s\",\"timestamp\":%u}",
+        data->temperature, data->humidity, data->pressure, data->iaq, data->co2_equivalent, data->breath_voc_equivalent,
+        (unsigned)data->iaq_accuracy, data->static_iaq, data->gas_percentage, data->stabilization_status ? "true" : "false",
+        data->run_in_status ? "true" : "false", is_averaged ? "averaged" : "raw", (unsigned)data->timestamp);
+}
+
+static int reference_bmv080(char *buf, size_t size, const bmv080_data_t *data) {
+    return snprintf(buf, size,
+        "{\"pm10\":%.2f,\"pm25\":%.2f,\"pm1\":%.2f,"
+        "\"obstructed\":\"%s\",\"out_of_range\":\"%s\","
+        "\"runtime\":%.2f,\"timestamp\":%u}",
+        data->pm10, data->pm25, data->pm1, data->is_obstructed ? "true" : "false", data->is_outside_range ? "true" : "false", data->runtime,
+        (unsigned)data->timestamp);
+}
+
+// Small deterministic PRNG so runs are reproducible across hosts
+static uint32_t rng_state = 1;
+
+static float rng_range(float min, float max) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    float value = min + (max - min) * ((rng_state >> 8) / 16777216.0f);
+
+    // Every 8th value lands on a multiple of 1/8, which puts an exact tie at the second decimal
+    if ((rng_state & 7) == 0) {
+        value = (float)(int)(value * 8.0f) / 8.0f;
+    }
+    return value;
+}
+
+static void generate(bme690_data_t *bme690, bmv080_data_t *bmv080, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        bme690[i] = (bme690_data_t){
+            .temperature = rng_range(-40.0f, 85.0f),
+            .pressure = rng_range(30000.0f, 110000.0f),
+            .humidity = rng_range(0.0f, 100.0f),
+            .iaq = rng_range(0.0f, 500.0f),
+            .iaq_accuracy = (uint8_t)(i % 4),
+            .co2_equivalent = rng_range(400.0f, 10000.0f),
+            .breath_voc_equivalent = rng_range(0.0f, 1000.0f),
+            .static_iaq = rng_range(0.0f, 500.0f),
+            .gas_percentage = rng_range(0.0f, 100.0f),
+            .stabilization_status = i & 1,
+            .run_in_status = i & 2,
+            .timestamp = (uint32_t)(i * 3000u + rng_state),
+        };
+        bmv080[i] = (bmv080_data_t){
+            .pm10 = rng_range(0.0f, 1000.0f),
+            .pm25 = rng_range(0.0f, 1000.0f),
+            .pm1 = rng_range(0.0f, 1000.0f),
+            .is_obstructed = i & 1,
+            .is_outside_range = i & 2,
+            .runtime = rng_range(0.0f, 1e6f),
+            .timestamp = (uint32_t)(i * 30000u),
+        };
+    }
+}
+
+static bool verify(const bme690_data_t *bme690, const bmv080_data_t *bmv080, size_t count) {
+    char expected[512];
+    char actual[512];
+    unsigned mismatches = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        bool averaged = i & 4;
+        int n1 = reference_bme690(expected, sizeof(expected), &bme690[i], averaged);
+        int n2 = mqtt_payload_bme690(actual, sizeof(actual), &bme690[i], averaged);
+        if (n1 != n2 || strcmp(expected, actual) != 0) {
+            if (mismatches++ < 5) {
+                fprintf(stderr, "bme690 mismatch:\n  snprintf: %s\n  template: %s\n", expected, actual);
+            }
+        }
+
+        n1 = reference_bmv080(expected, sizeof(expected), &bmv080[i]);
+        n2 = mqtt_payload_bmv080(actual, sizeof(actual), &bmv080[i]);
+        if (n1 != n2 || strcmp(expected, actual) != 0) {
+            if (mismatches++ < 5) {
+                fprintf(stderr, "bmv080 mismatch:\n  snprintf: %s\n  template: %s\n", expected, actual);
+            }
+        }
+    }
+
+    // Truncation must follow snprintf: the full length returned, the prefix that fits written.
+    // The prefix is cut from the full payload, a truncating snprintf() call trips -Wformat-truncation.
+    int full = reference_bme690(expected, sizeof(expected), &bme690[0], false);
+    for (size_t size = 0; size < 64; size++) {
+        int n2 = mqtt_payload_bme690(actual, size, &bme690[0], false);
+        if (n2 != full || (size > 0 && (strlen(actual) != size - 1 || memcmp(actual, expected, size - 1) != 0))) {
+            if (mismatches++ < 5) {
+                fprintf(stderr, "truncation mismatch at size %zu\n", size);
+            }
+        }
+    }
+
+    if (mismatches > 0) {
+        fprintf(stderr, "%u payload mismatches\n", mismatches);
+    }
+    return mismatches == 0;
+}
+
+static bool bme690_equal(const bme690_data_t *a, const bme690_data_t *b) {
+    return a->temperature == b->temperature && a->pressure == b->pressure && a->humidity == b->humidity && a->iaq == b->iaq &&
+           a->iaq_accuracy == b->iaq_accuracy && a->co2_equivalent == b->co2_equivalent &&
+           a->breath_voc_equivalent == b->breath_voc_equivalent && a->static_iaq == b->static_iaq &&
+           a->gas_percentage == b->gas_percentage && a->stabilization_status == b->stabilization_status &&
+           a->run_in_status == b->run_in_status && a->timestamp == b->timestamp;
+}
+
+static bool bmv080_equal(const bmv080_data_t *a, const bmv080_data_t *b) {
+    return a->pm10 == b->pm10 && a->pm25 == b->pm25 && a->pm1 == b->pm1 && a->is_obstructed == b->is_obstructed &&
+           a->is_outside_range == b->is_outside_range && a->runtime == b->runtime && a->timestamp == b->timestamp;
+}
+
+static bool verify_cbor(const bme690_data_t *bme690, const bmv080_data_t *bmv080, size_t count) {
+    uint8_t payload[MQTT_CBOR_BME690_MAX];
+    unsigned failures = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        bool averaged = i & 4;
+        bme690_data_t bme690_out;
+        bool averaged_out;
+        int n = mqtt_cbor_bme690(payload, sizeof(payload), &bme690[i], averaged);
+        if (n <= 0 || !mqtt_cbor_decode_bme690(payload, n, &bme690_out, &averaged_out) || !bme690_equal(&bme690[i], &bme690_out) ||
+            averaged_out != averaged) {
+            failures++;
+        }
+
+        // Every proper prefix is malformed
+        for (int len = 0; len < n; len++) {
+            if (mqtt_cbor_decode_bme690(payload, len, &bme690_out, NULL)) {
+                failures++;
+            }
+        }
+
+        bmv080_data_t bmv080_out;
+        n = mqtt_cbor_bmv080(payload, MQTT_CBOR_BMV080_MAX, &bmv080[i]);
+        if (n <= 0 || !mqtt_cbor_decode_bmv080(payload, n, &bmv080_out) || !bmv080_equal(&bmv080[i], &bmv080_out)) {
+            failures++;
+        }
+    }
+
+    // Buffers one byte short are rejected
+    int n = mqtt_cbor_bme690(payload, sizeof(payload), &bme690[0], false);
+    if (mqtt_cbor_bme690(payload, n - 1, &bme690[0], false) != -1) {
+        failures++;
+    }
+
+    // {0: 1, 1: 21.5 as float16, 3: 96500 as uint, 13: 1000, "x": [1, {2: h''}], 99: -5}
+    static const uint8_t foreign[] = {0xA6, 0x00, 0x01, 0x01, 0xF9, 0x4D, 0x60, 0x03, 0x1A, 0x00, 0x01, 0x78, 0xF4, 0x0D, 0x19, 0x03, 0xE8,
+        0x61, 'x', 0x82, 0x01, 0xA1, 0x02, 0x40, 0x18, 0x63, 0x24};
+    bme690_data_t decoded;
+    if (!mqtt_cbor_decode_bme690(foreign, sizeof(foreign), &decoded, NULL) || decoded.temperature != 21.5f ||
+        decoded.pressure != 96500.0f || decoded.timestamp != 1000) {
+        failures++;
+    }
+
+    // Wrong version, wrong value type, trailing garbage
+    static const uint8_t wrong_version[] = {0xA1, 0x00, 0x02};
+    static const uint8_t wrong_type[] = {0xA2, 0x00, 0x01, 0x01, 0x61, 'x'};
+    static const uint8_t trailing[] = {0xA1, 0x00, 0x01, 0x00};
+    if (mqtt_cbor_decode_bme690(wrong_version, sizeof(wrong_version), &decoded, NULL) ||
+        mqtt_cbor_decode_bme690(wrong_type, sizeof(wrong_type), &decoded, NULL) ||
+        mqtt_cbor_decode_bme690(trailing, sizeof(trailing), &decoded, NULL)) {
+        failures++;
+    }
+
+    if (failures > 0) {
+        fprintf(stderr, "%u CBOR round trip failures\n", failures);
+    }
+    return failures == 0;
+}
+
+// Full BSEC output around a published sample, raw signals offset from the compensated ones
+static bme690_raw_data_t raw_from(const bme690_data_t *data, size_t i) {
+    return (bme690_raw_data_t){
+        .raw_temperature = data->temperature + 4.25f,
+        .raw_humidity = data->humidity * 0.8f,
+        .raw_pressure = data->pressure,
+        .raw_gas = 5000.0f + data->iaq * 1234.5f,
+        .temperature = data->temperature,
+        .humidity = data->humidity,
+        .iaq = data->iaq,
+        .static_iaq = data->static_iaq,
+        .co2_equivalent = data->co2_equivalent,
+        .breath_voc_equivalent = data->breath_voc_equivalent,
+        .gas_percentage = data->gas_percentage,
+        .iaq_accuracy = data->iaq_accuracy,
+        .gas_index = (uint8_t)(i % 10),
+        .stabilization_status = data->stabilization_status,
+        .run_in_status = data->run_in_status,
+        .timestamp = data->timestamp,
+    };
+}
+
+static bool bme690_raw_equal(const bme690_raw_data_t *a, const bme690_raw_data_t *b) {
+    return a->raw_temperature == b->raw_temperature && a->raw_humidity == b->raw_humidity && a->raw_pressure == b->raw_pressure &&
+           a->raw_gas == b->raw_gas && a->temperature == b->temperature && a->humidity == b->humidity && a->iaq == b->iaq &&
+           a->static_iaq == b->static_iaq && a->co2_equivalent == b->co2_equivalent &&
+           a->breath_voc_equivalent == b->breath_voc_equivalent && a->gas_percentage == b->gas_percentage &&
+           a->iaq_accuracy == b->iaq_accuracy && a->gas_index == b->gas_index && a->stabilization_status == b->stabilization_status &&
+           a->run_in_status == b->run_in_status && a->timestamp == b->timestamp;
+}
+
+static bool verify_telemetry(const bme690_data_t *bme690, const bmv080_data_t *bmv080, size_t count) {
+    uint8_t frame[TELEMETRY_FRAME_MAX];
+    unsigned failures = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        bme690_raw_data_t raw = raw_from(&bme690[i], i);
+        bme690_raw_data_t raw_out;
+        bmv080_data_t bmv080_out;
+        uint32_t sequence = 0;
+        size_t n = telemetry_frame_bme690_raw(frame, sizeof(frame), (uint32_t)i * 7, &raw);
+        if (n != TELEMETRY_FRAME_BME690_SIZE || !telemetry_frame_decode_bme690_raw(frame, n, &sequence, &raw_out) ||
+            !bme690_raw_equal(&raw, &raw_out) || sequence != i * 7) {
+            failures++;
+        }
+
+        // Truncated frames and frames of the other type are rejected
+        if (telemetry_frame_decode_bme690_raw(frame, n - 1, NULL, &raw_out) || telemetry_frame_decode_bmv080(frame, n, NULL, &bmv080_out)) {
+            failures++;
+        }
+
+        n = telemetry_frame_bmv080(frame, sizeof(frame), (uint32_t)i, &bmv080[i]);
+        if (n != TELEMETRY_FRAME_BMV080_SIZE || !telemetry_frame_decode_bmv080(frame, n, &sequence, &bmv080_out) ||
+            !bmv080_equal(&bmv080[i], &bmv080_out) || sequence != i) {
+            failures++;
+        }
+    }
+
+    // Buffers one byte short are rejected
+    bme690_raw_data_t raw = raw_from(&bme690[0], 0);
+    if (telemetry_frame_bme690_raw(frame, TELEMETRY_FRAME_BME690_SIZE - 1, 0, &raw) != 0 ||
+        telemetry_frame_bmv080(frame, TELEMETRY_FRAME_BMV080_SIZE - 1, 0, &bmv080[0]) != 0) {
+        failures++;
+    }
+
+    // Layout: version 1, type 2, obstructed, sequence 0x01020304, timestamp 1000, pm10 1.0, pm25 2.0, pm1 -0.5, runtime 0
+    static const uint8_t expected[TELEMETRY_FRAME_BMV080_SIZE] = {0x01, 0x02, 0x01, 0x00, 0x04, 0x03, 0x02, 0x01, 0xE8, 0x03, 0x00, 0x00,
+        0x00, 0x00, 0x80, 0x3F, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0xBF, 0x00, 0x00, 0x00, 0x00};
+    bmv080_data_t known = {.pm10 = 1.0f, .pm25 = 2.0f, .pm1 = -0.5f, .is_obstructed = true, .timestamp = 1000};
+    size_t n = telemetry_frame_bmv080(frame, sizeof(frame), 0x01020304, &known);
+    if (n != sizeof(expected) || memcmp(frame, expected, sizeof(expected)) != 0) {
+        failures++;
+    }
+
+    // Another version is rejected
+    frame[0] = TELEMETRY_FRAME_VERSION + 1;
+    bmv080_data_t decoded;
+    if (telemetry_frame_decode_bmv080(frame, sizeof(expected), NULL, &decoded)) {
+        failures++;
+    }
+
+    if (failures > 0) {
+        fprintf(stderr, "%u telemetry frame failures\n", failures);
+    }
+    return failures == 0;
+}
+
+static const mqtt_discovery_device_t discovery_device = {
+    .id = "A1B2C3",
+    .name = "Polverine A1B2C3",
+    .availability_topic = "polverine/A1B2C3/availability",
+    .state_topics = {
+        [MQTT_DISCOVERY_BME690] = "polverine/A1B2C3/bme690/state",
+        [MQTT_DISCOVERY_BMV080] = "polverine/A1B2C3/bmv080/state",
+        [MQTT_DISCOVERY_SYSTEM] = "polverine/A1B2C3/system/state",
+    },
+};
+
+// Discovery payload as formerly written out by hand in send_ha_discovery()
+static const char reference_pressure_discovery[] =
+    "{\"unique_id\":\"A1B2C3_pressure\","
+    "\"name\":\"Pressure\","
+    "\"state_topic\":\"polverine/A1B2C3/bme690/state\","
+    "\"availability_topic\":\"polverine/A1B2C3/availability\","
+    "\"device_class\":\"pressure\","
+    "\"unit_of_measurement\":\"hPa\","
+    "\"value_template\":\"{{ value_json.pressure | float / 100 }}\","
+    "\"device\":{\"identifiers\":\"A1B2C3\",\"name\":\"Polverine A1B2C3\",\"manufacturer\":\"BlackIoT\",\"model\":\"Polverine Sensor\"}}";
+
+static bool verify_discovery(void) {
+    char topic[128];
+    char payload[MQTT_DISCOVERY_PAYLOAD_MAX];
+    unsigned failures = 0;
+
+    for (uint8_t i = 0; i < mqtt_discovery_entity_count; i++) {
+        const mqtt_discovery_entity_t *entity = &mqtt_discovery_entities[i];
+        int topic_len = mqtt_discovery_topic(topic, sizeof(topic), entity, &discovery_device);
+        int len = mqtt_discovery_payload(payload, sizeof(payload), entity, &discovery_device);
+        if (topic_len <= 0 || topic_len >= (int)sizeof(topic) || len <= 0 || len >= (int)sizeof(payload)) {
+            fprintf(stderr, "discovery %s truncated (topic=%d, payload=%d)\n", entity->key, topic_len, len);
+            failures++;
+            continue;
+        }
+
+        int depth = 0;
+        for (int c = 0; c < len; c++) {
+            depth += payload[c] == '{' ? 1 : payload[c] == '}' ? -1 : 0;
+        }
+        if (depth != 0 || payload[len - 1] != '}') {
+            fprintf(stderr, "discovery %s unbalanced: %s\n", entity->key, payload);
+            failures++;
+        }
+        if (strcmp(entity->key, "pressure") == 0 && strcmp(payload, reference_pressure_discovery) != 0) {
+            fprintf(stderr, "discovery mismatch:\n  reference: %s\n  table:     %s\n", reference_pressure_discovery, payload);
+            failures++;
+        }
+        for (uint8_t j = 0; j < i; j++) {
+            if (strcmp(entity->key, mqtt_discovery_entities[j].key) == 0) {
+                fprintf(stderr, "discovery key %s used twice\n", entity->key);
+                failures++;
+            }
+        }
+    }
+
+    // The hash must be reproducible across boots and follow the broker
+    uint32_t hash = mqtt_discovery_hash(&discovery_device, "mqtt://homeassistant.local");
+    if (hash != mqtt_discovery_hash(&discovery_device, "mqtt://homeassistant.local") ||
+        hash == mqtt_discovery_hash(&discovery_device, "mqtt://other.local")) {
+        fprintf(stderr, "discovery hash not stable or not broker specific\n");
+        failures++;
+    }
+
+    if (failures) {
+        fprintf(stderr, "%u discovery failures\n", failures);
+    }
+    return failures == 0;
+}
+
+static bool verify_alias(void) {
+    static const char bme690_topic[] = "polverine/A1B2C3/bme690/state";
+    static const char bmv080_topic[] = "polverine/A1B2C3/bmv080/state";
+    mqtt_alias_table_t table;
+    const char *wire;
+    unsigned failures = 0;
+
+    mqtt_alias_init(&table);
+    if (mqtt_alias_add(&table, bme690_topic) != 1 || mqtt_alias_add(&table, bmv080_topic) != 2 || mqtt_alias_add(&table, "") != 0) {
+        failures++;
+    }
+
+    // No aliases before the first connect
+    if (mqtt_alias_resolve(&table, bme690_topic, 0, &wire) != 0 || wire != bme690_topic) {
+        failures++;
+    }
+
+    // Announce first, then alias only, but never for QoS 1 or unknown topics
+    mqtt_alias_connected(&table, MQTT_ALIAS_MAX);
+    uint16_t alias = mqtt_alias_resolve(&table, bme690_topic, 0, &wire);
+    if (alias != 1 || wire != bme690_topic) {
+        failures++;
+    }
+    mqtt_alias_sent(&table, alias, wire);
+    alias = mqtt_alias_resolve(&table, bme690_topic, 0, &wire);
+    if (alias != 1 || wire[0] != '\0') {
+        failures++;
+    }
+    mqtt_alias_sent(&table, alias, wire);
+    if (mqtt_alias_resolve(&table, bme690_topic, 1, &wire) != 1 || wire != bme690_topic ||
+        mqtt_alias_resolve(&table, bmv080_topic, 0, &wire) != 2 || wire != bmv080_topic ||
+        mqtt_alias_resolve(&table, "polverine/A1B2C3/system/state", 0, &wire) != 0) {
+        failures++;
+    }
+    if (table.alias_only != 1 || table.bytes_saved != strlen(bme690_topic)) {
+        failures++;
+    }
+
+    // A new connection forgets the mappings, a smaller broker maximum hides higher aliases
+    mqtt_alias_connected(&table, 1);
+    if (mqtt_alias_resolve(&table, bme690_topic, 0, &wire) != 1 || wire != bme690_topic ||
+        mqtt_alias_resolve(&table, bmv080_topic, 0, &wire) != 0) {
+        failures++;
+    }
+    mqtt_alias_disable(&table);
+    if (mqtt_alias_resolve(&table, bme690_topic, 0, &wire) != 0 || wire != bme690_topic) {
+        failures++;
+    }
+
+    if (failures) {
+        fprintf(stderr, "%u topic alias failures\n", failures);
+    }
+    return failures == 0;
+}
+
+static sensor_agg_report_t stats_report;
+static unsigned stats_reports;
+
+static void stats_on_report(const sensor_agg_report_t *report) {
+    stats_report = *report;
+    stats_reports++;
+}
+
+static bool verify_stats(void) {
+    // Temperature is NaN throughout the window, humidity in every third sample
+    sensor_aggregator_t agg;
+    sensor_aggregator_init(&agg, "bme690", sensor_agg_bme690_fields, sensor_agg_bme690_field_count, stats_on_report);
+    for (uint32_t i = 0; i <= 60; i++) {
+        bme690_data_t data = {.temperature = NAN, .humidity = i % 3 ? 40.0f : NAN, .pressure = 101325.0f, .co2_equivalent = 500.0f};
+        sensor_aggregator_add(&agg, &data, i * 1000);
+    }
+
+    static const char expected_start[] = "{\"window\":\"1m\",\"start\":0,\"count\":60,"
+                                         "\"temperature\":{\"count\":0,\"min\":null,\"max\":null,\"mean\":null,\"stddev\":null,"
+                                         "\"p50\":null,\"p95\":null},\"humidity\":{\"count\":40,\"min\":40.00,\"max\":40.00,"
+                                         "\"mean\":40.00,\"stddev\":0.00,\"p50\":40.00,\"p95\":40.00},\"pressure\":{\"min\":101325.00,";
+    char payload[1280];
+    int len = mqtt_payload_stats(payload, sizeof(payload), &stats_report);
+    bool ok = stats_reports == 1 && stats_report.count == 60 && stats_report.stats[0].count == 0 && stats_report.stats[1].count == 40 &&
+              len > 0 && len < (int)sizeof(payload) && strncmp(payload, expected_start, strlen(expected_start)) == 0;
+    if (!ok) {
+        fprintf(stderr, "statistics with NaN fields: %u reports, count %lu\n  got:      %.*s\n  expected: %s...\n", stats_reports,
+            (unsigned long)stats_report.count, len > 0 ? len : 0, payload, expected_start);
+    }
+    return ok;
+}
+
+static bool verify_command(void) {
+    static const char expected_result[] = "{\"id\":\"c-1\",\"ok\":true,\"applied\":[\"stats_windows\",\"qos\"],"
+                                          "\"requested\":[\"bmv080_duty_cycle\"],\"after_restart\":[\"batch\"],\"restart\":false}";
+    static const char *const invalid[] = {
+        "bmv080_duty_cycle=5",
+        "bmv080_duty_cycle=120x",
+        "bmv080_duty_cycle=-1",
+        "qos_state=2",
+        "stats_windows=60,900",
+        "stats_windows=60,900,3600,60",
+        "stats_windows=5,900,3600",
+        "bme690_deadband=pm10=2",
+        "bme690_gated",
+        "Qos_state=0",
+        "mqtt_uri=mqtt://elsewhere",
+        "id=a\"b",
+        " ; \n",
+    };
+    mqtt_command_t cmd = {0};
+    char result[256];
+    unsigned failures = 0;
+
+    cmd.sensor = (polverine_sensor_config_t){.bmv080_duty_cycle_s = 60, .bme690_gated = true, .stats_window_s = {60, 900, 3600}};
+    cmd.mqtt.qos.state = 0;
+    cmd.mqtt.qos.batch = 1;
+
+    // Separators, spaces and unchanged values
+    const char *command = "id=c-1; bmv080_duty_cycle=120\nqos_state = auto;stats_windows=300, 900,0\r\nbme690_batch=10;qos_batch=1";
+    if (!mqtt_command_parse(&cmd, command, strlen(command))) {
+        fprintf(stderr, "command rejected: %s\n", cmd.error);
+        failures++;
+    }
+    if (cmd.sensor.bmv080_duty_cycle_s != 120 || cmd.mqtt.qos.state != MQTT_QOS_ADAPTIVE || cmd.sensor.stats_window_s[0] != 300 ||
+        cmd.sensor.stats_window_s[2] != 0 || cmd.mqtt.batch_bme690.max_samples != 10 ||
+        cmd.changes != (MQTT_COMMAND_DUTY_CYCLE | MQTT_COMMAND_STATS_WINDOWS | MQTT_COMMAND_QOS | MQTT_COMMAND_BATCH)) {
+        fprintf(stderr, "command applied wrongly (changes %lx)\n", (unsigned long)cmd.changes);
+        failures++;
+    }
+    mqtt_command_result(result, sizeof(result), &cmd, true);
+    if (strcmp(result, expected_result) != 0) {
+        fprintf(stderr, "command result mismatch:\n  expected: %s\n  built:    %s\n", expected_result, result);
+        failures++;
+    }
+
+    // A single invalid setting rejects the whole command
+    command = "qos_state=0; bmv080_duty_cycle=5";
+    if (mqtt_command_parse(&cmd, command, strlen(command)) || cmd.mqtt.qos.state != MQTT_QOS_ADAPTIVE ||
+        strstr(cmd.error, "bmv080_duty_cycle") == NULL) {
+        failures++;
+    }
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        if (mqtt_command_parse(&cmd, invalid[i], strlen(invalid[i])) || cmd.error[0] == '\0' || cmd.changes != 0) {
+            fprintf(stderr, "command accepted: %s\n", invalid[i]);
+            failures++;
+        }
+    }
+    mqtt_command_result(result, sizeof(result), &cmd, false);
+    static const char error_prefix[] = "{\"id\":\"\",\"ok\":false,\"error\":\"";
+    if (strncmp(result, error_prefix, strlen(error_prefix)) != 0) {
+        fprintf(stderr, "command error result: %s\n", result);
+        failures++;
+    }
+
+    // Change filters are checked against the sensor's fields, restart is a group of its own
+    command = "bmv080_deadband=pm10=2,pm25=1; bmv080_heartbeat=600; restart=1";
+    if (!mqtt_command_parse(&cmd, command, strlen(command)) || strcmp(cmd.mqtt.deadband_bmv080.spec, "pm10=2,pm25=1") != 0 ||
+        cmd.changes != (MQTT_COMMAND_DEADBAND | MQTT_COMMAND_RESTART)) {
+        failures++;
+    }
+    char long_command[MQTT_COMMAND_MAX_LEN + 2];
+    memset(long_command, ' ', sizeof(long_command));
+    if (mqtt_command_parse(&cmd, long_command, sizeof(long_command))) {
+        failures++;
+    }
+
+    if (failures) {
+        fprintf(stderr, "%u command failures\n", failures);
+    }
+    return failures == 0;
+}
+
+static size_t varint_size(size_t value) {
+    size_t size = 1;
+    while (value >= 128) {
+        value /= 128;
+        size++;
+    }
+    return size;
+}
+
+// Bytes of a PUBLISH packet on the wire
+static size_t publish_size(size_t topic_len, size_t payload_len, int qos, bool mqtt5, bool alias, bool expiry) {
+    size_t remaining = 2 + topic_len + (qos > 0 ? 2 : 0) + payload_len;
+    if (mqtt5) {
+        size_t properties = (alias ? 3 : 0) + (expiry ? 5 : 0);
+        remaining += varint_size(properties) + properties;
+    }
+    return 1 + varint_size(remaining) + remaining;
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"iterations", required_argument, NULL, 'i'},
+        {"seed", required_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0},
+    };
+
+    unsigned iterations = 200;
+    uint32_t seed = 1;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:r:", options, NULL)) != -1) {
+        switch (opt) {
+        case 'i':
+            iterations = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            seed = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [--iterations N] [--seed N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    static bme690_data_t bme690[BENCH_SAMPLES];
+    static bmv080_data_t bmv080[BENCH_SAMPLES];
+    rng_state = seed ? seed : 1;
+    generate(bme690, bmv080, BENCH_SAMPLES);
+
+    if (!verify(bme690, bmv080, BENCH_SAMPLES) || !verify_cbor(bme690, bmv080, BENCH_SAMPLES) ||
+        !verify_telemetry(bme690, bmv080, BENCH_SAMPLES) || !verify_discovery() ||
+        !verify_alias() || !verify_command() || !verify_stats()) {
+        return 1;
+    }
+
+    char payload[320];
+    uint64_t bytes = 0;
+    uint64_t payloads = (uint64_t)iterations * BENCH_SAMPLES;
+
+    int64_t t0 = esp_timer_get_time();
+    for (unsigned it = 0; it < iterations; it++) {
+        for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+            bytes += reference_bme690(payload, sizeof(payload), &bme690[i], false);
+        }
+    }
+    int64_t t1 = esp_timer_get_time();
+    for (unsigned it = 0; it < iterations; it++) {
+        for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+            bytes += mqtt_payload_bme690(payload, sizeof(payload), &bme690[i], false);
+        }
+    }
+    int64_t t2 = esp_timer_get_time();
+    for (unsigned it = 0; it < iterations; it++) {
+        for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+            bytes += reference_bmv080(payload, sizeof(payload), &bmv080[i]);
+        }
+    }
+    int64_t t3 = esp_timer_get_time();
+    for (unsigned it = 0; it < iterations; it++) {
+        for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+            bytes += mqtt_payload_bmv080(payload, sizeof(payload), &bmv080[i]);
+        }
+    }
+    int64_t t4 = esp_timer_get_time();
+    uint64_t json_bytes = bytes;
+    bytes = 0;
+
+    uint8_t binary[MQTT_CBOR_BME690_MAX];
+    for (unsigned it = 0; it < iterations; it++) {
+        for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+            bytes += mqtt_cbor_bme690(binary, sizeof(binary), &bme690[i], false);
+        }
+    }
+    int64_t t5 = esp_timer_get_time();
+    uint64_t cbor_bme690_bytes = bytes;
+    for (unsigned it = 0; it < iterations; it++) {
+        for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+            bytes += mqtt_cbor_bmv080(binary, sizeof(binary), &bmv080[i]);
+        }
+    }
+    int64_t t6 = esp_timer_get_time();
+    uint64_t cbor_bmv080_bytes = bytes - cbor_bme690_bytes;
+
+    static bme690_raw_data_t raw[BENCH_SAMPLES];
+    for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+        raw[i] = raw_from(&bme690[i], i);
+    }
+    uint8_t frame[TELEMETRY_FRAME_MAX];
+    int64_t frame_start = esp_timer_get_time();
+    for (unsigned it = 0; it < iterations; it++) {
+        for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+            bytes += telemetry_frame_bme690_raw(frame, sizeof(frame), (uint32_t)i, &raw[i]);
+        }
+    }
+    int64_t frame_end = esp_timer_get_time();
+
+    // Full discovery set as sent when the hash changed, and the hash itself
+    char discovery[MQTT_DISCOVERY_PAYLOAD_MAX];
+    uint64_t discovery_bytes = 0;
+    for (unsigned it = 0; it < iterations; it++) {
+        discovery_bytes = 0;
+        for (uint8_t i = 0; i < mqtt_discovery_entity_count; i++) {
+            discovery_bytes += mqtt_discovery_topic(discovery, sizeof(discovery), &mqtt_discovery_entities[i], &discovery_device);
+            discovery_bytes += mqtt_discovery_payload(discovery, sizeof(discovery), &mqtt_discovery_entities[i], &discovery_device);
+        }
+    }
+    int64_t t7 = esp_timer_get_time();
+    volatile uint32_t discovery_hash = 0;
+    for (unsigned it = 0; it < iterations; it++) {
+        discovery_hash = mqtt_discovery_hash(&discovery_device, "mqtt://homeassistant.local");
+    }
+    int64_t t8 = esp_timer_get_time();
+
+    printf("payloads:         %" PRIu64 " per builder (%" PRIu64 " JSON bytes total)\n", payloads, json_bytes);
+    printf("bme690 snprintf:  %.1f ns/payload\n", (t1 - t0) * 1000.0 / payloads);
+    printf("bme690 template:  %.1f ns/payload (%.1fx)\n", (t2 - t1) * 1000.0 / payloads, (double)(t1 - t0) / (t2 - t1));
+    printf("bmv080 snprintf:  %.1f ns/payload\n", (t3 - t2) * 1000.0 / payloads);
+    printf("bmv080 template:  %.1f ns/payload (%.1fx)\n", (t4 - t3) * 1000.0 / payloads, (double)(t3 - t2) / (t4 - t3));
+    printf("bme690 cbor:      %.1f ns/payload, %.1f bytes\n", (t5 - t4) * 1000.0 / payloads, (double)cbor_bme690_bytes / payloads);
+    printf("bmv080 cbor:      %.1f ns/payload, %.1f bytes\n", (t6 - t5) * 1000.0 / payloads, (double)cbor_bmv080_bytes / payloads);
+    printf("bme690 ws frame:  %.1f ns/frame, %d bytes with all raw signals\n", (frame_end - frame_start) * 1000.0 / payloads,
+        TELEMETRY_FRAME_BME690_SIZE);
+    printf("discovery:        %u entities, %" PRIu64 " bytes, %.1f us/set, hash %08lx in %.1f us (once per boot)\n",
+        mqtt_discovery_entity_count, discovery_bytes, (double)(t7 - frame_end) / iterations, (unsigned long)discovery_hash,
+        (double)(t8 - t7) / iterations);
+
+    // One state message per topic: 3.1.1, MQTT 5 announcing the alias, MQTT 5 alias only (QoS 0)
+    static const char state_topic[] = "polverine/A1B2C3/bme690/state";
+    size_t topic_len = strlen(state_topic);
+    size_t json_len = (size_t)mqtt_payload_bme690(payload, sizeof(payload), &bme690[0], false);
+    size_t cbor_len = (size_t)mqtt_cbor_bme690(binary, sizeof(binary), &bme690[0], false);
+    printf("publish json:     %zu bytes 3.1.1, %zu MQTT 5 with expiry, %zu alias only\n",
+        publish_size(topic_len, json_len, 1, false, false, false), publish_size(topic_len, json_len, 1, true, true, true),
+        publish_size(0, json_len, 0, true, true, true));
+    printf("publish cbor:     %zu bytes 3.1.1, %zu MQTT 5 with expiry, %zu alias only\n",
+        publish_size(topic_len + 5, cbor_len, 1, false, false, false), publish_size(topic_len + 5, cbor_len, 1, true, true, true),
+        publish_size(0, cbor_len, 0, true, true, true));
+    return 0;
+}
@@ -0,0 +1,350 @@
+/**
+ * @file qos_sim.c
+ * @brief Simulates the MQTT client outbox under a degrading link for several QoS policies
+ *
+ * A device publishes live state, statistics, system metrics and availability
+ * over a link that is good for the first third of the run, poor (low
+ * throughput, long round trips) for the second and good again for the last.
+ * The client is modelled after esp-mqtt: every message is written to a TCP
+ * send buffer of limited size, QoS 0 messages that do not fit are dropped,
+ * QoS 1 messages stay in the outbox until their PUBACK, are retransmitted when
+ * it does not arrive within the retransmit timeout and are deleted when they
+ * outlive the outbox expiry. The QoS of each message comes from mqtt_qos.c.
+ *
+ * Reported per policy are the delivered share of each class, the PUBACK round
+ * trips, retransmitted duplicates, bytes on the air and the outbox depth.
+ * The policy's selection rules are checked on the way.
+ *
+ * Usage:
+ *   qos_sim [--minutes N] [--poor-bw B] [--poor-rtt MS] [--state-interval S]
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mqtt_qos.h"
+
+#define SIM_TICK_MS        10
+#define SIM_SCAN_MS        100   // Outbox scan interval of the client task
+#define SIM_SNDBUF         5744  // lwIP TCP send buffer
+#define SIM_RETRANSMIT_MS  1000  // esp-mqtt message_retransmit_timeout
+#define SIM_EXPIRE_MS      30000 // CONFIG_MQTT_OUTBOX_EXPIRED_TIMEOUT_MS
+#define SIM_GOOD_BW        20000 // Bytes per second
+#define SIM_GOOD_RTT_MS    40
+#define SIM_QUEUE          65536 // Socket queue entries
+#define SIM_HIGH_WATER     6144  // Adaptive water marks as in mqtt_main.c
+#define SIM_LOW_WATER      2048
+
+typedef enum {
+    MSG_OUTBOX,   // QoS 1 waiting for room in the send buffer
+    MSG_QUEUED,   // In the send buffer
+    MSG_INFLIGHT, // QoS 1 sent, waiting for the PUBACK
+    MSG_DONE,     // Delivered and acknowledged, or QoS 0 delivered
+    MSG_LOST,     // Dropped or expired
+} msg_state_t;
+
+typedef struct {
+    mqtt_qos_class_t cls;
+    uint16_t size;
+    uint8_t qos;
+    uint8_t state;
+    bool delivered;
+    uint32_t created_ms;
+    uint32_t sent_ms; // Last time the message left the send buffer
+    uint32_t ack_ms;  // Time its PUBACK arrives
+} msg_t;
+
+typedef struct {
+    const char *name;
+    mqtt_qos_class_t cls;
+    uint32_t interval_ms;
+    uint16_t size; // PUBLISH packet bytes
+} source_t;
+
+typedef struct {
+    const char *name;
+    uint8_t policy[MQTT_QOS_CLASS_CONFIGURABLE];
+} policy_t;
+
+static bool failed = false;
+
+static msg_t *msgs;
+static size_t msg_count;
+static uint32_t queue[SIM_QUEUE];
+static size_t queue_head, queue_len;
+static uint32_t queue_bytes;  // Bytes in the send buffer
+static uint32_t head_sent;    // Bytes of the head entry already on the air
+static uint32_t outbox_bytes; // QoS 1 messages not yet acknowledged
+
+static bool socket_write(uint32_t index) {
+    msg_t *msg = &msgs[index];
+    if (queue_bytes + msg->size > SIM_SNDBUF || queue_len == SIM_QUEUE) {
+        return false;
+    }
+    queue[(queue_head + queue_len++) % SIM_QUEUE] = index;
+    queue_bytes += msg->size;
+    msg->state = MSG_QUEUED;
+    return true;
+}
+
+static void check(bool condition, const char *what) {
+    if (!condition) {
+        printf("FAIL: %s\n", what);
+        failed = true;
+    }
+}
+
+static void check_policy(void) {
+    mqtt_qos_t qos;
+    uint8_t policy;
+
+    mqtt_qos_init(&qos, 1000, 400);
+    check(mqtt_qos_select(&qos, MQTT_QOS_CLASS_STATE, 0) == 1, "configurable classes default to QoS 1");
+    check(mqtt_qos_select(&qos, MQTT_QOS_CLASS_DIAG, 0) == 0, "diagnostics use QoS 0");
+    check(!mqtt_qos_set_policy(&qos, MQTT_QOS_CLASS_CONTROL, 0), "control class is fixed");
+    check(!mqtt_qos_set_policy(&qos, MQTT_QOS_CLASS_STATE, 3), "unknown policy rejected");
+    check(mqtt_qos_set_policy(&qos, MQTT_QOS_CLASS_STATE, 0) && mqtt_qos_select(&qos, MQTT_QOS_CLASS_STATE, 5000) == 0,
+        "fixed QoS 0 class");
+
+    // Adaptive follows the outbox with hysteresis, fixed classes do not
+    mqtt_qos_init(&qos, 1000, 400);
+    mqtt_qos_set_policy(&qos, MQTT_QOS_CLASS_BATCH, MQTT_QOS_ADAPTIVE);
+    check(mqtt_qos_select(&qos, MQTT_QOS_CLASS_BATCH, 999) == 1, "adaptive below high water");
+    check(mqtt_qos_select(&qos, MQTT_QOS_CLASS_BATCH, 1000) == 0, "adaptive at high water");
+    check(mqtt_qos_select(&qos, MQTT_QOS_CLASS_BATCH, 500) == 0, "adaptive between the water marks");
+    check(mqtt_qos_select(&qos, MQTT_QOS_CLASS_CONTROL, 500) == 1, "control while congested");
+    check(mqtt_qos_select(&qos, MQTT_QOS_CLASS_BATCH, 399) == 1, "adaptive below low water");
+    check(qos.congestions == 1 && qos.outbox_peak == 1000, "congestion and peak counters");
+
+    mqtt_qos_record(&qos, MQTT_QOS_CLASS_BATCH, 1, true);
+    mqtt_qos_record(&qos, MQTT_QOS_CLASS_BATCH, 0, false);
+    check(qos.queued[MQTT_QOS_CLASS_BATCH][1] == 1 && qos.failed[MQTT_QOS_CLASS_BATCH] == 1, "record counters");
+
+    check(mqtt_qos_policy_parse("auto", &policy) && policy == MQTT_QOS_ADAPTIVE && !mqtt_qos_policy_parse("2", &policy),
+        "policy names");
+    check(strcmp(mqtt_qos_policy_name(policy), "auto") == 0 && strcmp(mqtt_qos_class_name(MQTT_QOS_CLASS_STATS), "stats") == 0,
+        "class and policy names");
+}
+
+static uint32_t simulate(const policy_t *policy, const source_t *sources, size_t source_count, uint32_t duration_ms, uint32_t poor_bw,
+    uint32_t poor_rtt_ms) {
+    mqtt_qos_t qos;
+    uint32_t offered[MQTT_QOS_CLASS_COUNT] = {0};
+    uint32_t delivered[MQTT_QOS_CLASS_COUNT] = {0};
+    uint64_t air_bytes = 0;
+    uint64_t outbox_sum = 0;
+    uint32_t pubacks = 0;
+    uint32_t duplicates = 0;
+    uint32_t ticks = 0;
+    uint64_t budget = 0; // Link capacity left in the current tick, in thousandths of a byte
+
+    mqtt_qos_init(&qos, SIM_HIGH_WATER, SIM_LOW_WATER);
+    for (int i = 0; i < MQTT_QOS_CLASS_CONFIGURABLE; i++) {
+        mqtt_qos_set_policy(&qos, (mqtt_qos_class_t)i, policy->policy[i]);
+    }
+    msg_count = 0;
+    queue_head = queue_len = 0;
+    queue_bytes = head_sent = outbox_bytes = 0;
+
+    for (uint32_t t = 0; t < duration_ms; t += SIM_TICK_MS, ticks++) {
+        bool poor = t >= duration_ms / 3 && t < duration_ms * 2 / 3;
+        uint32_t bw = poor ? poor_bw : SIM_GOOD_BW;
+        uint32_t rtt_ms = poor ? poor_rtt_ms : SIM_GOOD_RTT_MS;
+
+        // Publish what is due
+        for (size_t s = 0; s < source_count; s++) {
+            if (t % sources[s].interval_ms != 0) {
+                continue;
+            }
+            uint32_t index = (uint32_t)msg_count++;
+            msg_t *msg = &msgs[index];
+            *msg = (msg_t){.cls = sources[s].cls, .size = sources[s].size, .created_ms = t, .state = MSG_OUTBOX};
+            msg->qos = (uint8_t)mqtt_qos_select(&qos, msg->cls, outbox_bytes);
+            offered[msg->cls]++;
+
+            if (msg->qos > 0) {
+                outbox_bytes += msg->size;
+                socket_write(index);
+            } else if (!socket_write(index)) {
+                msg->state = MSG_LOST;
+            }
+            mqtt_qos_record(&qos, msg->cls, msg->qos, msg->state != MSG_LOST);
+        }
+
+        // The client task handles PUBACKs, resends pending and unacknowledged messages and expires old ones
+        if (t % SIM_SCAN_MS == 0) {
+            for (size_t i = 0; i < msg_count; i++) {
+                msg_t *msg = &msgs[i];
+                if (msg->qos == 0 || msg->state == MSG_DONE || msg->state == MSG_LOST) {
+                    continue;
+                }
+                if (msg->delivered && msg->ack_ms <= t) {
+                    msg->state = MSG_DONE;
+                    outbox_bytes -= msg->size;
+                    pubacks++;
+                } else if (t - msg->created_ms >= SIM_EXPIRE_MS && msg->state != MSG_QUEUED) {
+                    msg->state = MSG_LOST;
+                    outbox_bytes -= msg->size;
+                } else if (msg->state == MSG_OUTBOX) {
+                    socket_write((uint32_t)i);
+                } else if (msg->state == MSG_INFLIGHT && t - msg->sent_ms >= SIM_RETRANSMIT_MS && socket_write((uint32_t)i)) {
+                    duplicates++;
+                }
+            }
+        }
+
+        // The link drains the send buffer
+        budget += (uint64_t)bw * SIM_TICK_MS;
+        while (queue_len > 0 && budget >= 1000) {
+            msg_t *msg = &msgs[queue[queue_head]];
+            uint32_t left = msg->size - head_sent;
+            uint32_t chunk = left < budget / 1000 ? left : (uint32_t)(budget / 1000);
+            head_sent += chunk;
+            budget -= (uint64_t)chunk * 1000;
+            air_bytes += chunk;
+            if (head_sent < msg->size) {
+                break;
+            }
+
+            head_sent = 0;
+            queue_head = (queue_head + 1) % SIM_QUEUE;
+            queue_len--;
+            queue_bytes -= msg->size;
+            if (!msg->delivered) {
+                msg->delivered = true;
+                msg->ack_ms = t + rtt_ms;
+                delivered[msg->cls]++;
+            }
+            if (msg->state == MSG_QUEUED) {
+                msg->state = msg->qos > 0 ? MSG_INFLIGHT : MSG_DONE;
+                msg->sent_ms = t;
+            }
+        }
+        if (queue_len == 0) {
+            budget = 0;
+        }
+
+        outbox_sum += outbox_bytes;
+        if (outbox_bytes > qos.outbox_peak) {
+            qos.outbox_peak = outbox_bytes;
+        }
+    }
+
+    printf("%-10s", policy->name);
+    for (int c = 0; c <= MQTT_QOS_CLASS_CONTROL; c++) {
+        if (offered[c] > 0) {
+            printf(" %s %5.1f%%", mqtt_qos_class_name((mqtt_qos_class_t)c), 100.0 * delivered[c] / offered[c]);
+        }
+    }
+    printf(", %5lu PUBACKs, %5lu duplicates, %6.1f kB on air, outbox mean %5.0f peak %6lu B, %lu congestions\n", (unsigned long)pubacks,
+        (unsigned long)duplicates, air_bytes / 1000.0, (double)outbox_sum / ticks, (unsigned long)qos.outbox_peak,
+        (unsigned long)qos.congestions);
+
+    if (outbox_bytes >= SIM_HIGH_WATER) {
+        printf("FAIL: %s outbox did not drain after the link recovered (%lu B)\n", policy->name, (unsigned long)outbox_bytes);
+        failed = true;
+    }
+    if (delivered[MQTT_QOS_CLASS_CONTROL] == 0) {
+        printf("FAIL: %s delivered no availability\n", policy->name);
+        failed = true;
+    }
+    return qos.outbox_peak;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [--minutes N] [--poor-bw B] [--poor-rtt MS] [--state-interval S]\n"
+        "  --minutes N         simulated minutes, the middle third on the poor link (default 30)\n"
+        "  --poor-bw B         throughput of the poor link in bytes per second (default 150)\n"
+        "  --poor-rtt MS       round trip time of the poor link (default 1500)\n"
+        "  --state-interval S  seconds between state messages per sensor (default 3)\n",
+        argv0);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"minutes", required_argument, NULL, 'm'},
+        {"poor-bw", required_argument, NULL, 'b'},
+        {"poor-rtt", required_argument, NULL, 'r'},
+        {"state-interval", required_argument, NULL, 's'},
+        {NULL, 0, NULL, 0},
+    };
+
+    double minutes = 30.0;
+    uint32_t poor_bw = 150;
+    uint32_t poor_rtt_ms = 1500;
+    double state_interval_s = 3.0;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'm':
+            minutes = atof(optarg);
+            break;
+        case 'b':
+            poor_bw = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            poor_rtt_ms = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            state_interval_s = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    uint32_t state_interval_ms = (uint32_t)(state_interval_s * 1000) / SIM_TICK_MS * SIM_TICK_MS;
+    uint32_t duration_ms = (uint32_t)(minutes * 60000) / SIM_TICK_MS * SIM_TICK_MS;
+    if (state_interval_ms == 0 || duration_ms == 0 || poor_bw == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // PUBLISH sizes: topic, header and the JSON payloads from mqtt_payload.c
+    const source_t sources[] = {
+        {"bme690", MQTT_QOS_CLASS_STATE, state_interval_ms, 322},
+        {"bmv080", MQTT_QOS_CLASS_STATE, state_interval_ms, 205},
+        {"stats", MQTT_QOS_CLASS_STATS, 60000, 1150},
+        {"system", MQTT_QOS_CLASS_SYSTEM, 30000, 140},
+        {"availability", MQTT_QOS_CLASS_CONTROL, 60000, 42},
+    };
+    const size_t source_count = sizeof(sources) / sizeof(sources[0]);
+    const policy_t policies[] = {
+        {"all qos1", {1, 1, 1, 1}},
+        {"per class", {0, 1, 1, 1}},
+        {"adaptive", {MQTT_QOS_ADAPTIVE, MQTT_QOS_ADAPTIVE, 1, MQTT_QOS_ADAPTIVE}},
+    };
+
+    size_t capacity = 0;
+    for (size_t s = 0; s < source_count; s++) {
+        capacity += duration_ms / sources[s].interval_ms + 1;
+    }
+    msgs = calloc(capacity, sizeof(*msgs));
+    if (msgs == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    check_policy();
+
+    printf("%.0f min, minutes %.0f-%.0f on a %lu B/s link with %lu ms round trips, state every %.1f s per sensor\n", minutes, minutes / 3,
+        minutes * 2 / 3, (unsigned long)poor_bw, (unsigned long)poor_rtt_ms, state_interval_s);
+    uint32_t peak_all = simulate(&policies[0], sources, source_count, duration_ms, poor_bw, poor_rtt_ms);
+    simulate(&policies[1], sources, source_count, duration_ms, poor_bw, poor_rtt_ms);
+    uint32_t peak_adaptive = simulate(&policies[2], sources, source_count, duration_ms, poor_bw, poor_rtt_ms);
+    if (peak_adaptive > peak_all) {
+        printf("FAIL: adaptive outbox peak %lu B above all QoS 1 with %lu B\n", (unsigned long)peak_adaptive, (unsigned long)peak_all);
+        failed = true;
+    }
+
+    free(msgs);
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
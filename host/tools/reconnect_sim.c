@@ -0,0 +1,198 @@
+/**
+ * @file reconnect_sim.c
+ * @brief Simulates a fleet of devices reconnecting after a broker restart
+ *
+ * All devices lose the broker at the same moment. The broker stays down for
+ * the outage and then accepts a limited number of connections per second,
+ * spread evenly over 100 ms windows, refusing the rest. Each device retries
+ * either after the fixed 2 s delay the firmware used before or after the
+ * exponential backoff with full jitter from mqtt_backoff.c. Reported are the connection attempts, the peak attempts
+ * within 100 ms and the time until half and all of the fleet are back.
+ * The backoff bounds are checked on the way.
+ *
+ * Usage:
+ *   reconnect_sim [--devices N] [--outage S] [--capacity N] [--seed N]
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mqtt_backoff.h"
+
+#define SIM_TICK_MS     10
+#define SIM_WINDOW_MS   100 // The broker spreads its accept rate over windows this long
+#define SIM_LIMIT_MS    (3600 * 1000)
+#define FIXED_DELAY_MS  2000
+#define BACKOFF_BASE_MS 1000
+#define BACKOFF_CAP_MS  120000
+
+typedef enum {
+    POLICY_FIXED,
+    POLICY_BACKOFF,
+} policy_t;
+
+typedef struct {
+    bool connected;
+    uint32_t next_attempt_ms;
+    mqtt_backoff_t backoff;
+} device_t;
+
+static bool failed = false;
+static uint32_t rng_state = 1;
+
+static uint32_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Delay before the next attempt of a device whose attempt just failed
+static uint32_t retry_delay(device_t *device, policy_t policy) {
+    if (policy == POLICY_FIXED) {
+        return FIXED_DELAY_MS;
+    }
+
+    uint32_t ceiling = mqtt_backoff_ceiling(&device->backoff);
+    uint32_t delay = mqtt_backoff_next(&device->backoff, rng_next());
+    if (delay > ceiling || ceiling > BACKOFF_CAP_MS) {
+        printf("FAIL: delay %lu ms above ceiling %lu ms\n", (unsigned long)delay, (unsigned long)ceiling);
+        failed = true;
+    }
+    return delay;
+}
+
+static void simulate(const char *label, policy_t policy, unsigned devices, uint32_t outage_ms, unsigned capacity) {
+    device_t *fleet = calloc(devices, sizeof(*fleet));
+    uint64_t attempts = 0;
+    unsigned connected = 0;
+    unsigned peak = 0;
+    unsigned window_attempts = 0;
+    unsigned window_accepted = 0;
+    unsigned window_capacity = capacity * SIM_WINDOW_MS / 1000 > 0 ? capacity * SIM_WINDOW_MS / 1000 : 1;
+    uint32_t half_ms = 0;
+    uint32_t all_ms = 0;
+
+    // Every device notices the lost connection at t = 0 and schedules its first retry
+    for (unsigned i = 0; i < devices; i++) {
+        mqtt_backoff_init(&fleet[i].backoff, BACKOFF_BASE_MS, BACKOFF_CAP_MS);
+        fleet[i].next_attempt_ms = retry_delay(&fleet[i], policy);
+    }
+
+    uint32_t t;
+    for (t = 0; t < SIM_LIMIT_MS && connected < devices; t += SIM_TICK_MS) {
+        if (t % SIM_WINDOW_MS == 0) {
+            window_attempts = 0;
+            window_accepted = 0;
+        }
+
+        for (unsigned i = 0; i < devices; i++) {
+            device_t *device = &fleet[i];
+            if (device->connected || device->next_attempt_ms > t) {
+                continue;
+            }
+
+            attempts++;
+            window_attempts++;
+            if (t >= outage_ms && window_accepted < window_capacity) {
+                window_accepted++;
+                device->connected = true;
+                connected++;
+            } else {
+                device->next_attempt_ms = t + retry_delay(device, policy);
+            }
+        }
+
+        if (window_attempts > peak) {
+            peak = window_attempts;
+        }
+        if (half_ms == 0 && connected * 2 >= devices) {
+            half_ms = t;
+        }
+    }
+    all_ms = t;
+
+    printf("%-8s %8" PRIu64 " attempts, peak %5u per 100 ms, half back after %6.1f s, all after %6.1f s%s\n", label, attempts, peak,
+        half_ms / 1000.0, all_ms / 1000.0, connected < devices ? " (not all reconnected)" : "");
+    free(fleet);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [--devices N] [--outage S] [--capacity N] [--seed N]\n"
+        "  --devices N   devices connected to the broker (default 500)\n"
+        "  --outage S    seconds the broker is down (default 30)\n"
+        "  --capacity N  connections the restarted broker accepts per second (default 50)\n"
+        "  --seed N      random seed of the jitter (default 1)\n",
+        argv0);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"devices", required_argument, NULL, 'd'},
+        {"outage", required_argument, NULL, 'o'},
+        {"capacity", required_argument, NULL, 'c'},
+        {"seed", required_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0},
+    };
+
+    unsigned devices = 500;
+    double outage_s = 30.0;
+    unsigned capacity = 50;
+    uint32_t seed = 1;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            devices = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            outage_s = atof(optarg);
+            break;
+        case 'c':
+            capacity = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            seed = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    // The ceiling doubles from the base up to the cap and restarts after a reset
+    mqtt_backoff_t backoff;
+    mqtt_backoff_init(&backoff, BACKOFF_BASE_MS, BACKOFF_CAP_MS);
+    for (uint32_t expected = BACKOFF_BASE_MS, i = 0; i < 40; i++) {
+        if (mqtt_backoff_ceiling(&backoff) != expected) {
+            printf("FAIL: ceiling %lu ms after %lu retries, expected %lu ms\n", (unsigned long)mqtt_backoff_ceiling(&backoff),
+                (unsigned long)i, (unsigned long)expected);
+            failed = true;
+        }
+        if (mqtt_backoff_next(&backoff, UINT32_MAX) != expected) {
+            printf("FAIL: largest delay is not the ceiling\n");
+            failed = true;
+        }
+        expected = expected * 2 < BACKOFF_CAP_MS ? expected * 2 : BACKOFF_CAP_MS;
+    }
+    mqtt_backoff_reset(&backoff);
+    if (mqtt_backoff_ceiling(&backoff) != BACKOFF_BASE_MS || mqtt_backoff_next(&backoff, 0) != 0) {
+        printf("FAIL: reset does not restart at the base\n");
+        failed = true;
+    }
+
+    printf("%u devices, broker down for %.0f s, then accepting %u connections/s\n", devices, outage_s, capacity);
+    rng_state = seed ? seed : 1;
+    simulate("fixed", POLICY_FIXED, devices, (uint32_t)(outage_s * 1000), capacity);
+    rng_state = seed ? seed : 1;
+    simulate("backoff", POLICY_BACKOFF, devices, (uint32_t)(outage_s * 1000), capacity);
+
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,266 @@
+#include "sensor_columnar.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+
+static const char *TAG = "sensor_columnar";
+
+// Fixed-point encodings: stored = round((value - offset) * scale)
+#define TEMPERATURE_SCALE 100.0f
+#define PRESSURE_OFFSET   30000.0f
+#define PRESSURE_SCALE    0.5f
+#define HUNDREDTHS_SCALE  100.0f
+#define CO2_SCALE         2.0f
+#define VOC_SCALE         50.0f
+
+#define U16_COLUMNS 9 // time_delta + eight measurement columns
+
+static uint32_t round_capacity(uint32_t capacity) {
+    uint32_t rounded = (capacity + SENSOR_COLUMNAR_ANCHOR_INTERVAL - 1) / SENSOR_COLUMNAR_ANCHOR_INTERVAL * SENSOR_COLUMNAR_ANCHOR_INTERVAL;
+    // At least two anchor blocks, so the partially overwritten block can be decoded from the next one
+    return rounded < 2 * SENSOR_COLUMNAR_ANCHOR_INTERVAL ? 2 * SENSOR_COLUMNAR_ANCHOR_INTERVAL : rounded;
+}
+
+static uint16_t quantize_u16(float value, float offset, float scale) {
+    float q = roundf((value - offset) * scale);
+    if (!(q > 0.0f)) {
+        return 0; // Also maps NaN to zero
+    }
+    return q >= UINT16_MAX ? UINT16_MAX : (uint16_t)q;
+}
+
+static int16_t quantize_i16(float value, float scale) {
+    float q = roundf(value * scale);
+    if (isnan(q)) {
+        return 0;
+    }
+    if (q <= INT16_MIN) {
+        return INT16_MIN;
+    }
+    return q >= INT16_MAX ? INT16_MAX : (int16_t)q;
+}
+
+static inline uint32_t slot_for_age(const sensor_columnar_t *ring, uint32_t age) {
+    return (ring->write_index + ring->capacity - 1 - age) % ring->capacity;
+}
+
+size_t sensor_columnar_storage_size(uint32_t capacity) {
+    uint32_t rounded = round_capacity(capacity);
+    return (size_t)rounded / SENSOR_COLUMNAR_ANCHOR_INTERVAL * sizeof(uint32_t) + (size_t)rounded * U16_COLUMNS * sizeof(uint16_t) +
+           (size_t)rounded * sizeof(uint8_t);
+}
+
+bool sensor_columnar_init(sensor_columnar_t *ring, uint32_t capacity) {
+    if (ring == NULL || capacity == 0) {
+        ESP_LOGE(TAG, "Invalid columnar ring arguments");
+        return false;
+    }
+
+    memset(ring, 0, sizeof(sensor_columnar_t));
+    capacity = round_capacity(capacity);
+
+    // One allocation, widest columns first so every column stays aligned
+    size_t size = sensor_columnar_storage_size(capacity);
+    uint8_t *storage = calloc(1, size);
+    if (storage == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for %lu samples", (unsigned)size, (unsigned long)capacity);
+        return false;
+    }
+
+    ring->capacity = capacity;
+    ring->anchors = (uint32_t *)storage;
+    uint16_t *column = (uint16_t *)(ring->anchors + capacity / SENSOR_COLUMNAR_ANCHOR_INTERVAL);
+    ring->time_delta = column;
+    ring->temperature = (int16_t *)(column += capacity);
+    ring->pressure = (column += capacity);
+    ring->humidity = (column += capacity);
+    ring->iaq = (column += capacity);
+    ring->static_iaq = (column += capacity);
+    ring->co2 = (column += capacity);
+    ring->voc = (column += capacity);
+    ring->gas_percentage = (column += capacity);
+    ring->status = (uint8_t *)(column + capacity);
+
+    ESP_LOGI(TAG, "Columnar ring initialized (%lu samples, %u bytes)", (unsigned long)capacity, (unsigned)size);
+    return true;
+}
+
+void sensor_columnar_deinit(sensor_columnar_t *ring) {
+    if (ring == NULL) {
+        return;
+    }
+
+    free(ring->anchors);
+    memset(ring, 0, sizeof(sensor_columnar_t));
+}
+
+void sensor_columnar_add(sensor_columnar_t *ring, const bme690_data_t *data) {
+    if (ring == NULL || ring->anchors == NULL || data == NULL) {
+        ESP_LOGE(TAG, "Cannot add to NULL ring or NULL data");
+        return;
+    }
+
+    uint32_t slot = ring->write_index;
+
+    if (slot % SENSOR_COLUMNAR_ANCHOR_INTERVAL == 0) {
+        ring->anchors[slot / SENSOR_COLUMNAR_ANCHOR_INTERVAL] = data->timestamp;
+    }
+    uint32_t delta = ring->sample_count > 0 ? data->timestamp - ring->last_timestamp : 0;
+    ring->time_delta[slot] = delta > UINT16_MAX ? UINT16_MAX : (uint16_t)delta;
+    ring->last_timestamp = data->timestamp;
+
+    ring->temperature[slot] = quantize_i16(data->temperature, TEMPERATURE_SCALE);
+    ring->pressure[slot] = quantize_u16(data->pressure, PRESSURE_OFFSET, PRESSURE_SCALE);
+    ring->humidity[slot] = quantize_u16(data->humidity, 0.0f, HUNDREDTHS_SCALE);
+    ring->iaq[slot] = quantize_u16(data->iaq, 0.0f, HUNDREDTHS_SCALE);
+    ring->static_iaq[slot] = quantize_u16(data->static_iaq, 0.0f, HUNDREDTHS_SCALE);
+    ring->co2[slot] = quantize_u16(data->co2_equivalent, 0.0f, CO2_SCALE);
+    ring->voc[slot] = quantize_u16(data->breath_voc_equivalent, 0.0f, VOC_SCALE);
+    ring->gas_percentage[slot] = quantize_u16(data->gas_percentage, 0.0f, HUNDREDTHS_SCALE);
+    ring->status[slot] = (data->iaq_accuracy & SENSOR_COLUMNAR_STATUS_ACCURACY_MASK) |
+                         (data->stabilization_status ? SENSOR_COLUMNAR_STATUS_STABILIZED : 0) |
+                         (data->run_in_status ? SENSOR_COLUMNAR_STATUS_RUN_IN : 0);
+
+    ring->write_index = (slot + 1) % ring->capacity;
+    if (ring->sample_count < ring->capacity) {
+        ring->sample_count++;
+    }
+    ring->total_samples++;
+}
+
+uint32_t sensor_columnar_timestamp(const sensor_columnar_t *ring, uint32_t age) {
+    if (ring == NULL || age >= ring->sample_count) {
+        return 0;
+    }
+    if (age == 0) {
+        return ring->last_timestamp;
+    }
+
+    uint32_t slot = slot_for_age(ring, age);
+    uint32_t newest = slot_for_age(ring, 0);
+    uint32_t block_start = slot - slot % SENSOR_COLUMNAR_ANCHOR_INTERVAL;
+    uint32_t timestamp;
+
+    if (block_start != newest - newest % SENSOR_COLUMNAR_ANCHOR_INTERVAL || slot <= newest) {
+        // Anchor belongs to the same lap: walk forward from the block start
+        timestamp = ring->anchors[block_start / SENSOR_COLUMNAR_ANCHOR_INTERVAL];
+        for (uint32_t i = block_start + 1; i <= slot; i++) {
+            timestamp += ring->time_delta[i];
+        }
+    } else {
+        // Older part of the block being overwritten: walk back from the next anchor
+        uint32_t next_start = (block_start + SENSOR_COLUMNAR_ANCHOR_INTERVAL) % ring->capacity;
+        timestamp = ring->anchors[next_start / SENSOR_COLUMNAR_ANCHOR_INTERVAL] - ring->time_delta[next_start];
+        for (uint32_t i = block_start + SENSOR_COLUMNAR_ANCHOR_INTERVAL - 1; i > slot; i--) {
+            timestamp -= ring->time_delta[i];
+        }
+    }
+
+    return timestamp;
+}
+
+bool sensor_columnar_get(const sensor_columnar_t *ring, uint32_t age, bme690_data_t *out) {
+    if (ring == NULL || out == NULL || age >= ring->sample_count) {
+        return false;
+    }
+
+    uint32_t slot = slot_for_age(ring, age);
+    uint8_t status = ring->status[slot];
+
+    *out = (bme690_data_t){
+        .temperature = ring->temperature[slot] / TEMPERATURE_SCALE,
+        .pressure = ring->pressure[slot] / PRESSURE_SCALE + PRESSURE_OFFSET,
+        .humidity = ring->humidity[slot] / HUNDREDTHS_SCALE,
+        .iaq = ring->iaq[slot] / HUNDREDTHS_SCALE,
+        .iaq_accuracy = status & SENSOR_COLUMNAR_STATUS_ACCURACY_MASK,
+        .co2_equivalent = ring->co2[slot] / CO2_SCALE,
+        .breath_voc_equivalent = ring->voc[slot] / VOC_SCALE,
+        .static_iaq = ring->static_iaq[slot] / HUNDREDTHS_SCALE,
+        .gas_percentage = ring->gas_percentage[slot] / HUNDREDTHS_SCALE,
+        .stabilization_status = (status & SENSOR_COLUMNAR_STATUS_STABILIZED) != 0,
+        .run_in_status = (status & SENSOR_COLUMNAR_STATUS_RUN_IN) != 0,
+        .timestamp = sensor_columnar_timestamp(ring, age),
+    };
+    return true;
+}
+
+// Sum a run of one column in blocks a 32-bit sum cannot overflow in, so the inner loops vectorize
+#define SUM_BLOCK 65536
+
+static int64_t run_sum_u16(const uint16_t *values, uint32_t count) {
+    int64_t total = 0;
+    for (uint32_t start = 0; start < count; start += SUM_BLOCK) {
+        uint32_t end = count - start < SUM_BLOCK ? count : start + SUM_BLOCK;
+        uint32_t sum = 0;
+        for (uint32_t i = start; i < end; i++) {
+            sum += values[i];
+        }
+        total += sum;
+    }
+    return total;
+}
+
+static int64_t run_sum_i16(const int16_t *values, uint32_t count) {
+    int64_t total = 0;
+    for (uint32_t start = 0; start < count; start += SUM_BLOCK) {
+        uint32_t end = count - start < SUM_BLOCK ? count : start + SUM_BLOCK;
+        int32_t sum = 0;
+        for (uint32_t i = start; i < end; i++) {
+            sum += values[i];
+        }
+        total += sum;
+    }
+    return total;
+}
+
+// Sum the latest samples of one column; the range wraps at most once
+static int64_t column_sum_u16(const uint16_t *column, uint32_t start, uint32_t first, uint32_t second) {
+    return run_sum_u16(column + start, first) + run_sum_u16(column, second);
+}
+
+static int64_t column_sum_i16(const int16_t *column, uint32_t start, uint32_t first, uint32_t second) {
+    return run_sum_i16(column + start, first) + run_sum_i16(column, second);
+}
+
+bme690_data_t sensor_columnar_get_averaged(const sensor_columnar_t *ring, uint32_t samples) {
+    bme690_data_t averaged = {0};
+
+    if (ring == NULL || ring->sample_count == 0) {
+        ESP_LOGW(TAG, "Cannot get average from empty ring");
+        return averaged;
+    }
+
+    if (samples == 0 || samples > ring->sample_count) {
+        samples = ring->sample_count;
+    }
+
+    // Latest sample as base for the non-averaged fields
+    sensor_columnar_get(ring, 0, &averaged);
+
+    uint32_t start = slot_for_age(ring, samples - 1);
+    uint32_t first = start + samples <= ring->capacity ? samples : ring->capacity - start;
+    uint32_t second = samples - first;
+
+    uint32_t accuracy = 0;
+    for (uint32_t i = 0; i < first; i++) {
+        accuracy += ring->status[start + i] & SENSOR_COLUMNAR_STATUS_ACCURACY_MASK;
+    }
+    for (uint32_t i = 0; i < second; i++) {
+        accuracy += ring->status[i] & SENSOR_COLUMNAR_STATUS_ACCURACY_MASK;
+    }
+
+    double n = samples;
+    averaged.temperature = (float)(column_sum_i16(ring->temperature, start, first, second) / n / TEMPERATURE_SCALE);
+    averaged.pressure = (float)(column_sum_u16(ring->pressure, start, first, second) / n / PRESSURE_SCALE + PRESSURE_OFFSET);
+    averaged.humidity = (float)(column_sum_u16(ring->humidity, start, first, second) / n / HUNDREDTHS_SCALE);
+    averaged.iaq = (float)(column_sum_u16(ring->iaq, start, first, second) / n / HUNDREDTHS_SCALE);
+    averaged.iaq_accuracy = (uint8_t)(accuracy / n + 0.5); // Round to nearest
+    averaged.co2_equivalent = (float)(column_sum_u16(ring->co2, start, first, second) / n / CO2_SCALE);
+    averaged.breath_voc_equivalent = (float)(column_sum_u16(ring->voc, start, first, second) / n / VOC_SCALE);
+
+    ESP_LOGD(TAG, "Generated averaged BME690 data from %lu columnar samples", (unsigned long)samples);
+
+    return averaged;
+}
@@ -0,0 +1,132 @@
+/**
+ * @file sensor_columnar.h
+ * @brief Columnar, quantized BME690 history ring
+ *
+ * Stores each field in its own fixed-point column instead of full
+ * bme690_data_t copies: 16-bit values for the measurements, one packed status
+ * byte and a 16-bit timestamp delta per sample, plus a 32-bit timestamp anchor
+ * every SENSOR_COLUMNAR_ANCHOR_INTERVAL samples. That is about 19 bytes per
+ * sample instead of 44, and averaging scans touch only the columns they need.
+ *
+ * Resolution per column:
+ *   temperature        0.01 °C      (-327.68 .. 327.67)
+ *   pressure           2 Pa         (30000 .. 161070)
+ *   humidity           0.01 %RH
+ *   iaq, static_iaq    0.01
+ *   co2_equivalent     0.5 ppm      (0 .. 32767)
+ *   breath_voc         0.02 ppm     (0 .. 1310)
+ *   gas_percentage     0.01 %
+ * Values outside a column's range saturate. So do timestamp deltas above
+ * 65.5 s: after such a gap, timestamps read back early by the excess until the
+ * next anchor.
+ *
+ * Host only: 24 h of samples at one per second take about 1.65 MB, more than
+ * the internal RAM of the ESP32-S3, and the Polverine is built without PSRAM
+ * (CONFIG_SPIRAM is not set). The firmware averages with the running sums of
+ * sensor_buffer.c and keeps its long term history downsampled in
+ * sensor_history.c. sensor_replay uses the ring to compare its footprint and
+ * averaging scans with full bme690_data_t copies.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sensor_data_broker.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Samples per absolute timestamp anchor; capacity is rounded up to a multiple
+#define SENSOR_COLUMNAR_ANCHOR_INTERVAL 32
+
+// Packed status byte layout
+#define SENSOR_COLUMNAR_STATUS_ACCURACY_MASK 0x03
+#define SENSOR_COLUMNAR_STATUS_STABILIZED    0x04
+#define SENSOR_COLUMNAR_STATUS_RUN_IN        0x08
+
+/**
+ * @brief Columnar BME690 history ring
+ */
+typedef struct {
+    uint32_t capacity;
+    uint32_t write_index;
+    uint32_t sample_count;
+    uint32_t total_samples;
+    uint32_t last_timestamp;
+
+    // Columns, capacity entries each (anchors: capacity / ANCHOR_INTERVAL)
+    uint32_t *anchors;
+    uint16_t *time_delta; // ms since previous sample, saturating
+    int16_t *temperature;
+    uint16_t *pressure;
+    uint16_t *humidity;
+    uint16_t *iaq;
+    uint16_t *static_iaq;
+    uint16_t *co2;
+    uint16_t *voc;
+    uint16_t *gas_percentage;
+    uint8_t *status;
+} sensor_columnar_t;
+
+/**
+ * @brief Bytes of column storage needed for a given capacity
+ * @param capacity Number of samples
+ * @return Size in bytes after rounding capacity to the anchor interval
+ */
+size_t sensor_columnar_storage_size(uint32_t capacity);
+
+/**
+ * @brief Allocate and initialize a columnar ring
+ * @param ring Ring to initialize
+ * @param capacity Number of samples, rounded up to SENSOR_COLUMNAR_ANCHOR_INTERVAL
+ * @return True on success, false on invalid arguments or allocation failure
+ */
+bool sensor_columnar_init(sensor_columnar_t *ring, uint32_t capacity);
+
+/**
+ * @brief Release the storage of a columnar ring
+ * @param ring Ring to release
+ */
+void sensor_columnar_deinit(sensor_columnar_t *ring);
+
+/**
+ * @brief Quantize a sample into the ring, overwriting the oldest when full
+ * @param ring Ring
+ * @param data Sample to add
+ */
+void sensor_columnar_add(sensor_columnar_t *ring, const bme690_data_t *data);
+
+/**
+ * @brief Decode a stored sample
+ * @param ring Ring
+ * @param age 0 for the latest sample, 1 for the one before, ...
+ * @param out Decoded sample
+ * @return True if a sample of that age is stored
+ */
+bool sensor_columnar_get(const sensor_columnar_t *ring, uint32_t age, bme690_data_t *out);
+
+/**
+ * @brief Timestamp of a stored sample
+ * @param ring Ring
+ * @param age 0 for the latest sample, 1 for the one before, ...
+ * @return Timestamp in milliseconds, 0 if no sample of that age is stored
+ */
+uint32_t sensor_columnar_timestamp(const sensor_columnar_t *ring, uint32_t age);
+
+/**
+ * @brief Average the latest samples
+ * Averages the same fields as bme690_buffer_get_averaged(), all other fields
+ * come from the latest sample.
+ * @param ring Ring
+ * @param samples Number of latest samples to average (clamped to the stored count)
+ * @return Averaged sensor data, zeroed if the ring is empty
+ */
+bme690_data_t sensor_columnar_get_averaged(const sensor_columnar_t *ring, uint32_t samples);
+
+#ifdef __cplusplus
+}
+#endif
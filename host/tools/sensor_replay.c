@@ -0,0 +1,568 @@
+/**
+ * @file sensor_replay.c
+ * @brief Replays a recorded sensor trace through the real sensor pipeline
+ *
+ * BME690 records go through the same path as output_ready() in bme690_main.c
+ * (sensor buffer, statistics windows, BMV080-gated averaging, broker publish).
+ * Outside of the timed path they are also kept in a 24 h columnar history
+ * ring and as full bme690_data_t copies, to compare footprint and the cost
+ * of averaging the latest samples of both layouts.
+ * BMV080 records through the same path as bmv080_data_ready() in
+ * bmv080_main.c. The MQTT
+ * payload builders are registered as broker subscribers so that the measured
+ * cost covers the data path up to the point where a payload is handed to the
+ * MQTT client. With --batch the state payloads are batched like in
+ * mqtt_main.c, using the sample timestamps as clock, to compare message rates.
+ * With --deadband-bme690/--deadband-bmv080 the samples first pass the change
+ * filter and its suppression counters are reported.
+ *
+ * Usage:
+ *   sensor_replay [--speed N] [--loops N] [--batch N] [--batch-age S]
+ *                 [--deadband-bme690 SPEC] [--deadband-bmv080 SPEC] [--heartbeat S] <trace>
+ *   sensor_replay --generate <trace> [--hours N] [--seed N]
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "mqtt_batch.h"
+#include "mqtt_deadband.h"
+#include "mqtt_payload.h"
+#include "polverine_cfg.h"
+#include "sensor_aggregate.h"
+#include "sensor_buffer.h"
+#include "sensor_columnar.h"
+#include "sensor_data_broker.h"
+#include "sensor_trace.h"
+
+static const char *TAG = "replay";
+
+#define REPLAY_HISTORY_SAMPLES (24 * 3600)
+
+// Pipeline state mirrored from bme690_main.c / bmv080_main.c
+static bme690_sensor_buffer_t sensor_buffer;
+static sensor_aggregator_t bme690_aggregator;
+static sensor_aggregator_t bmv080_aggregator;
+static sensor_columnar_t history;
+static bme690_data_t *history_aos; // The same samples as full copies, REPLAY_HISTORY_SAMPLES of them
+static uint32_t history_aos_next;
+static uint32_t history_aos_count;
+static volatile bool flBMV080Published = false;
+
+// Consumer side statistics
+static uint64_t bme690_payloads = 0;
+static uint64_t bmv080_payloads = 0;
+static uint64_t stats_payloads = 0;
+static uint64_t payload_bytes = 0;
+
+// MQTT messages the state payloads turn into, see mqtt_publish_state()
+static bool batching = false;
+static mqtt_batch_t bme690_batch;
+static mqtt_batch_t bmv080_batch;
+static uint64_t state_messages = 0;
+static uint64_t state_bytes = 0;
+static uint64_t batch_errors = 0;
+
+// Change filters, see mqtt_deadband_pass()
+static mqtt_deadband_t bme690_deadband;
+static mqtt_deadband_t bmv080_deadband;
+static bool bme690_filtering = false;
+static bool bmv080_filtering = false;
+
+// Batch array plus the newest sample on the state topic
+static void replay_batch_flush(const uint8_t *payload, size_t len, uint16_t count, void *ctx) {
+    const mqtt_batch_t *batch = ctx;
+    if (len < 2 || payload[0] != '[' || payload[len - 1] != ']' || batch->last_offset + batch->last_len >= len) {
+        batch_errors++;
+    }
+    state_messages += 2;
+    state_bytes += len + batch->last_len;
+}
+
+static void replay_state_publish(mqtt_batch_t *batch, const char *payload, size_t len, uint32_t timestamp_ms) {
+    if (!batching) {
+        state_messages++;
+        state_bytes += len;
+    } else if (!mqtt_batch_add(batch, payload, len, timestamp_ms, replay_batch_flush, batch)) {
+        batch_errors++;
+    }
+}
+
+static void replay_bme690_handler(const sensor_sample_t *sample, void *ctx) {
+    const bme690_data_t *data = sensor_sample_data(sample);
+    if (bme690_filtering && !mqtt_deadband_check(&bme690_deadband, data, sample->flags, data->timestamp)) {
+        return;
+    }
+    char payload[320];
+    int written = mqtt_payload_bme690(payload, sizeof(payload), data, sample->flags & SENSOR_SAMPLE_AVERAGED);
+    if (written > 0 && written < (int)sizeof(payload)) {
+        bme690_payloads++;
+        payload_bytes += written;
+        replay_state_publish(&bme690_batch, payload, written, data->timestamp);
+    }
+}
+
+static void replay_bmv080_handler(const sensor_sample_t *sample, void *ctx) {
+    const bmv080_data_t *data = sensor_sample_data(sample);
+    if (bmv080_filtering && !mqtt_deadband_check(&bmv080_deadband, data, sample->flags, data->timestamp)) {
+        return;
+    }
+    char payload[192];
+    int written = mqtt_payload_bmv080(payload, sizeof(payload), data);
+    if (written > 0 && written < (int)sizeof(payload)) {
+        bmv080_payloads++;
+        payload_bytes += written;
+        replay_state_publish(&bmv080_batch, payload, written, data->timestamp);
+    }
+}
+
+static void replay_stats_handler(const sensor_sample_t *sample, void *ctx) {
+    char payload[1280];
+    int written = mqtt_payload_stats(payload, sizeof(payload), sensor_sample_data(sample));
+    if (written > 0 && written < (int)sizeof(payload)) {
+        stats_payloads++;
+        payload_bytes += written;
+    }
+}
+
+// Equivalent of output_ready() without the BSEC state handling and logging
+static void replay_output_ready(const bme690_data_t *sensor_data) {
+    bme690_buffer_add(&sensor_buffer, sensor_data);
+    sensor_aggregator_add(&bme690_aggregator, sensor_data, sensor_data->timestamp);
+
+    if (!PVLN_CFG_BSEC_OUTPUT_UPDATE_GATED_BY_BMV080) {
+        sensor_broker_publish(SENSOR_TYPE_BME690, sensor_data, 0);
+    } else if (flBMV080Published) {
+        bme690_data_t averaged = bme690_buffer_get_averaged(&sensor_buffer);
+        flBMV080Published = false;
+        sensor_broker_publish(SENSOR_TYPE_BME690, &averaged, SENSOR_SAMPLE_AVERAGED);
+    }
+}
+
+// Equivalent of bmv080_data_ready()
+static void replay_bmv080_data_ready(const bmv080_data_t *sensor_data) {
+    sensor_broker_publish(SENSOR_TYPE_BMV080, sensor_data, 0);
+    sensor_aggregator_add(&bmv080_aggregator, sensor_data, sensor_data->timestamp);
+    flBMV080Published = true;
+}
+
+static void history_add(const bme690_data_t *sensor_data) {
+    sensor_columnar_add(&history, sensor_data);
+    history_aos[history_aos_next] = *sensor_data;
+    history_aos_next = (history_aos_next + 1) % REPLAY_HISTORY_SAMPLES;
+    if (history_aos_count < REPLAY_HISTORY_SAMPLES) {
+        history_aos_count++;
+    }
+}
+
+// Average the latest samples of the full copies, the fields sensor_columnar_get_averaged() averages
+static bme690_data_t history_aos_averaged(uint32_t samples) {
+    bme690_data_t averaged = history_aos[(history_aos_next + REPLAY_HISTORY_SAMPLES - 1) % REPLAY_HISTORY_SAMPLES];
+    double sum[7] = {0};
+    uint32_t index = (history_aos_next + REPLAY_HISTORY_SAMPLES - samples) % REPLAY_HISTORY_SAMPLES;
+    for (uint32_t i = 0; i < samples; i++) {
+        const bme690_data_t *sample = &history_aos[index];
+        sum[0] += sample->temperature;
+        sum[1] += sample->pressure;
+        sum[2] += sample->humidity;
+        sum[3] += sample->iaq;
+        sum[4] += sample->iaq_accuracy;
+        sum[5] += sample->co2_equivalent;
+        sum[6] += sample->breath_voc_equivalent;
+        index = index + 1 == REPLAY_HISTORY_SAMPLES ? 0 : index + 1;
+    }
+
+    averaged.temperature = (float)(sum[0] / samples);
+    averaged.pressure = (float)(sum[1] / samples);
+    averaged.humidity = (float)(sum[2] / samples);
+    averaged.iaq = (float)(sum[3] / samples);
+    averaged.iaq_accuracy = (uint8_t)(sum[4] / samples + 0.5);
+    averaged.co2_equivalent = (float)(sum[5] / samples);
+    averaged.breath_voc_equivalent = (float)(sum[6] / samples);
+    return averaged;
+}
+
+// Time averaging the latest samples of both layouts and check they agree within the columns' resolution
+static bool compare_averaging(void) {
+    const uint32_t windows[] = {60, 3600, REPLAY_HISTORY_SAMPLES};
+    bool agree = true;
+
+    for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+        if (w > 0 && windows[w - 1] >= history_aos_count) {
+            break; // Already averaged all of them
+        }
+        uint32_t samples = windows[w] < history_aos_count ? windows[w] : history_aos_count;
+        if (samples == 0) {
+            break;
+        }
+        unsigned repeat = 20000000u / samples + 1;
+
+        bme690_data_t aos = {0};
+        int64_t t0 = esp_timer_get_time();
+        for (unsigned r = 0; r < repeat; r++) {
+            aos = history_aos_averaged(samples);
+        }
+        int64_t t1 = esp_timer_get_time();
+        bme690_data_t columnar = {0};
+        for (unsigned r = 0; r < repeat; r++) {
+            columnar = sensor_columnar_get_averaged(&history, samples);
+        }
+        int64_t t2 = esp_timer_get_time();
+
+        // Half a step of each column, the mean of rounded values is off by at most that
+        bool same = fabsf(aos.temperature - columnar.temperature) <= 0.005f + 1e-4f &&
+                    fabsf(aos.pressure - columnar.pressure) <= 1.0f + 0.02f && fabsf(aos.humidity - columnar.humidity) <= 0.005f + 1e-4f &&
+                    fabsf(aos.iaq - columnar.iaq) <= 0.005f + 1e-4f && aos.iaq_accuracy == columnar.iaq_accuracy &&
+                    fabsf(aos.co2_equivalent - columnar.co2_equivalent) <= 0.25f + 1e-3f &&
+                    fabsf(aos.breath_voc_equivalent - columnar.breath_voc_equivalent) <= 0.01f + 1e-4f;
+        if (!same) {
+            ESP_LOGE(TAG, "Columnar average of %lu samples differs: temperature %.3f/%.3f, pressure %.1f/%.1f, co2 %.2f/%.2f",
+                (unsigned long)samples, aos.temperature, columnar.temperature, aos.pressure, columnar.pressure, aos.co2_equivalent,
+                columnar.co2_equivalent);
+            agree = false;
+        }
+
+        double aos_us = (double)(t1 - t0) / repeat;
+        double columnar_us = (double)(t2 - t1) / repeat;
+        printf("average %6lu:   AoS %9.2f us, columnar %9.2f us (%.1fx)\n", (unsigned long)samples, aos_us, columnar_us,
+            columnar_us > 0 ? aos_us / columnar_us : 0.0);
+    }
+    return agree;
+}
+
+static void sleep_until_us(int64_t deadline_us) {
+    int64_t remaining = deadline_us - esp_timer_get_time();
+    if (remaining > 0) {
+        struct timespec ts = {.tv_sec = remaining / 1000000, .tv_nsec = (remaining % 1000000) * 1000};
+        nanosleep(&ts, NULL);
+    }
+}
+
+static int replay(const char *path, double speed, unsigned loops, const mqtt_batch_limits_t *batch_limits) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        ESP_LOGE(TAG, "Cannot open %s", path);
+        return 1;
+    }
+
+    batching = batch_limits->max_samples > 1;
+    if (batching && (!mqtt_batch_init(&bme690_batch, &mqtt_batch_json, batch_limits, MQTT_BATCH_DEFAULT_CAPACITY) ||
+                        !mqtt_batch_init(&bmv080_batch, &mqtt_batch_json, batch_limits, MQTT_BATCH_DEFAULT_CAPACITY))) {
+        fclose(file);
+        return 1;
+    }
+
+    sensor_broker_init();
+    // Queued like the firmware's MQTT subscribers, but blocking instead of dropping so payload counts are deterministic
+    const sensor_subscriber_config_t subscriptions[] = {
+        {.name = "replay_bme690", .type = SENSOR_TYPE_BME690, .callback = replay_bme690_handler, .overflow = SENSOR_OVERFLOW_BLOCK},
+        {.name = "replay_bmv080", .type = SENSOR_TYPE_BMV080, .callback = replay_bmv080_handler, .overflow = SENSOR_OVERFLOW_BLOCK},
+        {.name = "replay_bme690_stats", .type = SENSOR_TYPE_BME690_STATS, .callback = replay_stats_handler, .overflow = SENSOR_OVERFLOW_BLOCK},
+        {.name = "replay_bmv080_stats", .type = SENSOR_TYPE_BMV080_STATS, .callback = replay_stats_handler, .overflow = SENSOR_OVERFLOW_BLOCK},
+    };
+    for (size_t i = 0; i < sizeof(subscriptions) / sizeof(subscriptions[0]); i++) {
+        sensor_broker_subscribe(&subscriptions[i]);
+    }
+    bme690_buffer_init(&sensor_buffer);
+    history_aos = calloc(REPLAY_HISTORY_SAMPLES, sizeof(bme690_data_t));
+    if (history_aos == NULL || !sensor_columnar_init(&history, REPLAY_HISTORY_SAMPLES)) {
+        free(history_aos);
+        fclose(file);
+        return 1;
+    }
+    sensor_aggregator_init(
+        &bme690_aggregator, "bme690", sensor_agg_bme690_fields, sensor_agg_bme690_field_count, sensor_aggregate_publish);
+    sensor_aggregator_init(
+        &bmv080_aggregator, "bmv080", sensor_agg_bmv080_fields, sensor_agg_bmv080_field_count, sensor_aggregate_publish);
+
+    uint64_t records = 0;
+    int64_t busy_us = 0;
+    int64_t wall_start = esp_timer_get_time();
+
+    for (unsigned loop = 0; loop < loops; loop++) {
+        rewind(file);
+        if (!sensor_trace_read_header(file, NULL)) {
+            fclose(file);
+            return 1;
+        }
+
+        sensor_trace_record_t record;
+        int64_t loop_start = esp_timer_get_time();
+        bool first = true;
+        uint32_t first_time_ms = 0;
+
+        while (sensor_trace_read_record(file, &record)) {
+            if (first) {
+                first_time_ms = record.time_ms;
+                first = false;
+            }
+
+            if (speed > 0) {
+                sleep_until_us(loop_start + (int64_t)((record.time_ms - first_time_ms) * 1000.0 / speed));
+            }
+
+            int64_t t0 = esp_timer_get_time();
+            if (record.type == SENSOR_TRACE_BME690) {
+                replay_output_ready(&record.data.bme690);
+            } else {
+                replay_bmv080_data_ready(&record.data.bmv080);
+            }
+            busy_us += esp_timer_get_time() - t0;
+            records++;
+
+            if (record.type == SENSOR_TRACE_BME690) {
+                history_add(&record.data.bme690);
+            }
+        }
+    }
+
+    if (!sensor_broker_flush(5000)) {
+        ESP_LOGW(TAG, "Subscribers did not drain within 5 s");
+    }
+    if (batching) {
+        mqtt_batch_flush(&bme690_batch, replay_batch_flush, &bme690_batch);
+        mqtt_batch_flush(&bmv080_batch, replay_batch_flush, &bmv080_batch);
+    }
+    int64_t wall_us = esp_timer_get_time() - wall_start;
+    fclose(file);
+
+    printf("records:          %" PRIu64 "\n", records);
+    printf("bme690 payloads:  %" PRIu64 "\n", bme690_payloads);
+    printf("bmv080 payloads:  %" PRIu64 "\n", bmv080_payloads);
+    printf("stats payloads:   %" PRIu64 "\n", stats_payloads);
+    printf("payload bytes:    %" PRIu64 "\n", payload_bytes);
+    printf("state messages:   %" PRIu64 " (%" PRIu64 " bytes)\n", state_messages, state_bytes);
+    if (batching) {
+        printf("batches:          bme690 %lu, bmv080 %lu, %" PRIu64 " errors\n", (unsigned long)bme690_batch.flushes,
+            (unsigned long)bmv080_batch.flushes, batch_errors);
+    }
+    if (bme690_filtering || bmv080_filtering) {
+        const char *names[2];
+        const mqtt_deadband_t *filters[2];
+        size_t count = 0;
+        if (bme690_filtering) {
+            names[count] = "bme690";
+            filters[count++] = &bme690_deadband;
+        }
+        if (bmv080_filtering) {
+            names[count] = "bmv080";
+            filters[count++] = &bmv080_deadband;
+        }
+        for (size_t i = 0; i < count; i++) {
+            const mqtt_deadband_t *filter = filters[i];
+            printf("deadband %s:  %lu of %lu published (%.1f%% suppressed, %lu heartbeats)\n", names[i],
+                (unsigned long)filter->published, (unsigned long)filter->samples,
+                filter->samples ? 100.0 * (filter->samples - filter->published) / filter->samples : 0.0,
+                (unsigned long)filter->heartbeats);
+        }
+        char diag[640];
+        int len = mqtt_payload_deadband(diag, sizeof(diag), names, filters, count);
+        if (len > 0 && len < (int)sizeof(diag)) {
+            printf("deadband diag:    %s\n", diag);
+        }
+    }
+    printf("wall time:        %.3f s\n", wall_us / 1e6);
+    printf("pipeline time:    %.3f s\n", busy_us / 1e6);
+    printf("cost per record:  %.1f ns\n", records ? busy_us * 1000.0 / records : 0.0);
+    size_t history_bytes = sensor_columnar_storage_size(REPLAY_HISTORY_SAMPLES);
+    printf("history:          %lu samples, %zu bytes for 24 h (%.1f B/sample, AoS %zu B/sample)\n", (unsigned long)history.sample_count,
+        history_bytes, (double)history_bytes / history.capacity, sizeof(bme690_data_t));
+    bool averages_agree = compare_averaging();
+
+    printf("%-20s %8s %6s %8s %8s %10s\n", "subscriber", "calls", "drops", "avg us", "max us", "latency us");
+    for (unsigned i = 0; i < sensor_broker_subscriber_count(); i++) {
+        sensor_subscriber_stats_t stats;
+        if (sensor_broker_get_subscriber_stats(i, &stats)) {
+            printf("%-20s %8lu %6lu %8lu %8lu %10lu\n", stats.name, (unsigned long)stats.invocations, (unsigned long)stats.drop_count,
+                (unsigned long)stats.callback_avg_us, (unsigned long)stats.callback_max_us, (unsigned long)stats.latency_max_us);
+        }
+    }
+
+    sensor_columnar_deinit(&history);
+    free(history_aos);
+    if (batching) {
+        mqtt_batch_deinit(&bme690_batch);
+        mqtt_batch_deinit(&bmv080_batch);
+    }
+    return batch_errors == 0 && averages_agree ? 0 : 1;
+}
+
+// Small deterministic PRNG so generated traces are reproducible across hosts
+static uint32_t rng_state = 1;
+
+static float rng_uniform(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return (rng_state >> 8) / 16777216.0f;
+}
+
+static float rng_noise(float amplitude) {
+    return (rng_uniform() * 2.0f - 1.0f) * amplitude;
+}
+
+static int generate(const char *path, double hours, uint32_t seed) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL || !sensor_trace_write_header(file)) {
+        ESP_LOGE(TAG, "Cannot create %s", path);
+        if (file != NULL) {
+            fclose(file);
+        }
+        return 1;
+    }
+
+    rng_state = seed ? seed : 1;
+    uint32_t duration_ms = (uint32_t)(hours * 3600.0 * 1000.0);
+    uint32_t bmv080_period_ms = PLVN_CFG_BMV080_DUTY_CYCLE_PERIOD_S * 1000;
+    uint64_t written = 0;
+
+    for (uint32_t t = 0; t < duration_ms; t += 1000) {
+        // Slow diurnal drift plus sensor noise, BSEC continuous mode runs at 1 Hz
+        float phase = (float)(2.0 * M_PI * t / 86400000.0);
+        sensor_trace_record_t record = {.time_ms = t, .type = SENSOR_TRACE_BME690};
+        record.data.bme690 = (bme690_data_t){
+            .temperature = 22.0f + 2.0f * sinf(phase) + rng_noise(0.05f),
+            .pressure = 96500.0f + 150.0f * sinf(phase / 3.0f) + rng_noise(2.0f),
+            .humidity = 45.0f - 5.0f * sinf(phase) + rng_noise(0.2f),
+            .iaq = 60.0f + 30.0f * fabsf(sinf(phase * 4.0f)) + rng_noise(1.0f),
+            .iaq_accuracy = t < 300000 ? 0 : (t < 1800000 ? 1 : 3),
+            .co2_equivalent = 550.0f + 200.0f * fabsf(sinf(phase * 4.0f)) + rng_noise(5.0f),
+            .breath_voc_equivalent = 0.6f + 0.4f * fabsf(sinf(phase * 4.0f)) + rng_noise(0.02f),
+            .static_iaq = 55.0f + 25.0f * fabsf(sinf(phase * 4.0f)) + rng_noise(1.0f),
+            .gas_percentage = 40.0f + 20.0f * sinf(phase * 2.0f) + rng_noise(0.5f),
+            .stabilization_status = t >= 60000,
+            .run_in_status = t >= 600000,
+            .timestamp = t,
+        };
+        written += sensor_trace_write_record(file, &record);
+
+        if (t % bmv080_period_ms == bmv080_period_ms - 1000) {
+            float pm = 8.0f + 6.0f * fabsf(sinf(phase * 3.0f)) + rng_noise(1.0f);
+            record = (sensor_trace_record_t){.time_ms = t, .type = SENSOR_TRACE_BMV080};
+            record.data.bmv080 = (bmv080_data_t){
+                .pm10 = pm * 1.6f,
+                .pm25 = pm,
+                .pm1 = pm * 0.7f,
+                .is_obstructed = false,
+                .is_outside_range = false,
+                .runtime = t / 1000.0f,
+                .timestamp = t,
+            };
+            written += sensor_trace_write_record(file, &record);
+        }
+    }
+
+    fclose(file);
+    printf("wrote %" PRIu64 " records (%.1f h) to %s\n", written, hours, path);
+    return 0;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [--speed N] [--loops N] [--batch N] [--batch-age S]\n"
+        "          [--deadband-bme690 SPEC] [--deadband-bmv080 SPEC] [--heartbeat S] <trace>\n"
+        "       %s --generate <trace> [--hours N] [--seed N]\n"
+        "  --speed N       replay speed factor, 0 replays as fast as possible (default 1000)\n"
+        "  --loops N       replay the trace N times (default 1)\n"
+        "  --batch N       batch up to N state payloads per message (default 1, no batching)\n"
+        "  --batch-age S   flush partial batches after S seconds of trace time (default 60)\n"
+        "  --deadband-bme690 SPEC, --deadband-bmv080 SPEC\n"
+        "                  filter samples by change, e.g. \"temperature=0.1,pressure=0.01%%\"\n"
+        "  --heartbeat S   publish filtered samples at least every S seconds (default 300, 0 for none)\n",
+        argv0, argv0);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"speed", required_argument, NULL, 's'},
+        {"loops", required_argument, NULL, 'l'},
+        {"generate", required_argument, NULL, 'g'},
+        {"hours", required_argument, NULL, 'h'},
+        {"seed", required_argument, NULL, 'r'},
+        {"batch", required_argument, NULL, 'b'},
+        {"batch-age", required_argument, NULL, 'a'},
+        {"deadband-bme690", required_argument, NULL, 'd'},
+        {"deadband-bmv080", required_argument, NULL, 'p'},
+        {"heartbeat", required_argument, NULL, 'k'},
+        {NULL, 0, NULL, 0},
+    };
+
+    double speed = 1000.0;
+    unsigned loops = 1;
+    const char *generate_path = NULL;
+    double hours = 24.0;
+    uint32_t seed = 1;
+    mqtt_batch_limits_t batch_limits = {.max_samples = 1, .max_age_ms = 60000};
+    const char *bme690_spec = NULL;
+    const char *bmv080_spec = NULL;
+    uint32_t heartbeat_ms = 300000;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 's':
+            speed = atof(optarg);
+            break;
+        case 'l':
+            loops = (unsigned)atoi(optarg);
+            break;
+        case 'g':
+            generate_path = optarg;
+            break;
+        case 'h':
+            hours = atof(optarg);
+            break;
+        case 'r':
+            seed = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            batch_limits.max_samples = (uint16_t)atoi(optarg);
+            break;
+        case 'a':
+            batch_limits.max_age_ms = (uint32_t)(atof(optarg) * 1000);
+            break;
+        case 'd':
+            bme690_spec = optarg;
+            break;
+        case 'p':
+            bmv080_spec = optarg;
+            break;
+        case 'k':
+            heartbeat_ms = (uint32_t)(atof(optarg) * 1000);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (generate_path != NULL) {
+        return generate(generate_path, hours, seed);
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    mqtt_deadband_init(&bme690_deadband, mqtt_deadband_bme690_fields, mqtt_deadband_bme690_field_count, heartbeat_ms);
+    mqtt_deadband_init(&bmv080_deadband, mqtt_deadband_bmv080_fields, mqtt_deadband_bmv080_field_count, heartbeat_ms);
+    bme690_filtering = bme690_spec != NULL;
+    bmv080_filtering = bmv080_spec != NULL;
+    if ((bme690_filtering && !mqtt_deadband_parse(&bme690_deadband, bme690_spec)) ||
+        (bmv080_filtering && !mqtt_deadband_parse(&bmv080_deadband, bmv080_spec))) {
+        ESP_LOGE(TAG, "Invalid change filter spec");
+        return 2;
+    }
+
+    return replay(argv[optind], speed, loops, &batch_limits);
+}
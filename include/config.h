@@ -9,6 +9,9 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
+
+#include "sensor_aggregate.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -20,14 +23,57 @@ typedef struct {
     char password[64];
 } polverine_wifi_config_t;
 
+// Encoding of the sensor state payloads
+typedef enum {
+    PAYLOAD_FORMAT_JSON = 0,  // JSON on the state topics (default, required by Home Assistant)
+    PAYLOAD_FORMAT_JSON_CBOR, // JSON plus CBOR on "<state topic>/cbor"
+    PAYLOAD_FORMAT_CBOR,      // CBOR on "<state topic>/cbor" only
+    PAYLOAD_FORMAT_COUNT
+} polverine_payload_format_t;
+
+// Batching limits of one sensor state topic
+typedef struct {
+    uint8_t max_samples; // Samples per batch payload, 0 or 1 publishes every sample
+    uint16_t max_age_s;  // Flush a partial batch after this many seconds, 0 for no limit
+} polverine_batch_config_t;
+
+// Change filter of one sensor state topic, see mqtt_deadband.h
+typedef struct {
+    char spec[96];        // Per-field thresholds, e.g. "temperature=0.1,pressure=0.01%", empty publishes every sample
+    uint16_t heartbeat_s; // Publish at least this often while filtering, 0 for no heartbeat
+} polverine_deadband_config_t;
+
+// QoS policy per message class: 0, 1 or 2 for adaptive, see mqtt_qos.h
+typedef struct {
+    uint8_t state;  // Live sensor state
+    uint8_t batch;  // Batch arrays and the newest sample of each batch
+    uint8_t stats;  // Windowed statistics
+    uint8_t system; // System metrics
+} polverine_qos_config_t;
+
 // Configuration structure for MQTT
 typedef struct {
     char uri[128];
     char username[64];
     char password[64];
     char client_id[32];
+    polverine_payload_format_t payload_format;
+    polverine_batch_config_t batch_bme690;
+    polverine_batch_config_t batch_bmv080;
+    polverine_deadband_config_t deadband_bme690;
+    polverine_deadband_config_t deadband_bmv080;
+    bool mqtt5;                // Connect with MQTT 5 (topic aliases, message expiry), falling back to 3.1.1 if refused
+    uint16_t message_expiry_s; // MQTT 5 message expiry of telemetry, 0 for none
+    polverine_qos_config_t qos;
 } polverine_mqtt_config_t;
 
+// Sensor settings that can be changed at runtime over MQTT, see mqtt_command.h
+typedef struct {
+    uint16_t bmv080_duty_cycle_s;                     // BMV080 duty cycling period
+    bool bme690_gated;                                // Publish the BME690 average once per BMV080 sample instead of every BSEC output
+    uint32_t stats_window_s[SENSOR_AGG_WINDOW_COUNT]; // Statistics window lengths, 0 disables a window
+} polverine_sensor_config_t;
+
 /**
  * Initialize configuration system
  * @return true if successful, false otherwise
@@ -63,6 +109,49 @@ bool config_load_mqtt(polverine_mqtt_config_t *config, const char *device_id);
  */
 bool config_save_mqtt(const polverine_mqtt_config_t *config);
 
+/**
+ * Load the runtime sensor settings from NVS
+ * @param config Pointer to polverine_sensor_config_t structure to fill, defaults for settings never saved
+ * @return true if successful, false otherwise
+ */
+bool config_load_sensor(polverine_sensor_config_t *config);
+
+/**
+ * Save the runtime sensor settings to NVS
+ * @param config Pointer to polverine_sensor_config_t structure to save
+ * @return true if successful, false otherwise
+ */
+bool config_save_sensor(const polverine_sensor_config_t *config);
+
+/**
+ * Load the hash of the Home Assistant discovery messages last published
+ * @param hash Stored hash, 0 if none was stored
+ * @return true if a hash was loaded, false otherwise
+ */
+bool config_load_discovery_hash(uint32_t *hash);
+
+/**
+ * Save the hash of the Home Assistant discovery messages just published
+ * @param hash Hash from mqtt_discovery_hash()
+ * @return true if successful, false otherwise
+ */
+bool config_save_discovery_hash(uint32_t hash);
+
+/**
+ * Get the configuration name of a payload format ("json", "json+cbor", "cbor")
+ * @param format Payload format
+ * @return Name, "json" for unknown values
+ */
+const char *config_payload_format_name(polverine_payload_format_t format);
+
+/**
+ * Parse a payload format name
+ * @param name Name as returned by config_payload_format_name()
+ * @param format Parsed format
+ * @return true if the name is known, false otherwise
+ */
+bool config_payload_format_parse(const char *name, polverine_payload_format_t *format);
+
 /**
  * Clear all configuration from NVS
  * @return true if successful, false otherwise
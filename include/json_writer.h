@@ -0,0 +1,134 @@
+/**
+ * @file json_writer.h
+ * @brief Streaming JSON writer with a fixed output buffer
+ *
+ * Writes compact JSON into a caller supplied buffer and hands each full
+ * buffer to a flush callback, e.g. httpd_resp_send_chunk(), so a document of
+ * any size is produced without heap allocations. Without a flush callback
+ * the document is kept in the buffer, e.g. to serve it again later. Values
+ * inside an object take a key, values inside an array or at the top level
+ * take NULL. Numbers are formatted like cJSON does.
+ *
+ * Errors are sticky: once a flush fails, the document outgrows a buffer
+ * without flush callback or the nesting is too deep, further calls do
+ * nothing and json_writer_finish() returns false.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JSON_WRITER_MAX_DEPTH 8 // Nesting of objects and arrays
+
+/**
+ * @brief Called with a full buffer and once more from json_writer_finish()
+ * @param buf Output written so far
+ * @param len Number of bytes in buf, at least 1
+ * @param ctx Context given to json_writer_init()
+ * @return False to abort the document
+ */
+typedef bool (*json_writer_flush_t)(const char *buf, size_t len, void *ctx);
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len; // Bytes in buf; the document length after finishing without flush callback
+    json_writer_flush_t flush;
+    void *ctx;
+    uint8_t depth;
+    uint32_t nonempty; // Bit per depth, set once the container holds a value
+    bool failed;
+} json_writer_t;
+
+/**
+ * @brief Initialize a writer
+ * @param writer Writer
+ * @param buf Output buffer
+ * @param size Size of buf, at least 1
+ * @param flush Callback receiving the output, NULL to keep the document in buf
+ * @param ctx Context passed to flush
+ */
+void json_writer_init(json_writer_t *writer, char *buf, size_t size, json_writer_flush_t flush, void *ctx);
+
+/**
+ * @brief Open an object
+ * @param writer Writer
+ * @param key Key inside an object, NULL otherwise
+ */
+void json_writer_object_begin(json_writer_t *writer, const char *key);
+
+/**
+ * @brief Close the innermost object
+ * @param writer Writer
+ */
+void json_writer_object_end(json_writer_t *writer);
+
+/**
+ * @brief Open an array
+ * @param writer Writer
+ * @param key Key inside an object, NULL otherwise
+ */
+void json_writer_array_begin(json_writer_t *writer, const char *key);
+
+/**
+ * @brief Close the innermost array
+ * @param writer Writer
+ */
+void json_writer_array_end(json_writer_t *writer);
+
+/**
+ * @brief Write a string
+ * @param writer Writer
+ * @param key Key inside an object, NULL otherwise
+ * @param value String, escaped as needed; NULL writes null
+ */
+void json_writer_string(json_writer_t *writer, const char *key, const char *value);
+
+/**
+ * @brief Write a number
+ * @param writer Writer
+ * @param key Key inside an object, NULL otherwise
+ * @param value Number; NaN and infinities write null
+ */
+void json_writer_number(json_writer_t *writer, const char *key, double value);
+
+/**
+ * @brief Write a number with a fixed number of decimals
+ * @param writer Writer
+ * @param key Key inside an object, NULL otherwise
+ * @param value Number; NaN and infinities write null, magnitudes from 1e15 are written as by json_writer_number()
+ * @param decimals Digits after the decimal point
+ */
+void json_writer_fixed(json_writer_t *writer, const char *key, double value, int decimals);
+
+/**
+ * @brief Write a boolean
+ * @param writer Writer
+ * @param key Key inside an object, NULL otherwise
+ * @param value Value
+ */
+void json_writer_bool(json_writer_t *writer, const char *key, bool value);
+
+/**
+ * @brief Write null
+ * @param writer Writer
+ * @param key Key inside an object, NULL otherwise
+ */
+void json_writer_null(json_writer_t *writer, const char *key);
+
+/**
+ * @brief Flush the remaining output
+ * @param writer Writer
+ * @return True if the document is complete and every flush succeeded
+ */
+bool json_writer_finish(json_writer_t *writer);
+
+#ifdef __cplusplus
+}
+#endif
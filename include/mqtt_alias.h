@@ -0,0 +1,87 @@
+/**
+ * @file mqtt_alias.h
+ * @brief MQTT 5 topic alias bookkeeping for the outgoing state topics
+ *
+ * Each registered topic owns a fixed alias. The first PUBLISH on a connection
+ * carries the topic name together with the alias, after which the broker knows
+ * the mapping and later messages may send an empty topic name with the alias
+ * only. Mappings exist only within a network connection, so they are forgotten
+ * on every connect.
+ *
+ * Only QoS 0 messages use the alias only form. The MQTT client retransmits
+ * unacknowledged QoS 1 messages as encoded after a reconnect, and an alias only
+ * message arriving on the new connection would be a protocol error. QoS 1
+ * messages therefore always carry the topic name, which also announces the
+ * alias again.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQTT_ALIAS_MAX 16
+
+typedef struct {
+    const char *topics[MQTT_ALIAS_MAX]; // Alias i + 1 stands for topics[i]
+    uint8_t count;
+    uint16_t maximum;   // Largest alias usable on the current connection, 0 disables aliases
+    uint32_t announced; // Bit i set once the broker learned alias i + 1 on the current connection
+
+    // Counters
+    uint32_t alias_only;  // Messages sent with an empty topic name
+    uint32_t bytes_saved; // Topic name bytes left out by them
+} mqtt_alias_table_t;
+
+/**
+ * @brief Initialize an empty table with aliases disabled until the first connect
+ * @param table Table
+ */
+void mqtt_alias_init(mqtt_alias_table_t *table);
+
+/**
+ * @brief Assign the next alias to a topic
+ * @param table Table
+ * @param topic Topic name, must stay valid as long as the table is used
+ * @return Alias, 0 if the table is full or the topic is empty
+ */
+uint16_t mqtt_alias_add(mqtt_alias_table_t *table, const char *topic);
+
+/**
+ * @brief Forget all mappings at the start of a connection
+ * @param table Table
+ * @param maximum Topic Alias Maximum accepted by the broker, 0 if the connection does not support aliases
+ */
+void mqtt_alias_connected(mqtt_alias_table_t *table, uint16_t maximum);
+
+/**
+ * @brief Stop using aliases on the current connection, e.g. after the client rejected one
+ * @param table Table
+ */
+void mqtt_alias_disable(mqtt_alias_table_t *table);
+
+/**
+ * @brief Choose the alias and the topic name to send for a message
+ * @param table Table
+ * @param topic Topic the message is published to
+ * @param qos QoS of the message, only QoS 0 may use the alias only form
+ * @param wire_topic Topic name to put into the PUBLISH packet, topic or ""
+ * @return Alias to send, 0 for none
+ */
+uint16_t mqtt_alias_resolve(mqtt_alias_table_t *table, const char *topic, int qos, const char **wire_topic);
+
+/**
+ * @brief Record that a message resolved with mqtt_alias_resolve() was queued
+ * @param table Table
+ * @param alias Alias returned by mqtt_alias_resolve()
+ * @param wire_topic Topic name returned by mqtt_alias_resolve()
+ */
+void mqtt_alias_sent(mqtt_alias_table_t *table, uint16_t alias, const char *wire_topic);
+
+#ifdef __cplusplus
+}
+#endif
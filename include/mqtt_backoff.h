@@ -0,0 +1,58 @@
+/**
+ * @file mqtt_backoff.h
+ * @brief Exponential reconnect backoff with full jitter
+ *
+ * The n-th retry after a failure waits a uniformly random time between 0 and
+ * min(cap_ms, base_ms * 2^n). Spreading the whole interval rather than adding
+ * a little noise to a fixed delay keeps a fleet of devices that lost the same
+ * broker at the same moment from reconnecting in lockstep.
+ *
+ * Not thread-safe: callers serialize access to a backoff.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t base_ms; // Ceiling of the first retry
+    uint32_t cap_ms;  // Largest ceiling
+    uint8_t attempt;  // Retries since the last reset
+} mqtt_backoff_t;
+
+/**
+ * @brief Initialize a backoff
+ * @param backoff Backoff
+ * @param base_ms Ceiling of the first retry, at least 1
+ * @param cap_ms Largest ceiling, at least base_ms
+ */
+void mqtt_backoff_init(mqtt_backoff_t *backoff, uint32_t base_ms, uint32_t cap_ms);
+
+/**
+ * @brief Ceiling of the next retry delay
+ * @param backoff Backoff
+ * @return min(cap_ms, base_ms * 2^attempt)
+ */
+uint32_t mqtt_backoff_ceiling(const mqtt_backoff_t *backoff);
+
+/**
+ * @brief Get the delay of the next retry and count the retry
+ * @param backoff Backoff
+ * @param random Uniformly distributed random number, e.g. from esp_random()
+ * @return Delay in milliseconds, between 0 and mqtt_backoff_ceiling() before the call
+ */
+uint32_t mqtt_backoff_next(mqtt_backoff_t *backoff, uint32_t random);
+
+/**
+ * @brief Start over at base_ms after a successful connection
+ * @param backoff Backoff
+ */
+void mqtt_backoff_reset(mqtt_backoff_t *backoff);
+
+#ifdef __cplusplus
+}
+#endif
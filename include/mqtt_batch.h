@@ -0,0 +1,134 @@
+/**
+ * @file mqtt_batch.h
+ * @brief Time and size bounded batching of MQTT payloads
+ *
+ * Collects the payloads of consecutive samples into one array payload that
+ * is handed to a flush callback when the batch holds max_samples items, its
+ * oldest item is max_age_ms old, or the next item would not fit the buffer.
+ * The framing is byte oriented so the same batcher builds JSON arrays and
+ * CBOR indefinite-length arrays.
+ *
+ * Not thread-safe: callers serialize access to a batch.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Default buffer size of one batch
+#define MQTT_BATCH_DEFAULT_CAPACITY 4096
+
+/**
+ * @brief Bytes written around and between the items of a batch
+ */
+typedef struct {
+    const char *prefix;
+    const char *separator;
+    const char *suffix;
+} mqtt_batch_framing_t;
+
+extern const mqtt_batch_framing_t mqtt_batch_json; // [item,item]
+extern const mqtt_batch_framing_t mqtt_batch_cbor; // 0x9F item item 0xFF
+
+/**
+ * @brief Flush limits of a batch
+ */
+typedef struct {
+    uint16_t max_samples; // Flush at this many items, 0 or 1 disables batching
+    uint32_t max_age_ms;  // Flush once the oldest item is this old, 0 for no age limit
+} mqtt_batch_limits_t;
+
+/**
+ * @brief Called with a complete batch payload
+ * @param payload Framed items, valid until the callback returns
+ * @param len Payload length in bytes
+ * @param count Number of items in the batch
+ * @param ctx Context given to the batch call
+ */
+typedef void (*mqtt_batch_flush_t)(const uint8_t *payload, size_t len, uint16_t count, void *ctx);
+
+typedef struct {
+    const mqtt_batch_framing_t *framing;
+    mqtt_batch_limits_t limits;
+    uint8_t *buf;
+    size_t capacity;
+    size_t len;
+    uint16_t count;
+    uint32_t first_ms;  // Time of the oldest item
+    size_t last_offset; // Position of the newest item in buf
+    size_t last_len;    // Length of the newest item
+
+    uint32_t items;   // Items added
+    uint32_t flushes; // Payloads handed to the flush callback
+    uint32_t dropped; // Items larger than an empty batch
+} mqtt_batch_t;
+
+/**
+ * @brief Initialize a batch and allocate its buffer
+ * @param batch Batch to initialize
+ * @param framing Payload framing
+ * @param limits Flush limits
+ * @param capacity Buffer size in bytes, including the framing
+ * @return False if the buffer could not be allocated
+ */
+bool mqtt_batch_init(mqtt_batch_t *batch, const mqtt_batch_framing_t *framing, const mqtt_batch_limits_t *limits, size_t capacity);
+
+/**
+ * @brief Free the buffer of a batch, dropping pending items
+ * @param batch Batch
+ */
+void mqtt_batch_deinit(mqtt_batch_t *batch);
+
+/**
+ * @brief Whether the limits make the batch collect more than one item
+ * @param batch Batch
+ */
+bool mqtt_batch_enabled(const mqtt_batch_t *batch);
+
+/**
+ * @brief Append an item, flushing before it if it does not fit and after it if a limit is reached
+ * @param batch Batch
+ * @param item Item payload
+ * @param len Item length in bytes
+ * @param now_ms Current time in milliseconds
+ * @param flush Flush callback
+ * @param ctx Context passed to the flush callback
+ * @return False if the item is too large for an empty batch and was dropped
+ */
+bool mqtt_batch_add(mqtt_batch_t *batch, const void *item, size_t len, uint32_t now_ms, mqtt_batch_flush_t flush, void *ctx);
+
+/**
+ * @brief Flush the batch if its age limit has been reached
+ * @param batch Batch
+ * @param now_ms Current time in milliseconds
+ * @param flush Flush callback
+ * @param ctx Context passed to the flush callback
+ * @return True if the batch was flushed
+ */
+bool mqtt_batch_poll(mqtt_batch_t *batch, uint32_t now_ms, mqtt_batch_flush_t flush, void *ctx);
+
+/**
+ * @brief Flush pending items regardless of the limits
+ * @param batch Batch
+ * @param flush Flush callback
+ * @param ctx Context passed to the flush callback
+ */
+void mqtt_batch_flush(mqtt_batch_t *batch, mqtt_batch_flush_t flush, void *ctx);
+
+/**
+ * @brief Time until the age limit flushes the batch
+ * @param batch Batch
+ * @param now_ms Current time in milliseconds
+ * @return Milliseconds, 0 if already due, UINT32_MAX if empty or without age limit
+ */
+uint32_t mqtt_batch_ms_until_due(const mqtt_batch_t *batch, uint32_t now_ms);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,83 @@
+/**
+ * @file mqtt_cbor.h
+ * @brief Compact CBOR encoding of the sensor state payloads
+ *
+ * Optional binary alternative to the JSON state payloads for metered links,
+ * published on "<state topic>/cbor". Each payload is a CBOR (RFC 8949) map
+ * with small unsigned integer keys instead of field names. Floats are
+ * encoded as single precision, so values survive a round trip bit-exact.
+ * A BME690 sample takes about 65 bytes instead of about 300 bytes of JSON.
+ *
+ * Key 0 holds MQTT_CBOR_VERSION. It changes only when the meaning of an
+ * existing key changes. New keys may be added within a version, and
+ * decoders skip keys they do not know.
+ *
+ * BME690 keys:
+ *   0 version, 1 temperature, 2 humidity, 3 pressure, 4 iaq, 5 co2,
+ *   6 voc, 7 iaq_accuracy, 8 static_iaq, 9 gas_percentage,
+ *   10 stabilization_status, 11 run_in_status, 12 averaged, 13 timestamp
+ *
+ * BMV080 keys:
+ *   0 version, 1 pm10, 2 pm25, 3 pm1, 4 obstructed, 5 out_of_range,
+ *   6 runtime, 7 timestamp
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sensor_data_broker.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQTT_CBOR_VERSION 1
+
+// Upper bounds of the encoded payloads
+#define MQTT_CBOR_BME690_MAX 80
+#define MQTT_CBOR_BMV080_MAX 48
+
+/**
+ * @brief Encode a BME690 sample
+ * @param buf Output buffer
+ * @param size Size of output buffer, MQTT_CBOR_BME690_MAX always suffices
+ * @param data Sensor sample
+ * @param is_averaged Whether the sample contains averaged values
+ * @return Encoded length in bytes, -1 if the buffer is too small
+ */
+int mqtt_cbor_bme690(uint8_t *buf, size_t size, const bme690_data_t *data, bool is_averaged);
+
+/**
+ * @brief Encode a BMV080 sample
+ * @param buf Output buffer
+ * @param size Size of output buffer, MQTT_CBOR_BMV080_MAX always suffices
+ * @param data Sensor sample
+ * @return Encoded length in bytes, -1 if the buffer is too small
+ */
+int mqtt_cbor_bmv080(uint8_t *buf, size_t size, const bmv080_data_t *data);
+
+/**
+ * @brief Decode a BME690 payload
+ * @param buf Payload
+ * @param len Payload length
+ * @param data Decoded sample, fields missing from the payload are zero
+ * @param is_averaged Decoded averaged flag, may be NULL
+ * @return False if the payload is malformed or of an unsupported version
+ */
+bool mqtt_cbor_decode_bme690(const uint8_t *buf, size_t len, bme690_data_t *data, bool *is_averaged);
+
+/**
+ * @brief Decode a BMV080 payload
+ * @param buf Payload
+ * @param len Payload length
+ * @param data Decoded sample, fields missing from the payload are zero
+ * @return False if the payload is malformed or of an unsupported version
+ */
+bool mqtt_cbor_decode_bmv080(const uint8_t *buf, size_t len, bmv080_data_t *data);
+
+#ifdef __cplusplus
+}
+#endif
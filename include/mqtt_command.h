@@ -0,0 +1,111 @@
+/**
+ * @file mqtt_command.h
+ * @brief Settings commands received on the device command topic
+ *
+ * A command is a list of "key=value" settings separated by semicolons or line
+ * breaks, e.g. "bmv080_duty_cycle=120; qos_state=auto". Keys are named like
+ * the fields of the configuration page. A command is checked as a whole: if
+ * any key is unknown or any value invalid, nothing changes.
+ *
+ *   bmv080_duty_cycle     BMV080 duty cycling period in s, 12 to 3600
+ *   bme690_gated          1 publishes the BME690 average once per BMV080 sample, 0 every BSEC output
+ *   stats_windows         Statistics window lengths in s, e.g. "60,900,3600", 0 disables a window
+ *   qos_state, qos_batch,
+ *   qos_stats, qos_system QoS policy, "0", "1" or "auto"
+ *   mqtt_expiry           MQTT 5 message expiry of telemetry in s, 0 for none
+ *   bme690_batch, bmv080_batch           Samples per batch message, 0 or 1 for none
+ *   bme690_batch_age, bmv080_batch_age   Batch age limit in s
+ *   bme690_deadband, bmv080_deadband     Change filter thresholds, see mqtt_deadband.h
+ *   bme690_heartbeat, bmv080_heartbeat   Change filter heartbeat in s
+ *   id                    Token echoed in the result, letters, digits, '-', '_' and '.'
+ *   restart               1 restarts the device once the settings are saved
+ *
+ * The first five groups take effect immediately, batching and change filters
+ * after a restart. The duty cycle is handed to the BMV080 task, which changes
+ * it between measurements and keeps the previous period if the sensor rejects
+ * the new one. Every accepted command is saved to NVS.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQTT_COMMAND_MAX_LEN   512 // Longest command accepted
+#define MQTT_COMMAND_ID_MAX    32
+#define MQTT_COMMAND_ERROR_MAX 96
+
+#define MQTT_COMMAND_WINDOW_MAX_S 86400 // Longest statistics window
+
+// Groups of settings a command changed
+typedef enum {
+    MQTT_COMMAND_DUTY_CYCLE = 1u << 0,
+    MQTT_COMMAND_GATING = 1u << 1,
+    MQTT_COMMAND_STATS_WINDOWS = 1u << 2,
+    MQTT_COMMAND_QOS = 1u << 3,
+    MQTT_COMMAND_EXPIRY = 1u << 4,
+    MQTT_COMMAND_BATCH = 1u << 5,
+    MQTT_COMMAND_DEADBAND = 1u << 6,
+    MQTT_COMMAND_RESTART = 1u << 7,
+    MQTT_COMMAND_GROUP_COUNT = 8
+} mqtt_command_change_t;
+
+// Groups stored by config_save_sensor(), the others by config_save_mqtt()
+#define MQTT_COMMAND_SENSOR (MQTT_COMMAND_DUTY_CYCLE | MQTT_COMMAND_GATING | MQTT_COMMAND_STATS_WINDOWS)
+
+// Groups the running firmware applies without a restart
+#define MQTT_COMMAND_LIVE (MQTT_COMMAND_SENSOR | MQTT_COMMAND_QOS | MQTT_COMMAND_EXPIRY)
+
+// Live groups only requested from a sensor task, which applies them later or keeps the previous value
+#define MQTT_COMMAND_ASYNC MQTT_COMMAND_DUTY_CYCLE
+
+typedef struct {
+    polverine_sensor_config_t sensor; // Current settings before, requested settings after parsing
+    polverine_mqtt_config_t mqtt;
+    uint32_t changes; // mqtt_command_change_t bits of the groups whose settings differ from before
+    char id[MQTT_COMMAND_ID_MAX];
+    char error[MQTT_COMMAND_ERROR_MAX];
+} mqtt_command_t;
+
+/**
+ * @brief Parse a command and apply it to the settings in the command struct
+ * @param cmd Command with sensor and mqtt set to the current settings
+ * @param payload Command text, need not be terminated
+ * @param len Length of the command text
+ * @return True if every setting is valid, false with the settings unchanged and error set otherwise
+ */
+bool mqtt_command_parse(mqtt_command_t *cmd, const char *payload, size_t len);
+
+/**
+ * @brief Get the name of a group of settings ("bmv080_duty_cycle", "qos", ...)
+ * @param change Single mqtt_command_change_t bit
+ * @return Name, "unknown" for invalid values
+ */
+const char *mqtt_command_change_name(mqtt_command_change_t change);
+
+/**
+ * @brief Build the result payload published on the command result topic
+ *
+ * {"id":"...","ok":true,"applied":["qos",...],"requested":["bmv080_duty_cycle"],
+ * "after_restart":["batch",...],"restart":false} for an accepted command,
+ * {"id":"...","ok":false,"error":"..."} otherwise. Requested groups are saved
+ * but not yet in effect, see MQTT_COMMAND_ASYNC.
+ *
+ * @param buf Output buffer
+ * @param size Size of output buffer
+ * @param cmd Parsed command
+ * @param ok True if the command was accepted and saved
+ * @return Number of characters that would have been written (snprintf semantics), negative on error
+ */
+int mqtt_command_result(char *buf, size_t size, const mqtt_command_t *cmd, bool ok);
+
+#ifdef __cplusplus
+}
+#endif
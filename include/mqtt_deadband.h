@@ -0,0 +1,112 @@
+/**
+ * @file mqtt_deadband.h
+ * @brief Change filter that suppresses state payloads without meaningful changes
+ *
+ * A sample is published when a field named in the spec moved out of its
+ * deadband around the last published value, when a discrete field (status
+ * flag, accuracy) or the sample flags changed, or when nothing was published
+ * for max_silence_ms. Comparing against the last published value rather than
+ * the previous sample keeps slow drifts from going unnoticed.
+ *
+ * Thresholds are given as a spec string of "name=value" entries separated by
+ * commas or spaces, where a trailing '%' makes the value relative to the last
+ * published value, e.g. "temperature=0.1,humidity=0.5,pressure=0.01%".
+ * A field can carry both an absolute and a relative threshold, it then counts
+ * as changed when either is exceeded. A threshold of 0 makes any difference
+ * count. Float fields not named in the spec never force a publish, their
+ * current values go out with the samples published for other reasons.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQTT_DEADBAND_MAX_FIELDS 12
+
+typedef enum {
+    MQTT_DEADBAND_FLOAT,
+    MQTT_DEADBAND_UINT8, // Discrete, any change is significant
+    MQTT_DEADBAND_BOOL,  // Discrete, any change is significant
+} mqtt_deadband_value_type_t;
+
+/**
+ * @brief Describes one filtered field of a sample struct
+ */
+typedef struct {
+    const char *name; // Key of the field in the MQTT state payload
+    size_t offset;    // offsetof() the field in the sample struct
+    mqtt_deadband_value_type_t type;
+} mqtt_deadband_field_t;
+
+extern const mqtt_deadband_field_t mqtt_deadband_bme690_fields[];
+extern const uint8_t mqtt_deadband_bme690_field_count;
+extern const mqtt_deadband_field_t mqtt_deadband_bmv080_fields[];
+extern const uint8_t mqtt_deadband_bmv080_field_count;
+
+typedef struct {
+    bool set;       // Named in the spec, unnamed float fields never force a publish
+    float absolute; // Smallest significant change, 0 if unset
+    float relative; // Smallest significant change as a fraction of the last value, 0 if unset
+} mqtt_deadband_threshold_t;
+
+typedef struct {
+    const mqtt_deadband_field_t *fields;
+    uint8_t field_count;
+    mqtt_deadband_threshold_t thresholds[MQTT_DEADBAND_MAX_FIELDS];
+    uint32_t max_silence_ms; // Publish at least this often, 0 for no heartbeat
+
+    // Last published sample
+    bool primed;
+    float last[MQTT_DEADBAND_MAX_FIELDS];
+    uint32_t last_flags;
+    uint32_t last_publish_ms;
+
+    // Counters
+    uint32_t samples;                                 // Samples checked
+    uint32_t published;                               // Samples let through
+    uint32_t heartbeats;                              // Of which published only because of max_silence_ms
+    uint32_t field_changes[MQTT_DEADBAND_MAX_FIELDS]; // Published samples in which the field had changed
+} mqtt_deadband_t;
+
+/**
+ * @brief Initialize a filter without thresholds
+ * @param filter Filter
+ * @param fields Field descriptors, at most MQTT_DEADBAND_MAX_FIELDS
+ * @param field_count Number of field descriptors
+ * @param max_silence_ms Heartbeat interval, 0 for none
+ */
+void mqtt_deadband_init(mqtt_deadband_t *filter, const mqtt_deadband_field_t *fields, uint8_t field_count, uint32_t max_silence_ms);
+
+/**
+ * @brief Set the thresholds from a spec string
+ * @param filter Filter
+ * @param spec Spec string as described above, NULL or empty clears all thresholds
+ * @return False if the spec names an unknown field or holds an invalid value, the thresholds are then unchanged
+ */
+bool mqtt_deadband_parse(mqtt_deadband_t *filter, const char *spec);
+
+/**
+ * @brief Decide whether a sample is published, remembering it if so
+ * @param filter Filter
+ * @param sample Sample struct described by the field descriptors
+ * @param flags Sample flags, a change is always significant
+ * @param now_ms Current time in milliseconds
+ * @return True if the sample should be published
+ */
+bool mqtt_deadband_check(mqtt_deadband_t *filter, const void *sample, uint32_t flags, uint32_t now_ms);
+
+/**
+ * @brief Forget the last published sample so that the next sample is published
+ * @param filter Filter
+ */
+void mqtt_deadband_reset(mqtt_deadband_t *filter);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,95 @@
+/**
+ * @file mqtt_discovery.h
+ * @brief Home Assistant MQTT discovery payloads built from a descriptor table
+ *
+ * Every entity announced to Home Assistant is one constant table entry. Topics
+ * and payloads are rendered from the entries by a single generic emitter, and
+ * a hash over everything that would be published lets the caller skip the
+ * retained discovery messages when the broker already holds them.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQTT_DISCOVERY_PREFIX       "homeassistant"
+#define MQTT_DISCOVERY_STATUS_TOPIC MQTT_DISCOVERY_PREFIX "/status" // Home Assistant birth and will messages
+#define MQTT_DISCOVERY_PAYLOAD_MAX  768                             // Largest rendered payload including the device block
+
+// State topic an entity reads its value from
+typedef enum {
+    MQTT_DISCOVERY_BME690 = 0,
+    MQTT_DISCOVERY_BMV080,
+    MQTT_DISCOVERY_SYSTEM,
+    MQTT_DISCOVERY_SOURCE_COUNT
+} mqtt_discovery_source_t;
+
+/**
+ * @brief Describes one Home Assistant entity, optional strings are NULL when absent
+ */
+typedef struct {
+    const char *component; // "sensor" or "binary_sensor"
+    const char *key;       // Object id, also the unique id suffix and the state payload key
+    const char *name;
+    mqtt_discovery_source_t source;
+    const char *device_class;
+    const char *unit;
+    const char *value_template; // NULL for "{{ value_json.<key> }}"
+    const char *icon;
+    const char *state_class;
+} mqtt_discovery_entity_t;
+
+extern const mqtt_discovery_entity_t mqtt_discovery_entities[];
+extern const uint8_t mqtt_discovery_entity_count;
+
+/**
+ * @brief Device the entities belong to
+ */
+typedef struct {
+    const char *id;                 // Short device id
+    const char *name;               // Display name
+    const char *availability_topic; // Shared availability topic
+    const char *state_topics[MQTT_DISCOVERY_SOURCE_COUNT];
+} mqtt_discovery_device_t;
+
+/**
+ * @brief Build the discovery config topic of an entity
+ * @param buf Output buffer
+ * @param size Size of output buffer
+ * @param entity Entity
+ * @param device Device
+ * @return Number of characters that would have been written (snprintf semantics), negative on error
+ */
+int mqtt_discovery_topic(char *buf, size_t size, const mqtt_discovery_entity_t *entity, const mqtt_discovery_device_t *device);
+
+/**
+ * @brief Build the discovery config payload of an entity
+ * @param buf Output buffer
+ * @param size Size of output buffer
+ * @param entity Entity
+ * @param device Device
+ * @return Number of characters that would have been written (snprintf semantics), negative on error
+ */
+int mqtt_discovery_payload(char *buf, size_t size, const mqtt_discovery_entity_t *entity, const mqtt_discovery_device_t *device);
+
+/**
+ * @brief Hash all discovery topics and payloads of a device
+ *
+ * Changes with the entity table, the device and the broker, so a stored hash
+ * tells whether the retained discovery messages on the broker are current.
+ *
+ * @param device Device
+ * @param broker Broker URI, the retained messages only exist on that broker
+ * @return 32-bit FNV-1a hash, never 0
+ */
+uint32_t mqtt_discovery_hash(const mqtt_discovery_device_t *device, const char *broker);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,116 @@
+/**
+ * @file mqtt_outbox.h
+ * @brief Flash-backed store-and-forward log for samples taken while MQTT is down
+ *
+ * Samples are appended as raw structs to a ring of flash sectors on the
+ * "spiffs" data partition, which is otherwise unused. Each record is written
+ * with a single flash write. A sector is erased only when the log wraps into
+ * it, so flash wear stays close to the size of the samples themselves.
+ *
+ * Sector layout: a 16 byte header (magic, sequence number, consumed marker)
+ * followed by records, each an 8 byte header (length, type, flags, checksum)
+ * and the sample padded to 4 bytes. Sequence numbers grow by one per opened
+ * sector and select the sector (seq % sector count), so the log is mounted
+ * again after a reboot by reading the sector headers.
+ *
+ * Replay reads records through a cursor and commits the cursor once the
+ * records have been handed to the MQTT client. Fully replayed sectors get
+ * their consumed marker cleared in place, which costs no erase. When the log
+ * is full the oldest sector is overwritten and its records are counted as
+ * dropped.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sensor_data_broker.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQTT_OUTBOX_PARTITION  "spiffs"
+#define MQTT_OUTBOX_RECORD_MAX 64 // Largest sample stored, bme690_data_t takes 44 bytes
+
+/**
+ * @brief A sample read back from the log
+ */
+typedef struct {
+    sensor_type_t type;
+    uint8_t flags; // SENSOR_SAMPLE_* flags, all of which fit the low 8 bits
+    uint16_t len;
+    uint8_t data[MQTT_OUTBOX_RECORD_MAX];
+} mqtt_outbox_record_t;
+
+/**
+ * @brief Replay position
+ */
+typedef struct {
+    uint32_t seq;    // Sector sequence number
+    uint32_t offset; // Byte offset within the sector
+} mqtt_outbox_cursor_t;
+
+typedef struct {
+    uint32_t pending;      // Records waiting for replay
+    uint32_t appended;     // Records appended since boot
+    uint32_t replayed;     // Records committed since boot
+    uint32_t dropped;      // Records overwritten before replay since boot
+    uint32_t corrupt;      // Records skipped on a checksum mismatch since boot
+    uint32_t erases;       // Sector erases since boot
+    uint32_t sectors;      // Sectors in the log
+    uint32_t sector_size;  // Sector size in bytes
+    uint32_t write_errors; // Failed flash operations since boot
+} mqtt_outbox_stats_t;
+
+/**
+ * @brief Mount the log on the MQTT_OUTBOX_PARTITION partition
+ * @return False if the partition is missing, the log is then disabled
+ */
+bool mqtt_outbox_init(void);
+
+/**
+ * @brief Append a sample to the log
+ * @param type Sample type
+ * @param flags SENSOR_SAMPLE_* flags
+ * @param data Sample data
+ * @param len Sample size, at most MQTT_OUTBOX_RECORD_MAX
+ * @return False if the log is disabled, the sample too large or the flash write failed
+ */
+bool mqtt_outbox_append(sensor_type_t type, uint8_t flags, const void *data, size_t len);
+
+/**
+ * @brief Get a cursor at the oldest record waiting for replay
+ */
+mqtt_outbox_cursor_t mqtt_outbox_begin(void);
+
+/**
+ * @brief Read the record at the cursor and advance the cursor past it
+ * @param cursor Cursor from mqtt_outbox_begin(), moved to the oldest record if its records were dropped
+ * @param record Record read
+ * @return False at the end of the log
+ */
+bool mqtt_outbox_read(mqtt_outbox_cursor_t *cursor, mqtt_outbox_record_t *record);
+
+/**
+ * @brief Mark all records before the cursor as replayed
+ * @param cursor Cursor advanced by mqtt_outbox_read()
+ */
+void mqtt_outbox_commit(const mqtt_outbox_cursor_t *cursor);
+
+/**
+ * @brief Number of records waiting for replay
+ */
+uint32_t mqtt_outbox_pending(void);
+
+/**
+ * @brief Get the log counters
+ * @param stats Counters
+ */
+void mqtt_outbox_get_stats(mqtt_outbox_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
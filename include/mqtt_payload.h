@@ -0,0 +1,116 @@
+/**
+ * @file mqtt_payload.h
+ * @brief MQTT state payload builders
+ *
+ * Formats sensor samples and system metrics into the JSON payloads published
+ * on the Home Assistant state topics. Kept free of ESP-IDF dependencies so the
+ * same code can be built and profiled on the host.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mqtt_deadband.h"
+#include "mqtt_qos.h"
+#include "sensor_data_broker.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Build the BME690 state payload
+ * @param buf Output buffer
+ * @param size Size of output buffer
+ * @param data Sensor sample to format
+ * @param is_averaged Whether the sample contains averaged values
+ * @return Number of characters that would have been written (snprintf semantics), negative on error
+ */
+int mqtt_payload_bme690(char *buf, size_t size, const bme690_data_t *data, bool is_averaged);
+
+/**
+ * @brief Build the BMV080 state payload
+ * @param buf Output buffer
+ * @param size Size of output buffer
+ * @param data Sensor sample to format
+ * @return Number of characters that would have been written (snprintf semantics), negative on error
+ */
+int mqtt_payload_bmv080(char *buf, size_t size, const bmv080_data_t *data);
+
+/**
+ * @brief Build the system metrics state payload
+ * @param buf Output buffer
+ * @param size Size of output buffer
+ * @param rssi WiFi RSSI in dBm
+ * @param free_heap Free heap in bytes
+ * @param uptime Uptime in seconds
+ * @param cpu_temp CPU temperature in °C
+ * @return Number of characters that would have been written (snprintf semantics), negative on error
+ */
+int mqtt_payload_system(char *buf, size_t size, int32_t rssi, uint32_t free_heap, uint32_t uptime, float cpu_temp);
+
+/**
+ * @brief Build the windowed statistics payload
+ *
+ * "count" holds the samples in the window. A field that was NaN in some of
+ * them adds its own "count", statistics of a field without values are null.
+ *
+ * @param buf Output buffer
+ * @param size Size of output buffer
+ * @param report Completed aggregation window
+ * @return Number of characters that would have been written (snprintf semantics), negative on error
+ */
+int mqtt_payload_stats(char *buf, size_t size, const sensor_agg_report_t *report);
+
+// Fits the broker diagnostics with SENSOR_BUS_MAX_SUBSCRIBERS subscribers and 10 digit counters
+#define MQTT_PAYLOAD_BROKER_DIAG_MAX 6144
+
+/**
+ * @brief Build the sensor bus diagnostics payload
+ *
+ * Publish and drop counters per sample type plus call counts, drops,
+ * callback durations and the latency histogram per subscriber. Also served
+ * by the web server on /diag/broker.
+ *
+ * @param buf Output buffer
+ * @param size Size of output buffer
+ * @return Number of characters that would have been written (snprintf semantics), negative on error
+ */
+int mqtt_payload_broker_diag(char *buf, size_t size);
+
+/**
+ * @brief Build the change filter diagnostics payload
+ *
+ * One object per filter keyed by its name, with checked, published and
+ * heartbeat counts, the suppression ratio and how often each field changed
+ * in a published sample.
+ *
+ * @param buf Output buffer
+ * @param size Size of output buffer
+ * @param names Filter names, e.g. "bme690"
+ * @param filters Filters
+ * @param count Number of filters
+ * @return Number of characters that would have been written (snprintf semantics), negative on error
+ */
+int mqtt_payload_deadband(char *buf, size_t size, const char *const names[], const mqtt_deadband_t *const filters[], size_t count);
+
+/**
+ * @brief Build the QoS policy diagnostics payload
+ *
+ * Current and peak outbox bytes, the congestion state and count, and per
+ * message class the policy with the messages queued at QoS 0 and 1 and
+ * refused by the client.
+ *
+ * @param buf Output buffer
+ * @param size Size of output buffer
+ * @param qos Policy
+ * @return Number of characters that would have been written (snprintf semantics), negative on error
+ */
+int mqtt_payload_qos(char *buf, size_t size, const mqtt_qos_t *qos);
+
+#ifdef __cplusplus
+}
+#endif
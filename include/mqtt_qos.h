@@ -0,0 +1,114 @@
+/**
+ * @file mqtt_qos.h
+ * @brief QoS policy per message class with outbox depth tracking
+ *
+ * Every published message belongs to a class. Live state, batches, statistics
+ * and system metrics have a configurable policy: QoS 0, QoS 1, or adaptive.
+ * Adaptive uses QoS 1 while the MQTT client outbox is short and QoS 0 once it
+ * backs up, e.g. under poor RSSI, with hysteresis between a high and a low
+ * water mark, so unacknowledged messages cannot pile up without bound.
+ *
+ * The remaining classes are fixed. Availability and discovery are retained
+ * control messages and always use QoS 1, as does the store-and-forward backlog
+ * because replayed samples exist nowhere else once sent. Diagnostics always
+ * use QoS 0.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MQTT_QOS_ADAPTIVE 2 // Policy value next to 0 and 1
+
+typedef enum {
+    MQTT_QOS_CLASS_STATE = 0, // Live sensor state, one message per sample
+    MQTT_QOS_CLASS_BATCH,     // Batch arrays and the newest sample of each batch
+    MQTT_QOS_CLASS_STATS,     // Windowed statistics
+    MQTT_QOS_CLASS_SYSTEM,    // System metrics
+    MQTT_QOS_CLASS_CONFIGURABLE,
+    MQTT_QOS_CLASS_BACKLOG = MQTT_QOS_CLASS_CONFIGURABLE, // Replayed samples, always QoS 1
+    MQTT_QOS_CLASS_CONTROL,                               // Availability and discovery, always QoS 1
+    MQTT_QOS_CLASS_DIAG,                                  // Diagnostics, always QoS 0
+    MQTT_QOS_CLASS_COUNT
+} mqtt_qos_class_t;
+
+typedef struct {
+    uint8_t policy[MQTT_QOS_CLASS_COUNT]; // 0, 1 or MQTT_QOS_ADAPTIVE
+    uint32_t high_water;                  // Outbox bytes from which adaptive classes use QoS 0
+    uint32_t low_water;                   // Outbox bytes below which they use QoS 1 again
+    bool congested;                       // Outbox passed the high water mark and has not yet drained below the low one
+
+    // Counters
+    uint32_t queued[MQTT_QOS_CLASS_COUNT][2]; // Messages handed to the client per class and QoS
+    uint32_t failed[MQTT_QOS_CLASS_COUNT];    // Messages the client refused
+    uint32_t congestions;                     // Times the outbox passed the high water mark
+    uint32_t outbox_bytes;                    // Outbox size at the last selection
+    uint32_t outbox_peak;                     // Largest outbox size seen
+} mqtt_qos_t;
+
+/**
+ * @brief Initialize with the fixed classes set and the configurable ones at QoS 1
+ * @param qos Policy
+ * @param high_water Outbox bytes from which adaptive classes use QoS 0
+ * @param low_water Outbox bytes below which adaptive classes use QoS 1 again
+ */
+void mqtt_qos_init(mqtt_qos_t *qos, uint32_t high_water, uint32_t low_water);
+
+/**
+ * @brief Set the policy of a configurable class
+ * @param qos Policy
+ * @param cls Class below MQTT_QOS_CLASS_CONFIGURABLE
+ * @param policy 0, 1 or MQTT_QOS_ADAPTIVE
+ * @return False if the class is fixed or the policy unknown, the policy is then unchanged
+ */
+bool mqtt_qos_set_policy(mqtt_qos_t *qos, mqtt_qos_class_t cls, uint8_t policy);
+
+/**
+ * @brief Choose the QoS of a message, updating the congestion state
+ * @param qos Policy
+ * @param cls Class of the message
+ * @param outbox_bytes Bytes currently held by the MQTT client outbox
+ * @return QoS level, 0 or 1
+ */
+int mqtt_qos_select(mqtt_qos_t *qos, mqtt_qos_class_t cls, uint32_t outbox_bytes);
+
+/**
+ * @brief Count a message handed to the client
+ * @param qos Policy
+ * @param cls Class of the message
+ * @param level QoS level returned by mqtt_qos_select()
+ * @param queued True if the client accepted the message
+ */
+void mqtt_qos_record(mqtt_qos_t *qos, mqtt_qos_class_t cls, int level, bool queued);
+
+/**
+ * @brief Get the name of a class ("state", "batch", ...)
+ * @param cls Class
+ * @return Name, "unknown" for invalid values
+ */
+const char *mqtt_qos_class_name(mqtt_qos_class_t cls);
+
+/**
+ * @brief Get the configuration name of a policy ("0", "1", "auto")
+ * @param policy Policy
+ * @return Name, "1" for unknown values
+ */
+const char *mqtt_qos_policy_name(uint8_t policy);
+
+/**
+ * @brief Parse a policy name
+ * @param name Name as returned by mqtt_qos_policy_name()
+ * @param policy Parsed policy
+ * @return True if the name is known, false otherwise
+ */
+bool mqtt_qos_policy_parse(const char *name, uint8_t *policy);
+
+#ifdef __cplusplus
+}
+#endif
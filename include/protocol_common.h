@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include <stdbool.h>
+
 #include "esp_err.h"
 #include "esp_netif.h"
 #include "sdkconfig.h"
@@ -39,6 +41,14 @@ esp_err_t polverine_connect(void);
  */
 esp_err_t polverine_disconnect(void);
 
+/**
+ * @brief Whether the station is associated and has an IPv4 address
+ *
+ * Cleared on every Wi-Fi disconnect and set again when an address is
+ * obtained by DHCP or the static fallback.
+ */
+bool wifi_sta_is_connected(void);
+
 /**
  * @brief Configure stdin and stdout to use blocking I/O
  *
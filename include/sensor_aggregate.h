@@ -0,0 +1,198 @@
+/**
+ * @file sensor_aggregate.h
+ * @brief Multi-window statistics over sensor samples
+ *
+ * Computes min/max/mean/stddev and streaming percentiles per field over
+ * tumbling time windows (1 min / 15 min / 1 h by default). Every sample is
+ * folded into all windows incrementally in constant time and memory; when a
+ * window elapses a report is handed to the report callback and the window
+ * restarts. Percentiles use the P² estimator (Jain & Chlamtac), which keeps
+ * five markers per quantile instead of the samples themselves.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SENSOR_AGG_MAX_FIELDS     9
+#define SENSOR_AGG_WINDOW_COUNT   3
+#define SENSOR_AGG_QUANTILE_COUNT 2
+
+// Quantiles estimated for every field, in report order
+#define SENSOR_AGG_QUANTILES {0.50f, 0.95f}
+
+// Default window lengths: 1 min, 15 min, 1 h
+#define SENSOR_AGG_DEFAULT_WINDOWS_MS {60000, 900000, 3600000}
+
+// No window length change requested
+#define SENSOR_AGG_NO_REQUEST UINT32_MAX
+
+/**
+ * @brief Storage type of an aggregated field inside the sample struct
+ */
+typedef enum {
+    SENSOR_AGG_FLOAT,
+    SENSOR_AGG_UINT8
+} sensor_agg_value_type_t;
+
+/**
+ * @brief Describes one aggregated field of a sample struct
+ */
+typedef struct {
+    const char *name; // Key used in reports, matches the MQTT state payload
+    size_t offset;    // offsetof() the field in the sample struct
+    sensor_agg_value_type_t type;
+} sensor_agg_field_t;
+
+/**
+ * @brief P² streaming quantile estimator state
+ */
+typedef struct {
+    float p;          // Target quantile (0..1)
+    float heights[5]; // Marker heights
+    float desired[5]; // Desired marker positions
+    int32_t positions[5];
+    uint32_t count;
+} sensor_p2_t;
+
+/**
+ * @brief Running state of one field within one window
+ */
+typedef struct {
+    uint32_t count;
+    float min;
+    float max;
+    double mean; // Welford running mean
+    double m2;   // Welford sum of squared deviations
+    sensor_p2_t quantiles[SENSOR_AGG_QUANTILE_COUNT];
+} sensor_agg_field_state_t;
+
+/**
+ * @brief Statistics of one field over a completed window
+ */
+typedef struct {
+    uint32_t count; // Values aggregated, samples with NaN in the field are left out
+    float min;      // The statistics are NaN or infinite if count is 0
+    float max;
+    float mean;
+    float stddev;
+    float quantiles[SENSOR_AGG_QUANTILE_COUNT];
+} sensor_agg_stats_t;
+
+/**
+ * @brief Report emitted when a window completes
+ */
+typedef struct {
+    const char *sensor;              // Sensor name, e.g. "bme690"
+    const sensor_agg_field_t *fields; // Field descriptors, field_count entries
+    uint8_t field_count;
+    uint8_t window;      // Window index (0..SENSOR_AGG_WINDOW_COUNT-1)
+    uint32_t window_ms;  // Window length in milliseconds
+    uint32_t start_ms;   // Window start, aligned to window_ms
+    uint32_t count;      // Samples in the window, a field's stats count less if some had NaN in it
+    sensor_agg_stats_t stats[SENSOR_AGG_MAX_FIELDS];
+} sensor_agg_report_t;
+
+typedef void (*sensor_agg_report_callback_t)(const sensor_agg_report_t *report);
+
+/**
+ * @brief State of one tumbling window
+ */
+typedef struct {
+    uint32_t window_ms;
+    uint32_t start_ms;
+    bool started;
+    uint32_t samples; // Samples added, each field's count leaves out its NaN values
+    sensor_agg_field_state_t fields[SENSOR_AGG_MAX_FIELDS];
+} sensor_agg_window_state_t;
+
+/**
+ * @brief Aggregator for one sensor
+ */
+typedef struct {
+    const char *sensor;
+    const sensor_agg_field_t *fields;
+    uint8_t field_count;
+    sensor_agg_report_callback_t on_report;
+    sensor_agg_window_state_t windows[SENSOR_AGG_WINDOW_COUNT];
+    atomic_uint_least32_t requested_ms[SENSOR_AGG_WINDOW_COUNT]; // From sensor_aggregator_request_window(), SENSOR_AGG_NO_REQUEST if none
+} sensor_aggregator_t;
+
+// Field descriptor tables for the built-in sensors
+extern const sensor_agg_field_t sensor_agg_bme690_fields[];
+extern const uint8_t sensor_agg_bme690_field_count;
+extern const sensor_agg_field_t sensor_agg_bmv080_fields[];
+extern const uint8_t sensor_agg_bmv080_field_count;
+
+/**
+ * @brief Initialize an aggregator with the default windows
+ * @param agg Aggregator to initialize
+ * @param sensor Sensor name used in reports
+ * @param fields Field descriptor table
+ * @param field_count Number of fields (at most SENSOR_AGG_MAX_FIELDS)
+ * @param on_report Called from sensor_aggregator_add() when a window completes
+ */
+void sensor_aggregator_init(sensor_aggregator_t *agg, const char *sensor, const sensor_agg_field_t *fields, uint8_t field_count,
+    sensor_agg_report_callback_t on_report);
+
+/**
+ * @brief Change the length of a window, restarting it
+ * @param agg Aggregator
+ * @param window Window index
+ * @param window_ms New window length in milliseconds (0 disables the window)
+ */
+void sensor_aggregator_set_window(sensor_aggregator_t *agg, uint8_t window, uint32_t window_ms);
+
+/**
+ * @brief Request a window length change from another task
+ *
+ * The change is applied by the next sensor_aggregator_add(), on the task that
+ * feeds the aggregator, as with sensor_aggregator_set_window(). Requesting the
+ * current length leaves the running window alone.
+ *
+ * @param agg Aggregator
+ * @param window Window index
+ * @param window_ms New window length in milliseconds (0 disables the window)
+ */
+void sensor_aggregator_request_window(sensor_aggregator_t *agg, uint8_t window, uint32_t window_ms);
+
+/**
+ * @brief Fold a sample into all windows
+ *
+ * Windows whose time span has elapsed are reported before the sample is added.
+ *
+ * @param agg Aggregator
+ * @param sample Pointer to the sample struct described by the field table
+ * @param timestamp_ms Sample timestamp in milliseconds
+ */
+void sensor_aggregator_add(sensor_aggregator_t *agg, const void *sample, uint32_t timestamp_ms);
+
+/**
+ * @brief Publish a report on the sensor data bus as a "<sensor>_stats" sample
+ *
+ * e.g. SENSOR_TYPE_BME690_STATS for reports of the "bme690" aggregator.
+ *
+ * Suitable as the on_report callback of sensor_aggregator_init().
+ *
+ * @param report Completed window
+ */
+void sensor_aggregate_publish(const sensor_agg_report_t *report);
+
+/**
+ * @brief Format a window length as a short label ("1m", "15m", "1h", "30s")
+ * @param window_ms Window length in milliseconds
+ * @param buf Output buffer
+ * @param size Size of output buffer
+ */
+void sensor_aggregate_window_label(uint32_t window_ms, char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -9,7 +9,32 @@
 extern "C" {
 #endif
 
+#ifndef MAX_SENSOR_SAMPLES
 #define MAX_SENSOR_SAMPLES 60
+#endif
+
+/**
+ * Number of additions after which the BME690 running sums are recomputed from
+ * the stored samples, bounding floating point drift. Amortized over the
+ * interval this keeps bme690_buffer_add() constant time.
+ */
+#ifndef SENSOR_BUFFER_RECOMPUTE_INTERVAL
+#define SENSOR_BUFFER_RECOMPUTE_INTERVAL (MAX_SENSOR_SAMPLES * 8)
+#endif
+
+/**
+ * @brief BME690 fields averaged by bme690_buffer_get_averaged()
+ */
+typedef enum {
+    BME690_AVG_TEMPERATURE = 0,
+    BME690_AVG_PRESSURE,
+    BME690_AVG_HUMIDITY,
+    BME690_AVG_IAQ,
+    BME690_AVG_IAQ_ACCURACY,
+    BME690_AVG_CO2,
+    BME690_AVG_VOC,
+    BME690_AVG_FIELD_COUNT
+} bme690_avg_field_t;
 
 /**
  * @brief BME690 sensor averaging buffer
@@ -19,6 +44,11 @@ typedef struct {
     uint16_t write_index;
     uint16_t sample_count;
     uint32_t total_samples; // For sequence tracking
+
+    // Running sums over the window, with Kahan-Babuska compensation terms
+    double sums[BME690_AVG_FIELD_COUNT];
+    double compensation[BME690_AVG_FIELD_COUNT];
+    uint32_t adds_since_recompute;
 } bme690_sensor_buffer_t;
 
 /**
@@ -46,6 +76,7 @@ void bme690_buffer_add(bme690_sensor_buffer_t *buffer, const bme690_data_t *data
 
 /**
  * @brief Get averaged data from BME690 buffer
+ * Runs in constant time using the running sums maintained by bme690_buffer_add().
  * Only averages the same fields that are currently averaged:
  * temperature, pressure, humidity, iaq, iaq_accuracy, co2_equivalent, breath_voc_equivalent
  * All other fields return latest values
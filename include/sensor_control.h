@@ -0,0 +1,51 @@
+/**
+ * @file sensor_control.h
+ * @brief Runtime settings of the sensor tasks
+ *
+ * The sensor tasks start with the settings from config_load_sensor(). These
+ * functions change them while the tasks run and may be called from any task;
+ * each sensor task applies a change with its next poll or sample. They do not
+ * persist anything, see config_save_sensor().
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensor_aggregate.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Shortest BMV080 duty cycling period: the 10 s integration time plus 2 s
+#define BMV080_DUTY_CYCLE_MIN_S 12
+
+/**
+ * @brief Restart the BMV080 duty cycling measurement with a new period
+ * @param period_s Duty cycling period, at least BMV080_DUTY_CYCLE_MIN_S
+ */
+void bmv080_set_duty_cycle(uint16_t period_s);
+
+/**
+ * @brief Choose between publishing the BME690 average once per BMV080 sample and every BSEC output
+ * @param gated True to publish the average gated by the BMV080
+ */
+void bme690_set_gated(bool gated);
+
+/**
+ * @brief Change the BME690 statistics windows, restarting the ones whose length changes
+ * @param window_s Window lengths in seconds, 0 disables a window
+ */
+void bme690_set_stats_windows(const uint32_t window_s[SENSOR_AGG_WINDOW_COUNT]);
+
+/**
+ * @brief Change the BMV080 statistics windows, restarting the ones whose length changes
+ * @param window_s Window lengths in seconds, 0 disables a window
+ */
+void bmv080_set_stats_windows(const uint32_t window_s[SENSOR_AGG_WINDOW_COUNT]);
+
+#ifdef __cplusplus
+}
+#endif
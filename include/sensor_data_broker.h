@@ -1,8 +1,12 @@
 #pragma once
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "sensor_aggregate.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -39,40 +43,302 @@ typedef struct {
 } bmv080_data_t;
 
 /**
- * @brief Callback function types for sensor data
+ * @brief Full BSEC output of one BME690 measurement, published every cycle
+ *
+ * Unlike SENSOR_TYPE_BME690 samples, which follow the BMV080 gating and
+ * averaging, these carry each BSEC output as is, including the raw signals.
+ */
+typedef struct {
+    float raw_temperature;       // Sensor temperature in °C, before heat compensation
+    float raw_humidity;          // Relative humidity in %RH, before heat compensation
+    float raw_pressure;          // Pressure in Pa
+    float raw_gas;               // Gas resistance in ohms
+    float temperature;           // Compensated temperature in °C
+    float humidity;              // Compensated humidity in %RH
+    float iaq;                   // Indoor Air Quality index
+    float static_iaq;            // Static IAQ value
+    float co2_equivalent;        // CO2 equivalent in ppm
+    float breath_voc_equivalent; // Breath VOC equivalent in ppm
+    float gas_percentage;        // Gas sensor percentage
+    uint8_t iaq_accuracy;        // IAQ accuracy (0-3)
+    uint8_t gas_index;           // Heater profile step of raw_gas
+    bool stabilization_status;   // Gas sensor stabilization status
+    bool run_in_status;          // Gas sensor run-in status
+    uint32_t timestamp;          // Timestamp in milliseconds
+} bme690_raw_data_t;
+
+/**
+ * @brief Built-in sample types, registered by sensor_broker_init()
+ *
+ * Further types are added at runtime with sensor_broker_register_type().
+ */
+typedef enum {
+    SENSOR_TYPE_BME690 = 0,   // bme690_data_t
+    SENSOR_TYPE_BMV080,       // bmv080_data_t
+    SENSOR_TYPE_BME690_STATS, // sensor_agg_report_t
+    SENSOR_TYPE_BMV080_STATS, // sensor_agg_report_t
+    SENSOR_TYPE_BME690_RAW,   // bme690_raw_data_t
+    SENSOR_TYPE_BUILTIN_COUNT
+} sensor_builtin_type_t;
+
+typedef uint8_t sensor_type_t;
+
+#define SENSOR_TYPE_INVALID 0xFF
+
+#define SENSOR_BUS_MAX_TYPES       8
+#define SENSOR_BUS_MAX_SUBSCRIBERS 16 // 12 in use: MQTT 4, /data 2, /events 2, /history 2, /ws 2
+// Covers a full queue of distinct samples for each of the 5 built-in types, which the 10 queued
+// subscribers mostly share, plus retained and in-flight samples
+#define SENSOR_BUS_POOL_SIZE       24
+
+// Per-subscriber queue depth, must be a power of two
+#define SENSOR_BUS_QUEUE_DEPTH 4
+
+// Default producer wait for SENSOR_OVERFLOW_BLOCK subscribers
+#define SENSOR_BUS_BLOCK_TIMEOUT_MS 20
+
+// Dispatcher task, runs queued subscriber callbacks
+#define SENSOR_BUS_DISPATCHER_STACK    6144
+#define SENSOR_BUS_DISPATCHER_PRIORITY 5
+
+// Producer-to-delivery latency histogram: upper bucket bounds in µs, the last bucket is open-ended
+#define SENSOR_BUS_LATENCY_BUCKETS   7
+#define SENSOR_BUS_LATENCY_BOUNDS_US {10, 100, 1000, 10000, 100000, 1000000}
+
+// Sample flags
+#define SENSOR_SAMPLE_AVERAGED (1u << 0) // BME690: values averaged over the buffer window
+
+/**
+ * @brief Describes a sample type carried by the bus
+ */
+typedef struct {
+    const char *name;                     // Type name, e.g. "bme690"
+    size_t sample_size;                   // Payload size, at most sizeof(sensor_sample_payload_t)
+    void (*validate)(const void *sample); // Optional sanity check run on publish, may be NULL
+} sensor_type_desc_t;
+
+/**
+ * @brief Payload storage of a pool slot, sized for the largest built-in type
+ */
+typedef union {
+    bme690_data_t bme690;
+    bmv080_data_t bmv080;
+    sensor_agg_report_t stats;
+    bme690_raw_data_t bme690_raw;
+} sensor_sample_payload_t;
+
+/**
+ * @brief Reference counted sample living in the bus pool
+ *
+ * Samples are written once by the producer and shared read-only with all
+ * subscribers. A subscriber that keeps a sample beyond its callback takes a
+ * reference with sensor_sample_retain() and drops it with
+ * sensor_sample_release(); the slot returns to the pool when the last
+ * reference is released.
  */
-typedef void (*bme690_data_callback_t)(const bme690_data_t *data, bool is_averaged);
-typedef void (*bmv080_data_callback_t)(const bmv080_data_t *data);
+typedef struct {
+    atomic_uint refcount; // 0 when the slot is free
+    sensor_type_t type;
+    uint32_t flags;
+    uint32_t sequence;  // Bus-wide publish sequence number
+    int64_t publish_us; // esp_timer_get_time() at commit
+    sensor_sample_payload_t payload;
+} sensor_sample_t;
 
 /**
- * @brief Initialize the sensor data broker
+ * @brief Subscriber callback
+ *
+ * Runs on the bus dispatcher task, or on the publishing task for synchronous
+ * subscribers.
+ *
+ * @param sample Published sample, valid until the callback returns unless retained
+ * @param ctx Context pointer given at subscription
+ */
+typedef void (*sensor_sample_callback_t)(const sensor_sample_t *sample, void *ctx);
+
+/**
+ * @brief What a publish does when a subscriber's queue is full
+ */
+typedef enum {
+    SENSOR_OVERFLOW_DROP_OLDEST = 0, // Discard the oldest queued sample (default)
+    SENSOR_OVERFLOW_COALESCE_LATEST, // Queue holds only the newest undelivered sample
+    SENSOR_OVERFLOW_BLOCK,           // Producer waits up to block_timeout_ms, then drops the new sample
+} sensor_overflow_policy_t;
+
+/**
+ * @brief Subscription parameters
+ */
+typedef struct {
+    const char *name; // Subscriber name, for logging
+    sensor_type_t type;
+    sensor_sample_callback_t callback;
+    void *ctx;
+    bool synchronous; // Call on the publishing task; only for constant time, non-blocking callbacks
+    sensor_overflow_policy_t overflow;
+    uint32_t block_timeout_ms; // SENSOR_OVERFLOW_BLOCK only, 0 selects SENSOR_BUS_BLOCK_TIMEOUT_MS
+} sensor_subscriber_config_t;
+
+/**
+ * @brief Publish counters of one sample type
+ */
+typedef struct {
+    const char *name;
+    uint32_t publish_count; // Samples committed
+    uint32_t drop_count;    // Publishes lost to an exhausted pool
+} sensor_type_stats_t;
+
+/**
+ * @brief Delivery counters of one subscriber
+ *
+ * Latency is measured from sensor_broker_commit() to the start of the
+ * callback, so for queued subscribers it includes the time spent waiting
+ * for the dispatcher.
+ */
+typedef struct {
+    const char *name;
+    sensor_type_t type;
+    bool synchronous;
+    uint32_t invocations;
+    uint32_t drop_count; // Samples discarded by the overflow policy
+    uint32_t queued;     // Samples currently waiting for delivery
+    uint32_t callback_avg_us;
+    uint32_t callback_max_us;
+    uint32_t latency_max_us;
+    uint32_t latency_histogram[SENSOR_BUS_LATENCY_BUCKETS]; // Bucketed by SENSOR_BUS_LATENCY_BOUNDS_US
+} sensor_subscriber_stats_t;
+
+/**
+ * @brief Initialize the sensor data bus, register the built-in types and start the dispatcher task
  */
 void sensor_broker_init(void);
 
 /**
- * @brief Register callback for BME690 sensor data
- * @param callback Function to call when BME690 data is available
+ * @brief Register a new sample type
+ * @param desc Type descriptor, must stay valid for the lifetime of the bus
+ * @return Type ID, SENSOR_TYPE_INVALID if the table is full or the sample does not fit a pool slot
+ */
+sensor_type_t sensor_broker_register_type(const sensor_type_desc_t *desc);
+
+/**
+ * @brief Look up a type by name
+ * @param name Type name
+ * @return Type ID, SENSOR_TYPE_INVALID if not registered
  */
-void sensor_broker_register_bme690_callback(bme690_data_callback_t callback);
+sensor_type_t sensor_broker_find_type(const char *name);
 
 /**
- * @brief Register callback for BMV080 sensor data
- * @param callback Function to call when BMV080 data is available
+ * @brief Get the descriptor of a registered type
+ * @param type Type ID
+ * @return Descriptor, NULL if not registered
  */
-void sensor_broker_register_bmv080_callback(bmv080_data_callback_t callback);
+const sensor_type_desc_t *sensor_broker_get_type(sensor_type_t type);
 
 /**
- * @brief Publish BME690 sensor data to all registered callbacks
- * @param data Pointer to BME690 sensor data
- * @param is_averaged Whether the data contains averaged values
+ * @brief Subscribe to samples of one type
+ * @param config Subscription parameters
+ * @return True on success, false if the subscriber table is full or the type is unknown
  */
-void sensor_broker_publish_bme690(const bme690_data_t *data, bool is_averaged);
+bool sensor_broker_subscribe(const sensor_subscriber_config_t *config);
 
 /**
- * @brief Publish BMV080 sensor data to all registered callbacks
- * @param data Pointer to BMV080 sensor data
+ * @brief Take a free pool slot to fill in place
+ *
+ * The producer owns one reference; after sensor_broker_commit() it must drop
+ * it with sensor_sample_release().
+ *
+ * @param type Type of the sample to be written
+ * @return Slot, NULL if the type is unknown or the pool is exhausted
  */
-void sensor_broker_publish_bmv080(const bmv080_data_t *data);
+sensor_sample_t *sensor_broker_acquire(sensor_type_t type);
+
+/**
+ * @brief Deliver a filled slot to all subscribers of its type
+ *
+ * Synchronous subscribers are called in place; all others get the sample
+ * queued for the dispatcher task, so the call returns without waiting for
+ * them (except for a full SENSOR_OVERFLOW_BLOCK queue). Each type must be
+ * published from a single task: the subscriber queues are single-producer.
+ *
+ * @param sample Slot obtained from sensor_broker_acquire()
+ * @param flags SENSOR_SAMPLE_* flags
+ */
+void sensor_broker_commit(sensor_sample_t *sample, uint32_t flags);
+
+/**
+ * @brief Copy a sample into a pool slot and deliver it
+ * @param type Type of the sample
+ * @param data Sample of the type's sample_size
+ * @param flags SENSOR_SAMPLE_* flags
+ * @return True if the sample was delivered, false if no slot was available
+ */
+bool sensor_broker_publish(sensor_type_t type, const void *data, uint32_t flags);
+
+/**
+ * @brief Wait until all queued samples have been delivered
+ * @param timeout_ms Maximum time to wait
+ * @return True if the queues drained in time
+ */
+bool sensor_broker_flush(uint32_t timeout_ms);
+
+/**
+ * @brief Number of registered sample types
+ */
+unsigned sensor_broker_type_count(void);
+
+/**
+ * @brief Number of registered subscribers
+ */
+unsigned sensor_broker_subscriber_count(void);
+
+/**
+ * @brief Get the publish counters of a type
+ * @param type Type ID
+ * @param stats Output
+ * @return False if the type is not registered
+ */
+bool sensor_broker_get_type_stats(sensor_type_t type, sensor_type_stats_t *stats);
+
+/**
+ * @brief Get the delivery counters of a subscriber
+ *
+ * Counters are updated without locking by the delivering task, so a
+ * snapshot taken while a callback completes may mix two updates.
+ *
+ * @param index Subscriber index, 0 to sensor_broker_subscriber_count() - 1
+ * @param stats Output
+ * @return False if the index is out of range
+ */
+bool sensor_broker_get_subscriber_stats(unsigned index, sensor_subscriber_stats_t *stats);
+
+/**
+ * @brief Take an additional reference to a sample
+ * @param sample Sample to retain
+ */
+void sensor_sample_retain(const sensor_sample_t *sample);
+
+/**
+ * @brief Drop a reference to a sample, freeing the slot on the last one
+ * @param sample Sample to release, may be NULL
+ */
+void sensor_sample_release(const sensor_sample_t *sample);
+
+/**
+ * @brief Payload of a sample
+ * @param sample Sample
+ * @return Pointer to the payload, to be cast to the type's struct
+ */
+static inline const void *sensor_sample_data(const sensor_sample_t *sample) {
+    return &sample->payload;
+}
+
+/**
+ * @brief Writable payload of an acquired, not yet committed sample
+ * @param sample Sample
+ * @return Pointer to the payload
+ */
+static inline void *sensor_sample_payload(sensor_sample_t *sample) {
+    return &sample->payload;
+}
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,191 @@
+/**
+ * @file sensor_history.h
+ * @brief Downsampled sensor history in RAM for time range queries
+ *
+ * Keeps min/mean/max per field over fixed time buckets, in tiers of growing
+ * bucket length: by default 30 s buckets for the last hour and 5 min buckets
+ * for the last 24 h. Every sample is folded into the open bucket of each tier
+ * in constant time. When a bucket closes its values are quantized to 16 bits
+ * in steps of the field's resolution and stored in the tier's ring,
+ * overwriting the oldest bucket.
+ *
+ * A query returns min/mean/max per step over a time range. It reads the
+ * finest tier that reaches back to the start of the range, including its
+ * open bucket, and merges the stored buckets of one step at a time, so a
+ * result of any length is produced without allocations.
+ *
+ * Not thread safe: the caller serializes sensor_history_add() and
+ * sensor_history_query_next(), which may be interleaved.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SENSOR_HISTORY_MAX_FIELDS 6
+#define SENSOR_HISTORY_TIER_COUNT 2
+
+// Default tiers: 30 s buckets for 1 h, 5 min buckets for 24 h
+#define SENSOR_HISTORY_DEFAULT_TIERS {{30000, 120}, {300000, 288}}
+
+/**
+ * @brief Describes one float field of a sample struct kept in the history
+ */
+typedef struct {
+    const char *name;  // Key used in responses, matches the MQTT state payload
+    size_t offset;     // offsetof() the float field in the sample struct
+    float resolution;  // Step of the stored values, which saturate at ±32767 steps
+} sensor_history_field_t;
+
+/**
+ * @brief Bucket length and count of one tier
+ */
+typedef struct {
+    uint32_t bucket_ms;
+    uint32_t buckets;
+} sensor_history_tier_config_t;
+
+/**
+ * @brief Quantized values of one field in a stored bucket
+ */
+typedef struct {
+    int16_t min;
+    int16_t mean;
+    int16_t max;
+} sensor_history_value_t;
+
+/**
+ * @brief One tier: a ring of stored buckets and the open bucket
+ */
+typedef struct {
+    uint32_t bucket_ms;
+    uint32_t capacity;
+    uint32_t head;  // Ring index the next closed bucket is stored at
+    uint32_t count; // Stored buckets
+
+    // Ring columns, capacity entries each (values: capacity * field_count)
+    uint32_t *start_ms;
+    uint16_t *samples;
+    sensor_history_value_t *values;
+
+    // Open bucket, not quantized
+    uint32_t open_start_ms;
+    uint32_t open_count;
+    float open_min[SENSOR_HISTORY_MAX_FIELDS];
+    float open_max[SENSOR_HISTORY_MAX_FIELDS];
+    double open_sum[SENSOR_HISTORY_MAX_FIELDS];
+} sensor_history_tier_t;
+
+/**
+ * @brief History of one sensor
+ */
+typedef struct {
+    const char *sensor;
+    const sensor_history_field_t *fields;
+    uint8_t field_count;
+    sensor_history_tier_t tiers[SENSOR_HISTORY_TIER_COUNT]; // Finest first
+} sensor_history_t;
+
+/**
+ * @brief Statistics of one step of a query
+ */
+typedef struct {
+    uint32_t start_ms; // Step start, aligned to the step length
+    uint32_t count;    // Samples in the step
+    float min[SENSOR_HISTORY_MAX_FIELDS];
+    float mean[SENSOR_HISTORY_MAX_FIELDS];
+    float max[SENSOR_HISTORY_MAX_FIELDS];
+} sensor_history_point_t;
+
+/**
+ * @brief Query position, independent of additions made while it runs
+ */
+typedef struct {
+    uint8_t tier;     // Tier read
+    uint32_t step_ms; // Step length, a multiple of the tier's bucket length
+    uint32_t next_ms; // Start of the next step
+    uint32_t to_ms;   // End of the range, exclusive
+} sensor_history_query_t;
+
+// Field descriptor tables for the built-in sensors
+extern const sensor_history_field_t sensor_history_bme690_fields[];
+extern const uint8_t sensor_history_bme690_field_count;
+extern const sensor_history_field_t sensor_history_bmv080_fields[];
+extern const uint8_t sensor_history_bmv080_field_count;
+
+/**
+ * @brief Bytes of ring storage needed for a history
+ * @param field_count Number of fields
+ * @param tiers Tier configuration, SENSOR_HISTORY_TIER_COUNT entries, NULL for the defaults
+ * @return Size in bytes
+ */
+size_t sensor_history_storage_size(uint8_t field_count, const sensor_history_tier_config_t *tiers);
+
+/**
+ * @brief Allocate and initialize a history
+ * @param history History to initialize
+ * @param sensor Sensor name used in responses
+ * @param fields Field descriptor table
+ * @param field_count Number of fields (at most SENSOR_HISTORY_MAX_FIELDS)
+ * @param tiers Tier configuration, SENSOR_HISTORY_TIER_COUNT entries with growing bucket length, NULL for the defaults
+ * @return True on success, false on invalid arguments or allocation failure
+ */
+bool sensor_history_init(sensor_history_t *history, const char *sensor, const sensor_history_field_t *fields, uint8_t field_count,
+    const sensor_history_tier_config_t *tiers);
+
+/**
+ * @brief Release the storage of a history
+ * @param history History to release
+ */
+void sensor_history_deinit(sensor_history_t *history);
+
+/**
+ * @brief Fold a sample into all tiers
+ * @param history History
+ * @param sample Pointer to the sample struct described by the field table
+ * @param timestamp_ms Sample timestamp in milliseconds
+ */
+void sensor_history_add(sensor_history_t *history, const void *sample, uint32_t timestamp_ms);
+
+/**
+ * @brief Start a query
+ *
+ * Reads the finest tier that holds data from before from_ms, or the coarsest
+ * tier if none does. The step is raised to at least that tier's bucket
+ * length and rounded up to a multiple of it; from_ms is aligned down to the
+ * step so steps do not move between repeated queries.
+ *
+ * Timestamps wrap after 49.7 days and are compared by their distance, so the
+ * range must be shorter than 24.8 days, as must the time the tiers span.
+ *
+ * @param history History
+ * @param query Query to start
+ * @param from_ms Start of the range in milliseconds
+ * @param to_ms End of the range in milliseconds, exclusive
+ * @param step_ms Requested step length in milliseconds
+ */
+void sensor_history_query_begin(const sensor_history_t *history, sensor_history_query_t *query, uint32_t from_ms, uint32_t to_ms,
+    uint32_t step_ms);
+
+/**
+ * @brief Get the next step holding samples
+ *
+ * Steps without samples are skipped. Buckets added since the previous call
+ * are included if they fall into steps not returned yet.
+ *
+ * @param history History
+ * @param query Query started with sensor_history_query_begin()
+ * @param point Statistics of the step
+ * @return False at the end of the range
+ */
+bool sensor_history_query_next(const sensor_history_t *history, sensor_history_query_t *query, sensor_history_point_t *point);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,43 @@
+/**
+ * @file sensor_json.h
+ * @brief JSON serializers for the /data and /history endpoints
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "json_writer.h"
+#include "sensor_data_broker.h"
+#include "sensor_history.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Write the latest sensor readings as the /data JSON document
+ * @param writer Writer the document is written to, see json_writer_finish() for the outcome
+ * @param device_id Short device ID
+ * @param timestamp_ms Response timestamp in milliseconds
+ * @param bme690 Latest BME690 data, or NULL if not available yet
+ * @param bmv080 Latest BMV080 data, or NULL if not available yet
+ */
+void sensor_json_write_data(json_writer_t *writer, const char *device_id, int64_t timestamp_ms, const bme690_data_t *bme690,
+    const bmv080_data_t *bmv080);
+
+/**
+ * @brief Write one step of a history query
+ *
+ * Writes {"t":<start_ms>,"n":<samples>,"<field>":[min,mean,max],...} with
+ * the values rounded to the decimals of the field's resolution.
+ *
+ * @param writer Writer, inside an array
+ * @param history History the point was read from
+ * @param point Step returned by sensor_history_query_next()
+ */
+void sensor_json_write_history_point(json_writer_t *writer, const sensor_history_t *history, const sensor_history_point_t *point);
+
+#ifdef __cplusplus
+}
+#endif
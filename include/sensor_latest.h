@@ -0,0 +1,73 @@
+/**
+ * @file sensor_latest.h
+ * @brief Latest value cell with a wait-free writer and lock-free readers
+ *
+ * Holds a copy of the latest value of one producer, e.g. the last BME690
+ * sample, for readers on other tasks. A seqlock over two buffers: the writer
+ * fills the buffer not holding the latest value, then publishes it by
+ * advancing the sequence counter. A reader copies the latest buffer and
+ * checks the counter again; it only retries if the writer started a second
+ * write into the buffer being copied meanwhile. So readers never wait for a
+ * writer that was preempted mid-write, and the writer never waits at all.
+ *
+ * Values are copied in 32-bit atomic words, so neither side has a data
+ * race. Each cell has a single writer. A zero initialized cell is empty.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SENSOR_LATEST_MAX_SIZE 64 // Largest value held, bme690_data_t takes 44 bytes
+
+#define SENSOR_LATEST_WORDS (SENSOR_LATEST_MAX_SIZE / sizeof(uint32_t))
+
+/**
+ * @brief Latest value cell
+ */
+typedef struct {
+    atomic_uint sequence; // Twice the completed writes, plus one while a write is in progress
+    atomic_uint retries;  // Reads repeated after a conflicting write, for diagnostics
+    atomic_uint_least32_t buffers[2][SENSOR_LATEST_WORDS];
+} sensor_latest_t;
+
+/**
+ * @brief Initialize an empty cell
+ * @param latest Cell
+ */
+void sensor_latest_init(sensor_latest_t *latest);
+
+/**
+ * @brief Store a new value, only ever called by the cell's writer
+ * @param latest Cell
+ * @param value Value to copy
+ * @param size Size of value, at most SENSOR_LATEST_MAX_SIZE
+ */
+void sensor_latest_store(sensor_latest_t *latest, const void *value, size_t size);
+
+/**
+ * @brief Copy the latest value
+ * @param latest Cell
+ * @param value Receives the value, as many bytes as stored
+ * @param size Size of value, at most SENSOR_LATEST_MAX_SIZE
+ * @return Version of the value copied (completed writes, counting from 1), 0 if no value was stored yet
+ */
+uint32_t sensor_latest_load(sensor_latest_t *latest, void *value, size_t size);
+
+/**
+ * @brief Version of the latest value without copying it
+ * @param latest Cell
+ * @return Completed writes, 0 if no value was stored yet
+ */
+uint32_t sensor_latest_version(const sensor_latest_t *latest);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,90 @@
+/**
+ * @file sensor_trace.h
+ * @brief Binary trace format for recorded sensor output
+ *
+ * A trace is a header followed by fixed-size records, each holding one
+ * bme690_data_t or bmv080_data_t exactly as produced by output_ready() and
+ * bmv080_data_ready(), tagged with the capture time. Records are stored in
+ * native (little-endian) layout; the header records the struct sizes so that
+ * traces from a different layout are rejected instead of misread.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sensor_data_broker.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SENSOR_TRACE_MAGIC   "PLVT"
+#define SENSOR_TRACE_VERSION 1
+
+typedef enum {
+    SENSOR_TRACE_BME690 = 1,
+    SENSOR_TRACE_BMV080 = 2
+} sensor_trace_type_t;
+
+/**
+ * @brief Trace file header
+ */
+typedef struct {
+    char magic[4];        // SENSOR_TRACE_MAGIC
+    uint16_t version;     // SENSOR_TRACE_VERSION
+    uint16_t record_size; // sizeof(sensor_trace_record_t)
+    uint16_t bme690_size; // sizeof(bme690_data_t)
+    uint16_t bmv080_size; // sizeof(bmv080_data_t)
+    uint32_t reserved;
+} sensor_trace_header_t;
+
+/**
+ * @brief Trace record, one sensor output each
+ */
+typedef struct {
+    uint32_t time_ms; // Capture time in milliseconds, monotonic within a trace
+    uint8_t type;     // sensor_trace_type_t
+    uint8_t reserved[3];
+    union {
+        bme690_data_t bme690;
+        bmv080_data_t bmv080;
+    } data;
+} sensor_trace_record_t;
+
+/**
+ * @brief Write a trace header for the current record layout
+ * @param file Output file
+ * @return true on success
+ */
+bool sensor_trace_write_header(FILE *file);
+
+/**
+ * @brief Read and validate a trace header
+ * @param file Input file positioned at the start of the trace
+ * @param header Optional output for the header read
+ * @return true if the header matches the current record layout
+ */
+bool sensor_trace_read_header(FILE *file, sensor_trace_header_t *header);
+
+/**
+ * @brief Append a record to a trace
+ * @param file Output file
+ * @param record Record to write
+ * @return true on success
+ */
+bool sensor_trace_write_record(FILE *file, const sensor_trace_record_t *record);
+
+/**
+ * @brief Read the next record from a trace
+ * @param file Input file
+ * @param record Output record
+ * @return true if a complete, valid record was read, false at end of trace or on error
+ */
+bool sensor_trace_read_record(FILE *file, sensor_trace_record_t *record);
+
+#ifdef __cplusplus
+}
+#endif
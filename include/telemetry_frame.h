@@ -0,0 +1,104 @@
+/**
+ * @file telemetry_frame.h
+ * @brief Binary sample frames of the /ws telemetry stream
+ *
+ * Every sample is sent as one binary WebSocket message: a fixed header
+ * followed by the fields of its type, all little-endian, floats as IEEE 754
+ * single precision so values arrive bit-exact.
+ *
+ * Header (12 bytes):
+ *   0 u8 version, 1 u8 type, 2 u16 flags, 4 u32 sequence, 8 u32 timestamp
+ *
+ * The sequence is the sensor bus sequence number; a gap between two frames
+ * of a type means samples were skipped for a slow client. The timestamp is
+ * in milliseconds since boot, as in the samples.
+ *
+ * BME690 raw (type 1, 60 bytes), flags bit 0 stabilized, bit 1 run-in done:
+ *   12 f32 raw_temperature, 16 f32 raw_humidity, 20 f32 raw_pressure,
+ *   24 f32 raw_gas, 28 f32 temperature, 32 f32 humidity, 36 f32 iaq,
+ *   40 f32 static_iaq, 44 f32 co2, 48 f32 voc, 52 f32 gas_percentage,
+ *   56 u8 iaq_accuracy, 57 u8 gas_index, 58 u16 reserved
+ *
+ * BMV080 (type 2, 28 bytes), flags bit 0 obstructed, bit 1 out of range:
+ *   12 f32 pm10, 16 f32 pm25, 20 f32 pm1, 24 f32 runtime
+ *
+ * The version changes when the layout of an existing type changes. New
+ * types may be added within a version, clients skip types they do not know.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sensor_data_broker.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TELEMETRY_FRAME_VERSION 1
+
+#define TELEMETRY_FRAME_HEADER_SIZE 12
+#define TELEMETRY_FRAME_BME690_SIZE 60
+#define TELEMETRY_FRAME_BMV080_SIZE 28
+#define TELEMETRY_FRAME_MAX         TELEMETRY_FRAME_BME690_SIZE
+
+/**
+ * @brief Frame types
+ */
+typedef enum {
+    TELEMETRY_FRAME_BME690_RAW = 1,
+    TELEMETRY_FRAME_BMV080 = 2,
+} telemetry_frame_type_t;
+
+// Header flags by type
+#define TELEMETRY_FLAG_BME690_STABILIZED   (1u << 0)
+#define TELEMETRY_FLAG_BME690_RUN_IN       (1u << 1)
+#define TELEMETRY_FLAG_BMV080_OBSTRUCTED   (1u << 0)
+#define TELEMETRY_FLAG_BMV080_OUT_OF_RANGE (1u << 1)
+
+/**
+ * @brief Encode a BME690 raw sample
+ * @param buf Output buffer
+ * @param size Size of output buffer, TELEMETRY_FRAME_BME690_SIZE suffices
+ * @param sequence Bus sequence number of the sample
+ * @param data Sample
+ * @return Frame length in bytes, 0 if the buffer is too small
+ */
+size_t telemetry_frame_bme690_raw(uint8_t *buf, size_t size, uint32_t sequence, const bme690_raw_data_t *data);
+
+/**
+ * @brief Encode a BMV080 sample
+ * @param buf Output buffer
+ * @param size Size of output buffer, TELEMETRY_FRAME_BMV080_SIZE suffices
+ * @param sequence Bus sequence number of the sample
+ * @param data Sample
+ * @return Frame length in bytes, 0 if the buffer is too small
+ */
+size_t telemetry_frame_bmv080(uint8_t *buf, size_t size, uint32_t sequence, const bmv080_data_t *data);
+
+/**
+ * @brief Decode a BME690 raw frame
+ * @param buf Frame
+ * @param len Frame length
+ * @param sequence Decoded sequence number, may be NULL
+ * @param data Decoded sample
+ * @return False if the frame is not a BME690 raw frame of this version
+ */
+bool telemetry_frame_decode_bme690_raw(const uint8_t *buf, size_t len, uint32_t *sequence, bme690_raw_data_t *data);
+
+/**
+ * @brief Decode a BMV080 frame
+ * @param buf Frame
+ * @param len Frame length
+ * @param sequence Decoded sequence number, may be NULL
+ * @param data Decoded sample
+ * @return False if the frame is not a BMV080 frame of this version
+ */
+bool telemetry_frame_decode_bmv080(const uint8_t *buf, size_t len, uint32_t *sequence, bmv080_data_t *data);
+
+#ifdef __cplusplus
+}
+#endif
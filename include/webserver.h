@@ -13,12 +13,17 @@
 extern "C" {
 #endif
 
+// Stack buffer of the streamed JSON handlers, a /config/get document fits in one chunk
+#define WEBSERVER_JSON_CHUNK 1024
+
 /**
  * @brief Initialize and start the unified web server
  *
  * This web server serves:
  * - GET / : Main sensor dashboard page
- * - GET /data : JSON endpoint with current sensor data
+ * - GET /data : JSON endpoint with current sensor data, 304 for a matching If-None-Match
+ * - GET /events : Server-Sent Events stream of new sensor samples
+ * - GET /history : min/mean/max per step of a sensor over a time range (JSON)
  * - GET /config : Configuration page for WiFi and MQTT settings
  * - GET /config/get : Get current configuration (JSON)
  * - POST /config/save : Save configuration endpoint
@@ -41,6 +46,27 @@ esp_err_t webserver_stop(void);
  */
 bool webserver_is_running(void);
 
+/**
+ * @brief Send JSON writer output as a chunk of the response, see json_writer_flush_t
+ *
+ * @param buf Output to send
+ * @param len Number of bytes in buf
+ * @param req HTTP request the response belongs to
+ * @return true if the chunk was sent
+ */
+bool webserver_json_flush(const char *buf, size_t len, void *req);
+
+/**
+ * @brief Check if a client socket takes more data without blocking
+ *
+ * Lets the push handlers skip a slow client and send it the latest data
+ * later, instead of blocking the httpd task until its send times out.
+ *
+ * @param fd Socket of the client
+ * @return true if a send would not block
+ */
+bool webserver_socket_writable(int fd);
+
 /**
  * @brief Register sensor data handlers with the web server
  *
@@ -49,6 +75,27 @@ bool webserver_is_running(void);
  */
 esp_err_t webserver_register_sensor_handlers(httpd_handle_t server);
 
+/**
+ * @brief Register the sensor history handler with the web server
+ *
+ * Starts recording the history on the first call.
+ *
+ * @param server HTTP server handle
+ * @return ESP_OK on success
+ */
+esp_err_t webserver_register_history_handlers(httpd_handle_t server);
+
+/**
+ * @brief Register the /ws telemetry WebSocket handler with the web server
+ *
+ * Streams binary frames, see telemetry_frame.h. Subscribes to the sensor
+ * data bus on the first call.
+ *
+ * @param server HTTP server handle
+ * @return ESP_OK on success
+ */
+esp_err_t webserver_register_ws_handlers(httpd_handle_t server);
+
 /**
  * @brief Register configuration handlers with the web server
  *
@@ -0,0 +1,61 @@
+/**
+ * @file mqtt_alias.c
+ * @brief MQTT 5 topic alias bookkeeping for the outgoing state topics
+ */
+
+#include "mqtt_alias.h"
+
+#include <string.h>
+
+void mqtt_alias_init(mqtt_alias_table_t *table) {
+    memset(table, 0, sizeof(*table));
+}
+
+uint16_t mqtt_alias_add(mqtt_alias_table_t *table, const char *topic) {
+    if (topic == NULL || topic[0] == '\0' || table->count >= MQTT_ALIAS_MAX) {
+        return 0;
+    }
+    table->topics[table->count++] = topic;
+    return table->count;
+}
+
+void mqtt_alias_connected(mqtt_alias_table_t *table, uint16_t maximum) {
+    table->maximum = maximum;
+    table->announced = 0;
+}
+
+void mqtt_alias_disable(mqtt_alias_table_t *table) {
+    mqtt_alias_connected(table, 0);
+}
+
+static uint16_t find_alias(const mqtt_alias_table_t *table, const char *topic) {
+    for (uint8_t i = 0; i < table->count && i < table->maximum; i++) {
+        if (strcmp(table->topics[i], topic) == 0) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+uint16_t mqtt_alias_resolve(mqtt_alias_table_t *table, const char *topic, int qos, const char **wire_topic) {
+    uint16_t alias = find_alias(table, topic);
+
+    *wire_topic = topic;
+    if (alias != 0 && qos == 0 && (table->announced & (1u << (alias - 1))) != 0) {
+        *wire_topic = "";
+    }
+    return alias;
+}
+
+void mqtt_alias_sent(mqtt_alias_table_t *table, uint16_t alias, const char *wire_topic) {
+    if (alias == 0 || alias > table->count) {
+        return;
+    }
+
+    if (wire_topic[0] == '\0') {
+        table->alias_only++;
+        table->bytes_saved += strlen(table->topics[alias - 1]);
+    } else {
+        table->announced |= 1u << (alias - 1);
+    }
+}
@@ -0,0 +1,33 @@
+/**
+ * @file mqtt_backoff.c
+ * @brief Exponential reconnect backoff with full jitter
+ */
+
+#include "mqtt_backoff.h"
+
+void mqtt_backoff_init(mqtt_backoff_t *backoff, uint32_t base_ms, uint32_t cap_ms) {
+    backoff->base_ms = base_ms > 0 ? base_ms : 1;
+    backoff->cap_ms = cap_ms > backoff->base_ms ? cap_ms : backoff->base_ms;
+    backoff->attempt = 0;
+}
+
+uint32_t mqtt_backoff_ceiling(const mqtt_backoff_t *backoff) {
+    uint64_t ceiling = (uint64_t)backoff->base_ms << (backoff->attempt < 32 ? backoff->attempt : 32);
+    return ceiling < backoff->cap_ms ? (uint32_t)ceiling : backoff->cap_ms;
+}
+
+uint32_t mqtt_backoff_next(mqtt_backoff_t *backoff, uint32_t random) {
+    uint32_t ceiling = mqtt_backoff_ceiling(backoff);
+
+    // Stop counting once the cap is reached so the shift cannot overflow
+    if (ceiling < backoff->cap_ms) {
+        backoff->attempt++;
+    }
+
+    // Scale instead of taking the remainder to avoid modulo bias
+    return (uint32_t)(((uint64_t)random * ((uint64_t)ceiling + 1)) >> 32);
+}
+
+void mqtt_backoff_reset(mqtt_backoff_t *backoff) {
+    backoff->attempt = 0;
+}
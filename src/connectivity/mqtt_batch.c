@@ -0,0 +1,101 @@
+/**
+ * @file mqtt_batch.c
+ * @brief Time and size bounded batching of MQTT payloads
+ */
+
+#include "mqtt_batch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+const mqtt_batch_framing_t mqtt_batch_json = {.prefix = "[", .separator = ",", .suffix = "]"};
+const mqtt_batch_framing_t mqtt_batch_cbor = {.prefix = "\x9F", .separator = "", .suffix = "\xFF"};
+
+bool mqtt_batch_init(mqtt_batch_t *batch, const mqtt_batch_framing_t *framing, const mqtt_batch_limits_t *limits, size_t capacity) {
+    memset(batch, 0, sizeof(*batch));
+    batch->framing = framing;
+    batch->limits = *limits;
+    batch->capacity = capacity;
+    batch->buf = malloc(capacity);
+    return batch->buf != NULL;
+}
+
+void mqtt_batch_deinit(mqtt_batch_t *batch) {
+    free(batch->buf);
+    batch->buf = NULL;
+    batch->len = 0;
+    batch->count = 0;
+}
+
+bool mqtt_batch_enabled(const mqtt_batch_t *batch) {
+    return batch->limits.max_samples > 1;
+}
+
+static void batch_put(mqtt_batch_t *batch, const void *bytes, size_t len) {
+    memcpy(batch->buf + batch->len, bytes, len);
+    batch->len += len;
+}
+
+void mqtt_batch_flush(mqtt_batch_t *batch, mqtt_batch_flush_t flush, void *ctx) {
+    if (batch->count == 0) {
+        return;
+    }
+
+    // Room for the suffix is reserved by mqtt_batch_add()
+    batch_put(batch, batch->framing->suffix, strlen(batch->framing->suffix));
+    flush(batch->buf, batch->len, batch->count, ctx);
+    batch->flushes++;
+    batch->len = 0;
+    batch->count = 0;
+}
+
+bool mqtt_batch_add(mqtt_batch_t *batch, const void *item, size_t len, uint32_t now_ms, mqtt_batch_flush_t flush, void *ctx) {
+    const mqtt_batch_framing_t *framing = batch->framing;
+    size_t prefix_len = strlen(framing->prefix);
+    size_t separator_len = strlen(framing->separator);
+    size_t suffix_len = strlen(framing->suffix);
+
+    if (prefix_len + len + suffix_len > batch->capacity) {
+        batch->dropped++;
+        return false;
+    }
+
+    if (batch->count > 0 && batch->len + separator_len + len + suffix_len > batch->capacity) {
+        mqtt_batch_flush(batch, flush, ctx);
+    }
+
+    if (batch->count == 0) {
+        batch_put(batch, framing->prefix, prefix_len);
+        batch->first_ms = now_ms;
+    } else {
+        batch_put(batch, framing->separator, separator_len);
+    }
+    batch->last_offset = batch->len;
+    batch->last_len = len;
+    batch_put(batch, item, len);
+    batch->count++;
+    batch->items++;
+
+    if (batch->count >= batch->limits.max_samples || mqtt_batch_ms_until_due(batch, now_ms) == 0) {
+        mqtt_batch_flush(batch, flush, ctx);
+    }
+    return true;
+}
+
+uint32_t mqtt_batch_ms_until_due(const mqtt_batch_t *batch, uint32_t now_ms) {
+    if (batch->count == 0 || batch->limits.max_age_ms == 0) {
+        return UINT32_MAX;
+    }
+
+    uint32_t age = now_ms - batch->first_ms;
+    return age >= batch->limits.max_age_ms ? 0 : batch->limits.max_age_ms - age;
+}
+
+bool mqtt_batch_poll(mqtt_batch_t *batch, uint32_t now_ms, mqtt_batch_flush_t flush, void *ctx) {
+    if (mqtt_batch_ms_until_due(batch, now_ms) != 0) {
+        return false;
+    }
+
+    mqtt_batch_flush(batch, flush, ctx);
+    return true;
+}
@@ -0,0 +1,432 @@
+/**
+ * @file mqtt_cbor.c
+ * @brief Compact CBOR encoding of the sensor state payloads
+ */
+
+#include "mqtt_cbor.h"
+
+#include <math.h>
+#include <string.h>
+
+// CBOR major types and simple values
+#define CBOR_UINT   0
+#define CBOR_NEGINT 1
+#define CBOR_BYTES  2
+#define CBOR_TEXT   3
+#define CBOR_ARRAY  4
+#define CBOR_MAP    5
+#define CBOR_TAG    6
+#define CBOR_SIMPLE 7
+
+#define CBOR_FALSE   0xF4
+#define CBOR_TRUE    0xF5
+#define CBOR_FLOAT32 0xFA
+
+// Additional information of major type 7 items
+#define CBOR_INFO_FALSE   20
+#define CBOR_INFO_TRUE    21
+#define CBOR_INFO_FLOAT16 25
+#define CBOR_INFO_FLOAT32 26
+#define CBOR_INFO_FLOAT64 27
+
+#define CBOR_MAX_DEPTH 8
+
+// Keys shared by both payloads
+#define KEY_VERSION 0
+
+typedef enum {
+    CBOR_FIELD_FLOAT,
+    CBOR_FIELD_UINT8,
+    CBOR_FIELD_UINT32,
+    CBOR_FIELD_BOOL,
+} cbor_field_kind_t;
+
+typedef struct {
+    uint8_t key;
+    uint8_t kind; // cbor_field_kind_t
+    uint16_t offset;
+} cbor_field_t;
+
+#define CBOR_FIELD(key, type, member, kind) {key, kind, offsetof(type, member)}
+
+#define KEY_BME690_AVERAGED 12
+
+static const cbor_field_t bme690_fields[] = {
+    CBOR_FIELD(1, bme690_data_t, temperature, CBOR_FIELD_FLOAT),
+    CBOR_FIELD(2, bme690_data_t, humidity, CBOR_FIELD_FLOAT),
+    CBOR_FIELD(3, bme690_data_t, pressure, CBOR_FIELD_FLOAT),
+    CBOR_FIELD(4, bme690_data_t, iaq, CBOR_FIELD_FLOAT),
+    CBOR_FIELD(5, bme690_data_t, co2_equivalent, CBOR_FIELD_FLOAT),
+    CBOR_FIELD(6, bme690_data_t, breath_voc_equivalent, CBOR_FIELD_FLOAT),
+    CBOR_FIELD(7, bme690_data_t, iaq_accuracy, CBOR_FIELD_UINT8),
+    CBOR_FIELD(8, bme690_data_t, static_iaq, CBOR_FIELD_FLOAT),
+    CBOR_FIELD(9, bme690_data_t, gas_percentage, CBOR_FIELD_FLOAT),
+    CBOR_FIELD(10, bme690_data_t, stabilization_status, CBOR_FIELD_BOOL),
+    CBOR_FIELD(11, bme690_data_t, run_in_status, CBOR_FIELD_BOOL),
+    CBOR_FIELD(13, bme690_data_t, timestamp, CBOR_FIELD_UINT32),
+};
+
+static const cbor_field_t bmv080_fields[] = {
+    CBOR_FIELD(1, bmv080_data_t, pm10, CBOR_FIELD_FLOAT),
+    CBOR_FIELD(2, bmv080_data_t, pm25, CBOR_FIELD_FLOAT),
+    CBOR_FIELD(3, bmv080_data_t, pm1, CBOR_FIELD_FLOAT),
+    CBOR_FIELD(4, bmv080_data_t, is_obstructed, CBOR_FIELD_BOOL),
+    CBOR_FIELD(5, bmv080_data_t, is_outside_range, CBOR_FIELD_BOOL),
+    CBOR_FIELD(6, bmv080_data_t, runtime, CBOR_FIELD_FLOAT),
+    CBOR_FIELD(7, bmv080_data_t, timestamp, CBOR_FIELD_UINT32),
+};
+
+#define FIELD_COUNT(fields) (sizeof(fields) / sizeof(fields[0]))
+
+// Encoder
+
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+} cbor_writer_t;
+
+static void cbor_put(cbor_writer_t *w, const uint8_t *bytes, size_t n) {
+    if (w->len + n > w->size) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->len, bytes, n);
+    w->len += n;
+}
+
+// Item head with the shortest encoding of the argument
+static void cbor_put_head(cbor_writer_t *w, uint8_t major, uint32_t value) {
+    uint8_t head[5];
+    size_t n;
+    if (value < 24) {
+        head[0] = (uint8_t)(major << 5 | value);
+        n = 1;
+    } else if (value <= 0xFF) {
+        head[0] = (uint8_t)(major << 5 | 24);
+        head[1] = (uint8_t)value;
+        n = 2;
+    } else if (value <= 0xFFFF) {
+        head[0] = (uint8_t)(major << 5 | 25);
+        head[1] = (uint8_t)(value >> 8);
+        head[2] = (uint8_t)value;
+        n = 3;
+    } else {
+        head[0] = (uint8_t)(major << 5 | 26);
+        head[1] = (uint8_t)(value >> 24);
+        head[2] = (uint8_t)(value >> 16);
+        head[3] = (uint8_t)(value >> 8);
+        head[4] = (uint8_t)value;
+        n = 5;
+    }
+    cbor_put(w, head, n);
+}
+
+static void cbor_put_float(cbor_writer_t *w, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint8_t item[5] = {CBOR_FLOAT32, (uint8_t)(bits >> 24), (uint8_t)(bits >> 16), (uint8_t)(bits >> 8), (uint8_t)bits};
+    cbor_put(w, item, sizeof(item));
+}
+
+static void cbor_put_bool(cbor_writer_t *w, bool value) {
+    const uint8_t item = value ? CBOR_TRUE : CBOR_FALSE;
+    cbor_put(w, &item, 1);
+}
+
+static void cbor_put_fields(cbor_writer_t *w, const cbor_field_t *fields, size_t count, const void *data) {
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *value = (const uint8_t *)data + fields[i].offset;
+        cbor_put_head(w, CBOR_UINT, fields[i].key);
+
+        switch (fields[i].kind) {
+        case CBOR_FIELD_FLOAT: {
+            float f;
+            memcpy(&f, value, sizeof(f));
+            cbor_put_float(w, f);
+            break;
+        }
+        case CBOR_FIELD_UINT8:
+            cbor_put_head(w, CBOR_UINT, *value);
+            break;
+        case CBOR_FIELD_UINT32: {
+            uint32_t u;
+            memcpy(&u, value, sizeof(u));
+            cbor_put_head(w, CBOR_UINT, u);
+            break;
+        }
+        case CBOR_FIELD_BOOL:
+            cbor_put_bool(w, *(const bool *)value);
+            break;
+        }
+    }
+}
+
+int mqtt_cbor_bme690(uint8_t *buf, size_t size, const bme690_data_t *data, bool is_averaged) {
+    if (buf == NULL || data == NULL) {
+        return -1;
+    }
+
+    cbor_writer_t w = {.buf = buf, .size = size};
+    cbor_put_head(&w, CBOR_MAP, 2 + FIELD_COUNT(bme690_fields));
+    cbor_put_head(&w, CBOR_UINT, KEY_VERSION);
+    cbor_put_head(&w, CBOR_UINT, MQTT_CBOR_VERSION);
+    cbor_put_head(&w, CBOR_UINT, KEY_BME690_AVERAGED);
+    cbor_put_bool(&w, is_averaged);
+    cbor_put_fields(&w, bme690_fields, FIELD_COUNT(bme690_fields), data);
+    return w.overflow ? -1 : (int)w.len;
+}
+
+int mqtt_cbor_bmv080(uint8_t *buf, size_t size, const bmv080_data_t *data) {
+    if (buf == NULL || data == NULL) {
+        return -1;
+    }
+
+    cbor_writer_t w = {.buf = buf, .size = size};
+    cbor_put_head(&w, CBOR_MAP, 1 + FIELD_COUNT(bmv080_fields));
+    cbor_put_head(&w, CBOR_UINT, KEY_VERSION);
+    cbor_put_head(&w, CBOR_UINT, MQTT_CBOR_VERSION);
+    cbor_put_fields(&w, bmv080_fields, FIELD_COUNT(bmv080_fields), data);
+    return w.overflow ? -1 : (int)w.len;
+}
+
+// Decoder
+
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;
+} cbor_reader_t;
+
+typedef struct {
+    uint8_t major;
+    uint8_t info;   // Additional information of the initial byte
+    uint64_t value; // Argument, or the raw bits of a float
+} cbor_item_t;
+
+static bool cbor_read_item(cbor_reader_t *r, cbor_item_t *item) {
+    if (r->pos >= r->len) {
+        return false;
+    }
+
+    uint8_t initial = r->buf[r->pos++];
+    item->major = initial >> 5;
+    item->info = initial & 0x1F;
+
+    size_t n;
+    if (item->info < 24) {
+        item->value = item->info;
+        return true;
+    } else if (item->info <= 27) {
+        n = (size_t)1 << (item->info - 24);
+    } else {
+        return false; // Reserved or indefinite length
+    }
+
+    if (r->len - r->pos < n) {
+        return false;
+    }
+    item->value = 0;
+    for (size_t i = 0; i < n; i++) {
+        item->value = item->value << 8 | r->buf[r->pos++];
+    }
+    return true;
+}
+
+static bool cbor_skip(cbor_reader_t *r, int depth) {
+    cbor_item_t item;
+    if (depth > CBOR_MAX_DEPTH || !cbor_read_item(r, &item)) {
+        return false;
+    }
+
+    switch (item.major) {
+    case CBOR_BYTES:
+    case CBOR_TEXT:
+        if (item.value > r->len - r->pos) {
+            return false;
+        }
+        r->pos += item.value;
+        return true;
+    case CBOR_ARRAY:
+    case CBOR_MAP: {
+        uint64_t count = item.major == CBOR_MAP ? item.value * 2 : item.value;
+        for (uint64_t i = 0; i < count; i++) {
+            if (!cbor_skip(r, depth + 1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    case CBOR_TAG:
+        return cbor_skip(r, depth + 1);
+    default:
+        return true;
+    }
+}
+
+static float half_to_float(uint16_t half) {
+    int exponent = (half >> 10) & 0x1F;
+    int mantissa = half & 0x3FF;
+    float value;
+    if (exponent == 0) {
+        value = ldexpf((float)mantissa, -24);
+    } else if (exponent == 31) {
+        value = mantissa == 0 ? INFINITY : NAN;
+    } else {
+        value = ldexpf((float)(mantissa + 1024), exponent - 25);
+    }
+    return (half & 0x8000) ? -value : value;
+}
+
+// Numeric value of an item as a float, accepting any CBOR number encoding
+static bool cbor_item_to_float(const cbor_item_t *item, float *out) {
+    if (item->major == CBOR_UINT) {
+        *out = (float)item->value;
+    } else if (item->major == CBOR_NEGINT) {
+        *out = -1.0f - (float)item->value;
+    } else if (item->major == CBOR_SIMPLE && item->info == CBOR_INFO_FLOAT16) {
+        *out = half_to_float((uint16_t)item->value);
+    } else if (item->major == CBOR_SIMPLE && item->info == CBOR_INFO_FLOAT32) {
+        uint32_t bits = (uint32_t)item->value;
+        memcpy(out, &bits, sizeof(*out));
+    } else if (item->major == CBOR_SIMPLE && item->info == CBOR_INFO_FLOAT64) {
+        double d;
+        memcpy(&d, &item->value, sizeof(d));
+        *out = (float)d;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool cbor_decode_field(const cbor_field_t *field, const cbor_item_t *item, void *data) {
+    uint8_t *value = (uint8_t *)data + field->offset;
+
+    switch (field->kind) {
+    case CBOR_FIELD_FLOAT: {
+        float f;
+        if (!cbor_item_to_float(item, &f)) {
+            return false;
+        }
+        memcpy(value, &f, sizeof(f));
+        return true;
+    }
+    case CBOR_FIELD_UINT8:
+        if (item->major != CBOR_UINT || item->value > UINT8_MAX) {
+            return false;
+        }
+        *value = (uint8_t)item->value;
+        return true;
+    case CBOR_FIELD_UINT32: {
+        if (item->major != CBOR_UINT || item->value > UINT32_MAX) {
+            return false;
+        }
+        uint32_t u = (uint32_t)item->value;
+        memcpy(value, &u, sizeof(u));
+        return true;
+    }
+    case CBOR_FIELD_BOOL:
+        if (item->major != CBOR_SIMPLE || (item->info != CBOR_INFO_FALSE && item->info != CBOR_INFO_TRUE)) {
+            return false;
+        }
+        *(bool *)value = item->info == CBOR_INFO_TRUE;
+        return true;
+    }
+    return false;
+}
+
+// Decode a payload map into data. bool_key, if not 0, is an extra boolean key stored in *extra
+static bool cbor_decode(
+    const uint8_t *buf, size_t len, const cbor_field_t *fields, size_t count, void *data, uint8_t bool_key, bool *extra) {
+    if (buf == NULL) {
+        return false;
+    }
+
+    cbor_reader_t r = {.buf = buf, .len = len};
+    cbor_item_t map;
+    if (!cbor_read_item(&r, &map) || map.major != CBOR_MAP) {
+        return false;
+    }
+
+    bool version_seen = false;
+    for (uint64_t i = 0; i < map.value; i++) {
+        size_t key_pos = r.pos;
+        cbor_item_t key;
+        if (!cbor_read_item(&r, &key)) {
+            return false;
+        }
+        if (key.major != CBOR_UINT) {
+            // Foreign key type, skip the whole key and its value
+            r.pos = key_pos;
+            if (!cbor_skip(&r, 1) || !cbor_skip(&r, 1)) {
+                return false;
+            }
+            continue;
+        }
+
+        const cbor_field_t *field = NULL;
+        for (size_t f = 0; f < count; f++) {
+            if (fields[f].key == key.value) {
+                field = &fields[f];
+                break;
+            }
+        }
+
+        if (field == NULL && key.value != KEY_VERSION && (bool_key == 0 || key.value != bool_key)) {
+            if (!cbor_skip(&r, 1)) {
+                return false;
+            }
+            continue;
+        }
+
+        // Known keys only hold scalars, a container fails the type checks below
+        cbor_item_t value;
+        if (!cbor_read_item(&r, &value)) {
+            return false;
+        }
+
+        if (key.value == KEY_VERSION) {
+            if (value.major != CBOR_UINT || value.value != MQTT_CBOR_VERSION) {
+                return false;
+            }
+            version_seen = true;
+        } else if (field != NULL) {
+            if (!cbor_decode_field(field, &value, data)) {
+                return false;
+            }
+        } else {
+            const cbor_field_t flag = {.key = bool_key, .kind = CBOR_FIELD_BOOL, .offset = 0};
+            bool decoded;
+            if (!cbor_decode_field(&flag, &value, &decoded)) {
+                return false;
+            }
+            if (extra != NULL) {
+                *extra = decoded;
+            }
+        }
+    }
+
+    return version_seen && r.pos == r.len;
+}
+
+bool mqtt_cbor_decode_bme690(const uint8_t *buf, size_t len, bme690_data_t *data, bool *is_averaged) {
+    if (data == NULL) {
+        return false;
+    }
+
+    memset(data, 0, sizeof(*data));
+    if (is_averaged != NULL) {
+        *is_averaged = false;
+    }
+    return cbor_decode(buf, len, bme690_fields, FIELD_COUNT(bme690_fields), data, KEY_BME690_AVERAGED, is_averaged);
+}
+
+bool mqtt_cbor_decode_bmv080(const uint8_t *buf, size_t len, bmv080_data_t *data) {
+    if (data == NULL) {
+        return false;
+    }
+
+    memset(data, 0, sizeof(*data));
+    return cbor_decode(buf, len, bmv080_fields, FIELD_COUNT(bmv080_fields), data, 0, NULL);
+}
@@ -0,0 +1,360 @@
+/**
+ * @file mqtt_command.c
+ * @brief Settings commands received on the device command topic
+ */
+
+#include "mqtt_command.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mqtt_deadband.h"
+#include "mqtt_qos.h"
+
+typedef enum {
+    SETTING_UINT,     // Unsigned number of the given width within min..max
+    SETTING_BOOL,     // "0" or "1"
+    SETTING_QOS,      // QoS policy name
+    SETTING_WINDOWS,  // Statistics window lengths
+    SETTING_DEADBAND, // Change filter thresholds
+    SETTING_ID,       // Correlation token
+    SETTING_RESTART,  // Restart request
+} setting_type_t;
+
+typedef struct {
+    const char *key;
+    setting_type_t type;
+    mqtt_command_change_t group;
+    size_t offset; // offsetof() the value in mqtt_command_t
+    uint8_t width; // Bytes of a SETTING_UINT value
+    uint32_t min;
+    uint32_t max;
+    const mqtt_deadband_field_t *fields; // Fields of a SETTING_DEADBAND value
+    const uint8_t *field_count;
+} setting_t;
+
+#define UINT_SETTING(key, group, member, min, max) \
+    {key, SETTING_UINT, group, offsetof(mqtt_command_t, member), sizeof(((mqtt_command_t *)0)->member), min, max, NULL, NULL}
+#define TYPED_SETTING(key, type, group, member) {key, type, group, offsetof(mqtt_command_t, member), 0, 0, 0, NULL, NULL}
+
+static const setting_t settings[] = {
+    UINT_SETTING("bmv080_duty_cycle", MQTT_COMMAND_DUTY_CYCLE, sensor.bmv080_duty_cycle_s, 12, 3600),
+    TYPED_SETTING("bme690_gated", SETTING_BOOL, MQTT_COMMAND_GATING, sensor.bme690_gated),
+    TYPED_SETTING("stats_windows", SETTING_WINDOWS, MQTT_COMMAND_STATS_WINDOWS, sensor.stats_window_s),
+    TYPED_SETTING("qos_state", SETTING_QOS, MQTT_COMMAND_QOS, mqtt.qos.state),
+    TYPED_SETTING("qos_batch", SETTING_QOS, MQTT_COMMAND_QOS, mqtt.qos.batch),
+    TYPED_SETTING("qos_stats", SETTING_QOS, MQTT_COMMAND_QOS, mqtt.qos.stats),
+    TYPED_SETTING("qos_system", SETTING_QOS, MQTT_COMMAND_QOS, mqtt.qos.system),
+    UINT_SETTING("mqtt_expiry", MQTT_COMMAND_EXPIRY, mqtt.message_expiry_s, 0, UINT16_MAX),
+    UINT_SETTING("bme690_batch", MQTT_COMMAND_BATCH, mqtt.batch_bme690.max_samples, 0, UINT8_MAX),
+    UINT_SETTING("bme690_batch_age", MQTT_COMMAND_BATCH, mqtt.batch_bme690.max_age_s, 0, UINT16_MAX),
+    UINT_SETTING("bmv080_batch", MQTT_COMMAND_BATCH, mqtt.batch_bmv080.max_samples, 0, UINT8_MAX),
+    UINT_SETTING("bmv080_batch_age", MQTT_COMMAND_BATCH, mqtt.batch_bmv080.max_age_s, 0, UINT16_MAX),
+    {"bme690_deadband", SETTING_DEADBAND, MQTT_COMMAND_DEADBAND, offsetof(mqtt_command_t, mqtt.deadband_bme690.spec), 0, 0, 0,
+        mqtt_deadband_bme690_fields, &mqtt_deadband_bme690_field_count},
+    {"bmv080_deadband", SETTING_DEADBAND, MQTT_COMMAND_DEADBAND, offsetof(mqtt_command_t, mqtt.deadband_bmv080.spec), 0, 0, 0,
+        mqtt_deadband_bmv080_fields, &mqtt_deadband_bmv080_field_count},
+    UINT_SETTING("bme690_heartbeat", MQTT_COMMAND_DEADBAND, mqtt.deadband_bme690.heartbeat_s, 0, UINT16_MAX),
+    UINT_SETTING("bmv080_heartbeat", MQTT_COMMAND_DEADBAND, mqtt.deadband_bmv080.heartbeat_s, 0, UINT16_MAX),
+    TYPED_SETTING("id", SETTING_ID, 0, id),
+    {"restart", SETTING_RESTART, MQTT_COMMAND_RESTART, 0, 0, 0, 0, NULL, NULL},
+};
+
+static const char *const change_names[MQTT_COMMAND_GROUP_COUNT] = {
+    "bmv080_duty_cycle",
+    "bme690_gated",
+    "stats_windows",
+    "qos",
+    "mqtt_expiry",
+    "batch",
+    "deadband",
+    "restart",
+};
+
+// The spec field of a change filter
+#define DEADBAND_SPEC_SIZE sizeof(((polverine_deadband_config_t *)0)->spec)
+
+static bool fail(mqtt_command_t *cmd, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(cmd->error, sizeof(cmd->error), format, args);
+    va_end(args);
+    return false;
+}
+
+static char *trim(char *s) {
+    while (*s == ' ' || *s == '\t') {
+        s++;
+    }
+    char *end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) {
+        *--end = '\0';
+    }
+    return s;
+}
+
+static bool is_token(const char *s, bool id) {
+    if (*s == '\0') {
+        return false;
+    }
+    for (; *s != '\0'; s++) {
+        bool ok = (*s >= 'a' && *s <= 'z') || (*s >= '0' && *s <= '9') || *s == '_' ||
+                  (id && ((*s >= 'A' && *s <= 'Z') || *s == '-' || *s == '.'));
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Decimal number without sign, ending at the end of the string or at stop
+static bool parse_uint(const char *s, char stop, uint32_t max, uint32_t *value, const char **end) {
+    if (*s < '0' || *s > '9') {
+        return false;
+    }
+    uint64_t v = 0;
+    for (; *s >= '0' && *s <= '9'; s++) {
+        v = v * 10 + (uint64_t)(*s - '0');
+        if (v > max) {
+            return false;
+        }
+    }
+    while (*s == ' ') {
+        s++;
+    }
+    if (*s != '\0' && *s != stop) {
+        return false;
+    }
+    *value = (uint32_t)v;
+    if (end != NULL) {
+        *end = s;
+    }
+    return true;
+}
+
+static void write_uint(void *field, uint8_t width, uint32_t value) {
+    if (width == 1) {
+        *(uint8_t *)field = (uint8_t)value;
+    } else if (width == 2) {
+        *(uint16_t *)field = (uint16_t)value;
+    } else {
+        *(uint32_t *)field = value;
+    }
+}
+
+static uint32_t read_uint(const void *field, uint8_t width) {
+    if (width == 1) {
+        return *(const uint8_t *)field;
+    } else if (width == 2) {
+        return *(const uint16_t *)field;
+    }
+    return *(const uint32_t *)field;
+}
+
+static bool apply_setting(mqtt_command_t *cmd, const setting_t *setting, const char *value) {
+    void *field = (uint8_t *)cmd + setting->offset;
+    uint32_t number;
+    bool changed = false;
+
+    switch (setting->type) {
+    case SETTING_UINT:
+        if (!parse_uint(value, '\0', setting->max, &number, NULL) || number < setting->min) {
+            return fail(cmd, "%s must be a number from %lu to %lu", setting->key, (unsigned long)setting->min,
+                (unsigned long)setting->max);
+        }
+        changed = read_uint(field, setting->width) != number;
+        write_uint(field, setting->width, number);
+        break;
+
+    case SETTING_BOOL:
+        if (!parse_uint(value, '\0', 1, &number, NULL)) {
+            return fail(cmd, "%s must be 0 or 1", setting->key);
+        }
+        changed = *(bool *)field != (number != 0);
+        *(bool *)field = number != 0;
+        break;
+
+    case SETTING_QOS: {
+        uint8_t policy;
+        if (!mqtt_qos_policy_parse(value, &policy)) {
+            return fail(cmd, "%s must be 0, 1 or auto", setting->key);
+        }
+        changed = *(uint8_t *)field != policy;
+        *(uint8_t *)field = policy;
+        break;
+    }
+
+    case SETTING_WINDOWS: {
+        uint32_t windows[SENSOR_AGG_WINDOW_COUNT];
+        const char *s = value;
+        for (int i = 0; i < SENSOR_AGG_WINDOW_COUNT; i++) {
+            const char *end;
+            bool last = i == SENSOR_AGG_WINDOW_COUNT - 1;
+            if (!parse_uint(s, last ? '\0' : ',', MQTT_COMMAND_WINDOW_MAX_S, &windows[i], &end) || (windows[i] != 0 && windows[i] < 10) ||
+                (!last && *end != ',')) {
+                return fail(cmd, "%s must be %d lengths from 10 to %d s or 0, separated by commas", setting->key, SENSOR_AGG_WINDOW_COUNT,
+                    MQTT_COMMAND_WINDOW_MAX_S);
+            }
+            if (!last) {
+                s = end + 1;
+                while (*s == ' ') {
+                    s++;
+                }
+            }
+        }
+        changed = memcmp(field, windows, sizeof(windows)) != 0;
+        memcpy(field, windows, sizeof(windows));
+        break;
+    }
+
+    case SETTING_DEADBAND: {
+        mqtt_deadband_t filter;
+        mqtt_deadband_init(&filter, setting->fields, *setting->field_count, 0);
+        if (strlen(value) >= DEADBAND_SPEC_SIZE || !mqtt_deadband_parse(&filter, value)) {
+            return fail(cmd, "%s has invalid thresholds", setting->key);
+        }
+        changed = strcmp(field, value) != 0;
+        strcpy(field, value);
+        break;
+    }
+
+    case SETTING_ID:
+        if (strlen(value) >= MQTT_COMMAND_ID_MAX || !is_token(value, true)) {
+            return fail(cmd, "id must be up to %d letters, digits, '-', '_' or '.'", MQTT_COMMAND_ID_MAX - 1);
+        }
+        strcpy(field, value);
+        break;
+
+    case SETTING_RESTART:
+        if (!parse_uint(value, '\0', 1, &number, NULL)) {
+            return fail(cmd, "%s must be 0 or 1", setting->key);
+        }
+        changed = number != 0;
+        break;
+    }
+
+    if (changed) {
+        cmd->changes |= setting->group;
+    }
+    return true;
+}
+
+bool mqtt_command_parse(mqtt_command_t *cmd, const char *payload, size_t len) {
+    if (cmd == NULL) {
+        return false;
+    }
+
+    cmd->changes = 0;
+    cmd->id[0] = '\0';
+    cmd->error[0] = '\0';
+    if (payload == NULL || len == 0) {
+        return fail(cmd, "empty command");
+    }
+    if (len > MQTT_COMMAND_MAX_LEN) {
+        return fail(cmd, "command longer than %d bytes", MQTT_COMMAND_MAX_LEN);
+    }
+
+    // Settings are applied to a copy, which only replaces the command's settings once all are valid
+    mqtt_command_t next = *cmd;
+    char text[MQTT_COMMAND_MAX_LEN + 1];
+    memcpy(text, payload, len);
+    text[len] = '\0';
+    if (strlen(text) != len) {
+        return fail(cmd, "command contains a NUL byte");
+    }
+
+    bool any = false;
+    char *saveptr = NULL;
+    for (char *entry = strtok_r(text, ";\n", &saveptr); entry != NULL; entry = strtok_r(NULL, ";\n", &saveptr)) {
+        entry = trim(entry);
+        if (*entry == '\0') {
+            continue;
+        }
+
+        char *value = strchr(entry, '=');
+        if (value == NULL) {
+            return fail(cmd, "expected key=value");
+        }
+        *value++ = '\0';
+        char *key = trim(entry);
+        value = trim(value);
+
+        if (!is_token(key, false)) {
+            return fail(cmd, "invalid key");
+        }
+
+        const setting_t *setting = NULL;
+        for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+            if (strcmp(settings[i].key, key) == 0) {
+                setting = &settings[i];
+                break;
+            }
+        }
+        if (setting == NULL) {
+            return fail(cmd, "unknown setting %.40s", key);
+        }
+        if (!apply_setting(&next, setting, value)) {
+            memcpy(cmd->error, next.error, sizeof(cmd->error));
+            return false;
+        }
+        any = true;
+    }
+    if (!any) {
+        return fail(cmd, "empty command");
+    }
+
+    *cmd = next;
+    return true;
+}
+
+const char *mqtt_command_change_name(mqtt_command_change_t change) {
+    for (int i = 0; i < MQTT_COMMAND_GROUP_COUNT; i++) {
+        if (change == (1u << i)) {
+            return change_names[i];
+        }
+    }
+    return "unknown";
+}
+
+static int append(char *buf, size_t size, int len, const char *format, ...) {
+    if (len < 0) {
+        return len;
+    }
+
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(len < (int)size ? buf + len : NULL, len < (int)size ? size - (size_t)len : 0, format, args);
+    va_end(args);
+    return n < 0 ? n : len + n;
+}
+
+static int append_groups(char *buf, size_t size, int len, const char *key, uint32_t groups) {
+    len = append(buf, size, len, ",\"%s\":[", key);
+    bool first = true;
+    for (int i = 0; i < MQTT_COMMAND_GROUP_COUNT; i++) {
+        if (groups & (1u << i)) {
+            len = append(buf, size, len, "%s\"%s\"", first ? "" : ",", change_names[i]);
+            first = false;
+        }
+    }
+    return append(buf, size, len, "]");
+}
+
+int mqtt_command_result(char *buf, size_t size, const mqtt_command_t *cmd, bool ok) {
+    if (buf == NULL || cmd == NULL) {
+        return -1;
+    }
+
+    // The id and the error text hold no characters that need escaping
+    int len = snprintf(buf, size, "{\"id\":\"%s\",\"ok\":%s", cmd->id, ok ? "true" : "false");
+    if (!ok) {
+        return append(buf, size, len, ",\"error\":\"%s\"}", cmd->error[0] != '\0' ? cmd->error : "not saved");
+    }
+
+    len = append_groups(buf, size, len, "applied", cmd->changes & MQTT_COMMAND_LIVE & ~MQTT_COMMAND_ASYNC);
+    len = append_groups(buf, size, len, "requested", cmd->changes & MQTT_COMMAND_ASYNC);
+    len = append_groups(buf, size, len, "after_restart", cmd->changes & ~(MQTT_COMMAND_LIVE | MQTT_COMMAND_RESTART));
+    return append(buf, size, len, ",\"restart\":%s}", (cmd->changes & MQTT_COMMAND_RESTART) ? "true" : "false");
+}
@@ -0,0 +1,166 @@
+/**
+ * @file mqtt_deadband.c
+ * @brief Change filter that suppresses state payloads without meaningful changes
+ */
+
+#include "mqtt_deadband.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sensor_data_broker.h"
+
+const mqtt_deadband_field_t mqtt_deadband_bme690_fields[] = {
+    {"temperature", offsetof(bme690_data_t, temperature), MQTT_DEADBAND_FLOAT},
+    {"humidity", offsetof(bme690_data_t, humidity), MQTT_DEADBAND_FLOAT},
+    {"pressure", offsetof(bme690_data_t, pressure), MQTT_DEADBAND_FLOAT},
+    {"iaq", offsetof(bme690_data_t, iaq), MQTT_DEADBAND_FLOAT},
+    {"co2", offsetof(bme690_data_t, co2_equivalent), MQTT_DEADBAND_FLOAT},
+    {"voc", offsetof(bme690_data_t, breath_voc_equivalent), MQTT_DEADBAND_FLOAT},
+    {"iaq_accuracy", offsetof(bme690_data_t, iaq_accuracy), MQTT_DEADBAND_UINT8},
+    {"static_iaq", offsetof(bme690_data_t, static_iaq), MQTT_DEADBAND_FLOAT},
+    {"gas_percentage", offsetof(bme690_data_t, gas_percentage), MQTT_DEADBAND_FLOAT},
+    {"stabilization_status", offsetof(bme690_data_t, stabilization_status), MQTT_DEADBAND_BOOL},
+    {"run_in_status", offsetof(bme690_data_t, run_in_status), MQTT_DEADBAND_BOOL},
+};
+const uint8_t mqtt_deadband_bme690_field_count = sizeof(mqtt_deadband_bme690_fields) / sizeof(mqtt_deadband_bme690_fields[0]);
+
+// The runtime field counts up with every sample and is left out
+const mqtt_deadband_field_t mqtt_deadband_bmv080_fields[] = {
+    {"pm10", offsetof(bmv080_data_t, pm10), MQTT_DEADBAND_FLOAT},
+    {"pm25", offsetof(bmv080_data_t, pm25), MQTT_DEADBAND_FLOAT},
+    {"pm1", offsetof(bmv080_data_t, pm1), MQTT_DEADBAND_FLOAT},
+    {"obstructed", offsetof(bmv080_data_t, is_obstructed), MQTT_DEADBAND_BOOL},
+    {"out_of_range", offsetof(bmv080_data_t, is_outside_range), MQTT_DEADBAND_BOOL},
+};
+const uint8_t mqtt_deadband_bmv080_field_count = sizeof(mqtt_deadband_bmv080_fields) / sizeof(mqtt_deadband_bmv080_fields[0]);
+
+void mqtt_deadband_init(mqtt_deadband_t *filter, const mqtt_deadband_field_t *fields, uint8_t field_count, uint32_t max_silence_ms) {
+    memset(filter, 0, sizeof(*filter));
+    filter->fields = fields;
+    filter->field_count = field_count > MQTT_DEADBAND_MAX_FIELDS ? MQTT_DEADBAND_MAX_FIELDS : field_count;
+    filter->max_silence_ms = max_silence_ms;
+}
+
+static int find_field(const mqtt_deadband_t *filter, const char *name, size_t len) {
+    for (int i = 0; i < filter->field_count; i++) {
+        if (strlen(filter->fields[i].name) == len && strncmp(filter->fields[i].name, name, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool mqtt_deadband_parse(mqtt_deadband_t *filter, const char *spec) {
+    mqtt_deadband_threshold_t thresholds[MQTT_DEADBAND_MAX_FIELDS] = {0};
+    const char *p = spec != NULL ? spec : "";
+
+    for (;;) {
+        while (*p == ',' || isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+
+        const char *name = p;
+        while (*p != '\0' && *p != '=' && *p != ',' && !isspace((unsigned char)*p)) {
+            p++;
+        }
+        int field = find_field(filter, name, (size_t)(p - name));
+        if (field < 0 || *p != '=') {
+            return false;
+        }
+
+        char *end;
+        float value = strtof(p + 1, &end);
+        if (end == p + 1 || !isfinite(value) || value < 0.0f) {
+            return false;
+        }
+        p = end;
+
+        thresholds[field].set = true;
+        if (*p == '%') {
+            thresholds[field].relative = value / 100.0f;
+            p++;
+        } else {
+            thresholds[field].absolute = value;
+        }
+        if (*p != '\0' && *p != ',' && !isspace((unsigned char)*p)) {
+            return false;
+        }
+    }
+
+    memcpy(filter->thresholds, thresholds, sizeof(thresholds));
+    return true;
+}
+
+static float field_value(const mqtt_deadband_field_t *field, const void *sample) {
+    const uint8_t *base = (const uint8_t *)sample + field->offset;
+    switch (field->type) {
+    case MQTT_DEADBAND_UINT8:
+        return (float)*base;
+    case MQTT_DEADBAND_BOOL:
+        return *(const bool *)base ? 1.0f : 0.0f;
+    default: {
+        float value;
+        memcpy(&value, base, sizeof(value));
+        return value;
+    }
+    }
+}
+
+static bool field_changed(const mqtt_deadband_field_t *field, const mqtt_deadband_threshold_t *threshold, float last, float value) {
+    if (field->type == MQTT_DEADBAND_FLOAT && !threshold->set) {
+        return false;
+    }
+    if (field->type != MQTT_DEADBAND_FLOAT || (threshold->absolute <= 0.0f && threshold->relative <= 0.0f)) {
+        return value != last && !(isnan(value) && isnan(last));
+    }
+    if (isnan(value) != isnan(last)) {
+        return true;
+    }
+
+    float delta = fabsf(value - last);
+    return (threshold->absolute > 0.0f && delta >= threshold->absolute) ||
+           (threshold->relative > 0.0f && delta >= threshold->relative * fabsf(last));
+}
+
+bool mqtt_deadband_check(mqtt_deadband_t *filter, const void *sample, uint32_t flags, uint32_t now_ms) {
+    float values[MQTT_DEADBAND_MAX_FIELDS];
+    bool changed[MQTT_DEADBAND_MAX_FIELDS] = {false};
+    bool publish = !filter->primed || flags != filter->last_flags;
+
+    filter->samples++;
+    for (uint8_t i = 0; i < filter->field_count; i++) {
+        values[i] = field_value(&filter->fields[i], sample);
+        if (filter->primed && field_changed(&filter->fields[i], &filter->thresholds[i], filter->last[i], values[i])) {
+            changed[i] = true;
+            publish = true;
+        }
+    }
+
+    if (!publish && filter->max_silence_ms > 0 && now_ms - filter->last_publish_ms >= filter->max_silence_ms) {
+        filter->heartbeats++;
+        publish = true;
+    }
+    if (!publish) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < filter->field_count; i++) {
+        filter->last[i] = values[i];
+        filter->field_changes[i] += changed[i];
+    }
+    filter->primed = true;
+    filter->last_flags = flags;
+    filter->last_publish_ms = now_ms;
+    filter->published++;
+    return true;
+}
+
+void mqtt_deadband_reset(mqtt_deadband_t *filter) {
+    filter->primed = false;
+}
@@ -0,0 +1,131 @@
+/**
+ * @file mqtt_discovery.c
+ * @brief Home Assistant MQTT discovery payloads built from a descriptor table
+ */
+
+#include "mqtt_discovery.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SENSOR        "sensor"
+#define BINARY_SENSOR "binary_sensor"
+
+const mqtt_discovery_entity_t mqtt_discovery_entities[] = {
+    {.component = SENSOR, .key = "temperature", .name = "Temperature", .source = MQTT_DISCOVERY_BME690, .device_class = "temperature",
+        .unit = "°C"},
+    {.component = SENSOR, .key = "humidity", .name = "Humidity", .source = MQTT_DISCOVERY_BME690, .device_class = "humidity", .unit = "%"},
+    {.component = SENSOR, .key = "pressure", .name = "Pressure", .source = MQTT_DISCOVERY_BME690, .device_class = "pressure", .unit = "hPa",
+        .value_template = "{{ value_json.pressure | float / 100 }}"},
+    {.component = SENSOR, .key = "iaq", .name = "Indoor Air Quality", .source = MQTT_DISCOVERY_BME690, .unit = "IAQ"},
+    {.component = SENSOR, .key = "co2", .name = "CO2", .source = MQTT_DISCOVERY_BME690, .device_class = "carbon_dioxide", .unit = "ppm"},
+    {.component = SENSOR, .key = "voc", .name = "VOC", .source = MQTT_DISCOVERY_BME690, .device_class = "volatile_organic_compounds_parts",
+        .unit = "ppm"},
+    {.component = SENSOR, .key = "pm10", .name = "PM10", .source = MQTT_DISCOVERY_BMV080, .device_class = "pm10", .unit = "µg/m³"},
+    {.component = SENSOR, .key = "pm25", .name = "PM2.5", .source = MQTT_DISCOVERY_BMV080, .device_class = "pm25", .unit = "µg/m³"},
+    {.component = SENSOR, .key = "pm1", .name = "PM1", .source = MQTT_DISCOVERY_BMV080, .device_class = "pm1", .unit = "µg/m³"},
+    {.component = SENSOR, .key = "iaq_accuracy", .name = "IAQ Accuracy", .source = MQTT_DISCOVERY_BME690, .icon = "mdi:gauge",
+        .state_class = "measurement"},
+    {.component = SENSOR, .key = "static_iaq", .name = "Static IAQ", .source = MQTT_DISCOVERY_BME690, .icon = "mdi:air-filter",
+        .state_class = "measurement"},
+    {.component = SENSOR, .key = "gas_percentage", .name = "Gas Percentage", .source = MQTT_DISCOVERY_BME690, .unit = "%",
+        .icon = "mdi:percent", .state_class = "measurement"},
+    {.component = BINARY_SENSOR, .key = "stabilization_status", .name = "Gas Sensor Stabilized", .source = MQTT_DISCOVERY_BME690,
+        .icon = "mdi:check-circle"},
+    {.component = BINARY_SENSOR, .key = "run_in_status", .name = "Gas Sensor Run-in Complete", .source = MQTT_DISCOVERY_BME690,
+        .icon = "mdi:timer-check"},
+    {.component = BINARY_SENSOR, .key = "obstructed", .name = "Sensor Obstructed", .source = MQTT_DISCOVERY_BMV080,
+        .device_class = "problem"},
+    {.component = BINARY_SENSOR, .key = "out_of_range", .name = "Measurement Out of Range", .source = MQTT_DISCOVERY_BMV080,
+        .device_class = "problem"},
+    {.component = SENSOR, .key = "wifi_rssi", .name = "WiFi Signal", .source = MQTT_DISCOVERY_SYSTEM, .device_class = "signal_strength",
+        .unit = "dBm", .value_template = "{{ value_json.rssi }}", .icon = "mdi:wifi"},
+    {.component = SENSOR, .key = "free_heap", .name = "Free Memory", .source = MQTT_DISCOVERY_SYSTEM, .unit = "B", .icon = "mdi:memory",
+        .state_class = "measurement"},
+    {.component = SENSOR, .key = "uptime", .name = "Uptime", .source = MQTT_DISCOVERY_SYSTEM, .unit = "s", .icon = "mdi:timer-outline",
+        .state_class = "total_increasing"},
+    {.component = SENSOR, .key = "cpu_temperature", .name = "CPU Temperature", .source = MQTT_DISCOVERY_SYSTEM,
+        .device_class = "temperature", .unit = "°C", .value_template = "{{ value_json.cpu_temp }}", .icon = "mdi:thermometer",
+        .state_class = "measurement"},
+};
+const uint8_t mqtt_discovery_entity_count = sizeof(mqtt_discovery_entities) / sizeof(mqtt_discovery_entities[0]);
+
+static int append(char *buf, size_t size, int len, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf((size_t)len < size ? buf + len : NULL, (size_t)len < size ? size - len : 0, format, args);
+    va_end(args);
+    return written < 0 ? written : len + written;
+}
+
+static int append_optional(char *buf, size_t size, int len, const char *key, const char *value) {
+    if (value == NULL || len < 0) {
+        return len;
+    }
+    return append(buf, size, len, ",\"%s\":\"%s\"", key, value);
+}
+
+int mqtt_discovery_topic(char *buf, size_t size, const mqtt_discovery_entity_t *entity, const mqtt_discovery_device_t *device) {
+    if (buf == NULL || entity == NULL || device == NULL) {
+        return -1;
+    }
+    return snprintf(buf, size, MQTT_DISCOVERY_PREFIX "/%s/polverine_%s/%s/config", entity->component, device->id, entity->key);
+}
+
+int mqtt_discovery_payload(char *buf, size_t size, const mqtt_discovery_entity_t *entity, const mqtt_discovery_device_t *device) {
+    if (buf == NULL || entity == NULL || device == NULL || entity->source >= MQTT_DISCOVERY_SOURCE_COUNT) {
+        return -1;
+    }
+
+    int len = append(buf, size, 0, "{\"unique_id\":\"%s_%s\",\"name\":\"%s\",\"state_topic\":\"%s\",\"availability_topic\":\"%s\"",
+        device->id, entity->key, entity->name, device->state_topics[entity->source], device->availability_topic);
+    if (strcmp(entity->component, BINARY_SENSOR) == 0) {
+        len = append_optional(buf, size, len, "payload_on", "true");
+        len = append_optional(buf, size, len, "payload_off", "false");
+    }
+    len = append_optional(buf, size, len, "device_class", entity->device_class);
+    len = append_optional(buf, size, len, "unit_of_measurement", entity->unit);
+    if (entity->value_template != NULL) {
+        len = append_optional(buf, size, len, "value_template", entity->value_template);
+    } else if (len >= 0) {
+        len = append(buf, size, len, ",\"value_template\":\"{{ value_json.%s }}\"", entity->key);
+    }
+    len = append_optional(buf, size, len, "icon", entity->icon);
+    len = append_optional(buf, size, len, "state_class", entity->state_class);
+    if (len < 0) {
+        return len;
+    }
+    return append(buf, size, len,
+        ",\"device\":{\"identifiers\":\"%s\",\"name\":\"%s\",\"manufacturer\":\"BlackIoT\",\"model\":\"Polverine Sensor\"}}", device->id,
+        device->name);
+}
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+uint32_t mqtt_discovery_hash(const mqtt_discovery_device_t *device, const char *broker) {
+    char buf[MQTT_DISCOVERY_PAYLOAD_MAX];
+    uint32_t hash = 2166136261u;
+
+    if (broker != NULL) {
+        hash = fnv1a(hash, broker, strlen(broker) + 1);
+    }
+    for (uint8_t i = 0; i < mqtt_discovery_entity_count; i++) {
+        int len = mqtt_discovery_topic(buf, sizeof(buf), &mqtt_discovery_entities[i], device);
+        if (len > 0) {
+            hash = fnv1a(hash, buf, len < (int)sizeof(buf) ? (size_t)len + 1 : sizeof(buf));
+        }
+        len = mqtt_discovery_payload(buf, sizeof(buf), &mqtt_discovery_entities[i], device);
+        if (len > 0) {
+            hash = fnv1a(hash, buf, len < (int)sizeof(buf) ? (size_t)len + 1 : sizeof(buf));
+        }
+    }
+
+    return hash != 0 ? hash : 1;
+}
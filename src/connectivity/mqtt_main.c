@@ -1,51 +1,66 @@
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "esp_log.h"
 #include "esp_mac.h"
+#include "esp_random.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "nvs_flash.h"
 #include "driver/temperature_sensor.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "mqtt_client.h"
+#ifdef CONFIG_MQTT_PROTOCOL_5
+#include "mqtt5_client.h"
+#endif
 
 #include "config.h"
+#include "mqtt_alias.h"
+#include "mqtt_backoff.h"
+#include "mqtt_batch.h"
+#include "mqtt_cbor.h"
+#include "mqtt_command.h"
+#include "mqtt_deadband.h"
+#include "mqtt_discovery.h"
+#include "mqtt_outbox.h"
+#include "mqtt_payload.h"
+#include "mqtt_qos.h"
+#include "protocol_common.h"
+#include "sensor_control.h"
 #include "sensor_data_broker.h"
 
 static const char *TAG = "mqtt";
 
 // Secrets moved to external configuration
 
-// Home Assistant discovery topics
-const char *TEMPLATE_HA_DISCOVERY_BME690_TEMP = "homeassistant/sensor/polverine_%s/temperature/config";
-const char *TEMPLATE_HA_DISCOVERY_BME690_HUMID = "homeassistant/sensor/polverine_%s/humidity/config";
-const char *TEMPLATE_HA_DISCOVERY_BME690_PRESS = "homeassistant/sensor/polverine_%s/pressure/config";
-const char *TEMPLATE_HA_DISCOVERY_BME690_IAQ = "homeassistant/sensor/polverine_%s/iaq/config";
-const char *TEMPLATE_HA_DISCOVERY_BME690_CO2 = "homeassistant/sensor/polverine_%s/co2/config";
-const char *TEMPLATE_HA_DISCOVERY_BME690_VOC = "homeassistant/sensor/polverine_%s/voc/config";
-const char *TEMPLATE_HA_DISCOVERY_BME690_IAQ_ACC = "homeassistant/sensor/polverine_%s/iaq_accuracy/config";
-const char *TEMPLATE_HA_DISCOVERY_BME690_STATIC_IAQ = "homeassistant/sensor/polverine_%s/static_iaq/config";
-const char *TEMPLATE_HA_DISCOVERY_BME690_GAS_PERCENTAGE = "homeassistant/sensor/polverine_%s/gas_percentage/config";
-const char *TEMPLATE_HA_DISCOVERY_BME690_STABILIZATION = "homeassistant/binary_sensor/polverine_%s/stabilization_status/config";
-const char *TEMPLATE_HA_DISCOVERY_BME690_RUN_IN = "homeassistant/binary_sensor/polverine_%s/run_in_status/config";
-
-const char *TEMPLATE_HA_DISCOVERY_BMV080_PM10 = "homeassistant/sensor/polverine_%s/pm10/config";
-const char *TEMPLATE_HA_DISCOVERY_BMV080_PM25 = "homeassistant/sensor/polverine_%s/pm25/config";
-const char *TEMPLATE_HA_DISCOVERY_BMV080_PM1 = "homeassistant/sensor/polverine_%s/pm1/config";
-const char *TEMPLATE_HA_DISCOVERY_BMV080_OBSTRUCTED = "homeassistant/binary_sensor/polverine_%s/obstructed/config";
-const char *TEMPLATE_HA_DISCOVERY_BMV080_OUT_OF_RANGE = "homeassistant/binary_sensor/polverine_%s/out_of_range/config";
-
-// ESP32 system metrics discovery topics
-const char *TEMPLATE_HA_DISCOVERY_ESP32_RSSI = "homeassistant/sensor/polverine_%s/wifi_rssi/config";
-const char *TEMPLATE_HA_DISCOVERY_ESP32_HEAP = "homeassistant/sensor/polverine_%s/free_heap/config";
-const char *TEMPLATE_HA_DISCOVERY_ESP32_UPTIME = "homeassistant/sensor/polverine_%s/uptime/config";
-const char *TEMPLATE_HA_DISCOVERY_ESP32_TEMP = "homeassistant/sensor/polverine_%s/cpu_temperature/config";
-
 // Home Assistant state topics
 const char *TEMPLATE_HA_STATE_BME690 = "polverine/%s/bme690/state";
 const char *TEMPLATE_HA_STATE_BMV080 = "polverine/%s/bmv080/state";
+const char *TEMPLATE_CBOR_STATE_BME690 = "polverine/%s/bme690/state/cbor";
+const char *TEMPLATE_CBOR_STATE_BMV080 = "polverine/%s/bmv080/state/cbor";
+const char *TEMPLATE_BATCH_BME690 = "polverine/%s/bme690/state/batch";
+const char *TEMPLATE_BATCH_BMV080 = "polverine/%s/bmv080/state/batch";
+const char *TEMPLATE_CBOR_BATCH_BME690 = "polverine/%s/bme690/state/cbor/batch";
+const char *TEMPLATE_CBOR_BATCH_BMV080 = "polverine/%s/bmv080/state/cbor/batch";
+const char *TEMPLATE_BACKLOG_BME690 = "polverine/%s/bme690/state/backlog";
+const char *TEMPLATE_BACKLOG_BMV080 = "polverine/%s/bmv080/state/backlog";
+const char *TEMPLATE_CBOR_BACKLOG_BME690 = "polverine/%s/bme690/state/cbor/backlog";
+const char *TEMPLATE_CBOR_BACKLOG_BMV080 = "polverine/%s/bmv080/state/cbor/backlog";
 const char *TEMPLATE_HA_STATE_SYSTEM = "polverine/%s/system/state";
+const char *TEMPLATE_DIAG_BROKER = "polverine/%s/diag/broker";
+const char *TEMPLATE_DIAG_DEADBAND = "polverine/%s/diag/deadband";
+const char *TEMPLATE_DIAG_QOS = "polverine/%s/diag/qos";
 const char *TEMPLATE_HA_AVAILABILITY = "polverine/%s/availability";
+const char *TEMPLATE_COMMAND = "polverine/%s/cmd";
+const char *TEMPLATE_COMMAND_RESULT = "polverine/%s/cmd/result";
+
+// Windowed statistics topic: device id, sensor name, window label
+const char *TEMPLATE_STATS = "polverine/%s/%s/stats/%s";
 
 // Configuration loaded from NVS
 
@@ -57,372 +72,639 @@ static char device_name[64];
 static char availability_topic[128];
 static char bme690_state_topic[128];
 static char bmv080_state_topic[128];
+static char bme690_cbor_topic[128];
+static char bmv080_cbor_topic[128];
 static char system_state_topic[128];
+static char broker_diag_topic[128];
+static char deadband_diag_topic[128];
+static char qos_diag_topic[128];
+static char command_topic[128];
+static char command_result_topic[128];
+static uint32_t discovery_hash = 0;
+
+// Batch buffer sizes, a JSON batch holds about a dozen BME690 samples
+#define MQTT_BATCH_JSON_CAPACITY MQTT_BATCH_DEFAULT_CAPACITY
+#define MQTT_BATCH_CBOR_CAPACITY 1024
+
+// A state topic whose samples may be published in batches. With batching
+// enabled the samples go to batch_topic as an array, and state_topic gets the
+// newest sample of each batch so Home Assistant stays current.
+typedef struct {
+    const char *state_topic;
+    char batch_topic[128];
+    mqtt_batch_t batch;
+    bool enabled;
+} mqtt_state_stream_t;
+
+static mqtt_state_stream_t bme690_json_stream = {.state_topic = bme690_state_topic};
+static mqtt_state_stream_t bmv080_json_stream = {.state_topic = bmv080_state_topic};
+static mqtt_state_stream_t bme690_cbor_stream = {.state_topic = bme690_cbor_topic};
+static mqtt_state_stream_t bmv080_cbor_stream = {.state_topic = bmv080_cbor_topic};
+
+static mqtt_state_stream_t *const state_streams[] = {
+    &bme690_json_stream,
+    &bmv080_json_stream,
+    &bme690_cbor_stream,
+    &bmv080_cbor_stream,
+};
+#define STATE_STREAM_COUNT (sizeof(state_streams) / sizeof(state_streams[0]))
+
+static SemaphoreHandle_t batch_mutex = NULL;
+static TaskHandle_t batch_task_handle = NULL;
+
+// Replay of samples stored in the outbox while disconnected
+#define OUTBOX_REPLAY_BATCH       20   // Samples per backlog message
+#define OUTBOX_REPLAY_INTERVAL_MS 250  // Pause between backlog messages, leaves room for live samples
+#define OUTBOX_REPLAY_MAX_QUEUED  8192 // Hold off while the MQTT client has this many bytes unsent
+#define OUTBOX_TASK_PRIORITY      3    // Below the sensor bus dispatcher
+
+typedef struct {
+    char topic[128];
+    mqtt_batch_t batch;
+    bool failed;
+} mqtt_backlog_stream_t;
+
+static mqtt_backlog_stream_t bme690_backlog;
+static mqtt_backlog_stream_t bmv080_backlog;
+static bool outbox_ready = false;
+static TaskHandle_t outbox_task_handle = NULL;
 
 void mqtt_default_init(const char *id) {
     snprintf(device_name, sizeof(device_name), "Polverine %s", id);
     snprintf(availability_topic, sizeof(availability_topic), TEMPLATE_HA_AVAILABILITY, id);
     snprintf(bme690_state_topic, sizeof(bme690_state_topic), TEMPLATE_HA_STATE_BME690, id);
     snprintf(bmv080_state_topic, sizeof(bmv080_state_topic), TEMPLATE_HA_STATE_BMV080, id);
+    snprintf(bme690_cbor_topic, sizeof(bme690_cbor_topic), TEMPLATE_CBOR_STATE_BME690, id);
+    snprintf(bmv080_cbor_topic, sizeof(bmv080_cbor_topic), TEMPLATE_CBOR_STATE_BMV080, id);
     snprintf(system_state_topic, sizeof(system_state_topic), TEMPLATE_HA_STATE_SYSTEM, id);
+    snprintf(broker_diag_topic, sizeof(broker_diag_topic), TEMPLATE_DIAG_BROKER, id);
+    snprintf(deadband_diag_topic, sizeof(deadband_diag_topic), TEMPLATE_DIAG_DEADBAND, id);
+    snprintf(qos_diag_topic, sizeof(qos_diag_topic), TEMPLATE_DIAG_QOS, id);
+    snprintf(command_topic, sizeof(command_topic), TEMPLATE_COMMAND, id);
+    snprintf(command_result_topic, sizeof(command_result_topic), TEMPLATE_COMMAND_RESULT, id);
+    snprintf(bme690_json_stream.batch_topic, sizeof(bme690_json_stream.batch_topic), TEMPLATE_BATCH_BME690, id);
+    snprintf(bmv080_json_stream.batch_topic, sizeof(bmv080_json_stream.batch_topic), TEMPLATE_BATCH_BMV080, id);
+    snprintf(bme690_cbor_stream.batch_topic, sizeof(bme690_cbor_stream.batch_topic), TEMPLATE_CBOR_BATCH_BME690, id);
+    snprintf(bmv080_cbor_stream.batch_topic, sizeof(bmv080_cbor_stream.batch_topic), TEMPLATE_CBOR_BATCH_BMV080, id);
 }
 
 bool isConnected = false;
 esp_mqtt_client_handle_t client = 0;
-#define MQTT_CONNECTION_TIMEOUT_MB 15000
-TickType_t mqtt_connection_start_time = 0;
-
-// Send Home Assistant discovery messages
-static void send_ha_discovery() {
-    char topic[256];
-    char payload[1024];
-
-    char device_json[256];
-    int dev_len = snprintf(device_json, sizeof(device_json),
-        "{\"identifiers\":\"%s\",\"name\":\"%s\",\"manufacturer\":\"BlackIoT\",\"model\":\"Polverine Sensor\"}", shortId, device_name);
-    if (dev_len <= 0 || dev_len >= (int)sizeof(device_json)) {
-        ESP_LOGE(TAG, "Device JSON truncated (%d)", dev_len);
-        return;
-    }
-
-    // BME690 Temperature
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_BME690_TEMP, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_temperature\","
-        "\"name\":\"Temperature\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"device_class\":\"temperature\","
-        "\"unit_of_measurement\":\"°C\","
-        "\"value_template\":\"{{ value_json.temperature }}\","
-        "\"device\":%s}",
-        shortId, bme690_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // BME690 Humidity
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_BME690_HUMID, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_humidity\","
-        "\"name\":\"Humidity\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"device_class\":\"humidity\","
-        "\"unit_of_measurement\":\"%%\","
-        "\"value_template\":\"{{ value_json.humidity }}\","
-        "\"device\":%s}",
-        shortId, bme690_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // BME690 Pressure
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_BME690_PRESS, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_pressure\","
-        "\"name\":\"Pressure\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"device_class\":\"pressure\","
-        "\"unit_of_measurement\":\"hPa\","
-        "\"value_template\":\"{{ value_json.pressure | float / 100 }}\","
-        "\"device\":%s}",
-        shortId, bme690_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // BME690 IAQ
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_BME690_IAQ, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_iaq\","
-        "\"name\":\"Indoor Air Quality\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"unit_of_measurement\":\"IAQ\","
-        "\"value_template\":\"{{ value_json.iaq }}\","
-        "\"device\":%s}",
-        shortId, bme690_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // BME690 CO2
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_BME690_CO2, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_co2\","
-        "\"name\":\"CO2\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"device_class\":\"carbon_dioxide\","
-        "\"unit_of_measurement\":\"ppm\","
-        "\"value_template\":\"{{ value_json.co2 }}\","
-        "\"device\":%s}",
-        shortId, bme690_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // BME690 VOC
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_BME690_VOC, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_voc\","
-        "\"name\":\"VOC\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"device_class\":\"volatile_organic_compounds_parts\","
-        "\"unit_of_measurement\":\"ppm\","
-        "\"value_template\":\"{{ value_json.voc }}\","
-        "\"device\":%s}",
-        shortId, bme690_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // BMV080 PM10
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_BMV080_PM10, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_pm10\","
-        "\"name\":\"PM10\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"device_class\":\"pm10\","
-        "\"unit_of_measurement\":\"µg/m³\","
-        "\"value_template\":\"{{ value_json.pm10 }}\","
-        "\"device\":%s}",
-        shortId, bmv080_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // BMV080 PM2.5
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_BMV080_PM25, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_pm25\","
-        "\"name\":\"PM2.5\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"device_class\":\"pm25\","
-        "\"unit_of_measurement\":\"µg/m³\","
-        "\"value_template\":\"{{ value_json.pm25 }}\","
-        "\"device\":%s}",
-        shortId, bmv080_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // BMV080 PM1
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_BMV080_PM1, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_pm1\","
-        "\"name\":\"PM1\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"device_class\":\"pm1\","
-        "\"unit_of_measurement\":\"µg/m³\","
-        "\"value_template\":\"{{ value_json.pm1 }}\","
-        "\"device\":%s}",
-        shortId, bmv080_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // BME690 IAQ Accuracy
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_BME690_IAQ_ACC, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_iaq_accuracy\","
-        "\"name\":\"IAQ Accuracy\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"value_template\":\"{{ value_json.iaq_accuracy }}\","
-        "\"icon\":\"mdi:gauge\","
-        "\"state_class\":\"measurement\","
-        "\"device\":%s}",
-        shortId, bme690_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // BME690 Static IAQ
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_BME690_STATIC_IAQ, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_static_iaq\","
-        "\"name\":\"Static IAQ\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"value_template\":\"{{ value_json.static_iaq }}\","
-        "\"icon\":\"mdi:air-filter\","
-        "\"state_class\":\"measurement\","
-        "\"device\":%s}",
-        shortId, bme690_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // BME690 Gas Percentage
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_BME690_GAS_PERCENTAGE, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_gas_percentage\","
-        "\"name\":\"Gas Percentage\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"unit_of_measurement\":\"%%\","
-        "\"value_template\":\"{{ value_json.gas_percentage }}\","
-        "\"icon\":\"mdi:percent\","
-        "\"state_class\":\"measurement\","
-        "\"device\":%s}",
-        shortId, bme690_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // BME690 Stabilization Status
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_BME690_STABILIZATION, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_stabilization_status\","
-        "\"name\":\"Gas Sensor Stabilized\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"payload_on\":\"true\","
-        "\"payload_off\":\"false\","
-        "\"value_template\":\"{{ value_json.stabilization_status }}\","
-        "\"icon\":\"mdi:check-circle\","
-        "\"device\":%s}",
-        shortId, bme690_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // BME690 Run-in Status
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_BME690_RUN_IN, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_run_in_status\","
-        "\"name\":\"Gas Sensor Run-in Complete\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"payload_on\":\"true\","
-        "\"payload_off\":\"false\","
-        "\"value_template\":\"{{ value_json.run_in_status }}\","
-        "\"icon\":\"mdi:timer-check\","
-        "\"device\":%s}",
-        shortId, bme690_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // BMV080 Obstructed
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_BMV080_OBSTRUCTED, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_obstructed\","
-        "\"name\":\"Sensor Obstructed\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"payload_on\":\"true\","
-        "\"payload_off\":\"false\","
-        "\"value_template\":\"{{ value_json.obstructed }}\","
-        "\"device_class\":\"problem\","
-        "\"device\":%s}",
-        shortId, bmv080_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // BMV080 Out of Range
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_BMV080_OUT_OF_RANGE, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_out_of_range\","
-        "\"name\":\"Measurement Out of Range\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"payload_on\":\"true\","
-        "\"payload_off\":\"false\","
-        "\"value_template\":\"{{ value_json.out_of_range }}\","
-        "\"device_class\":\"problem\","
-        "\"device\":%s}",
-        shortId, bmv080_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // ESP32 WiFi RSSI
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_ESP32_RSSI, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_wifi_rssi\","
-        "\"name\":\"WiFi Signal\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"device_class\":\"signal_strength\","
-        "\"unit_of_measurement\":\"dBm\","
-        "\"value_template\":\"{{ value_json.rssi }}\","
-        "\"icon\":\"mdi:wifi\","
-        "\"device\":%s}",
-        shortId, system_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // ESP32 Free Heap
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_ESP32_HEAP, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_free_heap\","
-        "\"name\":\"Free Memory\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"unit_of_measurement\":\"B\","
-        "\"value_template\":\"{{ value_json.free_heap }}\","
-        "\"icon\":\"mdi:memory\","
-        "\"state_class\":\"measurement\","
-        "\"device\":%s}",
-        shortId, system_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // ESP32 Uptime
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_ESP32_UPTIME, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_uptime\","
-        "\"name\":\"Uptime\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"unit_of_measurement\":\"s\","
-        "\"value_template\":\"{{ value_json.uptime }}\","
-        "\"icon\":\"mdi:timer-outline\","
-        "\"state_class\":\"total_increasing\","
-        "\"device\":%s}",
-        shortId, system_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    // ESP32 CPU Temperature
-    snprintf(topic, sizeof(topic), TEMPLATE_HA_DISCOVERY_ESP32_TEMP, shortId);
-    snprintf(payload, sizeof(payload),
-        "{\"unique_id\":\"%s_cpu_temperature\","
-        "\"name\":\"CPU Temperature\","
-        "\"state_topic\":\"%s\","
-        "\"availability_topic\":\"%s\","
-        "\"device_class\":\"temperature\","
-        "\"unit_of_measurement\":\"°C\","
-        "\"value_template\":\"{{ value_json.cpu_temp }}\","
-        "\"icon\":\"mdi:thermometer\","
-        "\"state_class\":\"measurement\","
-        "\"device\":%s}",
-        shortId, system_state_topic, availability_topic, device_json);
-    esp_mqtt_client_publish(client, topic, payload, 0, 1, true);
-
-    ESP_LOGI(TAG, "Home Assistant discovery messages sent");
+static esp_mqtt_client_config_t mqtt_cfg = {0};
+
+// CONNACK codes of brokers that do not speak MQTT 5: "unacceptable protocol version" (3.1.1) and "unsupported protocol version" (5)
+#define MQTT_REFUSED_PROTOCOL_V311 0x01
+#define MQTT_REFUSED_PROTOCOL_V5   0x84
+
+// Every publish goes through mqtt_publish() under publish_mutex, which guards
+// the QoS policy, the client wide MQTT 5 publish properties and the alias
+// table. The event handler runs with the client lock held and must neither
+// take publish_mutex nor publish, it announces connections through
+// alias_session and hands publishing to the system metrics task.
+static SemaphoreHandle_t publish_mutex = NULL;
+static mqtt_qos_t qos_policy;
+static uint32_t qos_congestions_logged = 0;
+
+// Adaptive QoS water marks, in bytes held by the MQTT client outbox
+#define MQTT_QOS_HIGH_WATER 6144 // Below OUTBOX_REPLAY_MAX_QUEUED, so live data yields before the replay stalls
+#define MQTT_QOS_LOW_WATER  2048
+
+// MQTT 5 session state
+static bool mqtt5_active = false;
+static mqtt_alias_table_t topic_aliases;
+static atomic_uint alias_session;      // Advanced by the event handler on every connect and disconnect, bit 0 set if aliases are usable
+static unsigned alias_session_applied; // alias_session the table was last reset for
+
+// Work the event handler leaves to the system metrics task
+#define SESSION_CONNECTED (1u << 0) // Announce availability and discovery
+#define SESSION_HA_ONLINE (1u << 1) // Home Assistant restarted, resend discovery
+#define SESSION_COMMAND   (1u << 2) // Commands waiting in command_queue
+
+// Commands received on command_topic, handed from the event handler to the system metrics task
+#define MQTT_COMMAND_QUEUE_LENGTH 2
+
+typedef struct {
+    uint16_t len; // Length of the whole message, more than MQTT_COMMAND_MAX_LEN if text holds only its start
+    char text[MQTT_COMMAND_MAX_LEN];
+} mqtt_command_message_t;
+
+static QueueHandle_t command_queue = NULL;
+static mqtt_command_t command_settings; // Settings as saved, including those that only apply after a restart
+
+// Reconnect delays, see mqtt_backoff.h
+#define MQTT_RECONNECT_BASE_MS 1000
+#define MQTT_RECONNECT_CAP_MS  120000
+
+// Connection state, driven by MQTT events, Wi-Fi events and the reconnect timer
+typedef enum {
+    MQTT_LINK_CONNECTING,   // Connection attempt in progress
+    MQTT_LINK_CONNECTED,    // Broker connected
+    MQTT_LINK_BACKOFF,      // Waiting for the reconnect timer
+    MQTT_LINK_WAIT_NETWORK, // Waiting for Wi-Fi to get an address
+} mqtt_link_state_t;
+
+static const char *const mqtt_link_state_names[] = {
+    [MQTT_LINK_CONNECTING] = "connecting",
+    [MQTT_LINK_CONNECTED] = "connected",
+    [MQTT_LINK_BACKOFF] = "backoff",
+    [MQTT_LINK_WAIT_NETWORK] = "wait_network",
+};
+
+static mqtt_link_state_t link_state = MQTT_LINK_CONNECTING;
+static mqtt_backoff_t reconnect_backoff;
+static esp_timer_handle_t reconnect_timer = NULL;
+static SemaphoreHandle_t link_mutex = NULL;
+static uint32_t reconnect_attempts = 0;
+
+#ifdef CONFIG_MQTT_PROTOCOL_5
+// Find the Topic Alias Maximum of the broker's CONNACK, 0 if it sent none. The
+// client keeps it to itself and only refuses larger aliases, so search for the
+// largest one it accepts, logging an error per refusal. Called with publish_mutex held.
+static uint16_t mqtt5_alias_maximum(void) {
+    esp_mqtt5_publish_property_config_t property = {0};
+    uint16_t accepted = 0;
+    uint16_t refused = topic_aliases.count + 1;
+    while (refused - accepted > 1) {
+        property.topic_alias = accepted + (refused - accepted) / 2;
+        if (esp_mqtt5_client_set_publish_property(client, &property) == ESP_OK) {
+            accepted = property.topic_alias;
+        } else {
+            refused = property.topic_alias;
+        }
+    }
+
+    ESP_LOGI(TAG, "%u of %u state topics within the broker's Topic Alias Maximum", accepted, topic_aliases.count);
+    return accepted;
 }
 
-// BME690 data callback handler
-static void mqtt_bme690_data_handler(const bme690_data_t *data, bool is_averaged) {
-    if (!isConnected || data == NULL)
+// Publish with the MQTT 5 properties of the message, called with publish_mutex held
+static int mqtt5_publish(const char *topic, const void *payload, size_t len, int qos, bool retain, bool telemetry) {
+    esp_mqtt5_publish_property_config_t property = {0};
+    const char *wire_topic = topic;
+
+    unsigned session = atomic_load(&alias_session);
+    if (session != alias_session_applied) {
+        mqtt_alias_connected(&topic_aliases, (session & 1u) ? mqtt5_alias_maximum() : 0);
+        alias_session_applied = session;
+    }
+    if (telemetry) {
+        property.message_expiry_interval = current_mqtt_config.message_expiry_s;
+        property.topic_alias = mqtt_alias_resolve(&topic_aliases, topic, qos, &wire_topic);
+    }
+
+    esp_err_t err = esp_mqtt5_client_set_publish_property(client, &property);
+    if (err != ESP_OK && property.topic_alias != 0) {
+        ESP_LOGW(TAG, "Topic alias %u refused, not using aliases on this connection", property.topic_alias);
+        mqtt_alias_disable(&topic_aliases);
+        property.topic_alias = 0;
+        wire_topic = topic;
+        err = esp_mqtt5_client_set_publish_property(client, &property);
+    }
+
+    int msg_id = -1;
+    if (err == ESP_OK) {
+        msg_id = esp_mqtt_client_publish(client, wire_topic, (const char *)payload, len, qos, retain);
+    }
+    if (msg_id >= 0) {
+        mqtt_alias_sent(&topic_aliases, property.topic_alias, wire_topic);
+    }
+    return msg_id;
+}
+#endif
+
+// Publish a message with the QoS its class gets from the policy. Telemetry
+// gets the configured message expiry and, on topics with an alias, the topic
+// alias when the session speaks MQTT 5.
+static int mqtt_publish(const char *topic, const void *payload, size_t len, mqtt_qos_class_t cls, bool retain) {
+    xSemaphoreTake(publish_mutex, portMAX_DELAY);
+    int outbox = esp_mqtt_client_get_outbox_size(client);
+    int qos = mqtt_qos_select(&qos_policy, cls, outbox > 0 ? (uint32_t)outbox : 0);
+    if (qos_policy.congestions != qos_congestions_logged) {
+        qos_congestions_logged = qos_policy.congestions;
+        ESP_LOGW(TAG, "MQTT outbox at %d bytes, adaptive classes use QoS 0 until below %lu", outbox,
+            (unsigned long)qos_policy.low_water);
+    }
+
+    int msg_id;
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    if (mqtt5_active) {
+        msg_id = mqtt5_publish(topic, payload, len, qos, retain, cls < MQTT_QOS_CLASS_CONFIGURABLE);
+    } else {
+        msg_id = esp_mqtt_client_publish(client, topic, (const char *)payload, len, qos, retain);
+    }
+#else
+    msg_id = esp_mqtt_client_publish(client, topic, (const char *)payload, len, qos, retain);
+#endif
+
+    mqtt_qos_record(&qos_policy, cls, qos, msg_id >= 0);
+    xSemaphoreGive(publish_mutex);
+    return msg_id;
+}
+
+// Send the Home Assistant discovery messages unless the broker already holds the current ones
+static void send_ha_discovery(bool force) {
+    const mqtt_discovery_device_t device = {
+        .id = shortId,
+        .name = device_name,
+        .availability_topic = availability_topic,
+        .state_topics = {
+            [MQTT_DISCOVERY_BME690] = bme690_state_topic,
+            [MQTT_DISCOVERY_BMV080] = bmv080_state_topic,
+            [MQTT_DISCOVERY_SYSTEM] = system_state_topic,
+        },
+    };
+
+    // The device strings and the broker only change with a restart, hash them once
+    if (discovery_hash == 0) {
+        discovery_hash = mqtt_discovery_hash(&device, current_mqtt_config.uri);
+    }
+
+    uint32_t published_hash;
+    if (!force && config_load_discovery_hash(&published_hash) && published_hash == discovery_hash) {
+        ESP_LOGI(TAG, "Home Assistant discovery unchanged (%08lx), not republished", (unsigned long)discovery_hash);
         return;
+    }
 
-    char payload[320];
-    int written = snprintf(payload, sizeof(payload),
-        "{\"temperature\":%.2f,\"humidity\":%.2f,\"pressure\":%.2f,"
-        "\"iaq\":%.2f,\"co2\":%.2f,\"voc\":%.2f,"
-        "\"iaq_accuracy\":%u,\"static_iaq\":%.2f,\"gas_percentage\":%.2f,"
-        "\"stabilization_status\":\"%s\",\"run_in_status\":\"%s\","
-        "\"data_type\":\"%s\",\"timestamp\":%u}",
-        data->temperature, data->humidity, data->pressure, data->iaq, data->co2_equivalent, data->breath_voc_equivalent,
-        (unsigned)data->iaq_accuracy, data->static_iaq, data->gas_percentage, data->stabilization_status ? "true" : "false",
-        data->run_in_status ? "true" : "false", is_averaged ? "averaged" : "raw", (unsigned)data->timestamp);
+    char topic[128];
+    char payload[MQTT_DISCOVERY_PAYLOAD_MAX];
+    bool queued = true;
+    for (uint8_t i = 0; i < mqtt_discovery_entity_count; i++) {
+        const mqtt_discovery_entity_t *entity = &mqtt_discovery_entities[i];
+        int topic_len = mqtt_discovery_topic(topic, sizeof(topic), entity, &device);
+        int len = mqtt_discovery_payload(payload, sizeof(payload), entity, &device);
+
+        if (topic_len <= 0 || topic_len >= (int)sizeof(topic) || len <= 0 || len >= (int)sizeof(payload)) {
+            ESP_LOGE(TAG, "Discovery message for %s truncated (topic=%d, payload=%d)", entity->key, topic_len, len);
+            queued = false;
+            continue;
+        }
+
+        queued = mqtt_publish(topic, payload, len, MQTT_QOS_CLASS_CONTROL, true) >= 0 && queued;
+    }
+
+    // Only remember the hash once every message is on its way, so a failed attempt is repeated on the next connect
+    if (queued) {
+        config_save_discovery_hash(discovery_hash);
+    }
+    ESP_LOGI(TAG, "Home Assistant discovery messages sent (%u entities, %08lx)", mqtt_discovery_entity_count, (unsigned long)discovery_hash);
+}
+
+static uint32_t batch_now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+// Publish a complete batch and the newest sample in it
+static void batch_flush_publish(const uint8_t *payload, size_t len, uint16_t count, void *ctx) {
+    mqtt_state_stream_t *stream = ctx;
+    const mqtt_batch_t *batch = &stream->batch;
+
+    mqtt_publish(stream->batch_topic, payload, len, MQTT_QOS_CLASS_BATCH, false);
+    mqtt_publish(stream->state_topic, batch->buf + batch->last_offset, batch->last_len, MQTT_QOS_CLASS_BATCH, false);
+    ESP_LOGD(TAG, "Published batch of %u samples (%u bytes) to %s", count, (unsigned)len, stream->batch_topic);
+}
+
+// Publish a state payload directly, or add it to the batch of its stream
+static void mqtt_publish_state(mqtt_state_stream_t *stream, const void *payload, size_t len) {
+    if (!stream->enabled) {
+        mqtt_publish(stream->state_topic, payload, len, MQTT_QOS_CLASS_STATE, false);
+        return;
+    }
+
+    xSemaphoreTake(batch_mutex, portMAX_DELAY);
+    bool started = stream->batch.count == 0;
+    if (!mqtt_batch_add(&stream->batch, payload, len, batch_now_ms(), batch_flush_publish, stream)) {
+        ESP_LOGE(TAG, "Payload of %u bytes exceeds the batch buffer of %s", (unsigned)len, stream->batch_topic);
+    }
+    started = started && stream->batch.count > 0;
+    xSemaphoreGive(batch_mutex);
+
+    // A new batch sets a new deadline for the flush task
+    if (started && batch_task_handle != NULL) {
+        xTaskNotifyGive(batch_task_handle);
+    }
+}
+
+// Flush batches whose age limit has expired
+static void mqtt_batch_task(void *pvParameter) {
+    for (;;) {
+        uint32_t wait_ms = UINT32_MAX;
+
+        xSemaphoreTake(batch_mutex, portMAX_DELAY);
+        uint32_t now_ms = batch_now_ms();
+        for (size_t i = 0; i < STATE_STREAM_COUNT; i++) {
+            mqtt_state_stream_t *stream = state_streams[i];
+            if (!stream->enabled) {
+                continue;
+            }
+
+            mqtt_batch_poll(&stream->batch, now_ms, batch_flush_publish, stream);
+            uint32_t due_ms = mqtt_batch_ms_until_due(&stream->batch, now_ms);
+            if (due_ms < wait_ms) {
+                wait_ms = due_ms;
+            }
+        }
+        xSemaphoreGive(batch_mutex);
+
+        ulTaskNotifyTake(pdTRUE, wait_ms == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(wait_ms) + 1);
+    }
+}
+
+// Enable batching of a stream according to its configured limits
+static void mqtt_state_stream_init(mqtt_state_stream_t *stream, const polverine_batch_config_t *config,
+    const mqtt_batch_framing_t *framing, size_t capacity) {
+    const mqtt_batch_limits_t limits = {
+        .max_samples = config->max_samples,
+        .max_age_ms = (uint32_t)config->max_age_s * 1000,
+    };
+
+    if (limits.max_samples <= 1) {
+        return;
+    }
+
+    if (!mqtt_batch_init(&stream->batch, framing, &limits, capacity)) {
+        ESP_LOGE(TAG, "No memory for the batch of %s, publishing every sample", stream->batch_topic);
+        return;
+    }
+
+    stream->enabled = true;
+    ESP_LOGI(TAG, "Batching up to %u samples or %u s on %s", limits.max_samples, config->max_age_s, stream->batch_topic);
+}
+
+static void mqtt_batching_start(void) {
+    polverine_payload_format_t format = current_mqtt_config.payload_format;
+
+    if (format != PAYLOAD_FORMAT_CBOR) {
+        mqtt_state_stream_init(&bme690_json_stream, &current_mqtt_config.batch_bme690, &mqtt_batch_json, MQTT_BATCH_JSON_CAPACITY);
+        mqtt_state_stream_init(&bmv080_json_stream, &current_mqtt_config.batch_bmv080, &mqtt_batch_json, MQTT_BATCH_JSON_CAPACITY);
+    }
+    if (format != PAYLOAD_FORMAT_JSON) {
+        mqtt_state_stream_init(&bme690_cbor_stream, &current_mqtt_config.batch_bme690, &mqtt_batch_cbor, MQTT_BATCH_CBOR_CAPACITY);
+        mqtt_state_stream_init(&bmv080_cbor_stream, &current_mqtt_config.batch_bmv080, &mqtt_batch_cbor, MQTT_BATCH_CBOR_CAPACITY);
+    }
+
+    bool enabled = false;
+    for (size_t i = 0; i < STATE_STREAM_COUNT; i++) {
+        enabled = enabled || state_streams[i]->enabled;
+    }
+    if (!enabled || batch_task_handle != NULL) {
+        return;
+    }
+
+    batch_mutex = xSemaphoreCreateMutex();
+    xTaskCreate(&mqtt_batch_task, "mqtt_batch_task", 4096, NULL, 5, &batch_task_handle);
+}
+
+// Publish a batch of replayed samples
+static void backlog_flush_publish(const uint8_t *payload, size_t len, uint16_t count, void *ctx) {
+    mqtt_backlog_stream_t *stream = ctx;
+
+    if (mqtt_publish(stream->topic, payload, len, MQTT_QOS_CLASS_BACKLOG, false) < 0) {
+        stream->failed = true;
+    }
+}
+
+// Encode a stored sample in the configured format and add it to its backlog batch
+static void backlog_add(const mqtt_outbox_record_t *record) {
+    bool cbor = current_mqtt_config.payload_format == PAYLOAD_FORMAT_CBOR;
+    mqtt_backlog_stream_t *stream;
+    uint8_t payload[320];
+    int written;
+
+    if (record->type == SENSOR_TYPE_BME690 && record->len == sizeof(bme690_data_t)) {
+        const bme690_data_t *data = (const bme690_data_t *)record->data;
+        bool is_averaged = (record->flags & SENSOR_SAMPLE_AVERAGED) != 0;
+        stream = &bme690_backlog;
+        written = cbor ? mqtt_cbor_bme690(payload, sizeof(payload), data, is_averaged)
+                       : mqtt_payload_bme690((char *)payload, sizeof(payload), data, is_averaged);
+    } else if (record->type == SENSOR_TYPE_BMV080 && record->len == sizeof(bmv080_data_t)) {
+        const bmv080_data_t *data = (const bmv080_data_t *)record->data;
+        stream = &bmv080_backlog;
+        written = cbor ? mqtt_cbor_bmv080(payload, sizeof(payload), data) : mqtt_payload_bmv080((char *)payload, sizeof(payload), data);
+    } else {
+        ESP_LOGW(TAG, "Skipping stored sample of type %u", record->type);
+        return;
+    }
 
     if (written <= 0 || written >= (int)sizeof(payload)) {
-        ESP_LOGE(TAG, "BME690 JSON payload truncated (size=%d)", written);
+        ESP_LOGE(TAG, "Backlog payload encoding failed (size=%d)", written);
+        return;
+    }
+    mqtt_batch_add(&stream->batch, payload, written, 0, backlog_flush_publish, stream);
+}
+
+// Replay stored samples after a reconnect, one rate-limited batch at a time
+static void mqtt_outbox_task(void *pvParameter) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        uint32_t pending = mqtt_outbox_pending();
+        if (pending > 0) {
+            ESP_LOGI(TAG, "Replaying %lu stored samples", (unsigned long)pending);
+        }
+
+        while (isConnected && mqtt_outbox_pending() > 0) {
+            if (esp_mqtt_client_get_outbox_size(client) > OUTBOX_REPLAY_MAX_QUEUED) {
+                vTaskDelay(pdMS_TO_TICKS(OUTBOX_REPLAY_INTERVAL_MS));
+                continue;
+            }
+
+            mqtt_outbox_cursor_t cursor = mqtt_outbox_begin();
+            mqtt_outbox_record_t record;
+            unsigned count = 0;
+            bme690_backlog.failed = false;
+            bmv080_backlog.failed = false;
+            while (count < OUTBOX_REPLAY_BATCH && mqtt_outbox_read(&cursor, &record)) {
+                backlog_add(&record);
+                count++;
+            }
+            mqtt_batch_flush(&bme690_backlog.batch, backlog_flush_publish, &bme690_backlog);
+            mqtt_batch_flush(&bmv080_backlog.batch, backlog_flush_publish, &bmv080_backlog);
+
+            if (bme690_backlog.failed || bmv080_backlog.failed) {
+                // Left in the outbox and retried after the next reconnect
+                ESP_LOGW(TAG, "Backlog publish failed, %lu samples left", (unsigned long)mqtt_outbox_pending());
+                break;
+            }
+            mqtt_outbox_commit(&cursor);
+            if (count == 0) {
+                break;
+            }
+            vTaskDelay(pdMS_TO_TICKS(OUTBOX_REPLAY_INTERVAL_MS));
+        }
+    }
+}
+
+static void mqtt_outbox_start(void) {
+    const bool cbor = current_mqtt_config.payload_format == PAYLOAD_FORMAT_CBOR;
+    const mqtt_batch_framing_t *framing = cbor ? &mqtt_batch_cbor : &mqtt_batch_json;
+    const mqtt_batch_limits_t limits = {.max_samples = OUTBOX_REPLAY_BATCH, .max_age_ms = 0};
+
+    snprintf(bme690_backlog.topic, sizeof(bme690_backlog.topic), cbor ? TEMPLATE_CBOR_BACKLOG_BME690 : TEMPLATE_BACKLOG_BME690, shortId);
+    snprintf(bmv080_backlog.topic, sizeof(bmv080_backlog.topic), cbor ? TEMPLATE_CBOR_BACKLOG_BMV080 : TEMPLATE_BACKLOG_BMV080, shortId);
+
+    if (!mqtt_outbox_init()) {
+        return;
+    }
+    if (!mqtt_batch_init(&bme690_backlog.batch, framing, &limits, MQTT_BATCH_DEFAULT_CAPACITY) ||
+        !mqtt_batch_init(&bmv080_backlog.batch, framing, &limits, MQTT_BATCH_DEFAULT_CAPACITY)) {
+        ESP_LOGE(TAG, "No memory for backlog batches, outbox disabled");
+        return;
+    }
+
+    outbox_ready = true;
+    xTaskCreate(&mqtt_outbox_task, "mqtt_outbox_task", 4096, NULL, OUTBOX_TASK_PRIORITY, &outbox_task_handle);
+}
+
+// Change filters, only touched by the sensor handlers on the bus dispatcher task once started
+static mqtt_deadband_t bme690_deadband;
+static mqtt_deadband_t bmv080_deadband;
+static bool bme690_deadband_enabled = false;
+static bool bmv080_deadband_enabled = false;
+
+// Set by the MQTT event handler on connect, the filter is reset by its sensor handler before the next check
+static atomic_bool bme690_deadband_reset_pending;
+static atomic_bool bmv080_deadband_reset_pending;
+
+static bool mqtt_deadband_filter_init(mqtt_deadband_t *filter, const char *name, const polverine_deadband_config_t *config,
+    const mqtt_deadband_field_t *fields, uint8_t field_count) {
+    mqtt_deadband_init(filter, fields, field_count, (uint32_t)config->heartbeat_s * 1000);
+    if (config->spec[0] == '\0') {
+        return false;
+    }
+    if (!mqtt_deadband_parse(filter, config->spec)) {
+        ESP_LOGE(TAG, "Invalid %s change filter '%s', publishing every sample", name, config->spec);
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Filtering %s changes with '%s', heartbeat %u s", name, config->spec, config->heartbeat_s);
+    return true;
+}
+
+static void mqtt_deadband_start(void) {
+    bme690_deadband_enabled = mqtt_deadband_filter_init(&bme690_deadband, "BME690", &current_mqtt_config.deadband_bme690,
+        mqtt_deadband_bme690_fields, mqtt_deadband_bme690_field_count);
+    bmv080_deadband_enabled = mqtt_deadband_filter_init(&bmv080_deadband, "BMV080", &current_mqtt_config.deadband_bmv080,
+        mqtt_deadband_bmv080_fields, mqtt_deadband_bmv080_field_count);
+}
+
+// Drop samples without a significant change, counting them in the filter
+static bool mqtt_deadband_pass(mqtt_deadband_t *filter, bool enabled, atomic_bool *reset_pending, const sensor_sample_t *sample) {
+    if (atomic_exchange(reset_pending, false)) {
+        mqtt_deadband_reset(filter);
+    }
+    return !enabled || mqtt_deadband_check(filter, sensor_sample_data(sample), sample->flags, batch_now_ms());
+}
+
+// Keep a sample for replay after the next reconnect
+static void mqtt_outbox_store(const sensor_sample_t *sample, size_t size) {
+    if (outbox_ready && !mqtt_outbox_append(sample->type, (uint8_t)sample->flags, sensor_sample_data(sample), size)) {
+        ESP_LOGW(TAG, "Failed to store sample while disconnected");
+    }
+}
+
+// BME690 data callback handler
+static void mqtt_bme690_data_handler(const sensor_sample_t *sample, void *ctx) {
+    if (sample == NULL || !mqtt_deadband_pass(&bme690_deadband, bme690_deadband_enabled, &bme690_deadband_reset_pending, sample))
+        return;
+
+    if (!isConnected) {
+        mqtt_outbox_store(sample, sizeof(bme690_data_t));
         return;
     }
 
-    esp_mqtt_client_publish(client, bme690_state_topic, payload, 0, 1, 0);
-    ESP_LOGI(TAG, "Published %s BME690 data", is_averaged ? "averaged" : "raw");
+    const bme690_data_t *data = sensor_sample_data(sample);
+    bool is_averaged = (sample->flags & SENSOR_SAMPLE_AVERAGED) != 0;
+    polverine_payload_format_t format = current_mqtt_config.payload_format;
+
+    if (format != PAYLOAD_FORMAT_CBOR) {
+        char payload[320];
+        int written = mqtt_payload_bme690(payload, sizeof(payload), data, is_averaged);
+
+        if (written <= 0 || written >= (int)sizeof(payload)) {
+            ESP_LOGE(TAG, "BME690 JSON payload truncated (size=%d)", written);
+            return;
+        }
+
+        mqtt_publish_state(&bme690_json_stream, payload, written);
+    }
+
+    if (format != PAYLOAD_FORMAT_JSON) {
+        uint8_t payload[MQTT_CBOR_BME690_MAX];
+        int written = mqtt_cbor_bme690(payload, sizeof(payload), data, is_averaged);
+
+        if (written <= 0) {
+            ESP_LOGE(TAG, "BME690 CBOR payload encoding failed");
+            return;
+        }
+
+        mqtt_publish_state(&bme690_cbor_stream, payload, written);
+    }
+
+    ESP_LOGI(TAG, "Published %s BME690 data (%s)", is_averaged ? "averaged" : "raw", config_payload_format_name(format));
 }
 
 // BMV080 data callback handler
-static void mqtt_bmv080_data_handler(const bmv080_data_t *data) {
-    if (!isConnected || data == NULL)
+static void mqtt_bmv080_data_handler(const sensor_sample_t *sample, void *ctx) {
+    if (sample == NULL || !mqtt_deadband_pass(&bmv080_deadband, bmv080_deadband_enabled, &bmv080_deadband_reset_pending, sample))
+        return;
+
+    if (!isConnected) {
+        mqtt_outbox_store(sample, sizeof(bmv080_data_t));
+        return;
+    }
+
+    const bmv080_data_t *data = sensor_sample_data(sample);
+    polverine_payload_format_t format = current_mqtt_config.payload_format;
+
+    if (format != PAYLOAD_FORMAT_CBOR) {
+        char payload[192];
+        int written = mqtt_payload_bmv080(payload, sizeof(payload), data);
+
+        if (written <= 0 || written >= (int)sizeof(payload)) {
+            ESP_LOGE(TAG, "BMV080 JSON payload truncated (size=%d)", written);
+            return;
+        }
+
+        mqtt_publish_state(&bmv080_json_stream, payload, written);
+    }
+
+    if (format != PAYLOAD_FORMAT_JSON) {
+        uint8_t payload[MQTT_CBOR_BMV080_MAX];
+        int written = mqtt_cbor_bmv080(payload, sizeof(payload), data);
+
+        if (written <= 0) {
+            ESP_LOGE(TAG, "BMV080 CBOR payload encoding failed");
+            return;
+        }
+
+        mqtt_publish_state(&bmv080_cbor_stream, payload, written);
+    }
+
+    ESP_LOGI(TAG, "Published BMV080 data (%s)", config_payload_format_name(format));
+}
+
+// Windowed statistics callback handler
+static void mqtt_stats_handler(const sensor_sample_t *sample, void *ctx) {
+    if (!isConnected || sample == NULL)
         return;
 
-    char payload[192];
-    int written = snprintf(payload, sizeof(payload),
-        "{\"pm10\":%.2f,\"pm25\":%.2f,\"pm1\":%.2f,"
-        "\"obstructed\":\"%s\",\"out_of_range\":\"%s\","
-        "\"runtime\":%.2f,\"timestamp\":%u}",
-        data->pm10, data->pm25, data->pm1, data->is_obstructed ? "true" : "false", data->is_outside_range ? "true" : "false", data->runtime,
-        (unsigned)data->timestamp);
+    const sensor_agg_report_t *report = sensor_sample_data(sample);
+
+    char window[8];
+    char topic[128];
+    sensor_aggregate_window_label(report->window_ms, window, sizeof(window));
+    snprintf(topic, sizeof(topic), TEMPLATE_STATS, shortId, report->sensor, window);
+
+    char payload[1280];
+    int written = mqtt_payload_stats(payload, sizeof(payload), report);
 
     if (written <= 0 || written >= (int)sizeof(payload)) {
-        ESP_LOGE(TAG, "BMV080 JSON payload truncated (size=%d)", written);
+        ESP_LOGE(TAG, "Stats JSON payload truncated (size=%d)", written);
         return;
     }
 
-    esp_mqtt_client_publish(client, bmv080_state_topic, payload, 0, 1, 0);
-
-    ESP_LOGI(TAG, "Published BMV080 data");
+    mqtt_publish(topic, payload, written, MQTT_QOS_CLASS_STATS, false);
+    ESP_LOGI(TAG, "Published %s %s stats (%lu samples)", report->sensor, window, (unsigned long)report->count);
 }
 
 // Forward declarations
@@ -456,15 +738,154 @@ void system_metrics_publish(void) {
     }
 
     char payload[160];
-    int len = snprintf(payload, sizeof(payload), "{\"rssi\":%ld,\"free_heap\":%lu,\"uptime\":%lu,\"cpu_temp\":%.2f}", (long)rssi,
-        (unsigned long)free_heap, (unsigned long)uptime, cpu_temp);
+    int len = mqtt_payload_system(payload, sizeof(payload), rssi, free_heap, uptime, cpu_temp);
 
     if (len <= 0 || len >= (int)sizeof(payload)) {
         ESP_LOGE(TAG, "System metrics JSON truncated (len=%d)", len);
         return;
     }
 
-    esp_mqtt_client_publish(client, system_state_topic, payload, 0, 1, 0);
+    mqtt_publish(system_state_topic, payload, len, MQTT_QOS_CLASS_SYSTEM, false);
+}
+
+// Publish sensor bus counters and latency histograms
+static void broker_diag_publish(void) {
+    if (!isConnected)
+        return;
+
+    const size_t size = MQTT_PAYLOAD_BROKER_DIAG_MAX;
+    char *payload = malloc(size);
+    if (payload == NULL) {
+        ESP_LOGE(TAG, "No memory for broker diagnostics payload");
+        return;
+    }
+
+    int len = mqtt_payload_broker_diag(payload, size);
+    if (len <= 0 || len >= (int)size) {
+        ESP_LOGE(TAG, "Broker diagnostics JSON truncated (len=%d)", len);
+    } else {
+        mqtt_publish(broker_diag_topic, payload, len, MQTT_QOS_CLASS_DIAG, false);
+    }
+    free(payload);
+}
+
+// Publish change filter counters
+static void deadband_diag_publish(void) {
+    if (!isConnected || !(bme690_deadband_enabled || bmv080_deadband_enabled))
+        return;
+
+    const char *names[2];
+    const mqtt_deadband_t *filters[2];
+    size_t count = 0;
+    if (bme690_deadband_enabled) {
+        names[count] = "bme690";
+        filters[count++] = &bme690_deadband;
+    }
+    if (bmv080_deadband_enabled) {
+        names[count] = "bmv080";
+        filters[count++] = &bmv080_deadband;
+    }
+
+    char payload[640];
+    int len = mqtt_payload_deadband(payload, sizeof(payload), names, filters, count);
+    if (len <= 0 || len >= (int)sizeof(payload)) {
+        ESP_LOGE(TAG, "Change filter diagnostics JSON truncated (len=%d)", len);
+        return;
+    }
+
+    mqtt_publish(deadband_diag_topic, payload, len, MQTT_QOS_CLASS_DIAG, false);
+}
+
+// Publish QoS policy counters and the outbox depth
+static void qos_diag_publish(void) {
+    if (!isConnected)
+        return;
+
+    char payload[768];
+    xSemaphoreTake(publish_mutex, portMAX_DELAY);
+    int len = mqtt_payload_qos(payload, sizeof(payload), &qos_policy);
+    xSemaphoreGive(publish_mutex);
+    if (len <= 0 || len >= (int)sizeof(payload)) {
+        ESP_LOGE(TAG, "QoS diagnostics JSON truncated (len=%d)", len);
+        return;
+    }
+
+    mqtt_publish(qos_diag_topic, payload, len, MQTT_QOS_CLASS_DIAG, false);
+}
+
+// Hand the running firmware the settings it applies without a restart
+static void command_apply(const mqtt_command_t *cmd) {
+    if (cmd->changes & MQTT_COMMAND_DUTY_CYCLE) {
+        bmv080_set_duty_cycle(cmd->sensor.bmv080_duty_cycle_s);
+    }
+    if (cmd->changes & MQTT_COMMAND_GATING) {
+        bme690_set_gated(cmd->sensor.bme690_gated);
+    }
+    if (cmd->changes & MQTT_COMMAND_STATS_WINDOWS) {
+        bme690_set_stats_windows(cmd->sensor.stats_window_s);
+        bmv080_set_stats_windows(cmd->sensor.stats_window_s);
+    }
+    if (cmd->changes & (MQTT_COMMAND_QOS | MQTT_COMMAND_EXPIRY)) {
+        xSemaphoreTake(publish_mutex, portMAX_DELAY);
+        current_mqtt_config.qos = cmd->mqtt.qos;
+        current_mqtt_config.message_expiry_s = cmd->mqtt.message_expiry_s;
+        mqtt_qos_set_policy(&qos_policy, MQTT_QOS_CLASS_STATE, cmd->mqtt.qos.state);
+        mqtt_qos_set_policy(&qos_policy, MQTT_QOS_CLASS_BATCH, cmd->mqtt.qos.batch);
+        mqtt_qos_set_policy(&qos_policy, MQTT_QOS_CLASS_STATS, cmd->mqtt.qos.stats);
+        mqtt_qos_set_policy(&qos_policy, MQTT_QOS_CLASS_SYSTEM, cmd->mqtt.qos.system);
+        xSemaphoreGive(publish_mutex);
+    }
+}
+
+// Check, save and apply a command, then publish its result. Runs on the system metrics task.
+static void command_handle(const mqtt_command_message_t *message) {
+    static mqtt_command_t cmd; // Only used on this task, kept off its stack
+
+    // The parser checks every setting of both groups before anything is saved
+    cmd = command_settings;
+    bool ok = mqtt_command_parse(&cmd, message->text, message->len);
+
+    uint32_t saved = cmd.changes & ~MQTT_COMMAND_RESTART;
+    bool save_sensor = ok && (saved & MQTT_COMMAND_SENSOR);
+    bool save_mqtt = ok && (saved & ~MQTT_COMMAND_SENSOR);
+    if (save_sensor && !config_save_sensor(&cmd.sensor)) {
+        ok = false;
+    }
+    if (ok && save_mqtt && !config_save_mqtt(&cmd.mqtt)) {
+        ok = false;
+    }
+
+    // A rejected command leaves no settings behind that a restart would pick up
+    if (!ok && save_sensor && !config_save_sensor(&command_settings.sensor)) {
+        ESP_LOGE(TAG, "Failed to restore the saved sensor settings after command %s", cmd.id);
+    }
+    if (!ok && save_mqtt && !config_save_mqtt(&command_settings.mqtt)) {
+        ESP_LOGE(TAG, "Failed to restore the saved MQTT settings after command %s", cmd.id);
+    }
+
+    if (ok) {
+        command_apply(&cmd);
+        command_settings.sensor = cmd.sensor;
+        command_settings.mqtt = cmd.mqtt;
+        ESP_LOGI(TAG, "Command %s applied, changes %02lx", cmd.id, (unsigned long)cmd.changes);
+    } else {
+        if (cmd.error[0] == '\0') {
+            snprintf(cmd.error, sizeof(cmd.error), "failed to save settings");
+        }
+        ESP_LOGW(TAG, "Command %s rejected: %s", cmd.id, cmd.error);
+    }
+
+    char payload[256];
+    int written = mqtt_command_result(payload, sizeof(payload), &cmd, ok);
+    if (written > 0 && written < (int)sizeof(payload) && isConnected) {
+        mqtt_publish(command_result_topic, payload, written, MQTT_QOS_CLASS_CONTROL, false);
+    }
+
+    if (ok && (cmd.changes & MQTT_COMMAND_RESTART)) {
+        ESP_LOGW(TAG, "Restarting on command %s", cmd.id);
+        vTaskDelay(pdMS_TO_TICKS(2000)); // Let the result go out
+        esp_restart();
+    }
 }
 
 static void log_error_if_nonzero(const char *message, int error_code) {
@@ -473,6 +894,177 @@ static void log_error_if_nonzero(const char *message, int error_code) {
     }
 }
 
+static void link_set_state(mqtt_link_state_t state) {
+    if (state != link_state) {
+        ESP_LOGI(TAG, "Link %s -> %s", mqtt_link_state_names[link_state], mqtt_link_state_names[state]);
+        link_state = state;
+    }
+}
+
+// Arm the reconnect timer with the next backoff delay, or wait for Wi-Fi. Called with link_mutex held.
+static void link_schedule_reconnect(void) {
+    esp_timer_stop(reconnect_timer);
+
+    if (!wifi_sta_is_connected()) {
+        link_set_state(MQTT_LINK_WAIT_NETWORK);
+        return;
+    }
+
+    uint32_t ceiling_ms = mqtt_backoff_ceiling(&reconnect_backoff);
+    uint32_t delay_ms = mqtt_backoff_next(&reconnect_backoff, esp_random());
+    esp_err_t err = esp_timer_start_once(reconnect_timer, (uint64_t)delay_ms * 1000);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to arm reconnect timer: %s", esp_err_to_name(err));
+    }
+
+    link_set_state(MQTT_LINK_BACKOFF);
+    ESP_LOGI(TAG, "Reconnecting to %s in %lu ms (of up to %lu ms)", current_mqtt_config.uri, (unsigned long)delay_ms,
+        (unsigned long)ceiling_ms);
+}
+
+// Runs on the esp_timer task, never on the MQTT client task
+static void reconnect_timer_callback(void *arg) {
+    xSemaphoreTake(link_mutex, portMAX_DELAY);
+    bool due = link_state == MQTT_LINK_BACKOFF;
+    if (due) {
+        link_set_state(MQTT_LINK_CONNECTING);
+        reconnect_attempts++;
+    }
+    xSemaphoreGive(link_mutex);
+
+    if (!due) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Reconnect attempt %lu", (unsigned long)reconnect_attempts);
+    esp_err_t err = esp_mqtt_client_reconnect(client);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initiate reconnection: %s", esp_err_to_name(err));
+        xSemaphoreTake(link_mutex, portMAX_DELAY);
+        link_schedule_reconnect();
+        xSemaphoreGive(link_mutex);
+    }
+}
+
+// Follow the station: no attempts while it has no address, a fresh jittered start once it has one
+static void link_wifi_event_handler(void *arg, esp_event_base_t base, int32_t event_id, void *event_data) {
+    xSemaphoreTake(link_mutex, portMAX_DELAY);
+    if (base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        if (link_state == MQTT_LINK_WAIT_NETWORK) {
+            mqtt_backoff_reset(&reconnect_backoff);
+            link_schedule_reconnect();
+        }
+    } else if (base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        if (link_state == MQTT_LINK_BACKOFF) {
+            esp_timer_stop(reconnect_timer);
+            link_set_state(MQTT_LINK_WAIT_NETWORK);
+        }
+    }
+    xSemaphoreGive(link_mutex);
+}
+
+// QoS policies of the configurable classes, see mqtt_qos.h
+static bool mqtt_qos_start(void) {
+    const uint8_t policies[MQTT_QOS_CLASS_CONFIGURABLE] = {
+        [MQTT_QOS_CLASS_STATE] = current_mqtt_config.qos.state,
+        [MQTT_QOS_CLASS_BATCH] = current_mqtt_config.qos.batch,
+        [MQTT_QOS_CLASS_STATS] = current_mqtt_config.qos.stats,
+        [MQTT_QOS_CLASS_SYSTEM] = current_mqtt_config.qos.system,
+    };
+
+    mqtt_qos_init(&qos_policy, MQTT_QOS_HIGH_WATER, MQTT_QOS_LOW_WATER);
+    for (int i = 0; i < MQTT_QOS_CLASS_CONFIGURABLE; i++) {
+        if (!mqtt_qos_set_policy(&qos_policy, (mqtt_qos_class_t)i, policies[i])) {
+            ESP_LOGW(TAG, "Invalid QoS policy %u for %s, using QoS 1", policies[i], mqtt_qos_class_name((mqtt_qos_class_t)i));
+        }
+    }
+    ESP_LOGI(TAG, "QoS policy: state %s, batch %s, stats %s, system %s", mqtt_qos_policy_name(qos_policy.policy[MQTT_QOS_CLASS_STATE]),
+        mqtt_qos_policy_name(qos_policy.policy[MQTT_QOS_CLASS_BATCH]), mqtt_qos_policy_name(qos_policy.policy[MQTT_QOS_CLASS_STATS]),
+        mqtt_qos_policy_name(qos_policy.policy[MQTT_QOS_CLASS_SYSTEM]));
+
+    publish_mutex = xSemaphoreCreateMutex();
+    if (publish_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create publish mutex");
+        return false;
+    }
+    return true;
+}
+
+// Aliases are assigned once; the broker learns them again on every connection
+static void mqtt5_start(void) {
+    mqtt_alias_init(&topic_aliases);
+
+    const char *const aliased_topics[] = {
+        bme690_state_topic,
+        bmv080_state_topic,
+        bme690_cbor_topic,
+        bmv080_cbor_topic,
+        bme690_json_stream.batch_topic,
+        bmv080_json_stream.batch_topic,
+        bme690_cbor_stream.batch_topic,
+        bmv080_cbor_stream.batch_topic,
+        system_state_topic,
+    };
+    for (size_t i = 0; i < sizeof(aliased_topics) / sizeof(aliased_topics[0]); i++) {
+        mqtt_alias_add(&topic_aliases, aliased_topics[i]);
+    }
+
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    mqtt5_active = current_mqtt_config.mqtt5;
+#else
+    if (current_mqtt_config.mqtt5) {
+        ESP_LOGW(TAG, "MQTT 5 configured but not enabled in the MQTT client (CONFIG_MQTT_PROTOCOL_5), using 3.1.1");
+    }
+#endif
+}
+
+// Called on the MQTT client task when the broker refused the connection
+static void mqtt5_fall_back(int return_code) {
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    if (!mqtt5_active || (return_code != MQTT_REFUSED_PROTOCOL_V311 && return_code != MQTT_REFUSED_PROTOCOL_V5)) {
+        return;
+    }
+
+    ESP_LOGW(TAG, "Broker does not support MQTT 5 (0x%x), falling back to 3.1.1", return_code);
+    mqtt5_active = false;
+
+    mqtt_cfg.session.protocol_ver = MQTT_PROTOCOL_V_3_1_1;
+    esp_err_t err = esp_mqtt_set_config(client, &mqtt_cfg);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to switch to MQTT 3.1.1: %s", esp_err_to_name(err));
+    }
+
+    // Not the broker being overloaded, retry after the shortest delay
+    xSemaphoreTake(link_mutex, portMAX_DELAY);
+    mqtt_backoff_reset(&reconnect_backoff);
+    xSemaphoreGive(link_mutex);
+#endif
+}
+
+// Make the alias table start over before the next publish
+static void alias_session_begin(bool usable) {
+    unsigned session = atomic_load(&alias_session);
+    atomic_store(&alias_session, ((session + 2u) & ~1u) | (usable ? 1u : 0u));
+}
+
+static bool link_init(void) {
+    const esp_timer_create_args_t timer_args = {
+        .callback = reconnect_timer_callback,
+        .name = "mqtt_reconnect",
+    };
+
+    mqtt_backoff_init(&reconnect_backoff, MQTT_RECONNECT_BASE_MS, MQTT_RECONNECT_CAP_MS);
+    link_mutex = xSemaphoreCreateMutex();
+    if (link_mutex == NULL || esp_timer_create(&timer_args, &reconnect_timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create reconnect timer");
+        return false;
+    }
+
+    esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, link_wifi_event_handler, NULL);
+    esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, link_wifi_event_handler, NULL);
+    return true;
+}
+
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
     ESP_LOGD(TAG, "Event dispatched from event loop base=%s, event_id=%" PRIi32, base, event_id);
     esp_mqtt_event_handle_t event = event_data;
@@ -482,45 +1074,45 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     case MQTT_EVENT_CONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
         isConnected = true;
-        mqtt_connection_start_time = 0;
 
-        // Publish online status FIRST with QoS 1 and retain
-        int msg_id = esp_mqtt_client_publish(client, availability_topic, "online", 0, 1, true);
-        ESP_LOGI(TAG, "Published availability 'online' to %s, msg_id=%d", availability_topic, msg_id);
+        xSemaphoreTake(link_mutex, portMAX_DELAY);
+        esp_timer_stop(reconnect_timer);
+        mqtt_backoff_reset(&reconnect_backoff);
+        link_set_state(MQTT_LINK_CONNECTED);
+        xSemaphoreGive(link_mutex);
+
+        // The broker knows no aliases yet on a new connection
+        alias_session_begin(mqtt5_active);
+        ESP_LOGI(TAG, "Connected with MQTT %s", mqtt5_active ? "5" : "3.1.1");
 
-        // Wait a bit to ensure availability is published before discovery
-        vTaskDelay(pdMS_TO_TICKS(100));
+        // Availability and discovery are published by the system metrics task, again whenever Home Assistant comes online
+        if (system_metrics_task_handle != NULL) {
+            xTaskNotify(system_metrics_task_handle, SESSION_CONNECTED, eSetBits);
+        }
+        esp_mqtt_client_subscribe(client, MQTT_DISCOVERY_STATUS_TOPIC, 1);
+        esp_mqtt_client_subscribe(client, command_topic, 1);
+
+        // Samples filtered while disconnected only reached the backlog topics, refresh the state topics
+        atomic_store(&bme690_deadband_reset_pending, true);
+        atomic_store(&bmv080_deadband_reset_pending, true);
 
-        // Send Home Assistant discovery messages
-        send_ha_discovery();
+        // Replay samples stored while disconnected
+        if (outbox_task_handle != NULL) {
+            xTaskNotifyGive(outbox_task_handle);
+        }
         break;
 
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
         isConnected = false;
 
-        // Attempt to reconnect with shorter delay for better availability
-        ESP_LOGI(TAG, "Will attempt to reconnect in 2 seconds...");
-        vTaskDelay(pdMS_TO_TICKS(2000));
-
-        // Get MQTT configuration for detailed logging
-        if (mqtt_config_loaded) {
-            ESP_LOGI(TAG, "Attempting to reconnect to MQTT broker...");
-            ESP_LOGI(TAG, "  Broker URI: %s", current_mqtt_config.uri);
-            ESP_LOGI(TAG, "  Username: %s", current_mqtt_config.username);
-            ESP_LOGI(TAG, "  Password: %s", current_mqtt_config.password);
-            ESP_LOGI(TAG, "  Client ID: %s", current_mqtt_config.client_id);
-        } else {
-            ESP_LOGE(TAG, "MQTT configuration incomplete, cannot log connection details");
-        }
+        // Messages queued while disconnected must carry their topic names
+        alias_session_begin(false);
 
-        esp_err_t err = esp_mqtt_client_reconnect(client);
-        if (err != ESP_OK) {
-            ESP_LOGE(TAG, "Failed to initiate reconnection: %s", esp_err_to_name(err));
-        } else {
-            ESP_LOGI(TAG, "Reconnection initiated");
-            mqtt_connection_start_time = xTaskGetTickCount();
-        }
+        // The client does not retry on its own, the reconnect timer does with backoff
+        xSemaphoreTake(link_mutex, portMAX_DELAY);
+        link_schedule_reconnect();
+        xSemaphoreGive(link_mutex);
         break;
 
     case MQTT_EVENT_ERROR:
@@ -530,6 +1122,9 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
             log_error_if_nonzero("reported from tls stack", event->error_handle->esp_tls_stack_err);
             log_error_if_nonzero("captured as transport's socket errno", event->error_handle->esp_transport_sock_errno);
             ESP_LOGI(TAG, "Last errno string (%s)", strerror(event->error_handle->esp_transport_sock_errno));
+        } else if (event->error_handle->error_type == MQTT_ERROR_TYPE_CONNECTION_REFUSED) {
+            ESP_LOGW(TAG, "Connection refused, return code 0x%x", event->error_handle->connect_return_code);
+            mqtt5_fall_back(event->error_handle->connect_return_code);
         }
         break;
 
@@ -540,6 +1135,35 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
         ESP_LOGD(TAG, "MQTT_EVENT_DATA");
         ESP_LOGD(TAG, "TOPIC=%.*s", event->topic_len, event->topic);
         ESP_LOGD(TAG, "DATA=%.*s", event->data_len, event->data);
+
+        // Home Assistant announces itself after a restart, resend in case the broker lost the retained messages
+        if (event->topic_len == (int)strlen(MQTT_DISCOVERY_STATUS_TOPIC) &&
+            strncmp(event->topic, MQTT_DISCOVERY_STATUS_TOPIC, event->topic_len) == 0 && event->data_len == 6 &&
+            strncmp(event->data, "online", 6) == 0) {
+            ESP_LOGI(TAG, "Home Assistant came online, resending discovery");
+            if (system_metrics_task_handle != NULL) {
+                xTaskNotify(system_metrics_task_handle, SESSION_HA_ONLINE, eSetBits);
+            }
+        }
+
+        // Commands are queued for the system metrics task, of a fragmented message only the first part arrives here
+        if (event->topic_len == (int)strlen(command_topic) && strncmp(event->topic, command_topic, event->topic_len) == 0 &&
+            event->current_data_offset == 0) {
+            if (event->retain) {
+                // A retained command would run again on every connect
+                ESP_LOGW(TAG, "Ignoring retained command");
+                break;
+            }
+
+            mqtt_command_message_t message;
+            message.len = event->total_data_len > MQTT_COMMAND_MAX_LEN ? MQTT_COMMAND_MAX_LEN + 1 : (uint16_t)event->total_data_len;
+            memcpy(message.text, event->data, message.len <= MQTT_COMMAND_MAX_LEN ? message.len : 0);
+            if (command_queue == NULL || xQueueSend(command_queue, &message, 0) != pdTRUE) {
+                ESP_LOGW(TAG, "Command queue full, dropping command");
+            } else if (system_metrics_task_handle != NULL) {
+                xTaskNotify(system_metrics_task_handle, SESSION_COMMAND, eSetBits);
+            }
+        }
         break;
 
     default:
@@ -565,8 +1189,7 @@ void mqtt_app_start(void) {
         return;
     }
 
-    // Configure MQTT client directly from struct
-    esp_mqtt_client_config_t mqtt_cfg = {0};
+    // Configure MQTT client directly from struct, kept for the protocol fallback
     mqtt_cfg.broker.address.uri = current_mqtt_config.uri;
     mqtt_cfg.credentials.username = current_mqtt_config.username;
     mqtt_cfg.credentials.authentication.password = current_mqtt_config.password;
@@ -579,8 +1202,26 @@ void mqtt_app_start(void) {
     mqtt_cfg.session.last_will.retain = true;
 
     mqtt_cfg.network.timeout_ms = 10000;
+    mqtt_cfg.network.disable_auto_reconnect = true; // Reconnects are scheduled by link_schedule_reconnect()
     mqtt_cfg.session.keepalive = 30; // Increased for better stability
 
+    if (!mqtt_qos_start()) {
+        return;
+    }
+    mqtt5_start();
+
+    // Commands change the saved settings, not only the running ones
+    command_settings.mqtt = current_mqtt_config;
+    config_load_sensor(&command_settings.sensor);
+    command_queue = xQueueCreate(MQTT_COMMAND_QUEUE_LENGTH, sizeof(mqtt_command_message_t));
+    if (command_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create command queue, commands disabled");
+    }
+
+#ifdef CONFIG_MQTT_PROTOCOL_5
+    mqtt_cfg.session.protocol_ver = mqtt5_active ? MQTT_PROTOCOL_V_5 : MQTT_PROTOCOL_V_3_1_1;
+#endif
+
     // Log detailed connection information
     ESP_LOGI(TAG, "MQTT client configuration prepared:");
     ESP_LOGI(TAG, "  Broker URI: %s", mqtt_cfg.broker.address.uri);
@@ -589,6 +1230,7 @@ void mqtt_app_start(void) {
     ESP_LOGI(TAG, "  Client ID: %s", mqtt_cfg.credentials.client_id);
     ESP_LOGI(TAG, "  Keepalive: %d seconds", mqtt_cfg.session.keepalive);
     ESP_LOGI(TAG, "  Timeout: %d ms", mqtt_cfg.network.timeout_ms);
+    ESP_LOGI(TAG, "  Protocol: MQTT %s, telemetry expiry %u s", mqtt5_active ? "5" : "3.1.1", current_mqtt_config.message_expiry_s);
 
     client = esp_mqtt_client_init(&mqtt_cfg);
     if (client == NULL) {
@@ -597,46 +1239,88 @@ void mqtt_app_start(void) {
     }
 
     esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+    if (!link_init()) {
+        return;
+    }
 
-    mqtt_connection_start_time = xTaskGetTickCount();
+    // Filters, batching and the outbox must be ready before the first connect event and sensor callback
+    mqtt_deadband_start();
+    mqtt_batching_start();
+    mqtt_outbox_start();
+
+    // Start system metrics reporting task, it also announces the device on every connect
+    mqtt_start_system_metrics_task();
+    ESP_LOGI(TAG, "System metrics task started");
 
     ESP_LOGI(TAG, "Attempting initial connection to MQTT broker...");
     esp_err_t err = esp_mqtt_client_start(client);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to start MQTT client: %s", esp_err_to_name(err));
-        mqtt_connection_start_time = 0;
         return;
     }
 
     ESP_LOGI(TAG, "MQTT client started successfully");
 
     // Register for sensor data callbacks
-    sensor_broker_register_bme690_callback(mqtt_bme690_data_handler);
-    sensor_broker_register_bmv080_callback(mqtt_bmv080_data_handler);
+    const sensor_subscriber_config_t subscriptions[] = {
+        {.name = "mqtt_bme690", .type = SENSOR_TYPE_BME690, .callback = mqtt_bme690_data_handler},
+        {.name = "mqtt_bmv080", .type = SENSOR_TYPE_BMV080, .callback = mqtt_bmv080_data_handler},
+        {.name = "mqtt_bme690_stats", .type = SENSOR_TYPE_BME690_STATS, .callback = mqtt_stats_handler},
+        {.name = "mqtt_bmv080_stats", .type = SENSOR_TYPE_BMV080_STATS, .callback = mqtt_stats_handler},
+    };
+    for (size_t i = 0; i < sizeof(subscriptions) / sizeof(subscriptions[0]); i++) {
+        if (!sensor_broker_subscribe(&subscriptions[i])) {
+            ESP_LOGE(TAG, "Failed to subscribe %s, its samples will not be published", subscriptions[i].name);
+        }
+    }
     ESP_LOGI(TAG, "Sensor data callbacks registered");
-
-    // Start system metrics reporting task
-    mqtt_start_system_metrics_task();
-    ESP_LOGI(TAG, "System metrics task started");
 }
 
-// Task to periodically publish system metrics and availability
+// Task to periodically publish system metrics and availability, and to announce the device after connecting
 static void system_metrics_task(void *pvParameter) {
     const TickType_t xDelay = 30000 / portTICK_PERIOD_MS;             // Publish every 30 seconds
     const TickType_t xAvailabilityDelay = 60000 / portTICK_PERIOD_MS; // Availability every 60 seconds
     TickType_t lastAvailabilityTime = 0;
+    TickType_t lastMetricsTime = xTaskGetTickCount();
 
     for (;;) {
-        vTaskDelay(xDelay);
+        TickType_t elapsed = xTaskGetTickCount() - lastMetricsTime;
+        uint32_t events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, elapsed < xDelay ? xDelay - elapsed : 0);
+
+        if ((events & SESSION_CONNECTED) && isConnected) {
+            // Publish online status FIRST with QoS 1 and retain
+            int msg_id = mqtt_publish(availability_topic, "online", 0, MQTT_QOS_CLASS_CONTROL, true);
+            ESP_LOGI(TAG, "Published availability 'online' to %s, msg_id=%d", availability_topic, msg_id);
+            lastAvailabilityTime = xTaskGetTickCount();
+
+            send_ha_discovery(false);
+        }
+        if ((events & SESSION_HA_ONLINE) && isConnected) {
+            send_ha_discovery(true);
+        }
+        if (events & SESSION_COMMAND) {
+            mqtt_command_message_t message;
+            while (xQueueReceive(command_queue, &message, 0) == pdTRUE) {
+                command_handle(&message);
+            }
+        }
+        if (xTaskGetTickCount() - lastMetricsTime < xDelay) {
+            continue;
+        }
+        lastMetricsTime = xTaskGetTickCount();
 
         if (isConnected) {
             // Publish system metrics
             system_metrics_publish();
+            broker_diag_publish();
+            deadband_diag_publish();
+            qos_diag_publish();
 
             // Check if it's time to send availability heartbeat
             TickType_t currentTime = xTaskGetTickCount();
             if ((currentTime - lastAvailabilityTime) >= xAvailabilityDelay) {
-                int msg_id = esp_mqtt_client_publish(client, availability_topic, "online", 0, 1, true);
+                int msg_id = mqtt_publish(availability_topic, "online", 0, MQTT_QOS_CLASS_CONTROL, true);
                 ESP_LOGI(TAG, "Availability heartbeat sent, msg_id=%d", msg_id);
                 lastAvailabilityTime = currentTime;
             }
@@ -647,7 +1331,8 @@ static void system_metrics_task(void *pvParameter) {
 void mqtt_start_system_metrics_task(void) {
     // Only create task if it doesn't already exist
     if (system_metrics_task_handle == NULL) {
-        xTaskCreate(&system_metrics_task, "system_metrics_task", 4096, NULL, 5, &system_metrics_task_handle);
+        // Sized for the discovery payload buffers besides the metrics
+        xTaskCreate(&system_metrics_task, "system_metrics_task", 6144, NULL, 5, &system_metrics_task_handle);
         ESP_LOGI(TAG, "System metrics task created");
     } else {
         ESP_LOGI(TAG, "System metrics task already exists");
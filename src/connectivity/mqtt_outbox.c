@@ -0,0 +1,404 @@
+/**
+ * @file mqtt_outbox.c
+ * @brief Flash-backed store-and-forward log for samples taken while MQTT is down
+ */
+
+#include "mqtt_outbox.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "mqtt_outbox";
+
+#define SECTOR_MAGIC       0x314F4250 // "PBO1"
+#define SECTOR_LIVE        0xFFFFFFFF
+#define SECTOR_CONSUMED    0x00000000
+#define RECORD_FREE        0xFFFF // Length of erased flash
+#define RECORD_HEADER_SIZE sizeof(outbox_record_header_t)
+#define SECTOR_HEADER_SIZE sizeof(outbox_sector_header_t)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t consumed; // Cleared once every record in the sector has been replayed
+    uint32_t reserved;
+} outbox_sector_header_t;
+
+typedef struct {
+    uint16_t len;
+    uint8_t type;
+    uint8_t flags;
+    uint16_t check; // Fletcher-16 over len, type, flags and data
+    uint16_t reserved;
+} outbox_record_header_t;
+
+static const esp_partition_t *partition = NULL;
+static SemaphoreHandle_t outbox_lock = NULL;
+static uint32_t sector_count = 0;
+static uint32_t sector_size = 0;
+
+// Write position, the head sector takes no more records once closed
+static uint32_t head_seq = 0;
+static uint32_t head_offset = 0;
+static bool head_closed = true;
+
+// Replay position, everything before it has been committed
+static uint32_t tail_seq = 1;
+static uint32_t tail_offset = SECTOR_HEADER_SIZE;
+
+static mqtt_outbox_stats_t stats;
+static bool overflowing = false;
+
+static uint32_t record_size(uint16_t len) {
+    return RECORD_HEADER_SIZE + ((len + 3u) & ~3u);
+}
+
+static size_t sector_address(uint32_t seq) {
+    return (size_t)(seq % sector_count) * sector_size;
+}
+
+static uint16_t record_check(const outbox_record_header_t *header, const uint8_t *data) {
+    uint16_t sum1 = 0;
+    uint16_t sum2 = 0;
+    const uint8_t fields[] = {header->len & 0xFF, header->len >> 8, header->type, header->flags};
+
+    for (size_t i = 0; i < sizeof(fields); i++) {
+        sum1 = (sum1 + fields[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    for (size_t i = 0; i < header->len; i++) {
+        sum1 = (sum1 + data[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return (uint16_t)(sum2 << 8 | sum1);
+}
+
+static bool flash_ok(esp_err_t err, const char *op) {
+    if (err != ESP_OK) {
+        stats.write_errors++;
+        ESP_LOGE(TAG, "Flash %s failed: %s", op, esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+static bool read_sector_header(uint32_t index, outbox_sector_header_t *header) {
+    return esp_partition_read(partition, (size_t)index * sector_size, header, sizeof(*header)) == ESP_OK &&
+           header->magic == SECTOR_MAGIC && header->seq % sector_count == index;
+}
+
+// Read the header at seq/offset, false if there is no plausible record
+static bool read_record_header(uint32_t seq, uint32_t offset, outbox_record_header_t *header) {
+    if (offset + RECORD_HEADER_SIZE > sector_size) {
+        return false;
+    }
+    if (esp_partition_read(partition, sector_address(seq) + offset, header, sizeof(*header)) != ESP_OK) {
+        return false;
+    }
+    return header->len != RECORD_FREE && header->len <= MQTT_OUTBOX_RECORD_MAX && offset + record_size(header->len) <= sector_size;
+}
+
+/**
+ * Step seq/offset over the next record before the write position, reading
+ * the record if requested. Sectors that end early, because they were closed
+ * or hold a torn write, are left at the first implausible header.
+ */
+static bool outbox_next(uint32_t *seq, uint32_t *offset, mqtt_outbox_record_t *record, bool *intact) {
+    for (;;) {
+        if (*seq > head_seq || (*seq == head_seq && *offset >= head_offset)) {
+            return false;
+        }
+
+        outbox_record_header_t header;
+        if (!read_record_header(*seq, *offset, &header)) {
+            (*seq)++;
+            *offset = SECTOR_HEADER_SIZE;
+            continue;
+        }
+
+        if (record != NULL) {
+            record->type = header.type;
+            record->flags = header.flags;
+            record->len = header.len;
+            bool read = esp_partition_read(partition, sector_address(*seq) + *offset + RECORD_HEADER_SIZE, record->data, header.len) ==
+                        ESP_OK;
+            *intact = read && record_check(&header, record->data) == header.check;
+        }
+        *offset += record_size(header.len);
+        return true;
+    }
+}
+
+// Whether the replay position has reached the write position
+static bool log_empty(void) {
+    return tail_seq > head_seq || (tail_seq == head_seq && tail_offset >= head_offset);
+}
+
+static void mark_consumed(uint32_t seq) {
+    const uint32_t consumed = SECTOR_CONSUMED;
+    flash_ok(esp_partition_write(partition, sector_address(seq) + offsetof(outbox_sector_header_t, consumed), &consumed, sizeof(consumed)),
+        "write");
+}
+
+// Erase the next sector for writing, dropping its records if they were not replayed
+static bool open_next_sector(void) {
+    uint32_t seq = head_seq + 1;
+
+    bool dropping = !log_empty() && tail_seq + sector_count <= seq;
+    if (dropping) {
+        uint32_t next_seq = tail_seq;
+        uint32_t offset = tail_offset;
+        uint32_t dropped = 0;
+        while (outbox_next(&next_seq, &offset, NULL, NULL) && next_seq == tail_seq) {
+            dropped++;
+        }
+        tail_seq++;
+        tail_offset = SECTOR_HEADER_SIZE;
+        stats.pending -= dropped < stats.pending ? dropped : stats.pending;
+        stats.dropped += dropped;
+        if (!overflowing) {
+            ESP_LOGW(TAG, "Log full, overwriting the oldest records");
+        }
+    }
+    overflowing = dropping;
+
+    head_closed = true;
+    if (!flash_ok(esp_partition_erase_range(partition, sector_address(seq), sector_size), "erase")) {
+        return false;
+    }
+    stats.erases++;
+
+    const outbox_sector_header_t header = {.magic = SECTOR_MAGIC, .seq = seq, .consumed = SECTOR_LIVE, .reserved = 0xFFFFFFFF};
+    if (!flash_ok(esp_partition_write(partition, sector_address(seq), &header, offsetof(outbox_sector_header_t, consumed)), "write")) {
+        return false;
+    }
+
+    bool empty = log_empty();
+    head_seq = seq;
+    head_offset = SECTOR_HEADER_SIZE;
+    head_closed = false;
+    if (empty) {
+        tail_seq = seq;
+        tail_offset = SECTOR_HEADER_SIZE;
+    }
+    return true;
+}
+
+// Find the write position in the head sector, closing it if it ends in a torn write
+static void mount_head(void) {
+    uint32_t offset = SECTOR_HEADER_SIZE;
+    outbox_record_header_t header;
+    mqtt_outbox_record_t record;
+
+    while (read_record_header(head_seq, offset, &header)) {
+        if (esp_partition_read(partition, sector_address(head_seq) + offset + RECORD_HEADER_SIZE, record.data, header.len) != ESP_OK ||
+            record_check(&header, record.data) != header.check) {
+            break;
+        }
+        offset += record_size(header.len);
+    }
+
+    head_offset = offset;
+    if (offset + RECORD_HEADER_SIZE <= sector_size &&
+        esp_partition_read(partition, sector_address(head_seq) + offset, &header, sizeof(header)) == ESP_OK && header.len != RECORD_FREE) {
+        ESP_LOGW(TAG, "Torn record in sector %lu, continuing in the next sector", (unsigned long)head_seq);
+        head_closed = true;
+    }
+}
+
+bool mqtt_outbox_init(void) {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, MQTT_OUTBOX_PARTITION);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "Partition '%s' not found, outbox disabled", MQTT_OUTBOX_PARTITION);
+        return false;
+    }
+
+    if (outbox_lock == NULL) {
+        outbox_lock = xSemaphoreCreateMutex();
+    }
+    sector_size = partition->erase_size;
+    sector_count = partition->size / sector_size;
+    memset(&stats, 0, sizeof(stats));
+    stats.sectors = sector_count;
+    stats.sector_size = sector_size;
+
+    // The head is the sector with the highest sequence number
+    bool found = false;
+    outbox_sector_header_t header;
+    for (uint32_t i = 0; i < sector_count; i++) {
+        if (read_sector_header(i, &header) && (!found || header.seq > head_seq)) {
+            head_seq = header.seq;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        head_seq = 0;
+        head_offset = 0;
+        head_closed = true;
+        tail_seq = 1;
+        tail_offset = SECTOR_HEADER_SIZE;
+        ESP_LOGI(TAG, "Empty log, %lu sectors of %lu bytes", (unsigned long)sector_count, (unsigned long)sector_size);
+        return true;
+    }
+
+    read_sector_header(head_seq % sector_count, &header);
+    head_closed = header.consumed != SECTOR_LIVE;
+    head_offset = sector_size;
+    if (!head_closed) {
+        mount_head();
+    }
+
+    // Records are pending from the oldest live sector that directly precedes the head
+    tail_seq = head_seq + 1;
+    for (uint32_t seq = head_seq; seq > 0 && head_seq - seq < sector_count; seq--) {
+        if (!read_sector_header(seq % sector_count, &header) || header.seq != seq || header.consumed != SECTOR_LIVE) {
+            break;
+        }
+        tail_seq = seq;
+    }
+    tail_offset = SECTOR_HEADER_SIZE;
+
+    uint32_t seq = tail_seq;
+    uint32_t offset = tail_offset;
+    while (outbox_next(&seq, &offset, NULL, NULL)) {
+        stats.pending++;
+    }
+
+    ESP_LOGI(TAG, "Mounted log at sector %lu, %lu records pending", (unsigned long)head_seq, (unsigned long)stats.pending);
+    return true;
+}
+
+bool mqtt_outbox_append(sensor_type_t type, uint8_t flags, const void *data, size_t len) {
+    if (partition == NULL || len > MQTT_OUTBOX_RECORD_MAX) {
+        return false;
+    }
+
+    struct {
+        outbox_record_header_t header;
+        uint8_t data[MQTT_OUTBOX_RECORD_MAX];
+    } record;
+    record.header = (outbox_record_header_t){.len = (uint16_t)len, .type = type, .flags = flags, .reserved = 0xFFFF};
+    memcpy(record.data, data, len);
+    memset(record.data + len, 0xFF, sizeof(record.data) - len);
+    record.header.check = record_check(&record.header, record.data);
+    uint32_t size = record_size(record.header.len);
+
+    xSemaphoreTake(outbox_lock, portMAX_DELAY);
+    bool ok = true;
+    if (head_closed || head_offset + size > sector_size) {
+        ok = open_next_sector();
+    }
+    if (ok) {
+        ok = flash_ok(esp_partition_write(partition, sector_address(head_seq) + head_offset, &record, size), "write");
+        if (ok) {
+            head_offset += size;
+            stats.pending++;
+            stats.appended++;
+        } else {
+            // Never write over a partially programmed record
+            head_closed = true;
+        }
+    }
+    xSemaphoreGive(outbox_lock);
+    return ok;
+}
+
+mqtt_outbox_cursor_t mqtt_outbox_begin(void) {
+    mqtt_outbox_cursor_t cursor = {.seq = 1, .offset = SECTOR_HEADER_SIZE};
+    if (partition == NULL) {
+        return cursor;
+    }
+
+    xSemaphoreTake(outbox_lock, portMAX_DELAY);
+    cursor.seq = tail_seq;
+    cursor.offset = tail_offset;
+    xSemaphoreGive(outbox_lock);
+    return cursor;
+}
+
+bool mqtt_outbox_read(mqtt_outbox_cursor_t *cursor, mqtt_outbox_record_t *record) {
+    if (partition == NULL) {
+        return false;
+    }
+
+    xSemaphoreTake(outbox_lock, portMAX_DELAY);
+    if (cursor->seq < tail_seq || (cursor->seq == tail_seq && cursor->offset < tail_offset)) {
+        cursor->seq = tail_seq;
+        cursor->offset = tail_offset;
+    }
+
+    bool intact = false;
+    bool found;
+    while ((found = outbox_next(&cursor->seq, &cursor->offset, record, &intact)) && !intact) {
+        stats.corrupt++;
+    }
+    xSemaphoreGive(outbox_lock);
+    return found;
+}
+
+void mqtt_outbox_commit(const mqtt_outbox_cursor_t *cursor) {
+    if (partition == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(outbox_lock, portMAX_DELAY);
+    for (;;) {
+        if (tail_seq > cursor->seq || (tail_seq == cursor->seq && tail_offset >= cursor->offset)) {
+            break;
+        }
+
+        uint32_t seq = tail_seq;
+        bool found = outbox_next(&tail_seq, &tail_offset, NULL, NULL);
+
+        // Sectors stepped out of are fully replayed
+        for (; seq < tail_seq; seq++) {
+            mark_consumed(seq);
+        }
+        if (!found) {
+            break;
+        }
+        // Records behind a torn write were never counted as pending
+        if (stats.pending > 0) {
+            stats.pending--;
+        }
+        stats.replayed++;
+    }
+
+    // All records replayed: close the head so that a reboot does not replay it again
+    if (log_empty()) {
+        if (head_seq > 0 && !head_closed) {
+            mark_consumed(head_seq);
+            head_closed = true;
+        }
+        tail_seq = head_seq + 1;
+        tail_offset = SECTOR_HEADER_SIZE;
+        stats.pending = 0;
+    }
+    xSemaphoreGive(outbox_lock);
+}
+
+uint32_t mqtt_outbox_pending(void) {
+    if (partition == NULL) {
+        return 0;
+    }
+
+    xSemaphoreTake(outbox_lock, portMAX_DELAY);
+    uint32_t pending = stats.pending;
+    xSemaphoreGive(outbox_lock);
+    return pending;
+}
+
+void mqtt_outbox_get_stats(mqtt_outbox_stats_t *out) {
+    if (partition == NULL) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+
+    xSemaphoreTake(outbox_lock, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGive(outbox_lock);
+}
@@ -0,0 +1,349 @@
+/**
+ * @file mqtt_payload.c
+ * @brief MQTT state payload builders
+ */
+
+#include "mqtt_payload.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// State payloads are rendered from a precompiled template instead of one
+// snprintf call: the static key fragments are copied verbatim and numbers go
+// through integer-only formatting, avoiding the float formatting path of
+// newlib's printf on every sample.
+
+typedef enum {
+    PAYLOAD_FIXED2,      // float, two decimals as "%.2f"
+    PAYLOAD_UINT8,       // uint8_t
+    PAYLOAD_UINT32,      // uint32_t
+    PAYLOAD_BOOL_STRING, // bool as "\"true\"" / "\"false\""
+} payload_field_kind_t;
+
+typedef struct {
+    const char *prefix; // Key fragment written before the value
+    uint8_t prefix_len;
+    uint8_t kind; // payload_field_kind_t
+    uint16_t offset;
+} payload_field_t;
+
+#define PAYLOAD_FIELD(prefix, type, member, kind) {prefix, sizeof(prefix) - 1, kind, offsetof(type, member)}
+
+static const payload_field_t bme690_template[] = {
+    PAYLOAD_FIELD("{\"temperature\":", bme690_data_t, temperature, PAYLOAD_FIXED2),
+    PAYLOAD_FIELD(",\"humidity\":", bme690_data_t, humidity, PAYLOAD_FIXED2),
+    PAYLOAD_FIELD(",\"pressure\":", bme690_data_t, pressure, PAYLOAD_FIXED2),
+    PAYLOAD_FIELD(",\"iaq\":", bme690_data_t, iaq, PAYLOAD_FIXED2),
+    PAYLOAD_FIELD(",\"co2\":", bme690_data_t, co2_equivalent, PAYLOAD_FIXED2),
+    PAYLOAD_FIELD(",\"voc\":", bme690_data_t, breath_voc_equivalent, PAYLOAD_FIXED2),
+    PAYLOAD_FIELD(",\"iaq_accuracy\":", bme690_data_t, iaq_accuracy, PAYLOAD_UINT8),
+    PAYLOAD_FIELD(",\"static_iaq\":", bme690_data_t, static_iaq, PAYLOAD_FIXED2),
+    PAYLOAD_FIELD(",\"gas_percentage\":", bme690_data_t, gas_percentage, PAYLOAD_FIXED2),
+    PAYLOAD_FIELD(",\"stabilization_status\":", bme690_data_t, stabilization_status, PAYLOAD_BOOL_STRING),
+    PAYLOAD_FIELD(",\"run_in_status\":", bme690_data_t, run_in_status, PAYLOAD_BOOL_STRING),
+};
+
+static const payload_field_t bmv080_template[] = {
+    PAYLOAD_FIELD("{\"pm10\":", bmv080_data_t, pm10, PAYLOAD_FIXED2),
+    PAYLOAD_FIELD(",\"pm25\":", bmv080_data_t, pm25, PAYLOAD_FIXED2),
+    PAYLOAD_FIELD(",\"pm1\":", bmv080_data_t, pm1, PAYLOAD_FIXED2),
+    PAYLOAD_FIELD(",\"obstructed\":", bmv080_data_t, is_obstructed, PAYLOAD_BOOL_STRING),
+    PAYLOAD_FIELD(",\"out_of_range\":", bmv080_data_t, is_outside_range, PAYLOAD_BOOL_STRING),
+    PAYLOAD_FIELD(",\"runtime\":", bmv080_data_t, runtime, PAYLOAD_FIXED2),
+    PAYLOAD_FIELD(",\"timestamp\":", bmv080_data_t, timestamp, PAYLOAD_UINT32),
+};
+
+static const char digit_pairs[] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+
+// Output cursor with snprintf semantics: writes stop at size - 1, len keeps counting
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+} payload_writer_t;
+
+static void writer_put(payload_writer_t *w, const char *s, size_t n) {
+    if (w->len + n < w->size) {
+        memcpy(w->buf + w->len, s, n);
+    } else if (w->len + 1 < w->size) {
+        memcpy(w->buf + w->len, s, w->size - 1 - w->len);
+    }
+    w->len += n;
+}
+
+static int writer_finish(payload_writer_t *w) {
+    if (w->size > 0) {
+        w->buf[w->len < w->size ? w->len : w->size - 1] = '\0';
+    }
+    return (int)w->len;
+}
+
+// Format an unsigned integer right-aligned ending at end, return the first digit
+static char *format_u64(char *end, uint64_t value) {
+    char *p = end;
+    while (value >= 100) {
+        unsigned pair = (unsigned)(value % 100) * 2;
+        value /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (value >= 10) {
+        *--p = digit_pairs[value * 2 + 1];
+        *--p = digit_pairs[value * 2];
+    } else {
+        *--p = (char)('0' + value);
+    }
+    return p;
+}
+
+static void writer_put_uint(payload_writer_t *w, uint32_t value) {
+    char tmp[10];
+    char *start = format_u64(tmp + sizeof(tmp), value);
+    writer_put(w, start, tmp + sizeof(tmp) - start);
+}
+
+// Same output as "%.2f" for finite values. A float times 100 is exact in a
+// double (24 + 7 bits of mantissa), so rounding it to an integer in the
+// default round-half-even mode matches printf's correctly rounded result.
+static void writer_put_fixed2(payload_writer_t *w, float value) {
+    if (!isfinite(value) || fabsf(value) >= 1e15f) {
+        char tmp[64];
+        int n = snprintf(tmp, sizeof(tmp), "%.2f", value);
+        writer_put(w, tmp, n > 0 ? (size_t)n : 0);
+        return;
+    }
+
+    uint64_t scaled = (uint64_t)nearbyint(fabs((double)value) * 100.0);
+    char tmp[24];
+    char *end = tmp + sizeof(tmp);
+    char *p = end - 3;
+    unsigned cents = (unsigned)(scaled % 100) * 2;
+    p[0] = '.';
+    p[1] = digit_pairs[cents];
+    p[2] = digit_pairs[cents + 1];
+    p = format_u64(p, scaled / 100);
+    if (signbit(value)) {
+        *--p = '-';
+    }
+    writer_put(w, p, end - p);
+}
+
+static void writer_put_template(payload_writer_t *w, const payload_field_t *fields, size_t count, const void *data) {
+    for (size_t i = 0; i < count; i++) {
+        const payload_field_t *field = &fields[i];
+        const uint8_t *value = (const uint8_t *)data + field->offset;
+
+        writer_put(w, field->prefix, field->prefix_len);
+        switch (field->kind) {
+        case PAYLOAD_FIXED2: {
+            float f;
+            memcpy(&f, value, sizeof(f));
+            writer_put_fixed2(w, f);
+            break;
+        }
+        case PAYLOAD_UINT8:
+            writer_put_uint(w, *value);
+            break;
+        case PAYLOAD_UINT32: {
+            uint32_t u;
+            memcpy(&u, value, sizeof(u));
+            writer_put_uint(w, u);
+            break;
+        }
+        case PAYLOAD_BOOL_STRING:
+            if (*(const bool *)value) {
+                writer_put(w, "\"true\"", 6);
+            } else {
+                writer_put(w, "\"false\"", 7);
+            }
+            break;
+        }
+    }
+}
+
+int mqtt_payload_bme690(char *buf, size_t size, const bme690_data_t *data, bool is_averaged) {
+    if (buf == NULL || data == NULL) {
+        return -1;
+    }
+
+    payload_writer_t w = {.buf = buf, .size = size, .len = 0};
+    writer_put_template(&w, bme690_template, sizeof(bme690_template) / sizeof(bme690_template[0]), data);
+    if (is_averaged) {
+        static const char averaged[] = ",\"data_type\":\"averaged\",\"timestamp\":";
+        writer_put(&w, averaged, sizeof(averaged) - 1);
+    } else {
+        static const char raw[] = ",\"data_type\":\"raw\",\"timestamp\":";
+        writer_put(&w, raw, sizeof(raw) - 1);
+    }
+    writer_put_uint(&w, data->timestamp);
+    writer_put(&w, "}", 1);
+    return writer_finish(&w);
+}
+
+int mqtt_payload_bmv080(char *buf, size_t size, const bmv080_data_t *data) {
+    if (buf == NULL || data == NULL) {
+        return -1;
+    }
+
+    payload_writer_t w = {.buf = buf, .size = size, .len = 0};
+    writer_put_template(&w, bmv080_template, sizeof(bmv080_template) / sizeof(bmv080_template[0]), data);
+    writer_put(&w, "}", 1);
+    return writer_finish(&w);
+}
+
+int mqtt_payload_system(char *buf, size_t size, int32_t rssi, uint32_t free_heap, uint32_t uptime, float cpu_temp) {
+    if (buf == NULL) {
+        return -1;
+    }
+
+    return snprintf(buf, size, "{\"rssi\":%ld,\"free_heap\":%lu,\"uptime\":%lu,\"cpu_temp\":%.2f}", (long)rssi, (unsigned long)free_heap,
+        (unsigned long)uptime, cpu_temp);
+}
+
+// Append formatted output at offset len, keeping snprintf length semantics once the buffer is full
+#define PAYLOAD_APPEND(buf, size, len, ...) \
+    ((len) += snprintf((size_t)(len) < (size) ? (buf) + (len) : NULL, (size_t)(len) < (size) ? (size) - (len) : 0, __VA_ARGS__))
+
+static int append_stat(char *buf, size_t size, int len, const char *key, float value) {
+    if (isnan(value) || isinf(value)) {
+        return PAYLOAD_APPEND(buf, size, len, "\"%s\":null", key);
+    }
+    return PAYLOAD_APPEND(buf, size, len, "\"%s\":%.2f", key, value);
+}
+
+int mqtt_payload_stats(char *buf, size_t size, const sensor_agg_report_t *report) {
+    if (buf == NULL || report == NULL) {
+        return -1;
+    }
+
+    static const float quantiles[SENSOR_AGG_QUANTILE_COUNT] = SENSOR_AGG_QUANTILES;
+    char window[8];
+    sensor_aggregate_window_label(report->window_ms, window, sizeof(window));
+
+    int len = 0;
+    PAYLOAD_APPEND(buf, size, len, "{\"window\":\"%s\",\"start\":%lu,\"count\":%lu", window, (unsigned long)report->start_ms,
+        (unsigned long)report->count);
+
+    for (uint8_t f = 0; f < report->field_count; f++) {
+        const sensor_agg_stats_t *stats = &report->stats[f];
+        PAYLOAD_APPEND(buf, size, len, ",\"%s\":{", report->fields[f].name);
+        // Only fields that were NaN in some samples carry their own count
+        if (stats->count != report->count) {
+            PAYLOAD_APPEND(buf, size, len, "\"count\":%lu,", (unsigned long)stats->count);
+        }
+        len = append_stat(buf, size, len, "min", stats->min);
+        PAYLOAD_APPEND(buf, size, len, ",");
+        len = append_stat(buf, size, len, "max", stats->max);
+        PAYLOAD_APPEND(buf, size, len, ",");
+        len = append_stat(buf, size, len, "mean", stats->mean);
+        PAYLOAD_APPEND(buf, size, len, ",");
+        len = append_stat(buf, size, len, "stddev", stats->stddev);
+        for (int q = 0; q < SENSOR_AGG_QUANTILE_COUNT; q++) {
+            char key[8];
+            snprintf(key, sizeof(key), "p%d", (int)lroundf(quantiles[q] * 100.0f));
+            PAYLOAD_APPEND(buf, size, len, ",");
+            len = append_stat(buf, size, len, key, stats->quantiles[q]);
+        }
+        PAYLOAD_APPEND(buf, size, len, "}");
+    }
+
+    return PAYLOAD_APPEND(buf, size, len, "}");
+}
+
+int mqtt_payload_broker_diag(char *buf, size_t size) {
+    if (buf == NULL) {
+        return -1;
+    }
+
+    static const uint32_t bounds[SENSOR_BUS_LATENCY_BUCKETS - 1] = SENSOR_BUS_LATENCY_BOUNDS_US;
+
+    int len = 0;
+    PAYLOAD_APPEND(buf, size, len, "{\"latency_bounds_us\":[");
+    for (int b = 0; b < SENSOR_BUS_LATENCY_BUCKETS - 1; b++) {
+        PAYLOAD_APPEND(buf, size, len, "%s%lu", b ? "," : "", (unsigned long)bounds[b]);
+    }
+
+    PAYLOAD_APPEND(buf, size, len, "],\"types\":[");
+    unsigned type_count = sensor_broker_type_count();
+    for (unsigned t = 0; t < type_count; t++) {
+        sensor_type_stats_t stats;
+        if (!sensor_broker_get_type_stats((sensor_type_t)t, &stats)) {
+            continue;
+        }
+        PAYLOAD_APPEND(buf, size, len, "%s{\"name\":\"%s\",\"published\":%lu,\"dropped\":%lu}", t ? "," : "", stats.name,
+            (unsigned long)stats.publish_count, (unsigned long)stats.drop_count);
+    }
+
+    PAYLOAD_APPEND(buf, size, len, "],\"subscribers\":[");
+    unsigned subscriber_count = sensor_broker_subscriber_count();
+    for (unsigned i = 0; i < subscriber_count; i++) {
+        sensor_subscriber_stats_t stats;
+        if (!sensor_broker_get_subscriber_stats(i, &stats)) {
+            continue;
+        }
+        const sensor_type_desc_t *type = sensor_broker_get_type(stats.type);
+        PAYLOAD_APPEND(buf, size, len,
+            "%s{\"name\":\"%s\",\"type\":\"%s\",\"mode\":\"%s\",\"calls\":%lu,\"dropped\":%lu,\"queued\":%lu,"
+            "\"callback_avg_us\":%lu,\"callback_max_us\":%lu,\"latency_max_us\":%lu,\"latency\":[",
+            i ? "," : "", stats.name ? stats.name : "?", type ? type->name : "?", stats.synchronous ? "sync" : "queued",
+            (unsigned long)stats.invocations, (unsigned long)stats.drop_count, (unsigned long)stats.queued,
+            (unsigned long)stats.callback_avg_us, (unsigned long)stats.callback_max_us, (unsigned long)stats.latency_max_us);
+        for (int b = 0; b < SENSOR_BUS_LATENCY_BUCKETS; b++) {
+            PAYLOAD_APPEND(buf, size, len, "%s%lu", b ? "," : "", (unsigned long)stats.latency_histogram[b]);
+        }
+        PAYLOAD_APPEND(buf, size, len, "]}");
+    }
+
+    return PAYLOAD_APPEND(buf, size, len, "]}");
+}
+
+int mqtt_payload_deadband(char *buf, size_t size, const char *const names[], const mqtt_deadband_t *const filters[], size_t count) {
+    if (buf == NULL || names == NULL || filters == NULL) {
+        return -1;
+    }
+
+    int len = 0;
+    PAYLOAD_APPEND(buf, size, len, "{");
+    for (size_t i = 0; i < count; i++) {
+        const mqtt_deadband_t *filter = filters[i];
+        uint32_t suppressed = filter->samples - filter->published;
+        PAYLOAD_APPEND(buf, size, len,
+            "%s\"%s\":{\"samples\":%lu,\"published\":%lu,\"suppressed\":%lu,\"heartbeats\":%lu,\"suppression\":%.3f,\"changes\":{",
+            i ? "," : "", names[i], (unsigned long)filter->samples, (unsigned long)filter->published, (unsigned long)suppressed,
+            (unsigned long)filter->heartbeats, filter->samples ? (double)suppressed / filter->samples : 0.0);
+        for (uint8_t f = 0; f < filter->field_count; f++) {
+            PAYLOAD_APPEND(buf, size, len, "%s\"%s\":%lu", f ? "," : "", filter->fields[f].name, (unsigned long)filter->field_changes[f]);
+        }
+        PAYLOAD_APPEND(buf, size, len, "}}");
+    }
+
+    return PAYLOAD_APPEND(buf, size, len, "}");
+}
+
+int mqtt_payload_qos(char *buf, size_t size, const mqtt_qos_t *qos) {
+    if (buf == NULL || qos == NULL) {
+        return -1;
+    }
+
+    int len = 0;
+    PAYLOAD_APPEND(buf, size, len, "{\"outbox\":%lu,\"outbox_peak\":%lu,\"congested\":%s,\"congestions\":%lu,\"classes\":{",
+        (unsigned long)qos->outbox_bytes, (unsigned long)qos->outbox_peak, qos->congested ? "true" : "false",
+        (unsigned long)qos->congestions);
+    for (int i = 0; i < MQTT_QOS_CLASS_COUNT; i++) {
+        PAYLOAD_APPEND(buf, size, len, "%s\"%s\":{\"policy\":\"%s\",\"qos0\":%lu,\"qos1\":%lu,\"failed\":%lu}", i ? "," : "",
+            mqtt_qos_class_name((mqtt_qos_class_t)i), mqtt_qos_policy_name(qos->policy[i]), (unsigned long)qos->queued[i][0],
+            (unsigned long)qos->queued[i][1], (unsigned long)qos->failed[i]);
+    }
+
+    return PAYLOAD_APPEND(buf, size, len, "}}");
+}
@@ -0,0 +1,96 @@
+/**
+ * @file mqtt_qos.c
+ * @brief QoS policy per message class with outbox depth tracking
+ */
+
+#include "mqtt_qos.h"
+
+#include <string.h>
+
+static const char *const class_names[MQTT_QOS_CLASS_COUNT] = {
+    [MQTT_QOS_CLASS_STATE] = "state",
+    [MQTT_QOS_CLASS_BATCH] = "batch",
+    [MQTT_QOS_CLASS_STATS] = "stats",
+    [MQTT_QOS_CLASS_SYSTEM] = "system",
+    [MQTT_QOS_CLASS_BACKLOG] = "backlog",
+    [MQTT_QOS_CLASS_CONTROL] = "control",
+    [MQTT_QOS_CLASS_DIAG] = "diag",
+};
+
+static const char *const policy_names[] = {
+    [0] = "0",
+    [1] = "1",
+    [MQTT_QOS_ADAPTIVE] = "auto",
+};
+
+void mqtt_qos_init(mqtt_qos_t *qos, uint32_t high_water, uint32_t low_water) {
+    memset(qos, 0, sizeof(*qos));
+    for (int i = 0; i < MQTT_QOS_CLASS_COUNT; i++) {
+        qos->policy[i] = 1;
+    }
+    qos->policy[MQTT_QOS_CLASS_DIAG] = 0;
+    qos->high_water = high_water;
+    qos->low_water = low_water < high_water ? low_water : high_water;
+}
+
+bool mqtt_qos_set_policy(mqtt_qos_t *qos, mqtt_qos_class_t cls, uint8_t policy) {
+    if ((unsigned)cls >= MQTT_QOS_CLASS_CONFIGURABLE || policy > MQTT_QOS_ADAPTIVE) {
+        return false;
+    }
+    qos->policy[cls] = policy;
+    return true;
+}
+
+int mqtt_qos_select(mqtt_qos_t *qos, mqtt_qos_class_t cls, uint32_t outbox_bytes) {
+    qos->outbox_bytes = outbox_bytes;
+    if (outbox_bytes > qos->outbox_peak) {
+        qos->outbox_peak = outbox_bytes;
+    }
+
+    if (!qos->congested && outbox_bytes >= qos->high_water) {
+        qos->congested = true;
+        qos->congestions++;
+    } else if (qos->congested && outbox_bytes < qos->low_water) {
+        qos->congested = false;
+    }
+
+    if ((unsigned)cls >= MQTT_QOS_CLASS_COUNT) {
+        return 1;
+    }
+    if (qos->policy[cls] == MQTT_QOS_ADAPTIVE) {
+        return qos->congested ? 0 : 1;
+    }
+    return qos->policy[cls];
+}
+
+void mqtt_qos_record(mqtt_qos_t *qos, mqtt_qos_class_t cls, int level, bool queued) {
+    if ((unsigned)cls >= MQTT_QOS_CLASS_COUNT) {
+        return;
+    }
+    if (queued) {
+        qos->queued[cls][level > 0 ? 1 : 0]++;
+    } else {
+        qos->failed[cls]++;
+    }
+}
+
+const char *mqtt_qos_class_name(mqtt_qos_class_t cls) {
+    return (unsigned)cls < MQTT_QOS_CLASS_COUNT ? class_names[cls] : "unknown";
+}
+
+const char *mqtt_qos_policy_name(uint8_t policy) {
+    return policy <= MQTT_QOS_ADAPTIVE ? policy_names[policy] : policy_names[1];
+}
+
+bool mqtt_qos_policy_parse(const char *name, uint8_t *policy) {
+    if (name == NULL) {
+        return false;
+    }
+    for (uint8_t i = 0; i <= MQTT_QOS_ADAPTIVE; i++) {
+        if (strcmp(name, policy_names[i]) == 0) {
+            *policy = i;
+            return true;
+        }
+    }
+    return false;
+}
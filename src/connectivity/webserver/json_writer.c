@@ -0,0 +1,227 @@
+/**
+ * @file json_writer.c
+ * @brief Streaming JSON writer with a fixed output buffer
+ */
+
+#include "json_writer.h"
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void json_writer_init(json_writer_t *writer, char *buf, size_t size, json_writer_flush_t flush, void *ctx) {
+    *writer = (json_writer_t){
+        .buf = buf,
+        .size = size,
+        .flush = flush,
+        .ctx = ctx,
+        .failed = size == 0,
+    };
+}
+
+static void flush_buffer(json_writer_t *writer) {
+    if (writer->len > 0 && !writer->failed) {
+        writer->failed = !writer->flush(writer->buf, writer->len, writer->ctx);
+    }
+    writer->len = 0;
+}
+
+static void put(json_writer_t *writer, const char *data, size_t len) {
+    while (len > 0 && !writer->failed) {
+        if (writer->len == writer->size) {
+            // Without a flush callback the document must fit the buffer
+            if (writer->flush == NULL) {
+                writer->failed = true;
+                break;
+            }
+            flush_buffer(writer);
+            continue;
+        }
+        size_t n = writer->size - writer->len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(writer->buf + writer->len, data, n);
+        writer->len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+static void put_char(json_writer_t *writer, char c) {
+    put(writer, &c, 1);
+}
+
+static void put_string(json_writer_t *writer, const char *str) {
+    static const char hex[] = "0123456789abcdef";
+
+    put_char(writer, '"');
+    const char *run = str;
+    for (const char *p = str; *p != '\0'; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        // Copy the plain run before the character, then its escape
+        put(writer, run, p - run);
+        run = p + 1;
+        char escape[6] = {'\\', 0};
+        size_t escape_len = 2;
+        switch (c) {
+        case '"':
+        case '\\':
+            escape[1] = (char)c;
+            break;
+        case '\b':
+            escape[1] = 'b';
+            break;
+        case '\f':
+            escape[1] = 'f';
+            break;
+        case '\n':
+            escape[1] = 'n';
+            break;
+        case '\r':
+            escape[1] = 'r';
+            break;
+        case '\t':
+            escape[1] = 't';
+            break;
+        default:
+            memcpy(escape + 1, "u00", 3);
+            escape[4] = hex[c >> 4];
+            escape[5] = hex[c & 0xF];
+            escape_len = 6;
+            break;
+        }
+        put(writer, escape, escape_len);
+    }
+    put(writer, run, strlen(run));
+    put_char(writer, '"');
+}
+
+// Separator and key in front of a value
+static void begin_value(json_writer_t *writer, const char *key) {
+    uint32_t bit = 1u << writer->depth;
+    if (writer->nonempty & bit) {
+        put_char(writer, ',');
+    }
+    writer->nonempty |= bit;
+
+    if (key != NULL) {
+        put_string(writer, key);
+        put_char(writer, ':');
+    }
+}
+
+static void open_container(json_writer_t *writer, const char *key, char bracket) {
+    begin_value(writer, key);
+    if (writer->depth + 1 >= JSON_WRITER_MAX_DEPTH) {
+        writer->failed = true;
+        return;
+    }
+    writer->depth++;
+    writer->nonempty &= ~(1u << writer->depth);
+    put_char(writer, bracket);
+}
+
+static void close_container(json_writer_t *writer, char bracket) {
+    if (writer->depth == 0) {
+        writer->failed = true;
+        return;
+    }
+    writer->depth--;
+    put_char(writer, bracket);
+}
+
+void json_writer_object_begin(json_writer_t *writer, const char *key) {
+    open_container(writer, key, '{');
+}
+
+void json_writer_object_end(json_writer_t *writer) {
+    close_container(writer, '}');
+}
+
+void json_writer_array_begin(json_writer_t *writer, const char *key) {
+    open_container(writer, key, '[');
+}
+
+void json_writer_array_end(json_writer_t *writer) {
+    close_container(writer, ']');
+}
+
+void json_writer_string(json_writer_t *writer, const char *key, const char *value) {
+    begin_value(writer, key);
+    if (value == NULL) {
+        put(writer, "null", 4);
+        return;
+    }
+    put_string(writer, value);
+}
+
+// Equality within the precision of the larger value, as cJSON compares
+static bool double_equal(double a, double b) {
+    double max = fabs(a) > fabs(b) ? fabs(a) : fabs(b);
+    return fabs(a - b) <= max * DBL_EPSILON;
+}
+
+void json_writer_number(json_writer_t *writer, const char *key, double value) {
+    begin_value(writer, key);
+
+    // Same output as cJSON: integers as such, otherwise 15 significant digits
+    // unless those do not read back as the value, then 17
+    char number[32];
+    int len;
+    if (isnan(value) || isinf(value)) {
+        len = snprintf(number, sizeof(number), "null");
+    } else if (value >= INT_MIN && value <= INT_MAX && value == (double)(int)value) {
+        len = snprintf(number, sizeof(number), "%d", (int)value);
+    } else {
+        len = snprintf(number, sizeof(number), "%1.15g", value);
+        if (!double_equal(strtod(number, NULL), value)) {
+            len = snprintf(number, sizeof(number), "%1.17g", value);
+        }
+    }
+    put(writer, number, (size_t)len);
+}
+
+void json_writer_fixed(json_writer_t *writer, const char *key, double value, int decimals) {
+    if (isnan(value) || isinf(value) || fabs(value) >= 1e15) {
+        json_writer_number(writer, key, value);
+        return;
+    }
+
+    begin_value(writer, key);
+    char number[32];
+    int len = snprintf(number, sizeof(number), "%.*f", decimals, value);
+    if (len > 0 && len < (int)sizeof(number)) {
+        put(writer, number, (size_t)len);
+    } else {
+        writer->failed = true;
+    }
+}
+
+void json_writer_bool(json_writer_t *writer, const char *key, bool value) {
+    begin_value(writer, key);
+    if (value) {
+        put(writer, "true", 4);
+    } else {
+        put(writer, "false", 5);
+    }
+}
+
+void json_writer_null(json_writer_t *writer, const char *key) {
+    begin_value(writer, key);
+    put(writer, "null", 4);
+}
+
+bool json_writer_finish(json_writer_t *writer) {
+    if (writer->flush != NULL) {
+        flush_buffer(writer);
+    }
+    return !writer->failed && writer->depth == 0 && writer->nonempty != 0;
+}
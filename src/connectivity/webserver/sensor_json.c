@@ -0,0 +1,85 @@
+/**
+ * @file sensor_json.c
+ * @brief JSON serializers for the /data and /history endpoints
+ */
+
+#include "sensor_json.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+void sensor_json_write_data(json_writer_t *writer, const char *device_id, int64_t timestamp_ms, const bme690_data_t *bme690,
+    const bmv080_data_t *bmv080) {
+    json_writer_object_begin(writer, NULL);
+    json_writer_number(writer, "timestamp", (double)timestamp_ms);
+    json_writer_string(writer, "device_id", device_id);
+
+    // Add BME690 data
+    if (bme690 != NULL) {
+        json_writer_object_begin(writer, "bme690");
+        json_writer_number(writer, "temperature", bme690->temperature);
+        json_writer_number(writer, "humidity", bme690->humidity);
+        json_writer_number(writer, "pressure", bme690->pressure);
+        json_writer_number(writer, "iaq", bme690->iaq);
+        json_writer_number(writer, "iaq_accuracy", bme690->iaq_accuracy);
+        json_writer_number(writer, "co2_equivalent", bme690->co2_equivalent);
+        json_writer_number(writer, "breath_voc_equivalent", bme690->breath_voc_equivalent);
+        json_writer_number(writer, "static_iaq", bme690->static_iaq);
+        json_writer_number(writer, "gas_percentage", bme690->gas_percentage);
+        json_writer_bool(writer, "stabilization_status", bme690->stabilization_status);
+        json_writer_bool(writer, "run_in_status", bme690->run_in_status);
+        json_writer_number(writer, "data_timestamp", bme690->timestamp);
+        json_writer_object_end(writer);
+    } else {
+        json_writer_null(writer, "bme690");
+    }
+
+    // Add BMV080 data
+    if (bmv080 != NULL) {
+        json_writer_object_begin(writer, "bmv080");
+        json_writer_number(writer, "pm1", bmv080->pm1);
+        json_writer_number(writer, "pm25", bmv080->pm25);
+        json_writer_number(writer, "pm10", bmv080->pm10);
+        json_writer_bool(writer, "is_obstructed", bmv080->is_obstructed);
+        json_writer_bool(writer, "is_outside_range", bmv080->is_outside_range);
+        json_writer_number(writer, "runtime", bmv080->runtime);
+        json_writer_number(writer, "data_timestamp", bmv080->timestamp);
+        json_writer_object_end(writer);
+    } else {
+        json_writer_null(writer, "bmv080");
+    }
+
+    // Add data availability status
+    json_writer_object_begin(writer, "status");
+    json_writer_bool(writer, "bme690_available", bme690 != NULL);
+    json_writer_bool(writer, "bmv080_available", bmv080 != NULL);
+    json_writer_object_end(writer);
+
+    json_writer_object_end(writer);
+}
+
+// Decimals that show a value in steps of the resolution
+static int resolution_decimals(float resolution) {
+    int decimals = 0;
+    float step = resolution;
+    while (decimals < 6 && step < 0.999f) {
+        step *= 10.0f;
+        decimals++;
+    }
+    return decimals;
+}
+
+void sensor_json_write_history_point(json_writer_t *writer, const sensor_history_t *history, const sensor_history_point_t *point) {
+    json_writer_object_begin(writer, NULL);
+    json_writer_number(writer, "t", point->start_ms);
+    json_writer_number(writer, "n", point->count);
+    for (uint8_t f = 0; f < history->field_count; f++) {
+        int decimals = resolution_decimals(history->fields[f].resolution);
+        json_writer_array_begin(writer, history->fields[f].name);
+        json_writer_fixed(writer, NULL, point->min[f], decimals);
+        json_writer_fixed(writer, NULL, point->mean[f], decimals);
+        json_writer_fixed(writer, NULL, point->max[f], decimals);
+        json_writer_array_end(writer);
+    }
+    json_writer_object_end(writer);
+}
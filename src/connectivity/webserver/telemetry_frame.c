@@ -0,0 +1,143 @@
+/**
+ * @file telemetry_frame.c
+ * @brief Binary sample frames of the /ws telemetry stream
+ */
+
+#include "telemetry_frame.h"
+
+#include <string.h>
+
+static void put_u16(uint8_t *p, uint16_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static void put_f32(uint8_t *p, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_u32(p, bits);
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static float get_f32(const uint8_t *p) {
+    uint32_t bits = get_u32(p);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void put_header(uint8_t *buf, telemetry_frame_type_t type, uint16_t flags, uint32_t sequence, uint32_t timestamp) {
+    buf[0] = TELEMETRY_FRAME_VERSION;
+    buf[1] = (uint8_t)type;
+    put_u16(&buf[2], flags);
+    put_u32(&buf[4], sequence);
+    put_u32(&buf[8], timestamp);
+}
+
+// Flags of a frame of the given type and size, false if it is not one
+static bool get_header(const uint8_t *buf, size_t len, telemetry_frame_type_t type, size_t size, uint16_t *flags, uint32_t *sequence) {
+    if (buf == NULL || len != size || buf[0] != TELEMETRY_FRAME_VERSION || buf[1] != type) {
+        return false;
+    }
+    *flags = get_u16(&buf[2]);
+    if (sequence != NULL) {
+        *sequence = get_u32(&buf[4]);
+    }
+    return true;
+}
+
+size_t telemetry_frame_bme690_raw(uint8_t *buf, size_t size, uint32_t sequence, const bme690_raw_data_t *data) {
+    if (buf == NULL || data == NULL || size < TELEMETRY_FRAME_BME690_SIZE) {
+        return 0;
+    }
+
+    uint16_t flags = (data->stabilization_status ? TELEMETRY_FLAG_BME690_STABILIZED : 0) |
+                     (data->run_in_status ? TELEMETRY_FLAG_BME690_RUN_IN : 0);
+    put_header(buf, TELEMETRY_FRAME_BME690_RAW, flags, sequence, data->timestamp);
+    put_f32(&buf[12], data->raw_temperature);
+    put_f32(&buf[16], data->raw_humidity);
+    put_f32(&buf[20], data->raw_pressure);
+    put_f32(&buf[24], data->raw_gas);
+    put_f32(&buf[28], data->temperature);
+    put_f32(&buf[32], data->humidity);
+    put_f32(&buf[36], data->iaq);
+    put_f32(&buf[40], data->static_iaq);
+    put_f32(&buf[44], data->co2_equivalent);
+    put_f32(&buf[48], data->breath_voc_equivalent);
+    put_f32(&buf[52], data->gas_percentage);
+    buf[56] = data->iaq_accuracy;
+    buf[57] = data->gas_index;
+    put_u16(&buf[58], 0);
+    return TELEMETRY_FRAME_BME690_SIZE;
+}
+
+size_t telemetry_frame_bmv080(uint8_t *buf, size_t size, uint32_t sequence, const bmv080_data_t *data) {
+    if (buf == NULL || data == NULL || size < TELEMETRY_FRAME_BMV080_SIZE) {
+        return 0;
+    }
+
+    uint16_t flags = (data->is_obstructed ? TELEMETRY_FLAG_BMV080_OBSTRUCTED : 0) |
+                     (data->is_outside_range ? TELEMETRY_FLAG_BMV080_OUT_OF_RANGE : 0);
+    put_header(buf, TELEMETRY_FRAME_BMV080, flags, sequence, data->timestamp);
+    put_f32(&buf[12], data->pm10);
+    put_f32(&buf[16], data->pm25);
+    put_f32(&buf[20], data->pm1);
+    put_f32(&buf[24], data->runtime);
+    return TELEMETRY_FRAME_BMV080_SIZE;
+}
+
+bool telemetry_frame_decode_bme690_raw(const uint8_t *buf, size_t len, uint32_t *sequence, bme690_raw_data_t *data) {
+    uint16_t flags;
+    if (data == NULL || !get_header(buf, len, TELEMETRY_FRAME_BME690_RAW, TELEMETRY_FRAME_BME690_SIZE, &flags, sequence)) {
+        return false;
+    }
+
+    memset(data, 0, sizeof(*data));
+    data->timestamp = get_u32(&buf[8]);
+    data->stabilization_status = (flags & TELEMETRY_FLAG_BME690_STABILIZED) != 0;
+    data->run_in_status = (flags & TELEMETRY_FLAG_BME690_RUN_IN) != 0;
+    data->raw_temperature = get_f32(&buf[12]);
+    data->raw_humidity = get_f32(&buf[16]);
+    data->raw_pressure = get_f32(&buf[20]);
+    data->raw_gas = get_f32(&buf[24]);
+    data->temperature = get_f32(&buf[28]);
+    data->humidity = get_f32(&buf[32]);
+    data->iaq = get_f32(&buf[36]);
+    data->static_iaq = get_f32(&buf[40]);
+    data->co2_equivalent = get_f32(&buf[44]);
+    data->breath_voc_equivalent = get_f32(&buf[48]);
+    data->gas_percentage = get_f32(&buf[52]);
+    data->iaq_accuracy = buf[56];
+    data->gas_index = buf[57];
+    return true;
+}
+
+bool telemetry_frame_decode_bmv080(const uint8_t *buf, size_t len, uint32_t *sequence, bmv080_data_t *data) {
+    uint16_t flags;
+    if (data == NULL || !get_header(buf, len, TELEMETRY_FRAME_BMV080, TELEMETRY_FRAME_BMV080_SIZE, &flags, sequence)) {
+        return false;
+    }
+
+    memset(data, 0, sizeof(*data));
+    data->timestamp = get_u32(&buf[8]);
+    data->is_obstructed = (flags & TELEMETRY_FLAG_BMV080_OBSTRUCTED) != 0;
+    data->is_outside_range = (flags & TELEMETRY_FLAG_BMV080_OUT_OF_RANGE) != 0;
+    data->pm10 = get_f32(&buf[12]);
+    data->pm25 = get_f32(&buf[16]);
+    data->pm1 = get_f32(&buf[20]);
+    data->runtime = get_f32(&buf[24]);
+    return true;
+}
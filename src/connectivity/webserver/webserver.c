@@ -6,6 +6,7 @@
 #include "webserver.h"
 
 #include <string.h>
+#include <sys/select.h>
 #include "esp_err.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
@@ -19,6 +20,8 @@ static bool server_running = false;
 
 // Forward declarations for handler registration functions
 extern esp_err_t webserver_register_sensor_handlers(httpd_handle_t server);
+extern esp_err_t webserver_register_history_handlers(httpd_handle_t server);
+extern esp_err_t webserver_register_ws_handlers(httpd_handle_t server);
 extern esp_err_t webserver_register_config_handlers(httpd_handle_t server);
 
 esp_err_t webserver_start(void) {
@@ -34,9 +37,11 @@ esp_err_t webserver_start(void) {
     // Increase limits to handle more connections and headers
     config.max_open_sockets = 7;  // Default is 7, max allowed
     config.max_resp_headers = 16; // Increase from default 8
+    config.max_uri_handlers = 12; // Default is 8
     config.recv_wait_timeout = 10;
     config.send_wait_timeout = 10;
     config.server_port = 80; // Use port 80
+    config.stack_size = 6144; // The configuration form is parsed in a stack buffer
 
     ESP_LOGI(TAG, "Starting unified web server on port %d", config.server_port);
 
@@ -49,6 +54,22 @@ esp_err_t webserver_start(void) {
             return ESP_FAIL;
         }
 
+        // Register sensor history handler
+        ret = webserver_register_history_handlers(server);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to register history handler");
+            httpd_stop(server);
+            return ESP_FAIL;
+        }
+
+        // Register telemetry WebSocket handler
+        ret = webserver_register_ws_handlers(server);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to register telemetry handler");
+            httpd_stop(server);
+            return ESP_FAIL;
+        }
+
         // Register configuration handlers
         ret = webserver_register_config_handlers(server);
         if (ret != ESP_OK) {
@@ -62,6 +83,9 @@ esp_err_t webserver_start(void) {
         ESP_LOGI(TAG, "Available endpoints:");
         ESP_LOGI(TAG, "  GET  / - Sensor dashboard");
         ESP_LOGI(TAG, "  GET  /data - Sensor data (JSON)");
+        ESP_LOGI(TAG, "  GET  /events - Live sensor data (Server-Sent Events)");
+        ESP_LOGI(TAG, "  GET  /history - Sensor history (JSON)");
+        ESP_LOGI(TAG, "  GET  /ws - Full rate sensor telemetry (binary WebSocket)");
         ESP_LOGI(TAG, "  GET  /config - Configuration page");
         ESP_LOGI(TAG, "  GET  /config/get - Current config (JSON)");
         ESP_LOGI(TAG, "  POST /config/save - Save configuration");
@@ -91,4 +115,16 @@ esp_err_t webserver_stop(void) {
 
 bool webserver_is_running(void) {
     return server_running;
-}
\ No newline at end of file
+}
+
+bool webserver_json_flush(const char *buf, size_t len, void *req) {
+    return httpd_resp_send_chunk(req, buf, len) == ESP_OK;
+}
+
+bool webserver_socket_writable(int fd) {
+    fd_set writable;
+    FD_ZERO(&writable);
+    FD_SET(fd, &writable);
+    struct timeval timeout = {0};
+    return select(fd + 1, NULL, &writable, NULL, &timeout) > 0;
+}
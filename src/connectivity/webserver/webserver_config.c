@@ -3,16 +3,19 @@
  * @brief Configuration web server handlers
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include "esp_err.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
 #include "esp_system.h"
-#include "cJSON.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
 #include "config.h"
+#include "json_writer.h"
+#include "mqtt_deadband.h"
+#include "mqtt_qos.h"
 #include "webserver.h"
 
 static const char *TAG = "web_config";
@@ -26,6 +29,17 @@ extern const uint8_t config_html_gz_end[] asm("_binary_config_html_gz_end");
 extern const uint8_t success_html_gz_start[] asm("_binary_success_html_gz_start");
 extern const uint8_t success_html_gz_end[] asm("_binary_success_html_gz_end");
 
+// Parse a number field of the form, clearing *valid unless it is a number from 0 to max as mqtt_command.c requires
+static uint32_t form_uint(const char *value, uint32_t max, bool *valid) {
+    char *end;
+    unsigned long number = strtoul(value, &end, 10);
+    if (value[0] < '0' || value[0] > '9' || *end != '\0' || number > max) {
+        *valid = false;
+        return 0;
+    }
+    return (uint32_t)number;
+}
+
 static esp_err_t config_get_handler(httpd_req_t *req) {
     ESP_LOGI(TAG, "Serving configuration page (compressed)");
     const size_t len = config_html_gz_end - config_html_gz_start;
@@ -37,10 +51,10 @@ static esp_err_t config_get_handler(httpd_req_t *req) {
 }
 
 static esp_err_t save_post_handler(httpd_req_t *req) {
-    char buf[512];
+    char buf[1536];
     int ret, remaining = req->content_len;
 
-    if (remaining > sizeof(buf)) {
+    if (remaining >= sizeof(buf)) {
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Content too long");
         return ESP_FAIL;
     }
@@ -57,6 +71,8 @@ static esp_err_t save_post_handler(httpd_req_t *req) {
     // Parse form data (URL encoded)
     polverine_wifi_config_t wifi_cfg = {0};
     polverine_mqtt_config_t mqtt_cfg = {0};
+    bool qos_valid = true;
+    bool numbers_valid = true;
 
     char *token = strtok(buf, "&");
     while (token != NULL) {
@@ -94,11 +110,62 @@ static esp_err_t save_post_handler(httpd_req_t *req) {
                 strncpy(mqtt_cfg.username, value, sizeof(mqtt_cfg.username) - 1);
             } else if (strcmp(key, "mqtt_pass") == 0) {
                 strncpy(mqtt_cfg.password, value, sizeof(mqtt_cfg.password) - 1);
+            } else if (strcmp(key, "mqtt_format") == 0) {
+                if (!config_payload_format_parse(value, &mqtt_cfg.payload_format)) {
+                    ESP_LOGW(TAG, "Unknown payload format '%s', using JSON", value);
+                }
+            } else if (strcmp(key, "bme690_batch") == 0) {
+                mqtt_cfg.batch_bme690.max_samples = (uint8_t)form_uint(value, UINT8_MAX, &numbers_valid);
+            } else if (strcmp(key, "bme690_batch_age") == 0) {
+                mqtt_cfg.batch_bme690.max_age_s = (uint16_t)form_uint(value, UINT16_MAX, &numbers_valid);
+            } else if (strcmp(key, "bmv080_batch") == 0) {
+                mqtt_cfg.batch_bmv080.max_samples = (uint8_t)form_uint(value, UINT8_MAX, &numbers_valid);
+            } else if (strcmp(key, "bmv080_batch_age") == 0) {
+                mqtt_cfg.batch_bmv080.max_age_s = (uint16_t)form_uint(value, UINT16_MAX, &numbers_valid);
+            } else if (strcmp(key, "bme690_deadband") == 0) {
+                strncpy(mqtt_cfg.deadband_bme690.spec, value, sizeof(mqtt_cfg.deadband_bme690.spec) - 1);
+            } else if (strcmp(key, "bme690_heartbeat") == 0) {
+                mqtt_cfg.deadband_bme690.heartbeat_s = (uint16_t)form_uint(value, UINT16_MAX, &numbers_valid);
+            } else if (strcmp(key, "bmv080_deadband") == 0) {
+                strncpy(mqtt_cfg.deadband_bmv080.spec, value, sizeof(mqtt_cfg.deadband_bmv080.spec) - 1);
+            } else if (strcmp(key, "bmv080_heartbeat") == 0) {
+                mqtt_cfg.deadband_bmv080.heartbeat_s = (uint16_t)form_uint(value, UINT16_MAX, &numbers_valid);
+            } else if (strcmp(key, "mqtt_protocol") == 0) {
+                mqtt_cfg.mqtt5 = strcmp(value, "3.1.1") != 0;
+            } else if (strcmp(key, "mqtt_expiry") == 0) {
+                mqtt_cfg.message_expiry_s = (uint16_t)form_uint(value, UINT16_MAX, &numbers_valid);
+            } else if (strcmp(key, "qos_state") == 0) {
+                qos_valid = mqtt_qos_policy_parse(value, &mqtt_cfg.qos.state) && qos_valid;
+            } else if (strcmp(key, "qos_batch") == 0) {
+                qos_valid = mqtt_qos_policy_parse(value, &mqtt_cfg.qos.batch) && qos_valid;
+            } else if (strcmp(key, "qos_stats") == 0) {
+                qos_valid = mqtt_qos_policy_parse(value, &mqtt_cfg.qos.stats) && qos_valid;
+            } else if (strcmp(key, "qos_system") == 0) {
+                qos_valid = mqtt_qos_policy_parse(value, &mqtt_cfg.qos.system) && qos_valid;
             }
         }
         token = strtok(NULL, "&");
     }
 
+    // Reject thresholds naming unknown fields rather than silently publishing every sample
+    mqtt_deadband_t filter;
+    mqtt_deadband_init(&filter, mqtt_deadband_bme690_fields, mqtt_deadband_bme690_field_count, 0);
+    bool deadband_valid = mqtt_deadband_parse(&filter, mqtt_cfg.deadband_bme690.spec);
+    mqtt_deadband_init(&filter, mqtt_deadband_bmv080_fields, mqtt_deadband_bmv080_field_count, 0);
+    deadband_valid = mqtt_deadband_parse(&filter, mqtt_cfg.deadband_bmv080.spec) && deadband_valid;
+    if (!deadband_valid) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid change filter thresholds");
+        return ESP_FAIL;
+    }
+    if (!qos_valid) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid QoS policy");
+        return ESP_FAIL;
+    }
+    if (!numbers_valid) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Batch sizes must be 0 to 255, ages, heartbeats and expiry 0 to 65535");
+        return ESP_FAIL;
+    }
+
     // Save configuration
     bool wifi_saved = config_save_wifi(&wifi_cfg);
     bool mqtt_saved = config_save_mqtt(&mqtt_cfg);
@@ -123,13 +190,6 @@ static esp_err_t save_post_handler(httpd_req_t *req) {
 static esp_err_t current_config_get_handler(httpd_req_t *req) {
     ESP_LOGI(TAG, "Serving current configuration JSON");
 
-    // Create JSON object
-    cJSON *json = cJSON_CreateObject();
-    if (json == NULL) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create JSON object");
-        return ESP_FAIL;
-    }
-
     // Load current WiFi configuration
     polverine_wifi_config_t wifi_cfg = {0};
     bool wifi_loaded = config_load_wifi(&wifi_cfg);
@@ -138,55 +198,79 @@ static esp_err_t current_config_get_handler(httpd_req_t *req) {
     polverine_mqtt_config_t mqtt_cfg = {0};
     bool mqtt_loaded = config_load_mqtt(&mqtt_cfg, shortId);
 
+    // Load sensor settings, which the command topic changes at runtime
+    polverine_sensor_config_t sensor_cfg;
+    config_load_sensor(&sensor_cfg);
+
+    // Stream the document in chunks from the stack, without heap allocations
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    char chunk[WEBSERVER_JSON_CHUNK];
+    json_writer_t json;
+    json_writer_init(&json, chunk, sizeof(chunk), webserver_json_flush, req);
+    json_writer_object_begin(&json, NULL);
+
     // Add WiFi configuration
-    cJSON *wifi_json = cJSON_CreateObject();
-    if (wifi_loaded) {
-        cJSON_AddStringToObject(wifi_json, "ssid", wifi_cfg.ssid);
-        // Don't send password for security reasons
-        cJSON_AddStringToObject(wifi_json, "password", "");
-    } else {
-        cJSON_AddStringToObject(wifi_json, "ssid", "");
-        cJSON_AddStringToObject(wifi_json, "password", "");
-    }
-    cJSON_AddItemToObject(json, "wifi", wifi_json);
+    json_writer_object_begin(&json, "wifi");
+    json_writer_string(&json, "ssid", wifi_loaded ? wifi_cfg.ssid : "");
+    // Don't send password for security reasons
+    json_writer_string(&json, "password", "");
+    json_writer_object_end(&json);
 
     // Add MQTT configuration
-    cJSON *mqtt_json = cJSON_CreateObject();
+    json_writer_object_begin(&json, "mqtt");
     if (mqtt_loaded) {
-        cJSON_AddStringToObject(mqtt_json, "uri", mqtt_cfg.uri);
-        cJSON_AddStringToObject(mqtt_json, "username", mqtt_cfg.username);
+        json_writer_string(&json, "uri", mqtt_cfg.uri);
+        json_writer_string(&json, "username", mqtt_cfg.username);
         // Don't send password for security reasons
-        cJSON_AddStringToObject(mqtt_json, "password", "");
+        json_writer_string(&json, "password", "");
+        json_writer_string(&json, "format", config_payload_format_name(mqtt_cfg.payload_format));
+        json_writer_number(&json, "bme690_batch", mqtt_cfg.batch_bme690.max_samples);
+        json_writer_number(&json, "bme690_batch_age", mqtt_cfg.batch_bme690.max_age_s);
+        json_writer_number(&json, "bmv080_batch", mqtt_cfg.batch_bmv080.max_samples);
+        json_writer_number(&json, "bmv080_batch_age", mqtt_cfg.batch_bmv080.max_age_s);
+        json_writer_string(&json, "bme690_deadband", mqtt_cfg.deadband_bme690.spec);
+        json_writer_number(&json, "bme690_heartbeat", mqtt_cfg.deadband_bme690.heartbeat_s);
+        json_writer_string(&json, "bmv080_deadband", mqtt_cfg.deadband_bmv080.spec);
+        json_writer_number(&json, "bmv080_heartbeat", mqtt_cfg.deadband_bmv080.heartbeat_s);
+        json_writer_string(&json, "protocol", mqtt_cfg.mqtt5 ? "5" : "3.1.1");
+        json_writer_number(&json, "expiry", mqtt_cfg.message_expiry_s);
+        json_writer_string(&json, "qos_state", mqtt_qos_policy_name(mqtt_cfg.qos.state));
+        json_writer_string(&json, "qos_batch", mqtt_qos_policy_name(mqtt_cfg.qos.batch));
+        json_writer_string(&json, "qos_stats", mqtt_qos_policy_name(mqtt_cfg.qos.stats));
+        json_writer_string(&json, "qos_system", mqtt_qos_policy_name(mqtt_cfg.qos.system));
     } else {
-        cJSON_AddStringToObject(mqtt_json, "uri", "");
-        cJSON_AddStringToObject(mqtt_json, "username", "");
-        cJSON_AddStringToObject(mqtt_json, "password", "");
+        json_writer_string(&json, "uri", "");
+        json_writer_string(&json, "username", "");
+        json_writer_string(&json, "password", "");
+        json_writer_string(&json, "format", config_payload_format_name(PAYLOAD_FORMAT_JSON));
+    }
+    json_writer_object_end(&json);
+
+    // Add sensor settings
+    json_writer_object_begin(&json, "sensor");
+    json_writer_number(&json, "bmv080_duty_cycle", sensor_cfg.bmv080_duty_cycle_s);
+    json_writer_bool(&json, "bme690_gated", sensor_cfg.bme690_gated);
+    json_writer_array_begin(&json, "stats_windows");
+    for (int i = 0; i < SENSOR_AGG_WINDOW_COUNT; i++) {
+        json_writer_number(&json, NULL, sensor_cfg.stats_window_s[i]);
     }
-    cJSON_AddItemToObject(json, "mqtt", mqtt_json);
+    json_writer_array_end(&json);
+    json_writer_object_end(&json);
 
     // Add status
-    cJSON_AddBoolToObject(json, "wifi_configured", wifi_loaded && strlen(wifi_cfg.ssid) > 0);
-    cJSON_AddBoolToObject(json, "mqtt_configured", mqtt_loaded && strlen(mqtt_cfg.uri) > 0);
-
-    // Convert to string
-    char *json_string = cJSON_Print(json);
-    if (json_string == NULL) {
-        cJSON_Delete(json);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to serialize JSON");
+    json_writer_bool(&json, "wifi_configured", wifi_loaded && strlen(wifi_cfg.ssid) > 0);
+    json_writer_bool(&json, "mqtt_configured", mqtt_loaded && strlen(mqtt_cfg.uri) > 0);
+    json_writer_object_end(&json);
+
+    // The headers are gone once a chunk is sent, a failure can only drop the connection
+    if (!json_writer_finish(&json) || httpd_resp_send_chunk(req, NULL, 0) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to send configuration JSON");
         return ESP_FAIL;
     }
-
-    // Send response
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
-    esp_err_t ret = httpd_resp_send(req, json_string, strlen(json_string));
-
-    // Cleanup
-    free(json_string);
-    cJSON_Delete(json);
-
-    return ret;
+    return ESP_OK;
 }
 
 esp_err_t webserver_register_config_handlers(httpd_handle_t server) {
@@ -0,0 +1,232 @@
+/**
+ * @file webserver_history.c
+ * @brief Sensor history web server handler
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "sensor_data_broker.h"
+#include "sensor_history.h"
+#include "sensor_json.h"
+#include "webserver.h"
+
+// External device ID from main.c
+extern char shortId[7];
+
+static const char *TAG = "web_history";
+
+#define HISTORY_DEFAULT_RANGE_S 3600 // Without from, the last hour
+#define HISTORY_DEFAULT_POINTS  120  // Without step, the range in this many steps
+#define HISTORY_MAX_POINTS      500  // Larger steps are used for ranges that would give more
+#define HISTORY_QUERY_MAX       128
+#define HISTORY_MAX_AGO_MS      (INT32_MAX - 1000) // History times are compared by their distance, which must fit an int32_t
+
+// Filled on the dispatcher task, read by the httpd task one step at a time
+static sensor_history_t bme690_history;
+static sensor_history_t bmv080_history;
+static SemaphoreHandle_t history_mutex = NULL;
+
+static void history_bme690_callback(const sensor_sample_t *sample, void *ctx) {
+    const bme690_data_t *data = sensor_sample_data(sample);
+    xSemaphoreTake(history_mutex, portMAX_DELAY);
+    sensor_history_add(&bme690_history, data, data->timestamp);
+    xSemaphoreGive(history_mutex);
+}
+
+static void history_bmv080_callback(const sensor_sample_t *sample, void *ctx) {
+    const bmv080_data_t *data = sensor_sample_data(sample);
+    xSemaphoreTake(history_mutex, portMAX_DELAY);
+    sensor_history_add(&bmv080_history, data, data->timestamp);
+    xSemaphoreGive(history_mutex);
+}
+
+// Read an integer query parameter into *value, false if present but not a number
+static bool query_int(const char *query, const char *key, long *value) {
+    char buf[16];
+    esp_err_t ret = httpd_query_key_value(query, key, buf, sizeof(buf));
+    if (ret == ESP_ERR_NOT_FOUND) {
+        return true;
+    }
+
+    char *end;
+    long parsed = strtol(buf, &end, 10);
+    if (ret != ESP_OK || end == buf || *end != '\0') {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+// Sample time of a from/to parameter: seconds since boot, or relative to now if zero or negative.
+// Relative times stay right after the millisecond timestamps wrap, as they do after 49.7 days.
+static uint32_t history_time_ms(long seconds, uint32_t now_ms) {
+    if (seconds <= 0) {
+        uint64_t ago_ms = (uint64_t)(-(int64_t)seconds) * 1000;
+        if (ago_ms >= (uint64_t)(esp_timer_get_time() / 1000)) {
+            return 0;
+        }
+        return now_ms - (uint32_t)(ago_ms < HISTORY_MAX_AGO_MS ? ago_ms : HISTORY_MAX_AGO_MS);
+    }
+    uint64_t ms = (uint64_t)seconds * 1000;
+    return ms >= UINT32_MAX ? UINT32_MAX - 1 : (uint32_t)ms;
+}
+
+// HTTP handler for the sensor history endpoint
+static esp_err_t history_get_handler(httpd_req_t *req) {
+    char query[HISTORY_QUERY_MAX] = "";
+    if (httpd_req_get_url_query_len(req) >= sizeof(query)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Query too long");
+        return ESP_FAIL;
+    }
+    httpd_req_get_url_query_str(req, query, sizeof(query));
+
+    char sensor[16];
+    esp_err_t ret = httpd_query_key_value(query, "sensor", sensor, sizeof(sensor));
+    if (ret == ESP_ERR_NOT_FOUND) {
+        strcpy(sensor, "bme690");
+    } else if (ret != ESP_OK) {
+        sensor[0] = '\0';
+    }
+    sensor_history_t *history = NULL;
+    if (strcmp(sensor, "bme690") == 0) {
+        history = &bme690_history;
+    } else if (strcmp(sensor, "bmv080") == 0) {
+        history = &bmv080_history;
+    }
+    if (history == NULL) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown sensor");
+        return ESP_FAIL;
+    }
+    if (history->tiers[0].start_ms == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "History not available");
+        return ESP_FAIL;
+    }
+
+    long from_s = -HISTORY_DEFAULT_RANGE_S;
+    long to_s = 0;
+    long step_s = 0;
+    if (!query_int(query, "from", &from_s) || !query_int(query, "to", &to_s) || !query_int(query, "step", &step_s) || step_s < 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid from, to or step");
+        return ESP_FAIL;
+    }
+
+    // Sample timestamps count ticks since boot, so does the range; to is inclusive
+    uint32_t now_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    uint32_t from_ms = history_time_ms(from_s, now_ms);
+    uint32_t to_ms = history_time_ms(to_s, now_ms) + 1;
+    if ((int32_t)(to_ms - from_ms) <= 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Empty time range");
+        return ESP_FAIL;
+    }
+
+    uint32_t range_ms = to_ms - from_ms;
+    uint32_t step_ms = range_ms / HISTORY_DEFAULT_POINTS;
+    if (step_s > 0) {
+        step_ms = step_s < UINT32_MAX / 1000 ? (uint32_t)step_s * 1000 : UINT32_MAX / 1000 * 1000;
+    }
+    uint32_t min_step_ms = range_ms / HISTORY_MAX_POINTS + 1;
+    if (step_ms < min_step_ms) {
+        step_ms = min_step_ms;
+    }
+
+    sensor_history_query_t history_query;
+    xSemaphoreTake(history_mutex, portMAX_DELAY);
+    sensor_history_query_begin(history, &history_query, from_ms, to_ms, step_ms);
+    xSemaphoreGive(history_mutex);
+
+    // Stream the steps in chunks from the stack, the lock is only held while a step is merged
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    char chunk[WEBSERVER_JSON_CHUNK];
+    json_writer_t writer;
+    json_writer_init(&writer, chunk, sizeof(chunk), webserver_json_flush, req);
+    json_writer_object_begin(&writer, NULL);
+    json_writer_string(&writer, "sensor", history->sensor);
+    json_writer_string(&writer, "device_id", shortId);
+    json_writer_number(&writer, "now", now_ms);
+    json_writer_number(&writer, "from", history_query.next_ms);
+    json_writer_number(&writer, "to", to_ms);
+    json_writer_number(&writer, "step", history_query.step_ms);
+    json_writer_array_begin(&writer, "fields");
+    for (uint8_t f = 0; f < history->field_count; f++) {
+        json_writer_string(&writer, NULL, history->fields[f].name);
+    }
+    json_writer_array_end(&writer);
+
+    json_writer_array_begin(&writer, "points");
+    sensor_history_point_t point;
+    unsigned points = 0;
+    while (!writer.failed) {
+        xSemaphoreTake(history_mutex, portMAX_DELAY);
+        bool more = sensor_history_query_next(history, &history_query, &point);
+        xSemaphoreGive(history_mutex);
+        if (!more) {
+            break;
+        }
+        sensor_json_write_history_point(&writer, history, &point);
+        points++;
+    }
+    json_writer_array_end(&writer);
+    json_writer_object_end(&writer);
+
+    // The headers are gone once a chunk is sent, a failure can only drop the connection
+    if (!json_writer_finish(&writer) || httpd_resp_send_chunk(req, NULL, 0) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to send %s history", history->sensor);
+        return ESP_FAIL;
+    }
+    ESP_LOGD(TAG, "Served %u %s history steps of %lu ms", points, history->sensor, (unsigned long)history_query.step_ms);
+    return ESP_OK;
+}
+
+esp_err_t webserver_register_history_handlers(httpd_handle_t server) {
+    ESP_LOGI(TAG, "Registering sensor history handler");
+
+    // The history is kept from the first start of the server on, across restarts
+    if (history_mutex == NULL) {
+        history_mutex = xSemaphoreCreateMutex();
+        if (history_mutex == NULL) {
+            ESP_LOGE(TAG, "Failed to create history mutex");
+            return ESP_FAIL;
+        }
+
+        // A history that cannot be fed is freed, /history then answers that it is not available
+        if (sensor_history_init(&bme690_history, "bme690", sensor_history_bme690_fields, sensor_history_bme690_field_count, NULL)) {
+            sensor_subscriber_config_t bme690_subscription = {
+                .name = "web_history_bme690", .type = SENSOR_TYPE_BME690, .callback = history_bme690_callback};
+            if (!sensor_broker_subscribe(&bme690_subscription)) {
+                ESP_LOGE(TAG, "Failed to subscribe to BME690 samples, BME690 history is disabled");
+                sensor_history_deinit(&bme690_history);
+            }
+        }
+        if (sensor_history_init(&bmv080_history, "bmv080", sensor_history_bmv080_fields, sensor_history_bmv080_field_count, NULL)) {
+            sensor_subscriber_config_t bmv080_subscription = {
+                .name = "web_history_bmv080", .type = SENSOR_TYPE_BMV080, .callback = history_bmv080_callback};
+            if (!sensor_broker_subscribe(&bmv080_subscription)) {
+                ESP_LOGE(TAG, "Failed to subscribe to BMV080 samples, BMV080 history is disabled");
+                sensor_history_deinit(&bmv080_history);
+            }
+        }
+    }
+
+    httpd_uri_t history_uri = {.uri = "/history", .method = HTTP_GET, .handler = history_get_handler, .user_ctx = NULL};
+    esp_err_t ret = httpd_register_uri_handler(server, &history_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register history handler");
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "Sensor history handler registered successfully");
+    return ESP_OK;
+}
@@ -3,20 +3,27 @@
  * @brief Sensor data web server handlers
  */
 
+#include <inttypes.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
 #include "esp_err.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
+#include "esp_random.h"
 #include "esp_system.h"
 #include "esp_timer.h"
-#include "cJSON.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "mqtt_payload.h"
 
 #include "sensor_data_broker.h"
+#include "sensor_json.h"
+#include "sensor_latest.h"
 #include "webserver.h"
 
 // External device ID from main.c
@@ -24,34 +31,208 @@ extern char shortId[7];
 
 static const char *TAG = "web_sensor";
 
-// Latest sensor data
-static bme690_data_t latest_bme690_data = {0};
-static bmv080_data_t latest_bmv080_data = {0};
-static bool bme690_data_available = false;
-static bool bmv080_data_available = false;
+// Latest sensor readings, copied from the sensor data bus on the sensor tasks
+// and read on the httpd task without either side taking a lock
+typedef struct {
+    bme690_data_t data;
+    bool is_averaged;
+} latest_bme690_t;
+
+_Static_assert(sizeof(latest_bme690_t) <= SENSOR_LATEST_MAX_SIZE, "latest_bme690_t must fit a sensor_latest_t");
+_Static_assert(sizeof(bmv080_data_t) <= SENSOR_LATEST_MAX_SIZE, "bmv080_data_t must fit a sensor_latest_t");
+
+static sensor_latest_t latest_bme690; // latest_bme690_t
+static sensor_latest_t latest_bmv080; // bmv080_data_t
+
+// The /data document of the latest samples, only touched on the httpd task.
+// Built again once a new sample arrived, identified to clients by an ETag of
+// the reading versions so unchanged data costs a 304 without a body.
+#define DATA_SNAPSHOT_MAX 1024
+#define DATA_ETAG_MAX     40
+
+static char data_snapshot[DATA_SNAPSHOT_MAX];
+static size_t data_snapshot_len = 0;
+static uint32_t data_snapshot_version[2]; // BME690 and BMV080 reading in the snapshot, 0 for none
+static char data_etag[DATA_ETAG_MAX];
+static uint32_t data_boot_id; // Versions restart with the device, keeps the ETags of a previous boot from matching
+
+// Live samples pushed to /events clients as Server-Sent Events. The client
+// sockets are only touched on the httpd task: by the /events handler, by the
+// push work queued with httpd_queue_work() and by the session close callback.
+#define SSE_MAX_CLIENTS  3     // Of the server's 7 sockets, leaves room for page loads
+#define SSE_KEEPALIVE_MS 15000 // Ping interval, lets the page tell a quiet sensor from a lost connection
+#define SSE_EVENT_MAX    384
+
+// Events waiting for the push work
+#define SSE_PENDING_BME690 (1u << 0)
+#define SSE_PENDING_BMV080 (1u << 1)
+#define SSE_PENDING_PING   (1u << 2)
+
+typedef struct {
+    int fd;           // -1 if the slot is free
+    unsigned pending; // Events not sent yet as the socket was busy
+    uint32_t events;
+    uint32_t skipped; // Readings replaced by a newer one before the socket could take them
+} sse_client_t;
+
+static httpd_handle_t sse_server = NULL;
+static sse_client_t sse_clients[SSE_MAX_CLIENTS] = {{.fd = -1}, {.fd = -1}, {.fd = -1}};
+static atomic_uint sse_client_count;
+static atomic_uint sse_pending;
+static esp_timer_handle_t sse_keepalive_timer = NULL;
+static bool sse_enabled = false; // Both /events subscriptions are in place
+
+// The bus keeps subscriptions for good, they are made on the first start of the server only
+static bool sensor_subscribed = false;
 
 // Embedded compressed HTML files
 extern const uint8_t sensor_dashboard_html_gz_start[] asm("_binary_sensor_dashboard_html_gz_start");
 extern const uint8_t sensor_dashboard_html_gz_end[] asm("_binary_sensor_dashboard_html_gz_end");
 
 // Sensor data callbacks
-static void bme690_data_callback(const bme690_data_t *data, bool is_averaged) {
-    if (data != NULL) {
-        memcpy(&latest_bme690_data, data, sizeof(bme690_data_t));
-        bme690_data_available = true;
-        ESP_LOGD(TAG, "Updated BME690 data: T=%.2f°C, H=%.1f%%, P=%.1fPa, IAQ=%.1f", data->temperature, data->humidity, data->pressure,
-            data->iaq);
+static void bme690_data_callback(const sensor_sample_t *sample, void *ctx) {
+    const bme690_data_t *data = sensor_sample_data(sample);
+    latest_bme690_t latest = {.data = *data, .is_averaged = (sample->flags & SENSOR_SAMPLE_AVERAGED) != 0};
+    sensor_latest_store(&latest_bme690, &latest, sizeof(latest));
+
+    ESP_LOGD(TAG, "Updated BME690 data: T=%.2f°C, H=%.1f%%, P=%.1fPa, IAQ=%.1f", data->temperature, data->humidity, data->pressure,
+        data->iaq);
+}
+
+static void bmv080_data_callback(const sensor_sample_t *sample, void *ctx) {
+    const bmv080_data_t *data = sensor_sample_data(sample);
+    sensor_latest_store(&latest_bmv080, data, sizeof(bmv080_data_t));
+
+    ESP_LOGD(TAG, "Updated BMV080 data: PM1=%.1f, PM2.5=%.1f, PM10=%.1f µg/m³", data->pm1, data->pm25, data->pm10);
+}
+
+// Format the latest BME690 or BMV080 reading as an event named after the sensor, 0 if none yet or on error
+static int sse_format_latest(char *buf, size_t size, sensor_type_t type) {
+    latest_bme690_t bme690;
+    bmv080_data_t bmv080;
+    if (type == SENSOR_TYPE_BME690 ? sensor_latest_load(&latest_bme690, &bme690, sizeof(bme690)) == 0
+                                   : sensor_latest_load(&latest_bmv080, &bmv080, sizeof(bmv080)) == 0) {
+        return 0;
+    }
+
+    int prefix = snprintf(buf, size, "event: %s\ndata: ", type == SENSOR_TYPE_BME690 ? "bme690" : "bmv080");
+    if (prefix <= 0 || prefix >= (int)size) {
+        return 0;
+    }
+
+    // The MQTT state payloads are single line JSON, as an event's data line must be
+    int written;
+    if (type == SENSOR_TYPE_BME690) {
+        written = mqtt_payload_bme690(buf + prefix, size - prefix, &bme690.data, bme690.is_averaged);
+    } else {
+        written = mqtt_payload_bmv080(buf + prefix, size - prefix, &bmv080);
+    }
+    int len = prefix + written;
+    if (written <= 0 || len + 2 >= (int)size) {
+        return 0;
+    }
+
+    buf[len++] = '\n';
+    buf[len++] = '\n';
+    buf[len] = '\0';
+    return len;
+}
+
+// Send an event to one client, closing its session if the send fails
+static void sse_send(sse_client_t *client, const char *event, size_t len) {
+    if (client->fd < 0 || len == 0) {
+        return;
+    }
+
+    if (httpd_socket_send(sse_server, client->fd, event, len, 0) != (int)len) {
+        ESP_LOGW(TAG, "Live client on socket %d stopped receiving, closing", client->fd);
+        httpd_sess_trigger_close(sse_server, client->fd);
+        return;
     }
+    client->events++;
 }
 
-static void bmv080_data_callback(const bmv080_data_t *data) {
-    if (data != NULL) {
-        memcpy(&latest_bmv080_data, data, sizeof(bmv080_data_t));
-        bmv080_data_available = true;
-        ESP_LOGD(TAG, "Updated BMV080 data: PM1=%.1f, PM2.5=%.1f, PM10=%.1f µg/m³", data->pm1, data->pm25, data->pm10);
+// Send an event to the clients waiting for it. A client whose socket is still
+// busy with earlier events keeps it pending and gets the then latest reading on
+// a later push, so a slow client drops readings instead of blocking the server.
+static void sse_push_event(unsigned event) {
+    bool waiting = false;
+    for (int i = 0; i < SSE_MAX_CLIENTS; i++) {
+        waiting = waiting || (sse_clients[i].fd >= 0 && (sse_clients[i].pending & event));
+    }
+    if (!waiting) {
+        return;
+    }
+
+    char buf[SSE_EVENT_MAX];
+    int len;
+    if (event == SSE_PENDING_PING) {
+        len = snprintf(buf, sizeof(buf), "event: ping\ndata: {\"uptime_ms\":%lld}\n\n", (long long)(esp_timer_get_time() / 1000));
+    } else {
+        len = sse_format_latest(buf, sizeof(buf), event == SSE_PENDING_BME690 ? SENSOR_TYPE_BME690 : SENSOR_TYPE_BMV080);
+    }
+
+    for (int i = 0; i < SSE_MAX_CLIENTS; i++) {
+        sse_client_t *client = &sse_clients[i];
+        if (client->fd < 0 || !(client->pending & event) || !webserver_socket_writable(client->fd)) {
+            continue;
+        }
+        client->pending &= ~event;
+        sse_send(client, buf, len);
     }
 }
 
+// Push the pending events, runs on the httpd task
+static void sse_push_work(void *arg) {
+    unsigned pending = atomic_exchange(&sse_pending, 0);
+
+    for (int i = 0; i < SSE_MAX_CLIENTS; i++) {
+        sse_client_t *client = &sse_clients[i];
+        if (client->fd >= 0) {
+            unsigned replaced = client->pending & pending;
+            client->skipped += ((replaced & SSE_PENDING_BME690) != 0) + ((replaced & SSE_PENDING_BMV080) != 0);
+            client->pending |= pending;
+        }
+    }
+
+    sse_push_event(SSE_PENDING_BME690);
+    sse_push_event(SSE_PENDING_BMV080);
+    sse_push_event(SSE_PENDING_PING);
+}
+
+// Have the httpd task push an event, coalescing with a push already queued
+static void sse_notify(unsigned event) {
+    if (atomic_load(&sse_client_count) == 0) {
+        return;
+    }
+
+    if (atomic_fetch_or(&sse_pending, event) == 0 && httpd_queue_work(sse_server, sse_push_work, NULL) != ESP_OK) {
+        atomic_store(&sse_pending, 0);
+    }
+}
+
+// Free the slot of a /events client when httpd closes its session
+static void sse_client_closed(void *ctx) {
+    sse_client_t *client = ctx;
+    ESP_LOGI(TAG, "Live client on socket %d disconnected after %lu events, %lu readings skipped", client->fd,
+        (unsigned long)client->events, (unsigned long)client->skipped);
+    client->fd = -1;
+    atomic_fetch_sub(&sse_client_count, 1);
+}
+
+static void sse_keepalive_callback(void *arg) {
+    sse_notify(SSE_PENDING_PING);
+}
+
+// Push samples to /events as the bus delivers them, on the dispatcher task as queueing the work may block
+static void sse_bme690_callback(const sensor_sample_t *sample, void *ctx) {
+    sse_notify(SSE_PENDING_BME690);
+}
+
+static void sse_bmv080_callback(const sensor_sample_t *sample, void *ctx) {
+    sse_notify(SSE_PENDING_BMV080);
+}
+
 // HTTP handler for the main dashboard page
 static esp_err_t dashboard_get_handler(httpd_req_t *req) {
     ESP_LOGI(TAG, "Serving sensor dashboard (compressed)");
@@ -63,92 +244,170 @@ static esp_err_t dashboard_get_handler(httpd_req_t *req) {
     return ESP_OK;
 }
 
+// Build the /data snapshot if a reading newer than the one in it arrived, false on error
+static bool data_snapshot_update(void) {
+    uint32_t version[2] = {sensor_latest_version(&latest_bme690), sensor_latest_version(&latest_bmv080)};
+    if (data_snapshot_len > 0 && memcmp(version, data_snapshot_version, sizeof(version)) == 0) {
+        return true;
+    }
+
+    latest_bme690_t bme690;
+    bmv080_data_t bmv080;
+    version[0] = sensor_latest_load(&latest_bme690, &bme690, sizeof(bme690));
+    version[1] = sensor_latest_load(&latest_bmv080, &bmv080, sizeof(bmv080));
+
+    json_writer_t writer;
+    json_writer_init(&writer, data_snapshot, sizeof(data_snapshot), NULL, NULL);
+    sensor_json_write_data(&writer, shortId, esp_timer_get_time() / 1000, // Convert to milliseconds
+        version[0] ? &bme690.data : NULL, version[1] ? &bmv080 : NULL);
+
+    bool ok = json_writer_finish(&writer);
+    data_snapshot_len = ok ? writer.len : 0;
+    memcpy(data_snapshot_version, version, sizeof(version));
+    snprintf(data_etag, sizeof(data_etag), "\"%08" PRIx32 "-%" PRIu32 "-%" PRIu32 "\"", data_boot_id, version[0], version[1]);
+    return ok;
+}
+
+// True if the request's If-None-Match lists the snapshot's ETag
+static bool data_etag_matches(httpd_req_t *req) {
+    char value[128];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", value, sizeof(value)) != ESP_OK) {
+        return false;
+    }
+    return strcmp(value, "*") == 0 || strstr(value, data_etag) != NULL;
+}
+
 // HTTP handler for the JSON data endpoint
 static esp_err_t data_get_handler(httpd_req_t *req) {
     ESP_LOGD(TAG, "Serving sensor data JSON");
 
-    // Create JSON object
-    cJSON *json = cJSON_CreateObject();
-    if (json == NULL) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create JSON object");
+    if (!data_snapshot_update()) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to serialize JSON");
         return ESP_FAIL;
     }
 
-    // Add timestamp
-    cJSON *timestamp = cJSON_CreateNumber(esp_timer_get_time() / 1000); // Convert to milliseconds
-    cJSON_AddItemToObject(json, "timestamp", timestamp);
-
-    // Add device ID
-    cJSON_AddStringToObject(json, "device_id", shortId);
-
-    // Add BME690 data
-    if (bme690_data_available) {
-        cJSON *bme690 = cJSON_CreateObject();
-        cJSON_AddNumberToObject(bme690, "temperature", latest_bme690_data.temperature);
-        cJSON_AddNumberToObject(bme690, "humidity", latest_bme690_data.humidity);
-        cJSON_AddNumberToObject(bme690, "pressure", latest_bme690_data.pressure);
-        cJSON_AddNumberToObject(bme690, "iaq", latest_bme690_data.iaq);
-        cJSON_AddNumberToObject(bme690, "iaq_accuracy", latest_bme690_data.iaq_accuracy);
-        cJSON_AddNumberToObject(bme690, "co2_equivalent", latest_bme690_data.co2_equivalent);
-        cJSON_AddNumberToObject(bme690, "breath_voc_equivalent", latest_bme690_data.breath_voc_equivalent);
-        cJSON_AddNumberToObject(bme690, "static_iaq", latest_bme690_data.static_iaq);
-        cJSON_AddNumberToObject(bme690, "gas_percentage", latest_bme690_data.gas_percentage);
-        cJSON_AddBoolToObject(bme690, "stabilization_status", latest_bme690_data.stabilization_status);
-        cJSON_AddBoolToObject(bme690, "run_in_status", latest_bme690_data.run_in_status);
-        cJSON_AddNumberToObject(bme690, "data_timestamp", latest_bme690_data.timestamp);
-        cJSON_AddItemToObject(json, "bme690", bme690);
-    } else {
-        cJSON_AddNullToObject(json, "bme690");
-    }
-
-    // Add BMV080 data
-    if (bmv080_data_available) {
-        cJSON *bmv080 = cJSON_CreateObject();
-        cJSON_AddNumberToObject(bmv080, "pm1", latest_bmv080_data.pm1);
-        cJSON_AddNumberToObject(bmv080, "pm25", latest_bmv080_data.pm25);
-        cJSON_AddNumberToObject(bmv080, "pm10", latest_bmv080_data.pm10);
-        cJSON_AddBoolToObject(bmv080, "is_obstructed", latest_bmv080_data.is_obstructed);
-        cJSON_AddBoolToObject(bmv080, "is_outside_range", latest_bmv080_data.is_outside_range);
-        cJSON_AddNumberToObject(bmv080, "runtime", latest_bmv080_data.runtime);
-        cJSON_AddNumberToObject(bmv080, "data_timestamp", latest_bmv080_data.timestamp);
-        cJSON_AddItemToObject(json, "bmv080", bmv080);
-    } else {
-        cJSON_AddNullToObject(json, "bmv080");
+    // no-cache lets browsers keep the document but revalidate it on every poll
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_set_hdr(req, "ETag", data_etag);
+
+    if (data_etag_matches(req)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    return httpd_resp_send(req, data_snapshot, data_snapshot_len);
+}
+
+// HTTP handler for the Server-Sent Events stream of live samples
+static esp_err_t events_get_handler(httpd_req_t *req) {
+    sse_client_t *client = NULL;
+    for (int i = 0; i < SSE_MAX_CLIENTS && client == NULL; i++) {
+        if (sse_clients[i].fd < 0) {
+            client = &sse_clients[i];
+        }
+    }
+    if (client == NULL) {
+        // EventSource gives up on an error status, the dashboard then polls /data
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+        httpd_resp_sendstr(req, "Too many live clients");
+        return ESP_OK;
+    }
+
+    // The response is written to the socket directly and stays open after the
+    // handler returns, httpd only notices the session again when it closes
+    int fd = httpd_req_to_sockfd(req);
+    char event[SSE_EVENT_MAX];
+    int len = snprintf(event, sizeof(event),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "\r\n"
+        "retry: 3000\n\n"
+        "event: device\ndata: {\"device_id\":\"%s\"}\n\n",
+        shortId);
+    if (httpd_socket_send(req->handle, fd, event, len, 0) != len) {
+        return ESP_FAIL;
     }
 
-    // Add data availability status
-    cJSON *status = cJSON_CreateObject();
-    cJSON_AddBoolToObject(status, "bme690_available", bme690_data_available);
-    cJSON_AddBoolToObject(status, "bmv080_available", bmv080_data_available);
-    cJSON_AddItemToObject(json, "status", status);
+    *client = (sse_client_t){.fd = fd};
+    req->sess_ctx = client;
+    req->free_ctx = sse_client_closed;
+    atomic_fetch_add(&sse_client_count, 1);
+    ESP_LOGI(TAG, "Live client on socket %d connected (%u of %d)", fd, atomic_load(&sse_client_count), SSE_MAX_CLIENTS);
+
+    // Start the page with the latest readings instead of waiting for the next ones
+    sse_send(client, event, sse_format_latest(event, sizeof(event), SENSOR_TYPE_BME690));
+    sse_send(client, event, sse_format_latest(event, sizeof(event), SENSOR_TYPE_BMV080));
+    return ESP_OK;
+}
 
-    // Convert to string
-    char *json_string = cJSON_Print(json);
+// HTTP handler for the sensor bus diagnostics endpoint
+static esp_err_t broker_diag_get_handler(httpd_req_t *req) {
+    const size_t size = MQTT_PAYLOAD_BROKER_DIAG_MAX;
+    char *json_string = malloc(size);
     if (json_string == NULL) {
-        cJSON_Delete(json);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+
+    int len = mqtt_payload_broker_diag(json_string, size);
+    if (len <= 0 || len >= (int)size) {
+        free(json_string);
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to serialize JSON");
         return ESP_FAIL;
     }
 
-    // Send response
     httpd_resp_set_type(req, "application/json");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
     httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
-    esp_err_t ret = httpd_resp_send(req, json_string, strlen(json_string));
+    esp_err_t ret = httpd_resp_send(req, json_string, len);
 
-    // Cleanup
     free(json_string);
-    cJSON_Delete(json);
-
     return ret;
 }
 
 esp_err_t webserver_register_sensor_handlers(httpd_handle_t server) {
     ESP_LOGI(TAG, "Registering sensor data handlers");
 
-    // Register with sensor data broker for callbacks
-    sensor_broker_register_bme690_callback(bme690_data_callback);
-    sensor_broker_register_bmv080_callback(bmv080_data_callback);
+    if (!sensor_subscribed) {
+        // Register with sensor data broker for callbacks
+        // Only copies the reading into a latest value cell, cheap enough to run on the sensor task
+        sensor_subscriber_config_t bme690_subscription = {
+            .name = "web_bme690", .type = SENSOR_TYPE_BME690, .callback = bme690_data_callback, .synchronous = true};
+        sensor_subscriber_config_t bmv080_subscription = {
+            .name = "web_bmv080", .type = SENSOR_TYPE_BMV080, .callback = bmv080_data_callback, .synchronous = true};
+        if (!sensor_broker_subscribe(&bme690_subscription)) {
+            ESP_LOGE(TAG, "Failed to subscribe to BME690 samples, /data and the dashboard will not show them");
+        }
+        if (!sensor_broker_subscribe(&bmv080_subscription)) {
+            ESP_LOGE(TAG, "Failed to subscribe to BMV080 samples, /data and the dashboard will not show them");
+        }
+
+        // Live pushes to /events, on the dispatcher task
+        sensor_subscriber_config_t sse_bme690_subscription = {
+            .name = "web_sse_bme690", .type = SENSOR_TYPE_BME690, .callback = sse_bme690_callback};
+        sensor_subscriber_config_t sse_bmv080_subscription = {
+            .name = "web_sse_bmv080", .type = SENSOR_TYPE_BMV080, .callback = sse_bmv080_callback};
+        sse_enabled = sensor_broker_subscribe(&sse_bme690_subscription);
+        sse_enabled = sensor_broker_subscribe(&sse_bmv080_subscription) && sse_enabled;
+        if (!sse_enabled) {
+            ESP_LOGE(TAG, "Failed to subscribe to sensor samples for /events, live updates are disabled");
+        }
+        sensor_subscribed = true;
+    }
+
+    data_boot_id = esp_random();
+    sse_server = server;
+
+    if (sse_keepalive_timer == NULL) {
+        const esp_timer_create_args_t keepalive_args = {.callback = sse_keepalive_callback, .name = "sse_keepalive"};
+        if (esp_timer_create(&keepalive_args, &sse_keepalive_timer) == ESP_OK) {
+            esp_timer_start_periodic(sse_keepalive_timer, (uint64_t)SSE_KEEPALIVE_MS * 1000);
+        }
+    }
 
     // Register URI handlers
     httpd_uri_t dashboard_uri = {.uri = "/", .method = HTTP_GET, .handler = dashboard_get_handler, .user_ctx = NULL};
@@ -165,6 +424,23 @@ esp_err_t webserver_register_sensor_handlers(httpd_handle_t server) {
         return ret;
     }
 
+    // Without its subscriptions /events would only ever send pings, the dashboard then polls /data
+    if (sse_enabled) {
+        httpd_uri_t events_uri = {.uri = "/events", .method = HTTP_GET, .handler = events_get_handler, .user_ctx = NULL};
+        ret = httpd_register_uri_handler(server, &events_uri);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to register events handler");
+            return ret;
+        }
+    }
+
+    httpd_uri_t broker_diag_uri = {.uri = "/diag/broker", .method = HTTP_GET, .handler = broker_diag_get_handler, .user_ctx = NULL};
+    ret = httpd_register_uri_handler(server, &broker_diag_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register broker diagnostics handler");
+        return ret;
+    }
+
     ESP_LOGI(TAG, "Sensor data handlers registered successfully");
     return ESP_OK;
 }
\ No newline at end of file
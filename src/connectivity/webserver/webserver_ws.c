@@ -0,0 +1,203 @@
+/**
+ * @file webserver_ws.c
+ * @brief WebSocket stream of binary sample frames for calibration sessions
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+
+#include "sensor_data_broker.h"
+#include "sensor_latest.h"
+#include "telemetry_frame.h"
+#include "webserver.h"
+
+static const char *TAG = "web_ws";
+
+#if CONFIG_HTTPD_WS_SUPPORT
+
+// The clients are only touched on the httpd task: by the /ws handler, by the
+// push work queued with httpd_queue_work() and by the session close callback.
+#define WS_MAX_CLIENTS 2  // With the 3 /events clients, leaves 2 of the server's 7 sockets for page loads
+#define WS_RECV_MAX    64 // Client messages are read and ignored, longer ones close the connection
+
+typedef enum {
+    WS_STREAM_BME690,
+    WS_STREAM_BMV080,
+    WS_STREAM_COUNT,
+} ws_stream_t;
+
+typedef struct {
+    int fd;                         // -1 if the slot is free
+    uint32_t sent[WS_STREAM_COUNT]; // Version of the frame last sent per stream
+    uint32_t frames;
+    uint32_t skipped; // Frames replaced by a newer one before the socket could take them
+} ws_client_t;
+
+static const size_t ws_frame_size[WS_STREAM_COUNT] = {TELEMETRY_FRAME_BME690_SIZE, TELEMETRY_FRAME_BMV080_SIZE};
+
+_Static_assert(TELEMETRY_FRAME_MAX <= SENSOR_LATEST_MAX_SIZE, "Telemetry frames must fit a sensor_latest_t");
+
+// Latest encoded frame per stream, written on the dispatcher task
+static sensor_latest_t ws_frames[WS_STREAM_COUNT];
+
+static httpd_handle_t ws_server = NULL;
+static ws_client_t ws_clients[WS_MAX_CLIENTS] = {{.fd = -1}, {.fd = -1}};
+static atomic_uint ws_client_count;
+static atomic_bool ws_push_queued;
+static bool ws_subscribed = false;
+static bool ws_enabled = false; // Both stream subscriptions are in place
+
+// Send the latest frame of each stream the client has not seen yet. A client
+// whose socket is still busy with earlier frames gets nothing now and the
+// latest frame on a later push, so a slow client drops frames, not the server.
+static void ws_push_client(ws_client_t *client) {
+    for (int s = 0; s < WS_STREAM_COUNT; s++) {
+        if (client->fd < 0 || sensor_latest_version(&ws_frames[s]) == client->sent[s] || !webserver_socket_writable(client->fd)) {
+            continue;
+        }
+
+        uint8_t frame[TELEMETRY_FRAME_MAX];
+        uint32_t version = sensor_latest_load(&ws_frames[s], frame, ws_frame_size[s]);
+        httpd_ws_frame_t packet = {.final = true, .type = HTTPD_WS_TYPE_BINARY, .payload = frame, .len = ws_frame_size[s]};
+        if (httpd_ws_send_frame_async(ws_server, client->fd, &packet) != ESP_OK) {
+            ESP_LOGW(TAG, "Telemetry client on socket %d stopped receiving, closing", client->fd);
+            httpd_sess_trigger_close(ws_server, client->fd);
+            return;
+        }
+
+        if (client->sent[s] != 0) {
+            client->skipped += version - client->sent[s] - 1;
+        }
+        client->sent[s] = version;
+        client->frames++;
+    }
+}
+
+// Push the latest frames to all clients, runs on the httpd task
+static void ws_push_work(void *arg) {
+    atomic_store(&ws_push_queued, false);
+    for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+        ws_push_client(&ws_clients[i]);
+    }
+}
+
+// Have the httpd task push the latest frames, coalescing with a push already queued
+static void ws_notify(void) {
+    if (atomic_load(&ws_client_count) == 0) {
+        return;
+    }
+
+    if (!atomic_exchange(&ws_push_queued, true) && httpd_queue_work(ws_server, ws_push_work, NULL) != ESP_OK) {
+        atomic_store(&ws_push_queued, false);
+    }
+}
+
+// Encode samples as they arrive, on the dispatcher task as queueing the push may block
+static void ws_bme690_raw_callback(const sensor_sample_t *sample, void *ctx) {
+    uint8_t frame[TELEMETRY_FRAME_MAX];
+    size_t len = telemetry_frame_bme690_raw(frame, sizeof(frame), sample->sequence, sensor_sample_data(sample));
+    sensor_latest_store(&ws_frames[WS_STREAM_BME690], frame, len);
+    ws_notify();
+}
+
+static void ws_bmv080_callback(const sensor_sample_t *sample, void *ctx) {
+    uint8_t frame[TELEMETRY_FRAME_MAX];
+    size_t len = telemetry_frame_bmv080(frame, sizeof(frame), sample->sequence, sensor_sample_data(sample));
+    sensor_latest_store(&ws_frames[WS_STREAM_BMV080], frame, len);
+    ws_notify();
+}
+
+// Free the slot of a /ws client when httpd closes its session
+static void ws_client_closed(void *ctx) {
+    ws_client_t *client = ctx;
+    ESP_LOGI(TAG, "Telemetry client on socket %d disconnected after %lu frames, %lu skipped", client->fd, (unsigned long)client->frames,
+        (unsigned long)client->skipped);
+    client->fd = -1;
+    atomic_fetch_sub(&ws_client_count, 1);
+}
+
+// HTTP handler for the telemetry WebSocket, called once after the handshake and then for every client message
+static esp_err_t ws_handler(httpd_req_t *req) {
+    if (req->method == HTTP_GET) {
+        ws_client_t *client = NULL;
+        for (int i = 0; i < WS_MAX_CLIENTS && client == NULL; i++) {
+            if (ws_clients[i].fd < 0) {
+                client = &ws_clients[i];
+            }
+        }
+        if (client == NULL) {
+            // The handshake is done, closing the session is all that is left
+            ESP_LOGW(TAG, "Too many telemetry clients, closing socket %d", httpd_req_to_sockfd(req));
+            return ESP_FAIL;
+        }
+
+        *client = (ws_client_t){.fd = httpd_req_to_sockfd(req)};
+        req->sess_ctx = client;
+        req->free_ctx = ws_client_closed;
+        atomic_fetch_add(&ws_client_count, 1);
+        ESP_LOGI(TAG, "Telemetry client on socket %d connected (%u of %d)", client->fd, atomic_load(&ws_client_count), WS_MAX_CLIENTS);
+
+        // Start with the latest frames instead of waiting for the next samples
+        ws_push_client(client);
+        return ESP_OK;
+    }
+
+    // Control frames are answered by httpd, anything else the client sends is ignored
+    uint8_t buf[WS_RECV_MAX];
+    httpd_ws_frame_t packet = {0};
+    esp_err_t ret = httpd_ws_recv_frame(req, &packet, 0);
+    if (ret != ESP_OK || packet.len > sizeof(buf)) {
+        return ESP_FAIL;
+    }
+    packet.payload = buf;
+    return packet.len > 0 ? httpd_ws_recv_frame(req, &packet, packet.len) : ESP_OK;
+}
+
+esp_err_t webserver_register_ws_handlers(httpd_handle_t server) {
+    ESP_LOGI(TAG, "Registering telemetry WebSocket handler");
+
+    ws_server = server;
+    if (!ws_subscribed) {
+        // Queued, coalescing: a busy dispatcher only ever encodes the latest sample
+        sensor_subscriber_config_t bme690_subscription = {.name = "web_ws_bme690",
+            .type = SENSOR_TYPE_BME690_RAW,
+            .callback = ws_bme690_raw_callback,
+            .overflow = SENSOR_OVERFLOW_COALESCE_LATEST};
+        sensor_subscriber_config_t bmv080_subscription = {.name = "web_ws_bmv080",
+            .type = SENSOR_TYPE_BMV080,
+            .callback = ws_bmv080_callback,
+            .overflow = SENSOR_OVERFLOW_COALESCE_LATEST};
+        ws_enabled = sensor_broker_subscribe(&bme690_subscription);
+        ws_enabled = sensor_broker_subscribe(&bmv080_subscription) && ws_enabled;
+        if (!ws_enabled) {
+            ESP_LOGE(TAG, "Failed to subscribe to sensor samples, /ws is disabled");
+        }
+        ws_subscribed = true;
+    }
+    if (!ws_enabled) {
+        return ESP_OK;
+    }
+
+    httpd_uri_t ws_uri = {.uri = "/ws", .method = HTTP_GET, .handler = ws_handler, .user_ctx = NULL, .is_websocket = true};
+    esp_err_t ret = httpd_register_uri_handler(server, &ws_uri);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register telemetry WebSocket handler");
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "Telemetry WebSocket handler registered successfully");
+    return ESP_OK;
+}
+
+#else
+
+esp_err_t webserver_register_ws_handlers(httpd_handle_t server) {
+    ESP_LOGW(TAG, "CONFIG_HTTPD_WS_SUPPORT is not set, /ws is not available");
+    return ESP_OK;
+}
+
+#endif // CONFIG_HTTPD_WS_SUPPORT
@@ -49,9 +49,11 @@ static polverine_wifi_config_t current_wifi_config = {0};
 static bool wifi_config_loaded = false;
 
 static int s_retry_num = 0;
+static volatile bool s_sta_connected = false;
 
 static void example_handler_on_wifi_disconnect(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
     ESP_LOGI(TAG, "WiFi disconnect event received");
+    s_sta_connected = false;
     s_retry_num++;
     ESP_LOGI(TAG, "Retry attempt: %d/%d", s_retry_num, CONFIG_POLVERINE_WIFI_CONN_MAX_RETRY);
 
@@ -163,6 +165,7 @@ static void polverine_handler_on_sta_got_ip(void *arg, esp_event_base_t event_ba
     ESP_LOGI(TAG, "Got IPv4 event: Interface \"%s\" address: " IPSTR, esp_netif_get_desc(event->esp_netif), IP2STR(&event->ip_info.ip));
     ESP_LOGI(TAG, "Gateway: " IPSTR ", Netmask: " IPSTR, IP2STR(&event->ip_info.gw), IP2STR(&event->ip_info.netmask));
     ESP_LOGI(TAG, "DNS Server: " IPSTR, IP2STR(&event->ip_info.gw)); // Often the gateway is also the DNS server
+    s_sta_connected = true;
 
     if (s_semph_get_ip_addrs) {
         ESP_LOGI(TAG, "Giving semaphore to unblock wifi_sta_do_connect");
@@ -395,6 +398,7 @@ esp_err_t set_static_ip(void) {
 
     // Mark that we're using static IP
     s_using_static_ip = true;
+    s_sta_connected = true;
 
     // Create a timer to periodically retry DHCP
     if (s_dhcp_retry_timer == NULL) {
@@ -465,6 +469,10 @@ esp_err_t wifi_connect(void) {
     return ret;
 }
 
+bool wifi_sta_is_connected(void) {
+    return s_sta_connected;
+}
+
 esp_err_t polverine_connect(void) {
     ESP_LOGI(TAG, "Starting polverine_connect...");
 
@@ -0,0 +1,326 @@
+#include "sensor_aggregate.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+
+#include "sensor_data_broker.h"
+
+static const char *TAG = "sensor_agg";
+
+const sensor_agg_field_t sensor_agg_bme690_fields[] = {
+    {"temperature", offsetof(bme690_data_t, temperature), SENSOR_AGG_FLOAT},
+    {"humidity", offsetof(bme690_data_t, humidity), SENSOR_AGG_FLOAT},
+    {"pressure", offsetof(bme690_data_t, pressure), SENSOR_AGG_FLOAT},
+    {"iaq", offsetof(bme690_data_t, iaq), SENSOR_AGG_FLOAT},
+    {"iaq_accuracy", offsetof(bme690_data_t, iaq_accuracy), SENSOR_AGG_UINT8},
+    {"co2", offsetof(bme690_data_t, co2_equivalent), SENSOR_AGG_FLOAT},
+    {"voc", offsetof(bme690_data_t, breath_voc_equivalent), SENSOR_AGG_FLOAT},
+    {"static_iaq", offsetof(bme690_data_t, static_iaq), SENSOR_AGG_FLOAT},
+    {"gas_percentage", offsetof(bme690_data_t, gas_percentage), SENSOR_AGG_FLOAT},
+};
+const uint8_t sensor_agg_bme690_field_count = sizeof(sensor_agg_bme690_fields) / sizeof(sensor_agg_bme690_fields[0]);
+
+const sensor_agg_field_t sensor_agg_bmv080_fields[] = {
+    {"pm10", offsetof(bmv080_data_t, pm10), SENSOR_AGG_FLOAT},
+    {"pm25", offsetof(bmv080_data_t, pm25), SENSOR_AGG_FLOAT},
+    {"pm1", offsetof(bmv080_data_t, pm1), SENSOR_AGG_FLOAT},
+};
+const uint8_t sensor_agg_bmv080_field_count = sizeof(sensor_agg_bmv080_fields) / sizeof(sensor_agg_bmv080_fields[0]);
+
+static const float quantile_targets[SENSOR_AGG_QUANTILE_COUNT] = SENSOR_AGG_QUANTILES;
+
+static void p2_init(sensor_p2_t *p2, float p) {
+    memset(p2, 0, sizeof(*p2));
+    p2->p = p;
+}
+
+static void p2_sort_heights(sensor_p2_t *p2, uint32_t n) {
+    for (uint32_t i = 1; i < n; i++) {
+        float v = p2->heights[i];
+        uint32_t j = i;
+        while (j > 0 && p2->heights[j - 1] > v) {
+            p2->heights[j] = p2->heights[j - 1];
+            j--;
+        }
+        p2->heights[j] = v;
+    }
+}
+
+static float p2_parabolic(const sensor_p2_t *p2, int i, int d) {
+    const float *q = p2->heights;
+    const int32_t *n = p2->positions;
+    return q[i] + (float)d / (n[i + 1] - n[i - 1]) *
+                      ((n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) / (n[i + 1] - n[i]) +
+                          (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+}
+
+static void p2_add(sensor_p2_t *p2, float x) {
+    // The first five observations become the initial markers
+    if (p2->count < 5) {
+        p2->heights[p2->count++] = x;
+        if (p2->count == 5) {
+            p2_sort_heights(p2, 5);
+            float p = p2->p;
+            for (int i = 0; i < 5; i++) {
+                p2->positions[i] = i;
+            }
+            p2->desired[0] = 0.0f;
+            p2->desired[1] = 2.0f * p;
+            p2->desired[2] = 4.0f * p;
+            p2->desired[3] = 2.0f + 2.0f * p;
+            p2->desired[4] = 4.0f;
+        }
+        return;
+    }
+
+    // Find the cell containing x, extending the extreme markers if needed
+    int k;
+    if (x < p2->heights[0]) {
+        p2->heights[0] = x;
+        k = 0;
+    } else if (x >= p2->heights[4]) {
+        p2->heights[4] = x;
+        k = 3;
+    } else {
+        k = 0;
+        while (k < 3 && x >= p2->heights[k + 1]) {
+            k++;
+        }
+    }
+
+    for (int i = k + 1; i < 5; i++) {
+        p2->positions[i]++;
+    }
+
+    const float p = p2->p;
+    const float increments[5] = {0.0f, p / 2.0f, p, (1.0f + p) / 2.0f, 1.0f};
+    for (int i = 0; i < 5; i++) {
+        p2->desired[i] += increments[i];
+    }
+
+    // Adjust the middle markers towards their desired positions
+    for (int i = 1; i <= 3; i++) {
+        float delta = p2->desired[i] - p2->positions[i];
+        if ((delta >= 1.0f && p2->positions[i + 1] - p2->positions[i] > 1) ||
+            (delta <= -1.0f && p2->positions[i - 1] - p2->positions[i] < -1)) {
+            int d = delta > 0 ? 1 : -1;
+            float candidate = p2_parabolic(p2, i, d);
+            if (p2->heights[i - 1] < candidate && candidate < p2->heights[i + 1]) {
+                p2->heights[i] = candidate;
+            } else {
+                p2->heights[i] += d * (p2->heights[i + d] - p2->heights[i]) / (p2->positions[i + d] - p2->positions[i]);
+            }
+            p2->positions[i] += d;
+        }
+    }
+
+    p2->count++;
+}
+
+static float p2_estimate(const sensor_p2_t *p2) {
+    if (p2->count == 0) {
+        return NAN;
+    }
+    if (p2->count >= 5) {
+        return p2->heights[2];
+    }
+
+    // Too few observations for the markers, use the exact nearest-rank value
+    sensor_p2_t sorted = *p2;
+    p2_sort_heights(&sorted, sorted.count);
+    uint32_t rank = (uint32_t)ceilf(p2->p * sorted.count);
+    return sorted.heights[rank > 0 ? rank - 1 : 0];
+}
+
+static void window_reset(sensor_agg_window_state_t *window, uint8_t field_count) {
+    window->samples = 0;
+    for (uint8_t f = 0; f < field_count; f++) {
+        sensor_agg_field_state_t *state = &window->fields[f];
+        state->count = 0;
+        state->min = INFINITY;
+        state->max = -INFINITY;
+        state->mean = 0.0;
+        state->m2 = 0.0;
+        for (int q = 0; q < SENSOR_AGG_QUANTILE_COUNT; q++) {
+            p2_init(&state->quantiles[q], quantile_targets[q]);
+        }
+    }
+}
+
+static void window_report(const sensor_aggregator_t *agg, uint8_t index) {
+    const sensor_agg_window_state_t *window = &agg->windows[index];
+    if (window->samples == 0 || agg->on_report == NULL) {
+        return;
+    }
+
+    sensor_agg_report_t report = {
+        .sensor = agg->sensor,
+        .fields = agg->fields,
+        .field_count = agg->field_count,
+        .window = index,
+        .window_ms = window->window_ms,
+        .start_ms = window->start_ms,
+        .count = window->samples,
+    };
+
+    for (uint8_t f = 0; f < agg->field_count; f++) {
+        const sensor_agg_field_state_t *state = &window->fields[f];
+        sensor_agg_stats_t *stats = &report.stats[f];
+        stats->count = state->count;
+        stats->min = state->min;
+        stats->max = state->max;
+        stats->mean = state->count > 0 ? (float)state->mean : NAN;
+        stats->stddev = state->count > 1 ? (float)sqrt(state->m2 / (state->count - 1)) : state->count > 0 ? 0.0f : NAN;
+        for (int q = 0; q < SENSOR_AGG_QUANTILE_COUNT; q++) {
+            stats->quantiles[q] = p2_estimate(&state->quantiles[q]);
+        }
+    }
+
+    ESP_LOGD(TAG, "%s window %u (%lu ms) complete: %lu samples", agg->sensor, index, (unsigned long)window->window_ms,
+        (unsigned long)report.count);
+    agg->on_report(&report);
+}
+
+static float read_field(const sensor_agg_field_t *field, const void *sample) {
+    const uint8_t *base = (const uint8_t *)sample + field->offset;
+    if (field->type == SENSOR_AGG_UINT8) {
+        return *base;
+    }
+    float value;
+    memcpy(&value, base, sizeof(value));
+    return value;
+}
+
+void sensor_aggregator_init(sensor_aggregator_t *agg, const char *sensor, const sensor_agg_field_t *fields, uint8_t field_count,
+    sensor_agg_report_callback_t on_report) {
+    if (agg == NULL || fields == NULL) {
+        ESP_LOGE(TAG, "Cannot initialize NULL aggregator");
+        return;
+    }
+
+    if (field_count > SENSOR_AGG_MAX_FIELDS) {
+        ESP_LOGW(TAG, "%s: %u fields exceed maximum, aggregating first %d", sensor, field_count, SENSOR_AGG_MAX_FIELDS);
+        field_count = SENSOR_AGG_MAX_FIELDS;
+    }
+
+    memset(agg, 0, sizeof(*agg));
+    agg->sensor = sensor;
+    agg->fields = fields;
+    agg->field_count = field_count;
+    agg->on_report = on_report;
+
+    const uint32_t defaults[SENSOR_AGG_WINDOW_COUNT] = SENSOR_AGG_DEFAULT_WINDOWS_MS;
+    for (uint8_t w = 0; w < SENSOR_AGG_WINDOW_COUNT; w++) {
+        agg->windows[w].window_ms = defaults[w];
+        window_reset(&agg->windows[w], field_count);
+        atomic_init(&agg->requested_ms[w], SENSOR_AGG_NO_REQUEST);
+    }
+
+    ESP_LOGI(TAG, "Aggregator for %s initialized (%u fields)", sensor, field_count);
+}
+
+void sensor_aggregator_set_window(sensor_aggregator_t *agg, uint8_t window, uint32_t window_ms) {
+    if (agg == NULL || window >= SENSOR_AGG_WINDOW_COUNT) {
+        return;
+    }
+
+    agg->windows[window].window_ms = window_ms;
+    agg->windows[window].started = false;
+    window_reset(&agg->windows[window], agg->field_count);
+}
+
+void sensor_aggregator_request_window(sensor_aggregator_t *agg, uint8_t window, uint32_t window_ms) {
+    if (agg == NULL || window >= SENSOR_AGG_WINDOW_COUNT || window_ms == SENSOR_AGG_NO_REQUEST) {
+        return;
+    }
+
+    atomic_store(&agg->requested_ms[window], window_ms);
+}
+
+void sensor_aggregator_add(sensor_aggregator_t *agg, const void *sample, uint32_t timestamp_ms) {
+    if (agg == NULL || sample == NULL) {
+        return;
+    }
+
+    for (uint8_t w = 0; w < SENSOR_AGG_WINDOW_COUNT; w++) {
+        uint32_t requested_ms = atomic_exchange(&agg->requested_ms[w], SENSOR_AGG_NO_REQUEST);
+        if (requested_ms != SENSOR_AGG_NO_REQUEST && requested_ms != agg->windows[w].window_ms) {
+            ESP_LOGI(TAG, "%s window %u: %lu -> %lu ms", agg->sensor, w, (unsigned long)agg->windows[w].window_ms,
+                (unsigned long)requested_ms);
+            sensor_aggregator_set_window(agg, w, requested_ms);
+        }
+    }
+
+    float values[SENSOR_AGG_MAX_FIELDS];
+    for (uint8_t f = 0; f < agg->field_count; f++) {
+        values[f] = read_field(&agg->fields[f], sample);
+    }
+
+    for (uint8_t w = 0; w < SENSOR_AGG_WINDOW_COUNT; w++) {
+        sensor_agg_window_state_t *window = &agg->windows[w];
+        if (window->window_ms == 0) {
+            continue;
+        }
+
+        // Close the window once the sample falls outside of it
+        if (window->started && (uint32_t)(timestamp_ms - window->start_ms) >= window->window_ms) {
+            window_report(agg, w);
+            window_reset(window, agg->field_count);
+            window->started = false;
+        }
+
+        if (!window->started) {
+            window->start_ms = timestamp_ms - timestamp_ms % window->window_ms;
+            window->started = true;
+        }
+        window->samples++;
+
+        for (uint8_t f = 0; f < agg->field_count; f++) {
+            float x = values[f];
+            if (isnan(x)) {
+                continue;
+            }
+
+            sensor_agg_field_state_t *state = &window->fields[f];
+            state->count++;
+            if (x < state->min) {
+                state->min = x;
+            }
+            if (x > state->max) {
+                state->max = x;
+            }
+
+            double delta = x - state->mean;
+            state->mean += delta / state->count;
+            state->m2 += delta * (x - state->mean);
+
+            for (int q = 0; q < SENSOR_AGG_QUANTILE_COUNT; q++) {
+                p2_add(&state->quantiles[q], x);
+            }
+        }
+    }
+}
+
+void sensor_aggregate_publish(const sensor_agg_report_t *report) {
+    // Each sensor publishes its reports as its own "<sensor>_stats" type, from the sensor's task
+    char type_name[32];
+    snprintf(type_name, sizeof(type_name), "%s_stats", report->sensor);
+    sensor_type_t type = sensor_broker_find_type(type_name);
+    if (type == SENSOR_TYPE_INVALID) {
+        ESP_LOGW(TAG, "No sample type %s registered, dropping report", type_name);
+        return;
+    }
+    sensor_broker_publish(type, report, 0);
+}
+
+void sensor_aggregate_window_label(uint32_t window_ms, char *buf, size_t size) {
+    if (window_ms % 3600000 == 0) {
+        snprintf(buf, size, "%luh", (unsigned long)(window_ms / 3600000));
+    } else if (window_ms % 60000 == 0) {
+        snprintf(buf, size, "%lum", (unsigned long)(window_ms / 60000));
+    } else {
+        snprintf(buf, size, "%lus", (unsigned long)(window_ms / 1000));
+    }
+}
@@ -1,10 +1,13 @@
 #include "sensor_buffer.h"
 
+#include <math.h>
 #include <string.h>
 #include "esp_log.h"
 
 static const char *TAG = "sensor_buffer";
 
+_Static_assert(MAX_SENSOR_SAMPLES <= UINT16_MAX, "sample_count and write_index are uint16_t");
+
 void bme690_buffer_init(bme690_sensor_buffer_t *buffer) {
     if (buffer == NULL) {
         ESP_LOGE(TAG, "Cannot initialize NULL BME690 buffer");
@@ -15,12 +18,60 @@ void bme690_buffer_init(bme690_sensor_buffer_t *buffer) {
     ESP_LOGI(TAG, "BME690 buffer initialized (max samples: %d)", MAX_SENSOR_SAMPLES);
 }
 
+static void bme690_avg_values(const bme690_data_t *sample, double values[BME690_AVG_FIELD_COUNT]) {
+    values[BME690_AVG_TEMPERATURE] = sample->temperature;
+    values[BME690_AVG_PRESSURE] = sample->pressure;
+    values[BME690_AVG_HUMIDITY] = sample->humidity;
+    values[BME690_AVG_IAQ] = sample->iaq;
+    values[BME690_AVG_IAQ_ACCURACY] = sample->iaq_accuracy;
+    values[BME690_AVG_CO2] = sample->co2_equivalent;
+    values[BME690_AVG_VOC] = sample->breath_voc_equivalent;
+}
+
+// Kahan-Babuska (Neumaier) compensated addition
+static inline void compensated_add(double *sum, double *compensation, double value) {
+    double t = *sum + value;
+    if (fabs(*sum) >= fabs(value)) {
+        *compensation += (*sum - t) + value;
+    } else {
+        *compensation += (value - t) + *sum;
+    }
+    *sum = t;
+}
+
+// Rebuild the running sums from the samples currently in the window
+static void bme690_buffer_recompute_sums(bme690_sensor_buffer_t *buffer) {
+    double values[BME690_AVG_FIELD_COUNT];
+
+    memset(buffer->sums, 0, sizeof(buffer->sums));
+    memset(buffer->compensation, 0, sizeof(buffer->compensation));
+
+    for (uint16_t i = 0; i < buffer->sample_count; i++) {
+        bme690_avg_values(&buffer->samples[i], values);
+        for (int f = 0; f < BME690_AVG_FIELD_COUNT; f++) {
+            compensated_add(&buffer->sums[f], &buffer->compensation[f], values[f]);
+        }
+    }
+
+    buffer->adds_since_recompute = 0;
+}
+
 void bme690_buffer_add(bme690_sensor_buffer_t *buffer, const bme690_data_t *data) {
     if (buffer == NULL || data == NULL) {
         ESP_LOGE(TAG, "Cannot add to NULL buffer or NULL data");
         return;
     }
 
+    double values[BME690_AVG_FIELD_COUNT];
+
+    // Remove the sample about to be overwritten from the running sums
+    if (buffer->sample_count == MAX_SENSOR_SAMPLES) {
+        bme690_avg_values(&buffer->samples[buffer->write_index], values);
+        for (int f = 0; f < BME690_AVG_FIELD_COUNT; f++) {
+            compensated_add(&buffer->sums[f], &buffer->compensation[f], -values[f]);
+        }
+    }
+
     // Add sample to circular buffer
     buffer->samples[buffer->write_index] = *data;
     buffer->write_index = (buffer->write_index + 1) % MAX_SENSOR_SAMPLES;
@@ -32,6 +83,15 @@ void bme690_buffer_add(bme690_sensor_buffer_t *buffer, const bme690_data_t *data
 
     buffer->total_samples++;
 
+    if (++buffer->adds_since_recompute >= SENSOR_BUFFER_RECOMPUTE_INTERVAL) {
+        bme690_buffer_recompute_sums(buffer);
+    } else {
+        bme690_avg_values(data, values);
+        for (int f = 0; f < BME690_AVG_FIELD_COUNT; f++) {
+            compensated_add(&buffer->sums[f], &buffer->compensation[f], values[f]);
+        }
+    }
+
     ESP_LOGD(
         TAG, "Added BME690 sample #%lu (buffer: %d/%d)", (unsigned long)buffer->total_samples, buffer->sample_count, MAX_SENSOR_SAMPLES);
 }
@@ -57,36 +117,20 @@ bme690_data_t bme690_buffer_get_averaged(const bme690_sensor_buffer_t *buffer) {
     // temperature, pressure, humidity, iaq, iaq_accuracy, co2_equivalent, breath_voc_equivalent
     // All other fields (static_iaq, gas_percentage, status flags) use latest values
 
-    double sum_temp = 0.0;
-    double sum_pressure = 0.0;
-    double sum_humidity = 0.0;
-    double sum_iaq = 0.0;
-    double sum_iaq_acc = 0.0;
-    double sum_co2 = 0.0;
-    double sum_voc = 0.0;
-
-    for (uint16_t i = 0; i < buffer->sample_count; i++) {
-        const bme690_data_t *sample = &buffer->samples[i];
-
-        sum_temp += sample->temperature;
-        sum_pressure += sample->pressure;
-        sum_humidity += sample->humidity;
-        sum_iaq += sample->iaq;
-        sum_iaq_acc += sample->iaq_accuracy;
-        sum_co2 += sample->co2_equivalent;
-        sum_voc += sample->breath_voc_equivalent;
-    }
-
+    double mean[BME690_AVG_FIELD_COUNT];
     uint16_t count = buffer->sample_count;
+    for (int f = 0; f < BME690_AVG_FIELD_COUNT; f++) {
+        mean[f] = (buffer->sums[f] + buffer->compensation[f]) / count;
+    }
 
     // Replace only the averaged fields
-    averaged.temperature = (float)(sum_temp / count);
-    averaged.pressure = (float)(sum_pressure / count);
-    averaged.humidity = (float)(sum_humidity / count);
-    averaged.iaq = (float)(sum_iaq / count);
-    averaged.iaq_accuracy = (uint8_t)(sum_iaq_acc / count + 0.5); // Round to nearest
-    averaged.co2_equivalent = (float)(sum_co2 / count);
-    averaged.breath_voc_equivalent = (float)(sum_voc / count);
+    averaged.temperature = (float)mean[BME690_AVG_TEMPERATURE];
+    averaged.pressure = (float)mean[BME690_AVG_PRESSURE];
+    averaged.humidity = (float)mean[BME690_AVG_HUMIDITY];
+    averaged.iaq = (float)mean[BME690_AVG_IAQ];
+    averaged.iaq_accuracy = (uint8_t)(mean[BME690_AVG_IAQ_ACCURACY] + 0.5); // Round to nearest
+    averaged.co2_equivalent = (float)mean[BME690_AVG_CO2];
+    averaged.breath_voc_equivalent = (float)mean[BME690_AVG_VOC];
 
     // All other fields keep their latest values:
     // - static_iaq (from latest sample)
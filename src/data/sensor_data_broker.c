@@ -1,127 +1,509 @@
 #include "sensor_data_broker.h"
 
+#include <stdio.h>
 #include <string.h>
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 static const char *TAG = "sensor_broker";
 
-#define MAX_BME690_CALLBACKS 4
-#define MAX_BMV080_CALLBACKS 4
+typedef struct {
+    const sensor_type_desc_t *desc;
+    uint32_t publish_count;
+    uint32_t drop_count; // Publishes lost to an exhausted pool
+} sensor_type_entry_t;
 
-// Callback arrays
-static bme690_data_callback_t bme690_callbacks[MAX_BME690_CALLBACKS] = {0};
-static bmv080_data_callback_t bmv080_callbacks[MAX_BMV080_CALLBACKS] = {0};
+// Type and subscriber tables are append-only: an entry is filled before the
+// count that makes it visible is incremented, so publishers never see a
+// partially written entry
+static sensor_type_entry_t types[SENSOR_BUS_MAX_TYPES];
+static atomic_uint type_count;
 
-// Callback counters
-static uint8_t bme690_callback_count = 0;
-static uint8_t bmv080_callback_count = 0;
+#define QUEUE_MASK (SENSOR_BUS_QUEUE_DEPTH - 1)
+_Static_assert((SENSOR_BUS_QUEUE_DEPTH & QUEUE_MASK) == 0, "SENSOR_BUS_QUEUE_DEPTH must be a power of two");
 
-// Statistics for debugging
-static uint32_t bme690_publish_count = 0;
-static uint32_t bmv080_publish_count = 0;
+// Subscriber with its delivery queue. The queue is a ring of retained samples
+// written only by the publishing task and drained by the dispatcher task. Both
+// sides advance `read` with a CAS, which lets a drop-oldest producer discard
+// the head without a lock.
+typedef struct {
+    sensor_subscriber_config_t config;
+    _Atomic(sensor_sample_t *) ring[SENSOR_BUS_QUEUE_DEPTH];
+    atomic_uint read;
+    atomic_uint write;
+    _Atomic(sensor_sample_t *) latest;      // SENSOR_OVERFLOW_COALESCE_LATEST mailbox
+    _Atomic(TaskHandle_t) blocked_producer; // SENSOR_OVERFLOW_BLOCK producer waiting for space
+    atomic_uint drop_count;
 
-void sensor_broker_init(void) {
-    // Clear all callbacks
-    memset(bme690_callbacks, 0, sizeof(bme690_callbacks));
-    memset(bmv080_callbacks, 0, sizeof(bmv080_callbacks));
+    // Written only by the delivering task (dispatcher, or the publisher for synchronous subscribers)
+    uint32_t invocations;
+    uint64_t callback_total_us;
+    uint32_t callback_max_us;
+    uint32_t latency_max_us;
+    uint32_t latency_histogram[SENSOR_BUS_LATENCY_BUCKETS];
+} sensor_subscriber_t;
+
+static const uint32_t latency_bounds_us[SENSOR_BUS_LATENCY_BUCKETS - 1] = SENSOR_BUS_LATENCY_BOUNDS_US;
+
+static sensor_subscriber_t subscribers[SENSOR_BUS_MAX_SUBSCRIBERS];
+static atomic_uint subscriber_count;
 
-    bme690_callback_count = 0;
-    bmv080_callback_count = 0;
+// Sample pool
+static sensor_sample_t pool[SENSOR_BUS_POOL_SIZE];
+static atomic_uint sequence;
 
-    bme690_publish_count = 0;
-    bmv080_publish_count = 0;
+// Dispatcher
+static TaskHandle_t dispatcher_handle = NULL;
+static atomic_uint pending; // Queued deliveries not yet completed
 
-    ESP_LOGI(TAG, "Sensor data broker initialized");
+static void validate_bme690(const void *sample) {
+    const bme690_data_t *data = sample;
+
+    // Validate data ranges (basic sanity check)
+    if (data->temperature < -40.0f || data->temperature > 85.0f) {
+        ESP_LOGW(TAG, "BME690 temperature out of range: %.2f°C", data->temperature);
+    }
+    if (data->humidity < 0.0f || data->humidity > 100.0f) {
+        ESP_LOGW(TAG, "BME690 humidity out of range: %.2f%%", data->humidity);
+    }
+    if (data->pressure < 30000.0f || data->pressure > 110000.0f) {
+        ESP_LOGW(TAG, "BME690 pressure out of range: %.2f Pa", data->pressure);
+    }
 }
 
-void sensor_broker_register_bme690_callback(bme690_data_callback_t callback) {
-    if (callback == NULL) {
-        ESP_LOGW(TAG, "Attempted to register NULL BME690 callback");
-        return;
+static void validate_bmv080(const void *sample) {
+    const bmv080_data_t *data = sample;
+
+    // Validate data ranges (basic sanity check)
+    if (data->pm10 < 0.0f || data->pm10 > 1000.0f) {
+        ESP_LOGW(TAG, "BMV080 PM10 out of expected range: %.2f µg/m³", data->pm10);
     }
+    if (data->pm25 < 0.0f || data->pm25 > 1000.0f) {
+        ESP_LOGW(TAG, "BMV080 PM2.5 out of expected range: %.2f µg/m³", data->pm25);
+    }
+    if (data->pm1 < 0.0f || data->pm1 > 1000.0f) {
+        ESP_LOGW(TAG, "BMV080 PM1 out of expected range: %.2f µg/m³", data->pm1);
+    }
+}
 
-    if (bme690_callback_count >= MAX_BME690_CALLBACKS) {
-        ESP_LOGE(TAG, "Maximum BME690 callbacks reached (%d)", MAX_BME690_CALLBACKS);
-        return;
+// Built-in types, in sensor_builtin_type_t order
+static const sensor_type_desc_t builtin_types[SENSOR_TYPE_BUILTIN_COUNT] = {
+    {.name = "bme690", .sample_size = sizeof(bme690_data_t), .validate = validate_bme690},
+    {.name = "bmv080", .sample_size = sizeof(bmv080_data_t), .validate = validate_bmv080},
+    {.name = "bme690_stats", .sample_size = sizeof(sensor_agg_report_t), .validate = NULL},
+    {.name = "bmv080_stats", .sample_size = sizeof(sensor_agg_report_t), .validate = NULL},
+    {.name = "bme690_raw", .sample_size = sizeof(bme690_raw_data_t), .validate = NULL},
+};
+
+// Run a subscriber's callback and account its latency and duration
+static void subscriber_deliver(sensor_subscriber_t *sub, sensor_sample_t *sample) {
+    int64_t start = esp_timer_get_time();
+    sub->config.callback(sample, sub->config.ctx);
+    uint32_t duration = (uint32_t)(esp_timer_get_time() - start);
+    uint32_t latency = (uint32_t)(start - sample->publish_us);
+
+    int bucket = 0;
+    while (bucket < SENSOR_BUS_LATENCY_BUCKETS - 1 && latency >= latency_bounds_us[bucket]) {
+        bucket++;
+    }
+
+    sub->invocations++;
+    sub->callback_total_us += duration;
+    if (duration > sub->callback_max_us) {
+        sub->callback_max_us = duration;
     }
+    if (latency > sub->latency_max_us) {
+        sub->latency_max_us = latency;
+    }
+    sub->latency_histogram[bucket]++;
+}
+
+// Take the oldest queued sample, NULL if the queue is empty
+static sensor_sample_t *subscriber_dequeue(sensor_subscriber_t *sub) {
+    if (sub->config.overflow == SENSOR_OVERFLOW_COALESCE_LATEST) {
+        return atomic_exchange(&sub->latest, NULL);
+    }
+
+    for (;;) {
+        unsigned r = atomic_load_explicit(&sub->read, memory_order_relaxed);
+        if (r == atomic_load_explicit(&sub->write, memory_order_acquire)) {
+            return NULL;
+        }
 
-    bme690_callbacks[bme690_callback_count] = callback;
-    bme690_callback_count++;
+        sensor_sample_t *sample = atomic_load_explicit(&sub->ring[r & QUEUE_MASK], memory_order_relaxed);
+        // Fails only if the producer discarded this entry in the meantime
+        if (atomic_compare_exchange_weak(&sub->read, &r, r + 1)) {
+            return sample;
+        }
+    }
+}
 
-    ESP_LOGI(TAG, "Registered BME690 callback #%d", bme690_callback_count);
+static void subscriber_drop(sensor_subscriber_t *sub, sensor_sample_t *sample) {
+    unsigned drops = atomic_fetch_add(&sub->drop_count, 1) + 1;
+    ESP_LOGD(TAG, "Subscriber %s queue full, dropped sample #%lu (%u total)", sub->config.name ? sub->config.name : "?",
+        (unsigned long)sample->sequence, drops);
 }
 
-void sensor_broker_register_bmv080_callback(bmv080_data_callback_t callback) {
-    if (callback == NULL) {
-        ESP_LOGW(TAG, "Attempted to register NULL BMV080 callback");
-        return;
+// Wait for the dispatcher to make room, false on timeout
+static bool subscriber_wait_for_space(sensor_subscriber_t *sub, unsigned w) {
+    uint32_t timeout_ms = sub->config.block_timeout_ms ? sub->config.block_timeout_ms : SENSOR_BUS_BLOCK_TIMEOUT_MS;
+    TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+    if (timeout == 0) {
+        timeout = 1;
     }
+    TickType_t start = xTaskGetTickCount();
+    bool space = true;
 
-    if (bmv080_callback_count >= MAX_BMV080_CALLBACKS) {
-        ESP_LOGE(TAG, "Maximum BMV080 callbacks reached (%d)", MAX_BMV080_CALLBACKS);
-        return;
+    // Register before re-checking, so a dequeue in between still leaves a notification pending
+    atomic_store(&sub->blocked_producer, xTaskGetCurrentTaskHandle());
+    while (w - atomic_load(&sub->read) >= SENSOR_BUS_QUEUE_DEPTH) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout) {
+            space = false;
+            break;
+        }
+        ulTaskNotifyTake(pdTRUE, timeout - elapsed);
     }
+    atomic_store(&sub->blocked_producer, NULL);
+    return space;
+}
 
-    bmv080_callbacks[bmv080_callback_count] = callback;
-    bmv080_callback_count++;
+// Queue a sample for the dispatcher according to the overflow policy
+static bool subscriber_enqueue(sensor_subscriber_t *sub, sensor_sample_t *sample) {
+    if (sub->config.overflow == SENSOR_OVERFLOW_COALESCE_LATEST) {
+        sensor_sample_retain(sample);
+        atomic_fetch_add(&pending, 1);
+        sensor_sample_t *replaced = atomic_exchange(&sub->latest, sample);
+        if (replaced != NULL) {
+            subscriber_drop(sub, replaced);
+            sensor_sample_release(replaced);
+            atomic_fetch_sub(&pending, 1);
+        }
+        return true;
+    }
 
-    ESP_LOGI(TAG, "Registered BMV080 callback #%d", bmv080_callback_count);
+    unsigned w = atomic_load_explicit(&sub->write, memory_order_relaxed);
+    for (;;) {
+        unsigned r = atomic_load(&sub->read);
+        if (w - r < SENSOR_BUS_QUEUE_DEPTH) {
+            break;
+        }
+
+        if (sub->config.overflow == SENSOR_OVERFLOW_BLOCK) {
+            if (!subscriber_wait_for_space(sub, w)) {
+                subscriber_drop(sub, sample);
+                return false;
+            }
+            break;
+        }
+
+        // Drop oldest, unless the dispatcher took it first
+        sensor_sample_t *oldest = atomic_load_explicit(&sub->ring[r & QUEUE_MASK], memory_order_relaxed);
+        if (atomic_compare_exchange_strong(&sub->read, &r, r + 1)) {
+            subscriber_drop(sub, oldest);
+            sensor_sample_release(oldest);
+            atomic_fetch_sub(&pending, 1);
+            break;
+        }
+    }
+
+    sensor_sample_retain(sample);
+    atomic_fetch_add(&pending, 1);
+    atomic_store_explicit(&sub->ring[w & QUEUE_MASK], sample, memory_order_relaxed);
+    atomic_store_explicit(&sub->write, w + 1, memory_order_release);
+    return true;
 }
 
-void sensor_broker_publish_bme690(const bme690_data_t *data, bool is_averaged) {
-    if (data == NULL) {
-        ESP_LOGW(TAG, "Attempted to publish NULL BME690 data");
-        return;
+// Deliver queued samples round-robin, one per subscriber per pass
+static void dispatcher_task(void *arg) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        bool delivered;
+        do {
+            delivered = false;
+            unsigned count = atomic_load(&subscriber_count);
+            for (unsigned i = 0; i < count; i++) {
+                sensor_subscriber_t *sub = &subscribers[i];
+                if (sub->config.synchronous) {
+                    continue;
+                }
+
+                sensor_sample_t *sample = subscriber_dequeue(sub);
+                if (sample == NULL) {
+                    continue;
+                }
+
+                TaskHandle_t producer = atomic_load(&sub->blocked_producer);
+                if (producer != NULL) {
+                    xTaskNotifyGive(producer);
+                }
+
+                subscriber_deliver(sub, sample);
+                sensor_sample_release(sample);
+                atomic_fetch_sub(&pending, 1);
+                delivered = true;
+            }
+        } while (delivered);
     }
+}
 
-    bme690_publish_count++;
+void sensor_broker_init(void) {
+    memset(types, 0, sizeof(types));
+    memset(subscribers, 0, sizeof(subscribers));
+    memset(pool, 0, sizeof(pool));
+    atomic_store(&type_count, 0);
+    atomic_store(&subscriber_count, 0);
+    atomic_store(&sequence, 0);
+    atomic_store(&pending, 0);
 
-    // Validate data ranges (basic sanity check)
-    if (data->temperature < -40.0f || data->temperature > 85.0f) {
-        ESP_LOGW(TAG, "BME690 temperature out of range: %.2f°C", data->temperature);
+    for (int i = 0; i < SENSOR_TYPE_BUILTIN_COUNT; i++) {
+        sensor_broker_register_type(&builtin_types[i]);
     }
-    if (data->humidity < 0.0f || data->humidity > 100.0f) {
-        ESP_LOGW(TAG, "BME690 humidity out of range: %.2f%%", data->humidity);
+
+    if (dispatcher_handle == NULL &&
+        xTaskCreate(dispatcher_task, "sensor_bus", SENSOR_BUS_DISPATCHER_STACK, NULL, SENSOR_BUS_DISPATCHER_PRIORITY, &dispatcher_handle) !=
+            pdPASS) {
+        ESP_LOGE(TAG, "Failed to start dispatcher task, all subscribers run synchronously");
     }
-    if (data->pressure < 30000.0f || data->pressure > 110000.0f) {
-        ESP_LOGW(TAG, "BME690 pressure out of range: %.2f Pa", data->pressure);
+
+    ESP_LOGI(TAG, "Sensor data bus initialized (%d slots of %u bytes)", SENSOR_BUS_POOL_SIZE, (unsigned)sizeof(sensor_sample_t));
+}
+
+sensor_type_t sensor_broker_register_type(const sensor_type_desc_t *desc) {
+    if (desc == NULL || desc->name == NULL) {
+        ESP_LOGW(TAG, "Attempted to register NULL sample type");
+        return SENSOR_TYPE_INVALID;
+    }
+
+    if (desc->sample_size > sizeof(sensor_sample_payload_t)) {
+        ESP_LOGE(TAG, "Sample type %s too large (%u > %u bytes)", desc->name, (unsigned)desc->sample_size,
+            (unsigned)sizeof(sensor_sample_payload_t));
+        return SENSOR_TYPE_INVALID;
     }
 
-    // Call all registered callbacks
-    for (uint8_t i = 0; i < bme690_callback_count; i++) {
-        if (bme690_callbacks[i] != NULL) {
-            bme690_callbacks[i](data, is_averaged);
+    unsigned count = atomic_load(&type_count);
+    if (count >= SENSOR_BUS_MAX_TYPES) {
+        ESP_LOGE(TAG, "Maximum sample types reached (%d)", SENSOR_BUS_MAX_TYPES);
+        return SENSOR_TYPE_INVALID;
+    }
+
+    types[count].desc = desc;
+    types[count].publish_count = 0;
+    types[count].drop_count = 0;
+    atomic_store(&type_count, count + 1);
+
+    ESP_LOGI(TAG, "Registered sample type #%u '%s' (%u bytes)", count, desc->name, (unsigned)desc->sample_size);
+    return (sensor_type_t)count;
+}
+
+sensor_type_t sensor_broker_find_type(const char *name) {
+    if (name == NULL) {
+        return SENSOR_TYPE_INVALID;
+    }
+
+    unsigned count = atomic_load(&type_count);
+    for (unsigned i = 0; i < count; i++) {
+        if (strcmp(types[i].desc->name, name) == 0) {
+            return (sensor_type_t)i;
         }
     }
+    return SENSOR_TYPE_INVALID;
+}
 
-    ESP_LOGD(TAG, "Published BME690 data (%s) to %d callbacks", is_averaged ? "averaged" : "raw", bme690_callback_count);
+const sensor_type_desc_t *sensor_broker_get_type(sensor_type_t type) {
+    if (type >= atomic_load(&type_count)) {
+        return NULL;
+    }
+    return types[type].desc;
 }
 
-void sensor_broker_publish_bmv080(const bmv080_data_t *data) {
-    if (data == NULL) {
-        ESP_LOGW(TAG, "Attempted to publish NULL BMV080 data");
+bool sensor_broker_subscribe(const sensor_subscriber_config_t *config) {
+    if (config == NULL || config->callback == NULL) {
+        ESP_LOGW(TAG, "Attempted to register NULL subscriber");
+        return false;
+    }
+
+    if (config->type >= atomic_load(&type_count)) {
+        ESP_LOGE(TAG, "Subscriber %s: unknown sample type %u", config->name ? config->name : "?", config->type);
+        return false;
+    }
+
+    unsigned count = atomic_load(&subscriber_count);
+    if (count >= SENSOR_BUS_MAX_SUBSCRIBERS) {
+        ESP_LOGE(TAG, "Maximum subscribers reached (%d)", SENSOR_BUS_MAX_SUBSCRIBERS);
+        return false;
+    }
+
+    sensor_subscriber_t *sub = &subscribers[count];
+    memset(sub, 0, sizeof(*sub));
+    sub->config = *config;
+    if (dispatcher_handle == NULL) {
+        sub->config.synchronous = true;
+    }
+    atomic_store(&subscriber_count, count + 1);
+
+    ESP_LOGI(TAG, "Registered %s subscriber #%u '%s' for %s", sub->config.synchronous ? "synchronous" : "queued", count + 1,
+        config->name ? config->name : "?", types[config->type].desc->name);
+    return true;
+}
+
+sensor_sample_t *sensor_broker_acquire(sensor_type_t type) {
+    if (type >= atomic_load(&type_count)) {
+        ESP_LOGW(TAG, "Attempted to acquire slot for unknown sample type %u", type);
+        return NULL;
+    }
+
+    for (int i = 0; i < SENSOR_BUS_POOL_SIZE; i++) {
+        unsigned expected = 0;
+        if (atomic_compare_exchange_strong(&pool[i].refcount, &expected, 1)) {
+            pool[i].type = type;
+            pool[i].flags = 0;
+            return &pool[i];
+        }
+    }
+
+    types[type].drop_count++;
+    ESP_LOGW(TAG, "Sample pool exhausted, dropping %s sample", types[type].desc->name);
+    return NULL;
+}
+
+void sensor_broker_commit(sensor_sample_t *sample, uint32_t flags) {
+    if (sample == NULL) {
+        ESP_LOGW(TAG, "Attempted to publish NULL sample");
         return;
     }
 
-    bmv080_publish_count++;
+    sensor_type_entry_t *entry = &types[sample->type];
+    sample->flags = flags;
+    sample->sequence = atomic_fetch_add(&sequence, 1) + 1;
+    sample->publish_us = esp_timer_get_time();
+    entry->publish_count++;
 
-    // Validate data ranges (basic sanity check)
-    if (data->pm10 < 0.0f || data->pm10 > 1000.0f) {
-        ESP_LOGW(TAG, "BMV080 PM10 out of expected range: %.2f µg/m³", data->pm10);
+    if (entry->desc->validate != NULL) {
+        entry->desc->validate(&sample->payload);
     }
-    if (data->pm25 < 0.0f || data->pm25 > 1000.0f) {
-        ESP_LOGW(TAG, "BMV080 PM2.5 out of expected range: %.2f µg/m³", data->pm25);
+
+    // Call synchronous subscribers in place, queue the sample for all others
+    unsigned count = atomic_load(&subscriber_count);
+    unsigned delivered = 0;
+    unsigned queued = 0;
+    for (unsigned i = 0; i < count; i++) {
+        sensor_subscriber_t *sub = &subscribers[i];
+        if (sub->config.type != sample->type) {
+            continue;
+        }
+
+        if (sub->config.synchronous) {
+            subscriber_deliver(sub, sample);
+            delivered++;
+        } else if (subscriber_enqueue(sub, sample)) {
+            queued++;
+        }
     }
-    if (data->pm1 < 0.0f || data->pm1 > 1000.0f) {
-        ESP_LOGW(TAG, "BMV080 PM1 out of expected range: %.2f µg/m³", data->pm1);
+
+    if (queued > 0) {
+        xTaskNotifyGive(dispatcher_handle);
+    }
+
+    ESP_LOGD(TAG, "Published %s sample #%lu to %u subscribers, %u queued", entry->desc->name, (unsigned long)sample->sequence, delivered,
+        queued);
+}
+
+bool sensor_broker_publish(sensor_type_t type, const void *data, uint32_t flags) {
+    if (data == NULL) {
+        ESP_LOGW(TAG, "Attempted to publish NULL data");
+        return false;
     }
 
-    // Call all registered callbacks
-    for (uint8_t i = 0; i < bmv080_callback_count; i++) {
-        if (bmv080_callbacks[i] != NULL) {
-            bmv080_callbacks[i](data);
+    sensor_sample_t *sample = sensor_broker_acquire(type);
+    if (sample == NULL) {
+        return false;
+    }
+
+    memcpy(&sample->payload, data, types[type].desc->sample_size);
+    sensor_broker_commit(sample, flags);
+    sensor_sample_release(sample);
+    return true;
+}
+
+bool sensor_broker_flush(uint32_t timeout_ms) {
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+
+    while (atomic_load(&pending) != 0) {
+        if (xTaskGetTickCount() - start >= timeout) {
+            return false;
         }
+        vTaskDelay(1);
+    }
+    return true;
+}
+
+unsigned sensor_broker_type_count(void) {
+    return atomic_load(&type_count);
+}
+
+unsigned sensor_broker_subscriber_count(void) {
+    return atomic_load(&subscriber_count);
+}
+
+bool sensor_broker_get_type_stats(sensor_type_t type, sensor_type_stats_t *stats) {
+    if (stats == NULL || type >= atomic_load(&type_count)) {
+        return false;
     }
 
-    ESP_LOGD(TAG, "Published BMV080 data to %d callbacks", bmv080_callback_count);
-}
\ No newline at end of file
+    stats->name = types[type].desc->name;
+    stats->publish_count = types[type].publish_count;
+    stats->drop_count = types[type].drop_count;
+    return true;
+}
+
+bool sensor_broker_get_subscriber_stats(unsigned index, sensor_subscriber_stats_t *stats) {
+    if (stats == NULL || index >= atomic_load(&subscriber_count)) {
+        return false;
+    }
+
+    const sensor_subscriber_t *sub = &subscribers[index];
+    stats->name = sub->config.name;
+    stats->type = sub->config.type;
+    stats->synchronous = sub->config.synchronous;
+    stats->invocations = sub->invocations;
+    stats->drop_count = atomic_load(&sub->drop_count);
+    stats->callback_avg_us = sub->invocations ? (uint32_t)(sub->callback_total_us / sub->invocations) : 0;
+    stats->callback_max_us = sub->callback_max_us;
+    stats->latency_max_us = sub->latency_max_us;
+    memcpy(stats->latency_histogram, sub->latency_histogram, sizeof(stats->latency_histogram));
+
+    if (sub->config.synchronous) {
+        stats->queued = 0;
+    } else if (sub->config.overflow == SENSOR_OVERFLOW_COALESCE_LATEST) {
+        stats->queued = atomic_load(&sub->latest) != NULL;
+    } else {
+        stats->queued = atomic_load(&sub->write) - atomic_load(&sub->read);
+    }
+    return true;
+}
+
+void sensor_sample_retain(const sensor_sample_t *sample) {
+    if (sample == NULL) {
+        return;
+    }
+
+    // The refcount is the only mutable part of a published sample
+    atomic_fetch_add(&((sensor_sample_t *)sample)->refcount, 1);
+}
+
+void sensor_sample_release(const sensor_sample_t *sample) {
+    if (sample == NULL) {
+        return;
+    }
+
+    unsigned previous = atomic_fetch_sub(&((sensor_sample_t *)sample)->refcount, 1);
+    if (previous == 0) {
+        atomic_store(&((sensor_sample_t *)sample)->refcount, 0);
+        ESP_LOGE(TAG, "Sample released more often than retained");
+    }
+}
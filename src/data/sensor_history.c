@@ -0,0 +1,295 @@
+#include "sensor_history.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+
+#include "sensor_data_broker.h"
+
+static const char *TAG = "sensor_history";
+
+const sensor_history_field_t sensor_history_bme690_fields[] = {
+    {"temperature", offsetof(bme690_data_t, temperature), 0.01f},
+    {"humidity", offsetof(bme690_data_t, humidity), 0.01f},
+    {"pressure", offsetof(bme690_data_t, pressure), 4.0f},
+    {"iaq", offsetof(bme690_data_t, iaq), 0.1f},
+    {"co2", offsetof(bme690_data_t, co2_equivalent), 0.5f},
+    {"voc", offsetof(bme690_data_t, breath_voc_equivalent), 0.05f},
+};
+const uint8_t sensor_history_bme690_field_count = sizeof(sensor_history_bme690_fields) / sizeof(sensor_history_bme690_fields[0]);
+
+const sensor_history_field_t sensor_history_bmv080_fields[] = {
+    {"pm10", offsetof(bmv080_data_t, pm10), 0.1f},
+    {"pm25", offsetof(bmv080_data_t, pm25), 0.1f},
+    {"pm1", offsetof(bmv080_data_t, pm1), 0.1f},
+};
+const uint8_t sensor_history_bmv080_field_count = sizeof(sensor_history_bmv080_fields) / sizeof(sensor_history_bmv080_fields[0]);
+
+static const sensor_history_tier_config_t default_tiers[SENSOR_HISTORY_TIER_COUNT] = SENSOR_HISTORY_DEFAULT_TIERS;
+
+static int16_t quantize(float value, float resolution) {
+    float q = roundf(value / resolution);
+    if (isnan(q)) {
+        return 0;
+    }
+    if (q <= -INT16_MAX) {
+        return -INT16_MAX;
+    }
+    return q >= INT16_MAX ? INT16_MAX : (int16_t)q;
+}
+
+// True if a is before b. Timestamps wrap after 49.7 days, so times are
+// compared by their distance, which works while they are less than 24.8 days apart.
+static inline bool ms_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+// Ring slot of the stored bucket at index (0 for the oldest)
+static inline uint32_t slot_for_index(const sensor_history_tier_t *tier, uint32_t index) {
+    return (tier->head + tier->capacity - tier->count + index) % tier->capacity;
+}
+
+static size_t tier_size(uint8_t field_count, uint32_t buckets) {
+    return (size_t)buckets * (sizeof(uint32_t) + sizeof(uint16_t) + field_count * sizeof(sensor_history_value_t));
+}
+
+size_t sensor_history_storage_size(uint8_t field_count, const sensor_history_tier_config_t *tiers) {
+    if (tiers == NULL) {
+        tiers = default_tiers;
+    }
+
+    size_t size = 0;
+    for (int t = 0; t < SENSOR_HISTORY_TIER_COUNT; t++) {
+        size += tier_size(field_count, tiers[t].buckets);
+    }
+    return size;
+}
+
+bool sensor_history_init(sensor_history_t *history, const char *sensor, const sensor_history_field_t *fields, uint8_t field_count,
+    const sensor_history_tier_config_t *tiers) {
+    if (tiers == NULL) {
+        tiers = default_tiers;
+    }
+    bool valid = history != NULL && fields != NULL && field_count > 0 && field_count <= SENSOR_HISTORY_MAX_FIELDS;
+    for (int t = 0; valid && t < SENSOR_HISTORY_TIER_COUNT; t++) {
+        valid = tiers[t].bucket_ms > 0 && tiers[t].buckets > 0 && (t == 0 || tiers[t].bucket_ms > tiers[t - 1].bucket_ms);
+    }
+    if (!valid) {
+        ESP_LOGE(TAG, "Invalid history arguments");
+        return false;
+    }
+
+    memset(history, 0, sizeof(sensor_history_t));
+    history->sensor = sensor;
+    history->fields = fields;
+    history->field_count = field_count;
+
+    // One allocation, widest columns of all tiers first so every column stays aligned
+    size_t size = sensor_history_storage_size(field_count, tiers);
+    uint8_t *storage = calloc(1, size);
+    if (storage == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for the %s history", (unsigned)size, sensor);
+        return false;
+    }
+
+    uint8_t *column = storage;
+    for (int t = 0; t < SENSOR_HISTORY_TIER_COUNT; t++) {
+        history->tiers[t].bucket_ms = tiers[t].bucket_ms;
+        history->tiers[t].capacity = tiers[t].buckets;
+        history->tiers[t].start_ms = (uint32_t *)column;
+        column += tiers[t].buckets * sizeof(uint32_t);
+    }
+    for (int t = 0; t < SENSOR_HISTORY_TIER_COUNT; t++) {
+        history->tiers[t].values = (sensor_history_value_t *)column;
+        column += (size_t)tiers[t].buckets * field_count * sizeof(sensor_history_value_t);
+    }
+    for (int t = 0; t < SENSOR_HISTORY_TIER_COUNT; t++) {
+        history->tiers[t].samples = (uint16_t *)column;
+        column += tiers[t].buckets * sizeof(uint16_t);
+    }
+
+    ESP_LOGI(TAG, "History for %s initialized (%u bytes)", sensor, (unsigned)size);
+    return true;
+}
+
+void sensor_history_deinit(sensor_history_t *history) {
+    if (history == NULL) {
+        return;
+    }
+
+    free(history->tiers[0].start_ms);
+    memset(history, 0, sizeof(sensor_history_t));
+}
+
+// Quantize the open bucket into the ring, overwriting the oldest bucket when full
+static void close_bucket(const sensor_history_t *history, sensor_history_tier_t *tier) {
+    uint32_t slot = tier->head;
+    tier->start_ms[slot] = tier->open_start_ms;
+    tier->samples[slot] = tier->open_count > UINT16_MAX ? UINT16_MAX : (uint16_t)tier->open_count;
+
+    sensor_history_value_t *values = &tier->values[(size_t)slot * history->field_count];
+    for (uint8_t f = 0; f < history->field_count; f++) {
+        float resolution = history->fields[f].resolution;
+        values[f].min = quantize(tier->open_min[f], resolution);
+        values[f].mean = quantize((float)(tier->open_sum[f] / tier->open_count), resolution);
+        values[f].max = quantize(tier->open_max[f], resolution);
+    }
+
+    tier->head = (tier->head + 1) % tier->capacity;
+    if (tier->count < tier->capacity) {
+        tier->count++;
+    }
+    tier->open_count = 0;
+}
+
+void sensor_history_add(sensor_history_t *history, const void *sample, uint32_t timestamp_ms) {
+    if (history == NULL || history->tiers[0].start_ms == NULL || sample == NULL) {
+        ESP_LOGE(TAG, "Cannot add to NULL history or NULL sample");
+        return;
+    }
+
+    float values[SENSOR_HISTORY_MAX_FIELDS];
+    for (uint8_t f = 0; f < history->field_count; f++) {
+        memcpy(&values[f], (const uint8_t *)sample + history->fields[f].offset, sizeof(float));
+    }
+
+    for (int t = 0; t < SENSOR_HISTORY_TIER_COUNT; t++) {
+        sensor_history_tier_t *tier = &history->tiers[t];
+        uint32_t start_ms = timestamp_ms - timestamp_ms % tier->bucket_ms;
+
+        // Close the open bucket once the sample falls after it, a sample older than it is counted in it
+        if (tier->open_count > 0 && !ms_before(timestamp_ms, tier->open_start_ms) &&
+            (uint32_t)(timestamp_ms - tier->open_start_ms) >= tier->bucket_ms) {
+            close_bucket(history, tier);
+        }
+        if (tier->open_count == 0) {
+            tier->open_start_ms = start_ms;
+            for (uint8_t f = 0; f < history->field_count; f++) {
+                tier->open_min[f] = INFINITY;
+                tier->open_max[f] = -INFINITY;
+                tier->open_sum[f] = 0.0;
+            }
+        }
+
+        for (uint8_t f = 0; f < history->field_count; f++) {
+            tier->open_min[f] = fminf(tier->open_min[f], values[f]);
+            tier->open_max[f] = fmaxf(tier->open_max[f], values[f]);
+            tier->open_sum[f] += values[f];
+        }
+        tier->open_count++;
+    }
+}
+
+// True if the tier holds everything since boot or a bucket from before from_ms
+static bool tier_reaches(const sensor_history_tier_t *tier, uint32_t from_ms) {
+    return tier->count < tier->capacity || !ms_before(from_ms, tier->start_ms[slot_for_index(tier, 0)]);
+}
+
+void sensor_history_query_begin(const sensor_history_t *history, sensor_history_query_t *query, uint32_t from_ms, uint32_t to_ms,
+    uint32_t step_ms) {
+    uint8_t tier = SENSOR_HISTORY_TIER_COUNT - 1;
+    for (uint8_t t = 0; t < SENSOR_HISTORY_TIER_COUNT; t++) {
+        if (tier_reaches(&history->tiers[t], from_ms)) {
+            tier = t;
+            break;
+        }
+    }
+
+    uint32_t bucket_ms = history->tiers[tier].bucket_ms;
+    if (step_ms > UINT32_MAX / 2) {
+        step_ms = UINT32_MAX / 2;
+    }
+    step_ms = step_ms <= bucket_ms ? bucket_ms : (step_ms + bucket_ms - 1) / bucket_ms * bucket_ms;
+
+    *query = (sensor_history_query_t){
+        .tier = tier,
+        .step_ms = step_ms,
+        .next_ms = from_ms - from_ms % step_ms,
+        .to_ms = to_ms,
+    };
+}
+
+// Index of the oldest stored bucket starting at or after start_ms, count if none
+static uint32_t find_bucket(const sensor_history_tier_t *tier, uint32_t start_ms) {
+    uint32_t low = 0;
+    uint32_t high = tier->count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (ms_before(tier->start_ms[slot_for_index(tier, mid)], start_ms)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+bool sensor_history_query_next(const sensor_history_t *history, sensor_history_query_t *query, sensor_history_point_t *point) {
+    const sensor_history_tier_t *tier = &history->tiers[query->tier];
+
+    while (ms_before(query->next_ms, query->to_ms)) {
+        uint32_t start_ms = query->next_ms;
+        uint32_t end_ms = start_ms + query->step_ms;
+        query->next_ms = end_ms;
+
+        double sum[SENSOR_HISTORY_MAX_FIELDS] = {0};
+        point->start_ms = start_ms;
+        point->count = 0;
+        for (uint8_t f = 0; f < history->field_count; f++) {
+            point->min[f] = INFINITY;
+            point->max[f] = -INFINITY;
+        }
+
+        uint32_t index = find_bucket(tier, start_ms);
+        for (; index < tier->count; index++) {
+            uint32_t slot = slot_for_index(tier, index);
+            if (!ms_before(tier->start_ms[slot], end_ms)) {
+                break;
+            }
+
+            const sensor_history_value_t *values = &tier->values[(size_t)slot * history->field_count];
+            uint16_t samples = tier->samples[slot];
+            for (uint8_t f = 0; f < history->field_count; f++) {
+                float resolution = history->fields[f].resolution;
+                point->min[f] = fminf(point->min[f], values[f].min * resolution);
+                point->max[f] = fmaxf(point->max[f], values[f].max * resolution);
+                sum[f] += (double)values[f].mean * resolution * samples;
+            }
+            point->count += samples;
+        }
+
+        bool open_in_step =
+            tier->open_count > 0 && !ms_before(tier->open_start_ms, start_ms) && ms_before(tier->open_start_ms, end_ms);
+        if (open_in_step) {
+            for (uint8_t f = 0; f < history->field_count; f++) {
+                point->min[f] = fminf(point->min[f], tier->open_min[f]);
+                point->max[f] = fmaxf(point->max[f], tier->open_max[f]);
+                sum[f] += tier->open_sum[f];
+            }
+            point->count += tier->open_count;
+        }
+
+        if (point->count > 0) {
+            for (uint8_t f = 0; f < history->field_count; f++) {
+                point->mean[f] = (float)(sum[f] / point->count);
+            }
+            return true;
+        }
+
+        // Nothing in this step, continue at the step holding the next bucket
+        bool has_next = index < tier->count;
+        uint32_t next_data_ms = has_next ? tier->start_ms[slot_for_index(tier, index)] : 0;
+        bool open_after = tier->open_count > 0 && !ms_before(tier->open_start_ms, end_ms);
+        if (open_after && (!has_next || ms_before(tier->open_start_ms, next_data_ms))) {
+            next_data_ms = tier->open_start_ms;
+            has_next = true;
+        }
+        if (!has_next) {
+            query->next_ms = query->to_ms;
+        } else if (ms_before(end_ms, next_data_ms)) {
+            query->next_ms = next_data_ms - (next_data_ms - start_ms) % query->step_ms;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,84 @@
+#include "sensor_latest.h"
+
+#include <string.h>
+#include "esp_log.h"
+
+static const char *TAG = "sensor_latest";
+
+void sensor_latest_init(sensor_latest_t *latest) {
+    atomic_init(&latest->sequence, 0);
+    atomic_init(&latest->retries, 0);
+    for (int b = 0; b < 2; b++) {
+        for (size_t w = 0; w < SENSOR_LATEST_WORDS; w++) {
+            atomic_init(&latest->buffers[b][w], 0);
+        }
+    }
+}
+
+void sensor_latest_store(sensor_latest_t *latest, const void *value, size_t size) {
+    if (latest == NULL || value == NULL || size > SENSOR_LATEST_MAX_SIZE) {
+        ESP_LOGE(TAG, "Cannot store NULL or oversized value");
+        return;
+    }
+
+    // Write number n goes to buffer n & 1, the sequence is odd from its start until it completes
+    unsigned sequence = atomic_load_explicit(&latest->sequence, memory_order_relaxed);
+    unsigned write = sequence / 2 + 1;
+    atomic_uint_least32_t *buffer = latest->buffers[write & 1];
+    atomic_store_explicit(&latest->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    const uint8_t *bytes = value;
+    size_t words = size / sizeof(uint32_t);
+    for (size_t w = 0; w < words; w++) {
+        uint32_t word;
+        memcpy(&word, bytes + w * sizeof(word), sizeof(word));
+        atomic_store_explicit(&buffer[w], word, memory_order_relaxed);
+    }
+    if (size % sizeof(uint32_t) != 0) {
+        uint32_t word = 0;
+        memcpy(&word, bytes + words * sizeof(word), size % sizeof(word));
+        atomic_store_explicit(&buffer[words], word, memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&latest->sequence, write * 2, memory_order_release);
+}
+
+uint32_t sensor_latest_load(sensor_latest_t *latest, void *value, size_t size) {
+    if (latest == NULL || value == NULL || size > SENSOR_LATEST_MAX_SIZE) {
+        ESP_LOGE(TAG, "Cannot load into NULL or oversized value");
+        return 0;
+    }
+
+    uint8_t *bytes = value;
+    size_t words = size / sizeof(uint32_t);
+    for (;;) {
+        // The latest completed write stays readable until the write after the one in progress starts
+        unsigned sequence = atomic_load_explicit(&latest->sequence, memory_order_acquire);
+        unsigned write = sequence / 2;
+        if (write == 0) {
+            return 0;
+        }
+
+        const atomic_uint_least32_t *buffer = latest->buffers[write & 1];
+        for (size_t w = 0; w < words; w++) {
+            uint32_t word = atomic_load_explicit(&buffer[w], memory_order_relaxed);
+            memcpy(bytes + w * sizeof(word), &word, sizeof(word));
+        }
+        if (size % sizeof(uint32_t) != 0) {
+            uint32_t word = atomic_load_explicit(&buffer[words], memory_order_relaxed);
+            memcpy(bytes + words * sizeof(word), &word, size % sizeof(word));
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        unsigned current = atomic_load_explicit(&latest->sequence, memory_order_relaxed);
+        if (current - write * 2 < 3) {
+            return write;
+        }
+        atomic_fetch_add_explicit(&latest->retries, 1, memory_order_relaxed);
+    }
+}
+
+uint32_t sensor_latest_version(const sensor_latest_t *latest) {
+    return atomic_load_explicit(&latest->sequence, memory_order_acquire) / 2;
+}
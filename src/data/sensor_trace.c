@@ -0,0 +1,81 @@
+#include "sensor_trace.h"
+
+#include <string.h>
+#include "esp_log.h"
+
+static const char *TAG = "sensor_trace";
+
+bool sensor_trace_write_header(FILE *file) {
+    if (file == NULL) {
+        ESP_LOGE(TAG, "Cannot write header to NULL file");
+        return false;
+    }
+
+    sensor_trace_header_t header = {
+        .version = SENSOR_TRACE_VERSION,
+        .record_size = sizeof(sensor_trace_record_t),
+        .bme690_size = sizeof(bme690_data_t),
+        .bmv080_size = sizeof(bmv080_data_t),
+    };
+    memcpy(header.magic, SENSOR_TRACE_MAGIC, sizeof(header.magic));
+
+    return fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+bool sensor_trace_read_header(FILE *file, sensor_trace_header_t *header) {
+    sensor_trace_header_t local;
+    if (header == NULL) {
+        header = &local;
+    }
+
+    if (file == NULL || fread(header, sizeof(*header), 1, file) != 1) {
+        ESP_LOGE(TAG, "Failed to read trace header");
+        return false;
+    }
+
+    if (memcmp(header->magic, SENSOR_TRACE_MAGIC, sizeof(header->magic)) != 0) {
+        ESP_LOGE(TAG, "Not a sensor trace (bad magic)");
+        return false;
+    }
+
+    if (header->version != SENSOR_TRACE_VERSION) {
+        ESP_LOGE(TAG, "Unsupported trace version %u (expected %u)", header->version, SENSOR_TRACE_VERSION);
+        return false;
+    }
+
+    if (header->record_size != sizeof(sensor_trace_record_t) || header->bme690_size != sizeof(bme690_data_t) ||
+        header->bmv080_size != sizeof(bmv080_data_t)) {
+        ESP_LOGE(TAG, "Trace layout mismatch (record %u/%u, bme690 %u/%u, bmv080 %u/%u)", header->record_size,
+            (unsigned)sizeof(sensor_trace_record_t), header->bme690_size, (unsigned)sizeof(bme690_data_t), header->bmv080_size,
+            (unsigned)sizeof(bmv080_data_t));
+        return false;
+    }
+
+    return true;
+}
+
+bool sensor_trace_write_record(FILE *file, const sensor_trace_record_t *record) {
+    if (file == NULL || record == NULL) {
+        ESP_LOGE(TAG, "Cannot write NULL record or to NULL file");
+        return false;
+    }
+
+    return fwrite(record, sizeof(*record), 1, file) == 1;
+}
+
+bool sensor_trace_read_record(FILE *file, sensor_trace_record_t *record) {
+    if (file == NULL || record == NULL) {
+        return false;
+    }
+
+    if (fread(record, sizeof(*record), 1, file) != 1) {
+        return false;
+    }
+
+    if (record->type != SENSOR_TRACE_BME690 && record->type != SENSOR_TRACE_BMV080) {
+        ESP_LOGE(TAG, "Invalid record type %u", record->type);
+        return false;
+    }
+
+    return true;
+}
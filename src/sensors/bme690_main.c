@@ -6,6 +6,7 @@
  * This works by running an endless loop in the bsec_iot_loop() function.
  */
 
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,10 +21,13 @@
 #include "bme690_io.h"
 #include "bsec_iaq.h"
 #include "bsec_integration.h"
+#include "config.h"
 #include "led_control.h"
 #include "nvs.h"
 #include "polverine_cfg.h"
+#include "sensor_aggregate.h"
 #include "sensor_buffer.h"
+#include "sensor_control.h"
 #include "sensor_data_broker.h"
 
 static const char *TAG = "bme690";
@@ -56,13 +60,33 @@ static void state_save(const uint8_t *state_buffer, uint32_t length);
 static void output_ready(outputs_t *output);
 
 static bme690_sensor_buffer_t sensor_buffer;
+static sensor_aggregator_t sensor_aggregator;
 static uint32_t startup_time = 0;
 static bool first_output = true;
+static atomic_bool output_gated = PVLN_CFG_BSEC_OUTPUT_UPDATE_GATED_BY_BMV080;
+
+void bme690_set_gated(bool gated) {
+    atomic_store(&output_gated, gated);
+}
+
+void bme690_set_stats_windows(const uint32_t window_s[SENSOR_AGG_WINDOW_COUNT]) {
+    for (uint8_t w = 0; w < SENSOR_AGG_WINDOW_COUNT; w++) {
+        sensor_aggregator_request_window(&sensor_aggregator, w, window_s[w] * 1000);
+    }
+}
 
 void bme690_task(void *) {
     bme690_i2c_init();
 
     bme690_buffer_init(&sensor_buffer);
+    sensor_aggregator_init(
+        &sensor_aggregator, "bme690", sensor_agg_bme690_fields, sensor_agg_bme690_field_count, sensor_aggregate_publish);
+
+    polverine_sensor_config_t sensor_config;
+    if (config_load_sensor(&sensor_config)) {
+        bme690_set_gated(sensor_config.bme690_gated);
+        bme690_set_stats_windows(sensor_config.stats_window_s);
+    }
 
     bsec_version_t version;
     return_values_init ret = {BME69X_OK, BSEC_OK};
@@ -226,9 +250,31 @@ static void output_ready(outputs_t *output) {
         .run_in_status = output->runInStatus,
         .timestamp = current_time};
 
+    // Every BSEC output as is, for the /ws calibration stream
+    bme690_raw_data_t raw_data = {.raw_temperature = output->raw_temp,
+        .raw_humidity = output->raw_humidity,
+        .raw_pressure = output->raw_pressure,
+        .raw_gas = output->raw_gas,
+        .temperature = output->compensated_temperature,
+        .humidity = output->compensated_humidity,
+        .iaq = output->iaq,
+        .static_iaq = output->static_iaq,
+        .co2_equivalent = output->co2_equivalent,
+        .breath_voc_equivalent = output->breath_voc_equivalent,
+        .gas_percentage = output->gas_percentage,
+        .iaq_accuracy = output->iaq_accuracy,
+        .gas_index = output->raw_gas_index,
+        .stabilization_status = output->stabStatus,
+        .run_in_status = output->runInStatus,
+        .timestamp = current_time};
+    sensor_broker_publish(SENSOR_TYPE_BME690_RAW, &raw_data, 0);
+
     // Add to buffer (replaces all the sb_add calls)
     bme690_buffer_add(&sensor_buffer, &sensor_data);
 
+    // Fold into the 1 min / 15 min / 1 h statistics windows
+    sensor_aggregator_add(&sensor_aggregator, &sensor_data, current_time);
+
     // Log detailed status information
     uint32_t uptime = (xTaskGetTickCount() * portTICK_PERIOD_MS / 1000) - startup_time;
 
@@ -271,12 +317,12 @@ static void output_ready(outputs_t *output) {
     bool use_averaged = false;
     bme690_data_t data_to_publish;
 
-    if (!PVLN_CFG_BSEC_OUTPUT_UPDATE_GATED_BY_BMV080) {
+    if (!atomic_load(&output_gated)) {
         // Immediate publishing with raw data (matches current behavior)
         data_to_publish = sensor_data;
         use_averaged = false;
         should_publish = true;
-    } else if (PVLN_CFG_BSEC_OUTPUT_UPDATE_GATED_BY_BMV080 && flBMV080Published) {
+    } else if (flBMV080Published) {
         // Gated publishing with averaged data (matches current behavior)
         data_to_publish = bme690_buffer_get_averaged(&sensor_buffer);
         use_averaged = true;
@@ -285,8 +331,8 @@ static void output_ready(outputs_t *output) {
     }
 
     if (should_publish) {
-        // Publish through data broker instead of direct JSON formatting
-        sensor_broker_publish_bme690(&data_to_publish, use_averaged);
+        // Publish through the sensor data bus instead of direct JSON formatting
+        sensor_broker_publish(SENSOR_TYPE_BME690, &data_to_publish, use_averaged ? SENSOR_SAMPLE_AVERAGED : 0);
 
         // Log the published values (matches current logging)
         const char *prefix = use_averaged ? "Averaged - " : "";
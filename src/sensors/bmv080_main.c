@@ -1,13 +1,17 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include "esp_log.h"
 #include "mqtt_client.h"
 
 #include "bmv080.h"
 #include "bmv080_io.h"
+#include "config.h"
 #include "led_control.h"
 #include "polverine_cfg.h"
+#include "sensor_aggregate.h"
+#include "sensor_control.h"
 #include "sensor_data_broker.h"
 
 static const char *TAG = "bmv080";
@@ -18,23 +22,45 @@ spi_device_handle_t hspi;
 extern char shortId[7];
 volatile bool flBMV080Published = false;
 
+static sensor_aggregator_t sensor_aggregator;
+static atomic_uint requested_duty_cycle_s; // Set by bmv080_set_duty_cycle(), 0 if no change is pending
+
 // Forward declaration
 uint32_t get_tick_ms(void);
 
+void bmv080_set_duty_cycle(uint16_t period_s) {
+    if (period_s >= BMV080_DUTY_CYCLE_MIN_S) {
+        atomic_store(&requested_duty_cycle_s, period_s);
+    }
+}
+
+void bmv080_set_stats_windows(const uint32_t window_s[SENSOR_AGG_WINDOW_COUNT]) {
+    for (uint8_t w = 0; w < SENSOR_AGG_WINDOW_COUNT; w++) {
+        sensor_aggregator_request_window(&sensor_aggregator, w, window_s[w] * 1000);
+    }
+}
+
 void bmv080_data_ready(bmv080_output_t bmv080_output, void *callback_parameters) {
     //  led_set_blue(LED_ON);
 
-    // Create data structure from BMV080 output
-    bmv080_data_t sensor_data = {.pm10 = bmv080_output.pm10_mass_concentration,
-        .pm25 = bmv080_output.pm2_5_mass_concentration,
-        .pm1 = bmv080_output.pm1_mass_concentration,
-        .is_obstructed = bmv080_output.is_obstructed,
-        .is_outside_range = bmv080_output.is_outside_measurement_range,
-        .runtime = bmv080_output.runtime_in_sec,
-        .timestamp = get_tick_ms()};
-
-    // Publish through data broker
-    sensor_broker_publish_bmv080(&sensor_data);
+    // Fill a bus slot in place; subscribers share it without copying
+    sensor_sample_t *sample = sensor_broker_acquire(SENSOR_TYPE_BMV080);
+    if (sample != NULL) {
+        bmv080_data_t *sensor_data = sensor_sample_payload(sample);
+        *sensor_data = (bmv080_data_t){.pm10 = bmv080_output.pm10_mass_concentration,
+            .pm25 = bmv080_output.pm2_5_mass_concentration,
+            .pm1 = bmv080_output.pm1_mass_concentration,
+            .is_obstructed = bmv080_output.is_obstructed,
+            .is_outside_range = bmv080_output.is_outside_measurement_range,
+            .runtime = bmv080_output.runtime_in_sec,
+            .timestamp = get_tick_ms()};
+
+        sensor_broker_commit(sample, 0);
+
+        // Fold into the 1 min / 15 min / 1 h statistics windows
+        sensor_aggregator_add(&sensor_aggregator, sensor_data, sensor_data->timestamp);
+        sensor_sample_release(sample);
+    }
 
     // Log the sensor values
     ESP_LOGI(TAG, "PM10: %.0f µg/m³, PM2.5: %.0f µg/m³, PM1: %.0f µg/m³, Runtime: %.1f s", bmv080_output.pm10_mass_concentration,
@@ -50,7 +76,28 @@ uint32_t get_tick_ms(void) {
     return xTaskGetTickCount() * portTICK_PERIOD_MS;
 }
 
+// Stop the running measurement and start it again with another duty cycling period
+static bmv080_status_code_t bmv080_restart_duty_cycling(bmv080_handle_t handle, uint16_t period_s) {
+    bmv080_status_code_t status = bmv080_stop_measurement(handle);
+    if (status == E_BMV080_OK) {
+        status = bmv080_set_parameter(handle, "duty_cycling_period", (void *)&period_s);
+    }
+    if (status == E_BMV080_OK) {
+        status = bmv080_start_duty_cycling_measurement(handle, get_tick_ms, E_BMV080_DUTY_CYCLING_MODE_0);
+    }
+    return status;
+}
+
 void bmv080_task(void *pvParameter) {
+    sensor_aggregator_init(
+        &sensor_aggregator, "bmv080", sensor_agg_bmv080_fields, sensor_agg_bmv080_field_count, sensor_aggregate_publish);
+
+    polverine_sensor_config_t sensor_config;
+    if (!config_load_sensor(&sensor_config)) {
+        sensor_config.bmv080_duty_cycle_s = PLVN_CFG_BMV080_DUTY_CYCLE_PERIOD_S;
+    } else {
+        bmv080_set_stats_windows(sensor_config.stats_window_s);
+    }
 
     esp_err_t comm_status = spi_init(&hspi);
     if (comm_status != ESP_OK) {
@@ -103,7 +150,10 @@ void bmv080_task(void *pvParameter) {
     ESP_LOGI(TAG, "Default duty_cycling_period: %d s", duty_cycling_period);
 
     /* Set custom parameter "duty_cycling_period" */
-    duty_cycling_period = PLVN_CFG_BMV080_DUTY_CYCLE_PERIOD_S;
+    duty_cycling_period = sensor_config.bmv080_duty_cycle_s;
+    if (duty_cycling_period < BMV080_DUTY_CYCLE_MIN_S) {
+        duty_cycling_period = PLVN_CFG_BMV080_DUTY_CYCLE_PERIOD_S;
+    }
     bmv080_current_status = bmv080_set_parameter(handle, "duty_cycling_period", (void *)&duty_cycling_period);
 
     ESP_LOGI(TAG, "Customized duty_cycling_period: %d s", duty_cycling_period);
@@ -128,6 +178,20 @@ void bmv080_task(void *pvParameter) {
 
     for (;;) {
         bmv080_delay(100); // Poll every 100ms for faster response
+
+        uint16_t requested_s = (uint16_t)atomic_exchange(&requested_duty_cycle_s, 0);
+        if (requested_s != 0 && requested_s != duty_cycling_period) {
+            bmv080_current_status = bmv080_restart_duty_cycling(handle, requested_s);
+            if (bmv080_current_status == E_BMV080_OK) {
+                ESP_LOGI(TAG, "Duty cycling period changed: %d -> %d s", duty_cycling_period, requested_s);
+                duty_cycling_period = requested_s;
+            } else {
+                ESP_LOGE(TAG, "Changing the duty cycling period to %d s failed with status %d, keeping %d s", requested_s,
+                    (int)bmv080_current_status, duty_cycling_period);
+                bmv080_restart_duty_cycling(handle, duty_cycling_period);
+            }
+        }
+
         bmv080_current_status = bmv080_serve_interrupt(handle, bmv080_data_ready, NULL);
         if (bmv080_current_status != E_BMV080_OK) {
             ESP_LOGE(TAG, "Reading BMV080 failed with status %d", (int)bmv080_current_status);
@@ -10,6 +10,7 @@
 #include "nvs_flash.h"
 
 #include "nvs.h"
+#include "polverine_cfg.h"
 
 static const char *TAG = "config";
 
@@ -23,6 +24,26 @@ static const char *TAG = "config";
 #define KEY_MQTT_USER   "mqtt_user"
 #define KEY_MQTT_PASS   "mqtt_pass"
 #define KEY_MQTT_CLIENT "mqtt_client"
+#define KEY_MQTT_FORMAT "mqtt_format"
+#define KEY_BATCH_BME690_SAMPLES "bat_bme690_n"
+#define KEY_BATCH_BME690_AGE     "bat_bme690_s"
+#define KEY_BATCH_BMV080_SAMPLES "bat_bmv080_n"
+#define KEY_BATCH_BMV080_AGE     "bat_bmv080_s"
+#define KEY_DEADBAND_BME690      "db_bme690"
+#define KEY_DEADBAND_BME690_HB   "db_bme690_hb"
+#define KEY_DEADBAND_BMV080      "db_bmv080"
+#define KEY_DEADBAND_BMV080_HB   "db_bmv080_hb"
+#define KEY_DISCOVERY_HASH       "ha_disc_hash"
+#define KEY_MQTT5                "mqtt5"
+#define KEY_MQTT_EXPIRY          "mqtt_expiry_s"
+#define KEY_QOS_STATE            "qos_state"
+#define KEY_QOS_BATCH            "qos_batch"
+#define KEY_QOS_STATS            "qos_stats"
+#define KEY_QOS_SYSTEM           "qos_system"
+#define KEY_BMV080_DUTY_CYCLE    "bmv080_duty_s"
+#define KEY_BME690_GATED         "bme690_gated"
+
+static const char *const key_stats_windows[SENSOR_AGG_WINDOW_COUNT] = {"stats_win_0", "stats_win_1", "stats_win_2"};
 
 // Default values (can be overridden at compile time)
 #ifndef DEFAULT_WIFI_SSID
@@ -45,6 +66,61 @@ static const char *TAG = "config";
 #define DEFAULT_MQTT_PASS ""
 #endif
 
+#ifndef DEFAULT_MQTT_FORMAT
+#define DEFAULT_MQTT_FORMAT PAYLOAD_FORMAT_JSON
+#endif
+
+#ifndef DEFAULT_MQTT_BATCH_SAMPLES
+#define DEFAULT_MQTT_BATCH_SAMPLES 1
+#endif
+
+#ifndef DEFAULT_MQTT_BATCH_AGE_S
+#define DEFAULT_MQTT_BATCH_AGE_S 60
+#endif
+
+#ifndef DEFAULT_MQTT_DEADBAND_BME690
+#define DEFAULT_MQTT_DEADBAND_BME690 ""
+#endif
+
+#ifndef DEFAULT_MQTT_DEADBAND_BMV080
+#define DEFAULT_MQTT_DEADBAND_BMV080 ""
+#endif
+
+#ifndef DEFAULT_MQTT_DEADBAND_HEARTBEAT_S
+#define DEFAULT_MQTT_DEADBAND_HEARTBEAT_S 300
+#endif
+
+#ifndef DEFAULT_MQTT5
+#define DEFAULT_MQTT5 1
+#endif
+
+#ifndef DEFAULT_MQTT_EXPIRY_S
+#define DEFAULT_MQTT_EXPIRY_S 600
+#endif
+
+// Raw state is superseded by the next sample, summaries are not
+#ifndef DEFAULT_MQTT_QOS_STATE
+#define DEFAULT_MQTT_QOS_STATE 0
+#endif
+
+#ifndef DEFAULT_MQTT_QOS_SUMMARY
+#define DEFAULT_MQTT_QOS_SUMMARY 1
+#endif
+
+#ifndef DEFAULT_BMV080_DUTY_CYCLE_S
+#define DEFAULT_BMV080_DUTY_CYCLE_S PLVN_CFG_BMV080_DUTY_CYCLE_PERIOD_S
+#endif
+
+#ifndef DEFAULT_BME690_GATED
+#define DEFAULT_BME690_GATED PVLN_CFG_BSEC_OUTPUT_UPDATE_GATED_BY_BMV080
+#endif
+
+static const char *const payload_format_names[PAYLOAD_FORMAT_COUNT] = {
+    [PAYLOAD_FORMAT_JSON] = "json",
+    [PAYLOAD_FORMAT_JSON_CBOR] = "json+cbor",
+    [PAYLOAD_FORMAT_CBOR] = "cbor",
+};
+
 static nvs_handle_t config_handle = 0;
 
 bool config_init(void) {
@@ -98,6 +174,96 @@ static bool save_string_to_nvs(const char *key, const char *value) {
     return true;
 }
 
+static uint8_t load_u8_from_nvs(const char *key, uint8_t default_value) {
+    uint8_t value;
+    esp_err_t err = nvs_get_u8(config_handle, key, &value);
+
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Loaded %s from NVS", key);
+        return value;
+    } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Failed to read %s: %s", key, esp_err_to_name(err));
+    }
+    return default_value;
+}
+
+static bool save_u8_to_nvs(const char *key, uint8_t value) {
+    esp_err_t err = nvs_set_u8(config_handle, key, value);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save %s: %s", key, esp_err_to_name(err));
+        return false;
+    }
+
+    err = nvs_commit(config_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to commit %s: %s", key, esp_err_to_name(err));
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Saved %s to NVS", key);
+    return true;
+}
+
+static uint16_t load_u16_from_nvs(const char *key, uint16_t default_value) {
+    uint16_t value;
+    esp_err_t err = nvs_get_u16(config_handle, key, &value);
+
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Loaded %s from NVS", key);
+        return value;
+    } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Failed to read %s: %s", key, esp_err_to_name(err));
+    }
+    return default_value;
+}
+
+static bool save_u16_to_nvs(const char *key, uint16_t value) {
+    esp_err_t err = nvs_set_u16(config_handle, key, value);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save %s: %s", key, esp_err_to_name(err));
+        return false;
+    }
+
+    err = nvs_commit(config_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to commit %s: %s", key, esp_err_to_name(err));
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Saved %s to NVS", key);
+    return true;
+}
+
+static uint32_t load_u32_from_nvs(const char *key, uint32_t default_value) {
+    uint32_t value;
+    esp_err_t err = nvs_get_u32(config_handle, key, &value);
+
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Loaded %s from NVS", key);
+        return value;
+    } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Failed to read %s: %s", key, esp_err_to_name(err));
+    }
+    return default_value;
+}
+
+static bool save_u32_to_nvs(const char *key, uint32_t value) {
+    esp_err_t err = nvs_set_u32(config_handle, key, value);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save %s: %s", key, esp_err_to_name(err));
+        return false;
+    }
+
+    err = nvs_commit(config_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to commit %s: %s", key, esp_err_to_name(err));
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Saved %s to NVS", key);
+    return true;
+}
+
 bool config_load_wifi(polverine_wifi_config_t *config) {
     if (!config || !config_handle) {
         return false;
@@ -151,7 +317,38 @@ bool config_load_mqtt(polverine_mqtt_config_t *config, const char *device_id) {
         snprintf(config->client_id, sizeof(config->client_id), "polverine_%s", device_id ? device_id : "unknown");
     }
 
-    ESP_LOGI(TAG, "MQTT configuration loaded: URI=%s, ClientID=%s", config->uri, config->client_id);
+    // Load payload format
+    config->payload_format = load_u8_from_nvs(KEY_MQTT_FORMAT, DEFAULT_MQTT_FORMAT);
+    if (config->payload_format >= PAYLOAD_FORMAT_COUNT) {
+        config->payload_format = PAYLOAD_FORMAT_JSON;
+    }
+
+    // Load batching limits
+    config->batch_bme690.max_samples = load_u8_from_nvs(KEY_BATCH_BME690_SAMPLES, DEFAULT_MQTT_BATCH_SAMPLES);
+    config->batch_bme690.max_age_s = load_u16_from_nvs(KEY_BATCH_BME690_AGE, DEFAULT_MQTT_BATCH_AGE_S);
+    config->batch_bmv080.max_samples = load_u8_from_nvs(KEY_BATCH_BMV080_SAMPLES, DEFAULT_MQTT_BATCH_SAMPLES);
+    config->batch_bmv080.max_age_s = load_u16_from_nvs(KEY_BATCH_BMV080_AGE, DEFAULT_MQTT_BATCH_AGE_S);
+
+    // Load change filters
+    load_string_from_nvs(KEY_DEADBAND_BME690, config->deadband_bme690.spec, sizeof(config->deadband_bme690.spec),
+        DEFAULT_MQTT_DEADBAND_BME690);
+    config->deadband_bme690.heartbeat_s = load_u16_from_nvs(KEY_DEADBAND_BME690_HB, DEFAULT_MQTT_DEADBAND_HEARTBEAT_S);
+    load_string_from_nvs(KEY_DEADBAND_BMV080, config->deadband_bmv080.spec, sizeof(config->deadband_bmv080.spec),
+        DEFAULT_MQTT_DEADBAND_BMV080);
+    config->deadband_bmv080.heartbeat_s = load_u16_from_nvs(KEY_DEADBAND_BMV080_HB, DEFAULT_MQTT_DEADBAND_HEARTBEAT_S);
+
+    // Load protocol options
+    config->mqtt5 = load_u8_from_nvs(KEY_MQTT5, DEFAULT_MQTT5) != 0;
+    config->message_expiry_s = load_u16_from_nvs(KEY_MQTT_EXPIRY, DEFAULT_MQTT_EXPIRY_S);
+
+    // Load QoS policies
+    config->qos.state = load_u8_from_nvs(KEY_QOS_STATE, DEFAULT_MQTT_QOS_STATE);
+    config->qos.batch = load_u8_from_nvs(KEY_QOS_BATCH, DEFAULT_MQTT_QOS_SUMMARY);
+    config->qos.stats = load_u8_from_nvs(KEY_QOS_STATS, DEFAULT_MQTT_QOS_SUMMARY);
+    config->qos.system = load_u8_from_nvs(KEY_QOS_SYSTEM, DEFAULT_MQTT_QOS_SUMMARY);
+
+    ESP_LOGI(TAG, "MQTT configuration loaded: URI=%s, ClientID=%s, Format=%s", config->uri, config->client_id,
+        config_payload_format_name(config->payload_format));
     return true;
 }
 
@@ -161,7 +358,19 @@ bool config_save_mqtt(const polverine_mqtt_config_t *config) {
     }
 
     bool success = save_string_to_nvs(KEY_MQTT_URI, config->uri) && save_string_to_nvs(KEY_MQTT_USER, config->username) &&
-                   save_string_to_nvs(KEY_MQTT_PASS, config->password) && save_string_to_nvs(KEY_MQTT_CLIENT, config->client_id);
+                   save_string_to_nvs(KEY_MQTT_PASS, config->password) && save_string_to_nvs(KEY_MQTT_CLIENT, config->client_id) &&
+                   save_u8_to_nvs(KEY_MQTT_FORMAT, (uint8_t)config->payload_format) &&
+                   save_u8_to_nvs(KEY_BATCH_BME690_SAMPLES, config->batch_bme690.max_samples) &&
+                   save_u16_to_nvs(KEY_BATCH_BME690_AGE, config->batch_bme690.max_age_s) &&
+                   save_u8_to_nvs(KEY_BATCH_BMV080_SAMPLES, config->batch_bmv080.max_samples) &&
+                   save_u16_to_nvs(KEY_BATCH_BMV080_AGE, config->batch_bmv080.max_age_s) &&
+                   save_string_to_nvs(KEY_DEADBAND_BME690, config->deadband_bme690.spec) &&
+                   save_u16_to_nvs(KEY_DEADBAND_BME690_HB, config->deadband_bme690.heartbeat_s) &&
+                   save_string_to_nvs(KEY_DEADBAND_BMV080, config->deadband_bmv080.spec) &&
+                   save_u16_to_nvs(KEY_DEADBAND_BMV080_HB, config->deadband_bmv080.heartbeat_s) &&
+                   save_u8_to_nvs(KEY_MQTT5, config->mqtt5 ? 1 : 0) && save_u16_to_nvs(KEY_MQTT_EXPIRY, config->message_expiry_s) &&
+                   save_u8_to_nvs(KEY_QOS_STATE, config->qos.state) && save_u8_to_nvs(KEY_QOS_BATCH, config->qos.batch) &&
+                   save_u8_to_nvs(KEY_QOS_STATS, config->qos.stats) && save_u8_to_nvs(KEY_QOS_SYSTEM, config->qos.system);
 
     if (success) {
         ESP_LOGI(TAG, "MQTT configuration saved");
@@ -170,6 +379,92 @@ bool config_save_mqtt(const polverine_mqtt_config_t *config) {
     return success;
 }
 
+bool config_load_sensor(polverine_sensor_config_t *config) {
+    if (!config || !config_handle) {
+        return false;
+    }
+
+    const uint32_t default_windows_ms[SENSOR_AGG_WINDOW_COUNT] = SENSOR_AGG_DEFAULT_WINDOWS_MS;
+
+    config->bmv080_duty_cycle_s = load_u16_from_nvs(KEY_BMV080_DUTY_CYCLE, DEFAULT_BMV080_DUTY_CYCLE_S);
+    config->bme690_gated = load_u8_from_nvs(KEY_BME690_GATED, DEFAULT_BME690_GATED) != 0;
+    for (int i = 0; i < SENSOR_AGG_WINDOW_COUNT; i++) {
+        config->stats_window_s[i] = load_u32_from_nvs(key_stats_windows[i], default_windows_ms[i] / 1000);
+    }
+
+    ESP_LOGI(TAG, "Sensor configuration loaded: BMV080 duty cycle %u s, BME690 %s", config->bmv080_duty_cycle_s,
+        config->bme690_gated ? "gated by BMV080" : "every output");
+    return true;
+}
+
+bool config_save_sensor(const polverine_sensor_config_t *config) {
+    if (!config || !config_handle) {
+        return false;
+    }
+
+    bool success = save_u16_to_nvs(KEY_BMV080_DUTY_CYCLE, config->bmv080_duty_cycle_s) &&
+                   save_u8_to_nvs(KEY_BME690_GATED, config->bme690_gated ? 1 : 0);
+    for (int i = 0; i < SENSOR_AGG_WINDOW_COUNT && success; i++) {
+        success = save_u32_to_nvs(key_stats_windows[i], config->stats_window_s[i]);
+    }
+
+    if (success) {
+        ESP_LOGI(TAG, "Sensor configuration saved");
+    }
+
+    return success;
+}
+
+bool config_load_discovery_hash(uint32_t *hash) {
+    if (!hash || !config_handle) {
+        return false;
+    }
+
+    *hash = 0;
+    esp_err_t err = nvs_get_u32(config_handle, KEY_DISCOVERY_HASH, hash);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Failed to read %s: %s", KEY_DISCOVERY_HASH, esp_err_to_name(err));
+    }
+    return err == ESP_OK;
+}
+
+bool config_save_discovery_hash(uint32_t hash) {
+    if (!config_handle) {
+        return false;
+    }
+
+    esp_err_t err = nvs_set_u32(config_handle, KEY_DISCOVERY_HASH, hash);
+    if (err == ESP_OK) {
+        err = nvs_commit(config_handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save %s: %s", KEY_DISCOVERY_HASH, esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+const char *config_payload_format_name(polverine_payload_format_t format) {
+    if ((unsigned)format >= PAYLOAD_FORMAT_COUNT) {
+        return payload_format_names[PAYLOAD_FORMAT_JSON];
+    }
+    return payload_format_names[format];
+}
+
+bool config_payload_format_parse(const char *name, polverine_payload_format_t *format) {
+    if (name == NULL || format == NULL) {
+        return false;
+    }
+
+    for (int i = 0; i < PAYLOAD_FORMAT_COUNT; i++) {
+        if (strcmp(name, payload_format_names[i]) == 0) {
+            *format = (polverine_payload_format_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
 bool config_clear_all(void) {
     if (!config_handle) {
         return false;